@@ -0,0 +1,67 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <pthread.h> 
+#include <stdint.h> 
+
+#include "server_context.h"
+#include "http_parser.h"
+
+/* forward declaration */ 
+struct Http_connection_s; 
+
+#define HTTP_ACCESS_LOG_PATH_LEN 80 /* longer paths are cut, a record is two cache lines */ 
+
+/* a request as the loop saw it, formatted later by the writer thread */ 
+typedef struct Http_access_record_s {
+    uint64_t time_ms;       /* wall clock when the request was read */ 
+    uint64_t bytes;         /* sent to the client */ 
+    uint32_t latency_us;    /* request read to response sent */ 
+    uint16_t status;        /* 0 while no response was made */ 
+    uint16_t path_len; 
+    uint8_t  addr[16];      /* ipv4 mapped into ipv6 */ 
+    char     method[8]; 
+    char     path[HTTP_ACCESS_LOG_PATH_LEN]; 
+} Http_access_record_t; 
+
+/* single producer (the loop) single consumer (the writer thread), head and tail
+ * have their own cache lines so neither side invalidates the other's on every record */ 
+typedef struct Http_access_ring_s {
+    uint64_t head __attribute__((aligned(64))); 
+    uint64_t cached_tail;   /* producer's copy, the real tail is read only when this looks full */ 
+    uint64_t tail __attribute__((aligned(64))); 
+    uint64_t dropped __attribute__((aligned(64))); 
+    Http_access_record_t records[HTTP_ACCESS_LOG_RING]; 
+} Http_access_ring_t; 
+
+typedef struct Http_access_log_s {
+    Http_access_ring_t* ring; 
+    pthread_t thread; 
+    int stop; 
+    int fd; 
+    const char* path; 
+    size_t max_size;        /* rotate above this many bytes, 0 for never */ 
+    int rotate_interval;    /* rotate every that many seconds, 0 for never */ 
+    size_t size;            /* of the current file */ 
+    uint64_t opened;        /* ms, when the current file was started */ 
+    uint64_t dropped_seen;  /* dropped records already reported in the file */ 
+} Http_access_log_t; 
+
+/* open the file and start the writer thread if an access log is configured, returns -1 on failure */ 
+int  http_access_log_start(Http_server_context_t* ctx); 
+/* write what's left and stop the thread */ 
+void http_access_log_stop(Http_server_context_t* ctx); 
+/* records lost because the ring was full */ 
+uint64_t http_access_log_dropped(Http_server_context_t* ctx); 
+
+/* a http/1 request was read, a pending one is recorded first (pipelining) */ 
+void http_access_log_begin(struct Http_connection_s* con, const Http_request_t* req); 
+/* the response head was written, the status is read from it */ 
+void http_access_log_response(struct Http_connection_s* con, const char* head, size_t len); 
+/* the response is out (or the connection is gone), queue the record */ 
+void http_access_log_end(struct Http_connection_s* con); 
+/* an http/2 stream, recorded at once */ 
+void http_access_log_stream(struct Http_connection_s* con, const Http_request_t* req,
+                            int status, size_t bytes, uint64_t start_ns); 
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdint.h> 
+
+#include "server_context.h"
+
+/* forward declaration */ 
+typedef struct Http_epoll_item_s Http_epoll_item_t; 
+
+/* serialize the 503 once, returns -1 if it doesn't fit */ 
+int  http_admission_init(Http_server_context_t* ctx); 
+/* once the loop's epoll exists: arm the lag probe if max_loop_lag_ms is set */ 
+int  http_admission_probe_start(Http_server_context_t* ctx); 
+void http_admission_clean(Http_server_context_t* ctx); 
+/* returns 0 if the listener can accept, otherwise it's paused until connections are released */ 
+int  http_admission_accept(Http_server_context_t* ctx, Http_epoll_item_t* listener); 
+/* a connection was closed */ 
+void http_admission_release(Http_server_context_t* ctx); 
+/* returns 1 if a new request must get the 503 instead of a handler */ 
+int  http_admission_shed(Http_server_context_t* ctx); 
+/* the lag probe fired, how late it's handled is the loop lag */ 
+void http_admission_lag_probe(Http_server_context_t* ctx); 
+
+#endif
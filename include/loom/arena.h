@@ -0,0 +1,34 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h> 
+
+#include "config.h"
+
+/* bump allocator for what a handler builds while answering one request. nothing is
+ * freed on its own, everything goes at once when the response is out */ 
+
+typedef struct Http_arena_block_s {
+    struct Http_arena_block_s* next; 
+    size_t size; 
+    char data[] __attribute__((aligned(16))); 
+} Http_arena_block_t; 
+
+typedef struct Http_arena_s {
+    Http_arena_block_t* blocks; /* the current block first, the one kept across requests last */ 
+    char* ptr; 
+    char* end; 
+} Http_arena_t; 
+
+/* an arena is usable zeroed, no block is allocated before the first allocation */ 
+void  http_arena_init(Http_arena_t* arena); 
+/* returns null if out of memory, the memory is 16 bytes aligned */ 
+void* http_arena_alloc(Http_arena_t* arena, size_t size); 
+char* http_arena_strdup(Http_arena_t* arena, const char* str); 
+/* returns the formatted string or null */ 
+char* http_arena_printf(Http_arena_t* arena, const char* fmt, ...) __attribute__((format(printf, 2, 3))); 
+/* drop everything allocated, the first block is kept for the next request */ 
+void  http_arena_reset(Http_arena_t* arena); 
+void  http_arena_free(Http_arena_t* arena); 
+
+#endif
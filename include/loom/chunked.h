@@ -0,0 +1,36 @@
+#ifndef CHUNKED_H
+#define CHUNKED_H
+
+#include <stddef.h> 
+
+typedef enum Http_chunked_state_e {
+    HTTP_CHUNK_SIZE = 0,
+    HTTP_CHUNK_EXT,
+    HTTP_CHUNK_SIZE_LF,
+    HTTP_CHUNK_DATA,
+    HTTP_CHUNK_DATA_CR,
+    HTTP_CHUNK_DATA_LF,
+    HTTP_CHUNK_TRAILER_START,
+    HTTP_CHUNK_TRAILER_LINE,
+    HTTP_CHUNK_FINAL_LF,
+    HTTP_CHUNK_DONE,
+} Http_chunked_state_t; 
+
+/* incremental decoder of a chunked request body */ 
+typedef struct Http_chunked_s {
+    Http_chunked_state_t state; 
+    int digits;             /* of the current size */ 
+    size_t size;            /* data left in the current chunk */ 
+    size_t ext_len;         /* extensions on the current size line */ 
+    size_t trailer_len; 
+    size_t max_ext; 
+    size_t max_trailer; 
+} Http_chunked_t; 
+
+void http_chunked_init(Http_chunked_t* chunked, size_t max_ext, size_t max_trailer); 
+/* decodes buf[*read..len) in place, the chunk data is moved down to buf[*written] (never past *read).
+ * stops after the last CRLF of the body, what follows belongs to the next request.
+ * returns 1 once the body is complete, 0 if more bytes are needed and -1 if it's malformed or over a limit */ 
+int  http_chunked_decode(Http_chunked_t* chunked, char* buf, size_t len, size_t* read, size_t* written); 
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <sys/stat.h> 
+
+#include "http_parser.h"
+#include "http_response.h"
+
+/* returns a mask of HTTP_ENCODING_BIT() the client accepts (value.ptr can be null) */ 
+unsigned int http_accept_encoding_parse(Http_slice_t value); 
+
+/* gzip a dynamic response body in place if it's worth it */ 
+/* returns -1 if an error (the response is left untouched) */ 
+int  http_compress_response(Http_request_t* req, Http_response_t* resp); 
+
+/* returns a new fd holding the gzip version of the file (compressed once and cached) */ 
+/* or -1 if it's not worth it, not compressed yet or an error, fd is the opened file and st its stat.
+ * a miss queues the file for the compression thread, the file is served as is until it's done */ 
+int  http_compress_cache_get(int fd, const struct stat* st, size_t* gz_len); 
+/* 1 if the gzip version of the file is cached and smaller, a miss doesn't queue it */ 
+int  http_compress_cache_ready(const struct stat* st); 
+void http_compress_cache_clean(void); 
+
+#endif
@@ -8,8 +8,50 @@
 
 /* forward declaration */ 
 typedef struct Http_router_s Http_router_t; 
+struct Http_trace_s; 
+
+/* gets the phase timestamps of a traced request, runs on the event loop */ 
+typedef void (*Http_trace_hook_t)(const struct Http_trace_s* trace, void* data); 
 
 #define HTTP_MAX_HOST_LEN 64
+#define HTTP_MAX_PATH_LEN 256
+#define HTTP_MAX_CPU_LIST 128
+
+/* socket options set on the listeners, accepted connections inherit them (0 leaves the kernel's default) */ 
+typedef struct Http_socket_tuning_s {
+    int nodelay;            /* send small writes right away (no nagle) */ 
+    int defer_accept;       /* seconds a connection stays in the kernel until the client sends something */ 
+    int fastopen;           /* tcp fast open queue length, the net.ipv4.tcp_fastopen sysctl must allow it */ 
+    int rcvbuf;             /* bytes, setting it turns off the kernel's buffer autotuning */ 
+    int sndbuf; 
+    int notsent_lowat;      /* unsent bytes above which a socket isn't writable, keeps the send queue short */ 
+    int rcvlowat;           /* bytes needed before a socket is readable, smaller requests wait for the timeout */ 
+    int quickack;           /* ack every segment right away, set again on each accepted connection */ 
+    int keepalive_idle;     /* seconds of silence before probing the client, 0 disables keepalive */ 
+    int keepalive_interval; /* seconds between probes */ 
+    int keepalive_count;    /* unanswered probes before the connection is dropped */ 
+    int busy_poll;          /* us the kernel polls the device queue instead of sleeping, above net.core.busy_read needs CAP_NET_ADMIN */ 
+    int prefer_busy_poll;   /* with busy_poll, keep the device interrupts off while the loop polls */ 
+} Http_socket_tuning_t; 
+
+/* what the kernel does by default */ 
+#define HTTP_TUNING_NONE        (Http_socket_tuning_t){ 0 }
+/* small requests and responses: no nagle, no delayed acks, short send queues and fast open */ 
+#define HTTP_TUNING_LOW_LATENCY (Http_socket_tuning_t){\
+    .nodelay = 1,               \
+    .defer_accept = 1,          \
+    .fastopen = 256,            \
+    .notsent_lowat = 16384,     \
+    .quickack = 1,              \
+}
+/* big responses: buffers left to autotuning, dead downloads found by keepalive */ 
+#define HTTP_TUNING_BULK        (Http_socket_tuning_t){\
+    .nodelay = 1,               \
+    .defer_accept = 1,          \
+    .keepalive_idle = 60,       \
+    .keepalive_interval = 10,   \
+    .keepalive_count = 6,       \
+}
 
 typedef struct Http_config_s {
     int port;
@@ -17,6 +59,35 @@ typedef struct Http_config_s {
     int backlog; 
     int max_events; 
     Http_router_t* router; /* must be not null */ 
+    int tls_port; /* 0 to disable the tls listener (needs a build with TLS=1) */ 
+    char tls_cert[HTTP_MAX_PATH_LEN]; /* PEM certificate chain */ 
+    char tls_key[HTTP_MAX_PATH_LEN];  /* PEM private key */ 
+    size_t max_connections; /* the listeners pause at this many clients, 0 for no limit */ 
+    size_t max_inflight;    /* requests get a 503 while this many responses are pending, 0 for no limit */ 
+    int max_loop_lag_ms;    /* requests get a 503 while the loop is slower than this, 0 to disable */ 
+    int retry_after;        /* seconds, sent with the 503 */ 
+    int rate_limit;         /* requests per second per client address, 0 for no limit */ 
+    int rate_burst;         /* requests a client can make at once, 0 for rate_limit */ 
+    size_t max_connections_per_ip; /* more connections from an address are closed, 0 for no limit */ 
+    int drain_timeout;      /* seconds given to the connections to finish on shutdown, 0 closes them right away */ 
+    char handoff_path[HTTP_MAX_PATH_LEN]; /* unix socket passing the listeners to the next process, empty to disable */ 
+    Http_socket_tuning_t tuning; /* HTTP_TUNING_xxx or http_sockopt_preset() */ 
+    char access_log[HTTP_MAX_PATH_LEN]; /* file the requests are logged to, empty to disable */ 
+    size_t access_log_max_size; /* bytes before the file is rotated, 0 for no limit */ 
+    int access_log_rotate;  /* seconds before the file is rotated, 0 for never */ 
+    int trace_sample;       /* trace one http/1 request in n, 0 to disable */ 
+    Http_trace_hook_t trace_hook; /* null for http_trace_print */ 
+    void* trace_data;       /* given to the hook */ 
+    size_t max_chunk_ext;   /* bytes of extensions on a chunk size line of a request body */ 
+    size_t max_trailer_size; /* bytes of trailer fields after a chunked request body */ 
+    size_t keepalive_requests; /* requests served on a connection before it's closed, 0 for no limit */ 
+    int keepalive_timeout;  /* seconds an idle keep-alive connection is kept */ 
+    int keepalive_min_timeout; /* seconds, what keepalive_timeout shrinks to as the clients reach max_connections */ 
+    int workers;            /* event loops, more than 1 forks a process per loop with its own listeners */ 
+    char cpus[HTTP_MAX_CPU_LIST]; /* "auto" or a list like "0-3,8", loop i is pinned to the i-th cpu, empty to not pin */ 
+    int numa;               /* a loop's memory comes from the node of the cpu it runs on */ 
+    int steer;              /* a connection goes to the loop of the cpu that received its packets */ 
+    int busy_poll_us;       /* after events the loop polls without sleeping for up to this long, 0 always sleeps */ 
 } Http_config_t;
 
 
@@ -25,14 +96,83 @@ typedef struct Http_config_s {
 #define HTTP_RESPONSE_SIZE                  8192
 #define HTTP_MAX_HEADER_LINE                1024
 #define HTTP_MAX_HEADERS                    128 
+#define HTTP_REQUEST_INLINE_HEADERS         16      /* in the request, the others go to the request arena */ 
+#define HTTP_RESPONSE_INLINE_HEADERS        8       /* in the response besides the typed ones, the others are malloc'd */ 
 #define HTTP_CLIENT_TIMEOUT                 30
 #define HTTP_TIMER_MAX_EVENTS               819200 
+#define HTTP_COMPRESS_MIN_SIZE              1024    /* smaller bodies are not worth compressing */ 
+#define HTTP_COMPRESS_LEVEL                 6       /* dynamic responses */ 
+#define HTTP_COMPRESS_STATIC_LEVEL          9       /* static files are compressed only once */ 
+#define HTTP_COMPRESS_STATIC_MAX_SIZE       (16 * 1024 * 1024)
+#define HTTP_COMPRESS_CACHE_SLOTS           256     /* must be power of 2 */ 
+#define HTTP_COMPRESS_QUEUE                 16      /* files waiting for the compression thread */ 
+#define HTTP_MAX_RANGES                     16      /* more ranges than this and the whole file is sent */ 
+#define HTTP_CACHE_BUCKETS                  256     /* per cached route, must be power of 2 */ 
+#define HTTP_CACHE_MAX_ENTRIES              1024    /* per cached route */ 
+#define HTTP_CACHE_MAX_VARY                 8
+#define HTTP_CACHE_MAX_KEY                  2048
+#define HTTP_H2_MAX_STREAMS                 100     /* concurrent streams per http/2 connection */ 
+#define HTTP_H2_MAX_FRAME_SIZE              16384   /* the protocol default, bigger frames are refused */ 
+#define HTTP_H2_MAX_HEADER_BLOCK            16384   /* headers split over CONTINUATION frames */ 
+#define HTTP_H2_HPACK_TABLE_SIZE            4096
+#define HTTP_H2_OUTPUT_HIGH                 (64 * 1024) /* stop making DATA frames above this */ 
+#define HTTP_PROXY_MAX_BACKENDS             16      /* per upstream */ 
+#define HTTP_PROXY_MAX_IDLE                 32      /* pooled keep-alive connections per backend */ 
+#define HTTP_PROXY_BUFFER                   16384   /* per backend connection and direction */ 
+#define HTTP_PROXY_TIMEOUT                  30      /* seconds without progress before a 504 */ 
+#define HTTP_PROXY_DOWN_MS                  5000    /* a backend that refused a connection is skipped */ 
+#define HTTP_RATELIMIT_SLOTS                16384   /* tracked client addresses, must be power of 2 */ 
+#define HTTP_RATELIMIT_PROBE                8       /* slots searched for an address */ 
+#define HTTP_RATELIMIT_IDLE_MS              60000   /* an address without connections is forgotten after that */ 
+#define HTTP_HANDOFF_TIMEOUT                5       /* seconds waiting for the previous server to send its listeners */ 
+#define HTTP_DRAIN_IDLE_TIMEOUT             1       /* seconds left to idle keep-alive connections when draining */ 
+#define HTTP_KEEPALIVE_SHRINK_AT            50      /* percent of max_connections above which the idle timeout shrinks */ 
+#define HTTP_LAG_PROBE_INTERVAL_MS          10      /* the loop lag timer, only armed with max_loop_lag_ms */ 
+#define HTTP_QSBR_MAX_READERS               64      /* event loops sharing published tables */ 
+#define HTTP_ACCESS_LOG_RING                4096    /* records waiting for the writer thread, must be power of 2 */ 
+#define HTTP_ACCESS_LOG_FLUSH_MS            100     /* the writer sleeps that long when the ring is empty */ 
+#define HTTP_ACCESS_LOG_BUFFER              65536   /* formatted lines written at once */ 
+#define HTTP_ARENA_BLOCK                    16384   /* request arena block, the first one is kept by the connection */ 
+#define HTTP_WS_MAX_MESSAGE                 (1024 * 1024) /* reassembled websocket message, bigger ones are closed with 1009 */ 
+#define HTTP_WS_MAX_OUTPUT                  (1024 * 1024) /* frames queued for a slow websocket client before sends fail */ 
+#define HTTP_WS_PING_INTERVAL               30      /* seconds of silence before a ping, the next silent interval closes */ 
+#define HTTP_SSE_TOPIC_BUCKETS              64      /* must be power of 2 */ 
+#define HTTP_SSE_QUEUE                      32      /* events queued per subscriber before they're dropped, must be power of 2 */ 
+#define HTTP_SSE_HEARTBEAT                  15      /* seconds of silence before a comment, a client stuck that long is closed */ 
+#define HTTP_MAX_WORKERS                    256
 
 /* configurable */ 
 #define HTTP_DEFAULT_PORT                   6969
 #define HTTP_DEFAULT_HOST                   "0.0.0.0"
 #define HTTP_DEFAULT_BACKLOG                SOMAXCONN
 #define HTTP_DEFAULT_MAX_EVENTS             1024
+#define HTTP_DEFAULT_TLS_PORT               0 /* disabled */ 
+#define HTTP_DEFAULT_TLS_CERT               "cert.pem"
+#define HTTP_DEFAULT_TLS_KEY                "key.pem"
+#define HTTP_DEFAULT_MAX_CONNECTIONS        65536
+#define HTTP_DEFAULT_MAX_INFLIGHT           0 /* no limit */ 
+#define HTTP_DEFAULT_MAX_LOOP_LAG_MS        0 /* disabled */ 
+#define HTTP_DEFAULT_RETRY_AFTER            1
+#define HTTP_DEFAULT_RATE_LIMIT             0 /* no limit */ 
+#define HTTP_DEFAULT_RATE_BURST             0
+#define HTTP_DEFAULT_MAX_CONNECTIONS_PER_IP 0 /* no limit */ 
+#define HTTP_DEFAULT_DRAIN_TIMEOUT          10
+#define HTTP_DEFAULT_HANDOFF_PATH           "" /* disabled */ 
+#define HTTP_DEFAULT_TUNING                 HTTP_TUNING_NONE
+#define HTTP_DEFAULT_ACCESS_LOG             "" /* disabled */ 
+#define HTTP_DEFAULT_ACCESS_LOG_MAX_SIZE    0
+#define HTTP_DEFAULT_ACCESS_LOG_ROTATE      0
+#define HTTP_DEFAULT_TRACE_SAMPLE           0 /* disabled */ 
+#define HTTP_DEFAULT_MAX_CHUNK_EXT          256
+#define HTTP_DEFAULT_MAX_TRAILER_SIZE       4096
+#define HTTP_DEFAULT_KEEPALIVE_REQUESTS     1000
+#define HTTP_DEFAULT_KEEPALIVE_TIMEOUT      30
+#define HTTP_DEFAULT_KEEPALIVE_MIN_TIMEOUT  2
+#define HTTP_DEFAULT_WORKERS                1
+#define HTTP_DEFAULT_CPUS                   "" /* not pinned */ 
+#define HTTP_DEFAULT_NUMA                   0
+#define HTTP_DEFAULT_STEER                  0
+#define HTTP_DEFAULT_BUSY_POLL_US           0 /* disabled */ 
 
 /* a http handler should be provided */ 
 #define HTTP_DEFAULT_CONFIG (Http_config_t){\
@@ -41,6 +181,35 @@ typedef struct Http_config_s {
     HTTP_DEFAULT_BACKLOG,       \
     HTTP_DEFAULT_MAX_EVENTS,    \
     NULL,                       \
+    HTTP_DEFAULT_TLS_PORT,      \
+    HTTP_DEFAULT_TLS_CERT,      \
+    HTTP_DEFAULT_TLS_KEY,       \
+    HTTP_DEFAULT_MAX_CONNECTIONS, \
+    HTTP_DEFAULT_MAX_INFLIGHT,  \
+    HTTP_DEFAULT_MAX_LOOP_LAG_MS, \
+    HTTP_DEFAULT_RETRY_AFTER,   \
+    HTTP_DEFAULT_RATE_LIMIT,    \
+    HTTP_DEFAULT_RATE_BURST,    \
+    HTTP_DEFAULT_MAX_CONNECTIONS_PER_IP, \
+    HTTP_DEFAULT_DRAIN_TIMEOUT, \
+    HTTP_DEFAULT_HANDOFF_PATH,  \
+    HTTP_DEFAULT_TUNING,        \
+    HTTP_DEFAULT_ACCESS_LOG,    \
+    HTTP_DEFAULT_ACCESS_LOG_MAX_SIZE, \
+    HTTP_DEFAULT_ACCESS_LOG_ROTATE, \
+    HTTP_DEFAULT_TRACE_SAMPLE,  \
+    NULL,                       \
+    NULL,                       \
+    HTTP_DEFAULT_MAX_CHUNK_EXT, \
+    HTTP_DEFAULT_MAX_TRAILER_SIZE, \
+    HTTP_DEFAULT_KEEPALIVE_REQUESTS, \
+    HTTP_DEFAULT_KEEPALIVE_TIMEOUT, \
+    HTTP_DEFAULT_KEEPALIVE_MIN_TIMEOUT, \
+    HTTP_DEFAULT_WORKERS,       \
+    HTTP_DEFAULT_CPUS,          \
+    HTTP_DEFAULT_NUMA,          \
+    HTTP_DEFAULT_STEER,         \
+    HTTP_DEFAULT_BUSY_POLL_US,  \
 }
 
 #endif
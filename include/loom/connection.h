@@ -9,6 +9,12 @@
 #include "epoll_utils.h"
 #include "timer.h"
 #include "router.h"
+#include "access_log.h"
+#include "trace.h"
+#include "arena.h"
+#include "chunked.h"
+#include "websocket.h"
+#include "sse.h"
 
 /* forward declaration */ 
 typedef struct Http_epoll_item_s Http_epoll_item_t; 
@@ -17,6 +23,7 @@ typedef struct Http_epoll_item_s Http_epoll_item_t;
 #define HTTP_READING_HEADERS  0
 #define HTTP_READING_BODY     1
 #define HTTP_REQUEST_READY    2
+#define HTTP_READING_CHUNKED  3 /* decoding a chunked body in place */ 
 
 /* flags */ 
 /* if should close flag is set then stop recv data and compelete sending and the close */ 
@@ -24,6 +31,13 @@ typedef struct Http_epoll_item_s Http_epoll_item_t;
 #define HTTP_FLAG_WRITING           0x04
 #define HTTP_FLAG_SHOULD_CLOSE      0x08 
 #define HTTP_FLAG_CLOSING           0x10
+#define HTTP_FLAG_SENDING_FILE      0x20 /* a file body is sent after the response buffer */ 
+#define HTTP_FLAG_HANDSHAKING       0x40 /* tls handshake in progress */ 
+#define HTTP_FLAG_TLS_WANT_WRITE    0x80 /* the handshake waits for the socket to be writable */ 
+#define HTTP_FLAG_KTLS_SEND         0x100 /* the kernel encrypts, sendfile stays zero copy */ 
+#define HTTP_FLAG_INFLIGHT          0x200 /* counted in ctx->inflight until the response is out */ 
+#define HTTP_FLAG_ADMITTED          0x400 /* admitted before its body was read (100-continue) */ 
+#define HTTP_FLAG_IDLE              0x800 /* kept alive with nothing to do, in ctx->idle_head list */ 
 
 #define HTTP_GET_READ_STATE(flags)      ((flags) & HTTP_READ_STATE_MASK)
 #define HTTP_SET_READ_STATE(flags, state) \
@@ -41,13 +55,41 @@ typedef struct Http_epoll_item_s Http_epoll_item_t;
 #define HTTP_SET_CLOSING(flags)         ((flags) |= HTTP_FLAG_CLOSING)
 #define HTTP_IS_CLOSING(flags)          ((flags) & HTTP_FLAG_CLOSING)   
 
+#define HTTP_SET_SENDING_FILE(flags)    ((flags) |= HTTP_FLAG_SENDING_FILE)
+#define HTTP_IS_SENDING_FILE(flags)     ((flags) & HTTP_FLAG_SENDING_FILE)
+#define HTTP_CLEAR_SENDING_FILE(flags)  ((flags) &= ~HTTP_FLAG_SENDING_FILE)
+
+#define HTTP_SET_HANDSHAKING(flags)     ((flags) |= HTTP_FLAG_HANDSHAKING)
+#define HTTP_IS_HANDSHAKING(flags)      ((flags) & HTTP_FLAG_HANDSHAKING)
+#define HTTP_CLEAR_HANDSHAKING(flags)   ((flags) &= ~HTTP_FLAG_HANDSHAKING)
+
+#define HTTP_SET_TLS_WANT_WRITE(flags)  ((flags) |= HTTP_FLAG_TLS_WANT_WRITE)
+#define HTTP_TLS_WANT_WRITE(flags)      ((flags) & HTTP_FLAG_TLS_WANT_WRITE)
+#define HTTP_CLEAR_TLS_WANT_WRITE(flags) ((flags) &= ~HTTP_FLAG_TLS_WANT_WRITE)
+
+#define HTTP_SET_KTLS_SEND(flags)       ((flags) |= HTTP_FLAG_KTLS_SEND)
+#define HTTP_IS_KTLS_SEND(flags)        ((flags) & HTTP_FLAG_KTLS_SEND)
+
+#define HTTP_SET_INFLIGHT(flags)        ((flags) |= HTTP_FLAG_INFLIGHT)
+#define HTTP_IS_INFLIGHT(flags)         ((flags) & HTTP_FLAG_INFLIGHT)
+#define HTTP_CLEAR_INFLIGHT(flags)      ((flags) &= ~HTTP_FLAG_INFLIGHT)
+
+#define HTTP_SET_ADMITTED(flags)        ((flags) |= HTTP_FLAG_ADMITTED)
+#define HTTP_IS_ADMITTED(flags)         ((flags) & HTTP_FLAG_ADMITTED)
+#define HTTP_CLEAR_ADMITTED(flags)      ((flags) &= ~HTTP_FLAG_ADMITTED)
+
+#define HTTP_SET_IDLE(flags)            ((flags) |= HTTP_FLAG_IDLE)
+#define HTTP_IS_IDLE(flags)             ((flags) & HTTP_FLAG_IDLE)
+#define HTTP_CLEAR_IDLE(flags)          ((flags) &= ~HTTP_FLAG_IDLE)
+
 typedef struct Http_connection_s {
     int     client_fd; 
     int     timeout_index; /* keep track of where is timeout event in timer events array */
 
     Http_request_t request; 
     size_t header_len; 
-    size_t body_len; 
+    size_t body_len; /* bytes after the headers that belong to the request */ 
+    Http_chunked_t chunked; 
     char    buff[HTTP_REQUEST_SIZE]; 
     size_t  buff_len; 
 
@@ -55,17 +97,77 @@ typedef struct Http_connection_s {
     size_t  response_len;  
     size_t  response_sent; 
 
-    uint8_t flags;  
-
-    Http_router_t* router;  
+    /* pending file body, sent once the response buffer is flushed */ 
+    int     file_fd; 
+    off_t   file_offset; 
+    size_t  file_remaining; 
+    int     file_owned; 
+    struct Http_byteranges_s* byteranges; /* null unless the file is sent as multipart/byteranges */ 
+    int     byteranges_part; /* the next part head to write */ 
+
+    uint32_t flags; 
+    size_t  requests; /* requests read on this connection */ 
+
+    struct ssl_st* ssl; /* null if it's not a tls connection */ 
+    struct Http_h2_session_s* h2; /* null while the connection speaks http/1 */ 
+    struct Http_ws_s* ws; /* null unless a handler accepted a websocket */ 
+    struct Http_sse_s* sse; /* null unless a handler subscribed it to a topic */ 
+    struct Http_upstream_con_s* upstream; /* the backend answering the current request */ 
+
+    Http_server_context_t* ctx; 
+    Http_epoll_item_t* item; 
+
+    struct sockaddr_storage peer; /* client address, ipv4 or ipv6 */ 
+    socklen_t peer_len; 
+    struct Http_ratelimit_entry_s* peer_limit; /* null if the address isn't tracked */ 
+
+    /* ctx->connections list */ 
+    struct Http_connection_s* prev; 
+    struct Http_connection_s* next; 
+    /* ctx idle list, least recently active first */ 
+    struct Http_connection_s* idle_prev; 
+    struct Http_connection_s* idle_next; 
+
+    /* access log */ 
+    uint64_t bytes_sent; 
+    Http_access_record_t access; /* the request being answered */ 
+    uint64_t access_start; /* ns, 0 if no record is pending */ 
+    uint64_t access_sent; /* bytes_sent when the request was read */ 
+
+    /* sampled phase timestamps */ 
+    int tracing; 
+    Http_trace_t trace; 
+
+    Http_arena_t arena; /* given to the handlers through request.arena */ 
 } Http_connection_t; 
 
-void http_connection_accept(Http_server_context_t* ctx); 
+void http_connection_accept(Http_server_context_t* ctx, int listen_fd); 
 void http_connection_clean(Http_server_context_t* ctx, Http_connection_t* con); 
+/* the connection timer expired */ 
+void http_connection_timeout(Http_server_context_t* ctx, Http_connection_t* con); 
 
 void http_connection_read(Http_connection_t* con); 
 void http_connection_write(Http_connection_t* con); 
+/* read and send on the socket or through tls */ 
+ssize_t http_connection_recv(Http_connection_t* con, char* buff, size_t len); 
+ssize_t http_connection_send(Http_connection_t* con, const char* buff, size_t len); 
 void http_connection_update_events(int epoll_fd, Http_epoll_item_t* con_item); 
+/* queue an error response, the connection is closed once it's sent */ 
+void http_connection_error(Http_connection_t* con, int status_code); 
+/* a response head was queued for the current request (access log and trace) */ 
+void http_connection_responded(Http_connection_t* con, const char* head, size_t len); 
+/* a request is being answered, returns 0 or the status (429 or 503) it must get instead */ 
+int  http_connection_admit(Http_connection_t* con); 
+/* the server is draining: idle connections are closed soon, the others close after their response */ 
+void http_connection_drain(Http_server_context_t* ctx, Http_connection_t* con); 
+/* returns 1 if the response being made must close the connection (draining or request cap) */ 
+int  http_connection_last_request(Http_connection_t* con); 
+/* close the least recently active idle connection, returns -1 if there is none */ 
+int  http_connection_evict_idle(Http_server_context_t* ctx); 
+/* after the event batch: run the handlers of the stale cache entries the batch served */ 
+void http_connection_cache_refresh(Http_server_context_t* ctx); 
+/* the loop is stopping, the queued refreshes are dropped */ 
+void http_connection_cache_refresh_drop(Http_server_context_t* ctx); 
 
 
 #endif
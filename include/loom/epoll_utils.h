@@ -7,6 +7,7 @@
 #include "config.h"
 #include "connection.h"
 #include "timer.h"
+#include "proxy.h"
 
 /* forward declaration */ 
 typedef struct Http_connection_s Http_connection_t; 
@@ -14,8 +15,13 @@ typedef struct Http_connection_s Http_connection_t;
 typedef enum Http_epoll_item_type_e {
     HTTP_ITEM_SHUTDOWN, 
     HTTP_ITEM_LISTENER, 
+    HTTP_ITEM_TLS_LISTENER,
     HTTP_ITEM_CLIENT, 
     HTTP_ITEM_TIMER,
+    HTTP_ITEM_UPSTREAM, /* a connection to a proxy backend */ 
+    HTTP_ITEM_HANDOFF,  /* the next process asks for the listeners */ 
+    HTTP_ITEM_CLOSED,   /* a client closed in the middle of a batch, its events are ignored */ 
+    HTTP_ITEM_LAG_PROBE, /* the admission timer measuring how late the loop wakes up */ 
 } Http_epoll_item_type_t; 
 
 /* a wrapper around epoll data */ 
@@ -27,6 +33,8 @@ typedef struct Http_epoll_item_s {
         int fd; 
         Http_connection_t* con; 
         Http_timer_t* timer; 
+        Http_upstream_con_t* upstream; 
+        struct Http_epoll_item_s* next; /* closed items, freed after the batch */ 
     }; 
 } Http_epoll_item_t; 
 
@@ -43,6 +51,10 @@ int  http_epoll_add_con(int epoll_fd, Http_connection_t* con, uint32_t events);
 int  http_epoll_mod_con(int epoll_fd, Http_epoll_item_t* con_item, uint32_t events); 
 void http_epoll_del_con(int epoll_fd, Http_connection_t* con); 
 
+int  http_epoll_add_upstream(int epoll_fd, Http_upstream_con_t* up, uint32_t events); 
+int  http_epoll_mod_upstream(int epoll_fd, Http_upstream_con_t* up, uint32_t events); 
+void http_epoll_del_upstream(int epoll_fd, Http_upstream_con_t* up); 
+
 /* main server loop */ 
 int  http_epoll_run_loop(Http_server_context_t* ctx); 
 
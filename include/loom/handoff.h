@@ -0,0 +1,17 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include "server_context.h"
+
+/* the listening sockets go from a running server to the one replacing it over a unix socket,
+ * the new process accepts from the same kernel queue so no connection is refused */ 
+
+/* ask the server listening on path for its listeners, fds[0] is the plain one and fds[1] the tls one or -1
+ * returns 0 if nobody answers on path, 1 if the listeners were received and -1 on error */ 
+int  http_handoff_receive(const char* path, int fds[HTTP_MAX_LISTENERS]); 
+/* wait for the next process on path, returns the fd or -1 */ 
+int  http_handoff_listen(const char* path); 
+/* give the listeners to the process connecting on ctx->handoff_fd, returns -1 if it failed */ 
+int  http_handoff_send(Http_server_context_t* ctx); 
+
+#endif
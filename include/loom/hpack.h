@@ -0,0 +1,51 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h> 
+#include <stdint.h> 
+
+#include "config.h"
+
+/* HPACK (RFC 7541) header compression for http/2 */ 
+
+#define HTTP_HPACK_ENTRY_OVERHEAD   32
+#define HTTP_HPACK_MAX_ENTRIES      (HTTP_H2_HPACK_TABLE_SIZE / HTTP_HPACK_ENTRY_OVERHEAD)
+
+typedef struct Http_hpack_entry_s {
+    char* name;  /* name and value share one allocation */ 
+    size_t name_len; 
+    char* value; 
+    size_t value_len; 
+} Http_hpack_entry_t; 
+
+/* dynamic table, a ring where the newest entry has the smallest index */ 
+typedef struct Http_hpack_table_s {
+    Http_hpack_entry_t entries[HTTP_HPACK_MAX_ENTRIES]; 
+    size_t head;        /* slot of the newest entry */ 
+    size_t count; 
+    size_t size;        /* name + value + 32 for every entry */ 
+    size_t max_size;    /* current maximum, changed by size updates */ 
+    size_t limit;       /* the maximum max_size can be set to */ 
+    int size_update;    /* encoder: a size update must start the next block */ 
+} Http_hpack_table_t; 
+
+/* called for every decoded field, strings are not nul terminated. return -1 to stop decoding */ 
+typedef int (*Http_hpack_field_cb)(void* arg,
+                                   const char* name, size_t name_len,
+                                   const char* value, size_t value_len); 
+
+void http_hpack_table_init(Http_hpack_table_t* table, size_t limit); 
+void http_hpack_table_clean(Http_hpack_table_t* table); 
+/* encoder side, the peer changed SETTINGS_HEADER_TABLE_SIZE */ 
+void http_hpack_table_set_limit(Http_hpack_table_t* table, size_t limit); 
+
+/* returns -1 on a compression error (the http/2 connection can't go on) */ 
+int http_hpack_decode(Http_hpack_table_t* table, const uint8_t* in, size_t len,
+                      Http_hpack_field_cb cb, void* arg); 
+
+/* the name must be lowercase, returns the used size or -1 if out is too small */ 
+int http_hpack_encode(Http_hpack_table_t* table, uint8_t* out, size_t out_len,
+                      const char* name, size_t name_len,
+                      const char* value, size_t value_len); 
+
+#endif
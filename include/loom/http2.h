@@ -0,0 +1,93 @@
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include <stdint.h> 
+
+#include "config.h"
+#include "hpack.h"
+#include "http_parser.h"
+#include "http_response.h"
+#include "arena.h"
+
+/* forward declaration */ 
+typedef struct Http_connection_s Http_connection_t; 
+
+#define HTTP_H2_PREFACE         "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP_H2_PREFACE_LEN     24
+#define HTTP_H2_FRAME_HEADER    9
+
+typedef enum Http_h2_stream_state_e {
+    HTTP_H2_STREAM_OPEN,                /* receiving the request */ 
+    HTTP_H2_STREAM_HALF_CLOSED_REMOTE,  /* sending the response */ 
+} Http_h2_stream_state_t; 
+
+typedef struct Http_h2_stream_s {
+    uint32_t id; 
+    Http_h2_stream_state_t state; 
+    int64_t send_window; 
+
+    Http_request_t request; 
+    char    fields[HTTP_REQUEST_SIZE]; /* decoded header strings */ 
+    size_t  fields_len; 
+    int     too_large; /* answered with 413 once the request ends */ 
+    int     malformed; 
+    char*   body; 
+    size_t  body_cap; 
+
+    Http_response_t response; 
+    Http_arena_t arena; /* the handler's, freed with the stream */ 
+    int     responding; 
+    int     send_body;  /* no DATA for HEAD */ 
+    size_t  body_sent; 
+} Http_h2_stream_t; 
+
+typedef struct Http_h2_session_s {
+    uint8_t in[HTTP_H2_FRAME_HEADER + HTTP_H2_MAX_FRAME_SIZE]; 
+    size_t  in_len; 
+    int     preface_pending; 
+
+    uint8_t* out; 
+    size_t  out_len; 
+    size_t  out_sent; 
+    size_t  out_cap; 
+
+    Http_hpack_table_t decoder; 
+    Http_hpack_table_t encoder; 
+
+    Http_h2_stream_t* streams[HTTP_H2_MAX_STREAMS]; 
+    size_t  stream_count; 
+    size_t  next_stream; /* round robin between the streams sending DATA */ 
+    uint32_t last_stream_id; 
+
+    /* a header block split over CONTINUATION frames */ 
+    uint32_t continuation_id; 
+    int     continuation_end_stream; 
+    uint8_t* block; 
+    size_t  block_len; 
+
+    int64_t send_window; 
+    uint32_t recv_consumed; /* DATA bytes not given back with WINDOW_UPDATE yet */ 
+    uint32_t peer_initial_window; 
+    uint32_t peer_max_frame; 
+
+    int     goaway_sent; 
+    int     goaway_received; 
+} Http_h2_session_t; 
+
+/* the buffered bytes are the start of a prior knowledge http/2 connection */ 
+int  http_h2_is_preface(const char* buff, size_t len); 
+/* returns 1 for "Upgrade: h2c" with HTTP2-Settings */ 
+int  http_h2_upgrade_requested(Http_request_t* request); 
+
+/* switch the connection to http/2, the con->buff bytes are moved to the session.
+ * upgrade is 1 if con->request was the "Upgrade: h2c" request, it becomes stream 1. returns -1 if an error */ 
+int  http_h2_start(Http_connection_t* con, int upgrade); 
+void http_h2_free(Http_connection_t* con); 
+
+void http_h2_read(Http_connection_t* con); 
+/* called once con->response is flushed */ 
+void http_h2_write(Http_connection_t* con); 
+/* GOAWAY for the streams the client hasn't opened yet, the open ones are finished */ 
+void http_h2_drain(Http_connection_t* con); 
+
+#endif
@@ -2,16 +2,23 @@
 #define HTTP_PARSER_H
 
 #include <stddef.h> 
+#include <stdint.h> 
 
 #include "utils.h"
 #include "config.h"
 
 #define HTTP_VERSION_SIZE 4
 
+/* forward declaration */ 
+struct Http_arena_s; 
+
+/* a header as offsets into the request bytes (request->base), nothing is copied or nul terminated */ 
 typedef struct Http_header_s {
-    char* key;
-    char* value;
-} Http_header_t;
+    uint16_t key_off; 
+    uint16_t key_len; 
+    uint16_t value_off; 
+    uint16_t value_len; 
+} Http_header_t; 
 
 #define HTTP_METHOD_LAST HTTP_METHOD_PATCH
 typedef enum Http_method_e {
@@ -35,16 +42,41 @@ Http_method_t http_method_from_string(char* str);
 typedef struct Http_request_s {
     Http_method_t method; 
     char* method_str; 
-    char* path; 
+    char* target;       /* as sent, path and query */ 
+    char* path;         /* percent-decoded, without dot segments and repeated slashes, what routes match */ 
+    Http_slice_t query; /* after the '?', still percent-encoded. .ptr is null without one */ 
     char version[HTTP_VERSION_SIZE]; 
-    Http_header_t headers[HTTP_MAX_HEADERS]; 
+    const char* base; /* the header offsets start there */ 
     size_t headers_count; 
+    Http_header_t headers[HTTP_REQUEST_INLINE_HEADERS]; 
+    Http_header_t* headers_more; /* the ones after the inline array, from the arena */ 
     char* body; 
     size_t body_len; 
+    int chunked; /* Transfer-Encoding: chunked, body_len is known once it's decoded */ 
+    int expect_continue; /* the client waits for a 100 Continue before sending the body */ 
+    struct Http_arena_s* arena; /* handler memory, released once the response is made */ 
 } Http_request_t; 
 
-char* http_request_search_header(Http_request_t* request, const char* key); /* return null if didn't find */ 
+/* the value of the first header named key, .ptr is null if there is none */ 
+Http_slice_t http_request_header(const Http_request_t* request, const char* key); 
+/* the i-th header, i < headers_count */ 
+void http_request_header_at(const Http_request_t* request, size_t i, Http_slice_t* key, Http_slice_t* value); 
+/* offsets are from request->base, returns -1 if there is no room (HTTP_MAX_HEADERS or no arena for the extra ones) */ 
+int  http_request_add_header(Http_request_t* request, size_t key_off, size_t key_len, size_t value_off, size_t value_len); 
+/* only method and target are nul terminated in place, request->arena is kept */ 
 int http_request_parse(Http_request_t* request, char* request_raw, size_t request_raw_len); 
+/* split target (nul terminated, len bytes) into path and query. path is target itself when there is
+ * nothing to decode or remove, otherwise it's written to request->arena. returns -1 if malformed */ 
+int http_request_set_target(Http_request_t* request, char* target, size_t len); 
+
+/* the value of the first query parameter named key (compared as sent), .ptr is null if there is none.
+ * the value is a view into the target, still percent-encoded */ 
+Http_slice_t http_request_query(const Http_request_t* request, const char* key); 
+/* walk the query parameters, *pos starts at 0. returns -1 once there are no more */ 
+int  http_request_query_next(const Http_request_t* request, size_t* pos, Http_slice_t* key, Http_slice_t* value); 
+/* percent-decode a query key or value into buf ('+' is a space) and nul terminate it, len may be null.
+ * returns -1 if it's malformed or doesn't fit */ 
+int  http_query_decode(Http_slice_t slice, char* buf, size_t size, size_t* len); 
 
 /* debug */ 
 void http_request_print(Http_request_t* request); 
@@ -1,6 +1,10 @@
 #ifndef HTTP_RESPONSE_H
 #define HTTP_RESPONSE_H
 
+#include <stdint.h> 
+#include <sys/types.h> 
+#include <time.h> 
+
 #include "config.h"
 #include "connection.h"
 #include "circ_buff.h"
@@ -14,6 +18,7 @@ typedef enum Http_status_code_e {
     HTTP_CREATED = 201,
     HTTP_ACCEPTED = 202,
     HTTP_NO_CONTENT = 204,
+    HTTP_PARTIAL_CONTENT = 206,
 
     HTTP_MOVED_PERMANENTLY = 301,
     HTTP_FOUND = 302,
@@ -28,6 +33,8 @@ typedef enum Http_status_code_e {
     HTTP_GONE = 410,
     HTTP_PAYLOAD_TOO_LARGE = 413,
     HTTP_UNSUPPORTED_MEDIA_TYPE = 415,
+    HTTP_RANGE_NOT_SATISFIABLE = 416,
+    HTTP_TOO_MANY_REQUESTS = 429,
 
     HTTP_INTERNAL_SERVER_ERROR = 500,
     HTTP_NOT_IMPLEMENTED = 501,
@@ -37,8 +44,12 @@ typedef enum Http_status_code_e {
 }  Http_status_code_t; 
 
 const char* http_reason_from_status(int status_code); 
+/* 1xx, 204 and 304 responses have no body (and no Content-Length) */ 
+int http_status_has_body(int status_code); 
+/* the code of a serialized "HTTP/1.x NNN" status line, 0 if it isn't one */ 
+int http_status_from_head(const char* head, size_t len); 
 
-#define HTTP_CONTENT_TYPE_LAST HTTP_CONTENT_IMAGE_SVG
+#define HTTP_CONTENT_TYPE_LAST HTTP_CONTENT_TEXT_EVENT_STREAM
 typedef enum Http_content_type_e {
     HTTP_CONTENT_NONE = 0, 
     HTTP_CONTENT_TEXT_PLAIN, 
@@ -49,15 +60,64 @@ typedef enum Http_content_type_e {
     HTTP_CONTENT_IMAGE_JPEG,
     HTTP_CONTENT_IMAGE_GIF,
     HTTP_CONTENT_IMAGE_SVG,
+    HTTP_CONTENT_TEXT_EVENT_STREAM,
 } Http_content_type_t;  
 
 const char* http_content_type_value(Http_content_type_t content_type); 
+/* returns 1 if the content type is worth compressing (text like) */ 
+int http_content_type_compressible(Http_content_type_t content_type); 
+
+#define HTTP_CONTENT_ENCODING_LAST HTTP_ENCODING_BR
+typedef enum Http_content_encoding_e {
+    HTTP_ENCODING_NONE = 0,
+    HTTP_ENCODING_GZIP,
+    HTTP_ENCODING_BR,
+} Http_content_encoding_t; 
+
+#define HTTP_ENCODING_BIT(encoding) (1u << (encoding))
+
+const char* http_content_encoding_value(Http_content_encoding_t encoding); 
 
 typedef enum Http_memory_flag_e {
     HTTP_MEM_STATIC, 
     HTTP_MEM_OWNED, 
+    HTTP_MEM_ARENA, /* from req->arena, released with the request */ 
 } Http_memory_flag_t; 
 
+/* where the body bytes come from */ 
+typedef enum Http_body_type_e {
+    HTTP_BODY_BUFFER = 0, /* body/body_len */ 
+    HTTP_BODY_FILE,       /* body_len bytes of body_fd starting at body_offset (sent with sendfile) */ 
+} Http_body_type_t; 
+
+/* inclusive like in the Range header */ 
+typedef struct Http_byte_range_s {
+    off_t start; 
+    off_t end; 
+} Http_byte_range_t; 
+
+#define HTTP_BYTERANGES_BOUNDARY_SIZE   64
+#define HTTP_BYTERANGES_HEAD_SIZE       256 /* a part head or the closing delimiter */ 
+
+/* a multipart/byteranges file body: the part heads are written while it's sent, each part
+ * goes straight from the file. body_len is the whole multipart length */ 
+typedef struct Http_byteranges_s {
+    char boundary[HTTP_BYTERANGES_BOUNDARY_SIZE]; 
+    const char* part_type;  /* null for none */ 
+    off_t size;             /* of the whole file */ 
+    int count; 
+    Http_byte_range_t ranges[HTTP_MAX_RANGES]; 
+} Http_byteranges_t; 
+
+/* the head of part i, i == count is the closing delimiter. size is at least HTTP_BYTERANGES_HEAD_SIZE,
+ * returns the length */ 
+size_t  http_byteranges_head(const Http_byteranges_t* byteranges, int i, char* buf, size_t size); 
+/* the multipart body length, heads and parts */ 
+size_t  http_byteranges_len(const Http_byteranges_t* byteranges); 
+/* len bytes of the multipart body from pos, the parts are read from fd.
+ * returns what was read (less if the file got truncated) or -1 if an error */ 
+ssize_t http_byteranges_pread(const Http_byteranges_t* byteranges, int fd, char* buf, size_t len, size_t pos); 
+
 typedef struct {
     char* key;
     char* value;
@@ -65,19 +125,76 @@ typedef struct {
     Http_memory_flag_t value_mem;
 } Http_response_header_t;
 
+#define HTTP_CACHE_CONTROL_SIZE 48 /* "public, max-age=4294967295, immutable" + '\0' */ 
+#define HTTP_CACHE_CONTROL_LAST HTTP_CACHE_CONTROL_IMMUTABLE
+typedef enum Http_cache_control_e {
+    HTTP_CACHE_CONTROL_NONE = 0,    /* no header */ 
+    HTTP_CACHE_CONTROL_NO_STORE,
+    HTTP_CACHE_CONTROL_NO_CACHE,
+    HTTP_CACHE_CONTROL_PRIVATE,     /* with max-age */ 
+    HTTP_CACHE_CONTROL_PUBLIC,      /* with max-age */ 
+    HTTP_CACHE_CONTROL_IMMUTABLE,   /* public with max-age, never revalidated */ 
+} Http_cache_control_t; 
+
 typedef struct Http_response_s {
     int status_code; 
     Http_content_type_t content_type; 
-    Http_response_header_t headers[HTTP_MAX_HEADERS]; 
-    size_t headers_count; 
+    Http_content_encoding_t content_encoding; 
+    int vary_encoding; /* add "Vary: Accept-Encoding" */ 
+    int connection_close; 
+
+    /* common headers, written from these without a header entry */ 
+    Http_cache_control_t cache_control; 
+    uint32_t max_age;       /* seconds, for private, public and immutable */ 
+    uint32_t retry_after;   /* seconds, 0 for none */ 
+    time_t last_modified;   /* 0 for none */ 
+    char* etag;             /* with its quotes */ 
+    char* location; 
+    Http_memory_flag_t etag_mem; 
+    Http_memory_flag_t location_mem; 
+
+    Http_body_type_t body_type; 
     char* body; 
+    int body_fd; 
+    off_t body_offset; 
     size_t body_len; 
-    Http_memory_flag_t body_mem; 
-    int connection_close; 
+    Http_memory_flag_t body_mem; /* for a file body owned means the fd will be closed */ 
+    Http_byteranges_t* byteranges; /* file body sent as multipart/byteranges, freed with the response */ 
+
+    /* set by http_ws_accept, the connection speaks websocket once the 101 is sent */ 
+    const struct Http_ws_handlers_s* websocket; 
+    void* websocket_data; 
+    /* set by http_sse_accept, the connection is held and subscribed once the head is sent */ 
+    const char* sse_topic; 
+
+    size_t headers_count; 
+    Http_response_header_t* headers_more; /* past the inline ones, grown on demand */ 
+    size_t headers_more_cap; 
+    /* last so http_response_init doesn't touch it, only valid up to headers_count */ 
+    Http_response_header_t headers[HTTP_RESPONSE_INLINE_HEADERS]; 
 } Http_response_t; 
 
+/* an empty response, cheaper than a memset of the whole thing */ 
+void http_response_init(Http_response_t* resp); 
+/* resets the response, what it held isn't freed */ 
 void http_response_make_error(Http_response_t* resp, int status_code); 
+/* returns -1 if there is no room for the header, the header is not freed then */ 
+int  http_response_add_header(Http_response_t* resp,
+                              char* key, Http_memory_flag_t key_mem,
+                              char* value, Http_memory_flag_t value_mem); 
+/* the i-th added header, i < headers_count */ 
+const Http_response_header_t* http_response_header_at(const Http_response_t* resp, size_t i); 
+
+/* typed common headers */ 
+void http_response_set_cache_control(Http_response_t* resp, Http_cache_control_t cache_control, uint32_t max_age); 
+void http_response_set_last_modified(Http_response_t* resp, time_t mtime); 
+void http_response_set_etag(Http_response_t* resp, char* etag, Http_memory_flag_t mem); 
+void http_response_set_location(Http_response_t* resp, char* location, Http_memory_flag_t mem); 
+void http_response_set_retry_after(Http_response_t* resp, uint32_t seconds); 
+/* the Cache-Control value, null for HTTP_CACHE_CONTROL_NONE. buf is used when there is a max-age */ 
+const char* http_cache_control_value(const Http_response_t* resp, char* buf, size_t size); 
 /* returns -1 if an error or the used size if everything is ok */ 
+/* a file body is not written, only its headers */ 
 int  http_response_raw(const Http_response_t* resp, char* buffer, size_t buffer_len); 
 int  http_response_raw_circ(const Http_response_t* resp, Http_circ_buff_t* resp_buff); 
 /* response won't be free if the handler returned error */ 
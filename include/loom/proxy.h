@@ -0,0 +1,99 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <stdint.h> 
+#include <sys/socket.h> 
+
+#include "config.h"
+#include "server_context.h"
+
+/* forward declaration */ 
+typedef struct Http_connection_s Http_connection_t; 
+typedef struct Http_epoll_item_s Http_epoll_item_t; 
+typedef struct Http_upstream_con_s Http_upstream_con_t; 
+
+typedef enum Http_upstream_con_state_e {
+    HTTP_UPSTREAM_CONNECTING,
+    HTTP_UPSTREAM_ACTIVE,       /* busy with a client request */ 
+    HTTP_UPSTREAM_IDLE,         /* waiting in the keep-alive pool */ 
+    HTTP_UPSTREAM_CLOSED,       /* freed after the current event batch */ 
+} Http_upstream_con_state_t; 
+
+typedef enum Http_upstream_body_e {
+    HTTP_UPSTREAM_BODY_NONE,
+    HTTP_UPSTREAM_BODY_LENGTH,
+    HTTP_UPSTREAM_BODY_CHUNKED,
+    HTTP_UPSTREAM_BODY_CLOSE,   /* ends when the backend closes */ 
+} Http_upstream_body_t; 
+
+typedef struct Http_backend_s {
+    struct sockaddr_storage addr; 
+    socklen_t addr_len; 
+    size_t active;              /* connections busy with a request */ 
+    Http_upstream_con_t* idle;  /* keep-alive pool */ 
+    size_t idle_count; 
+    uint64_t down_until;        /* skipped until then (ms) after a failed connect */ 
+} Http_backend_t; 
+
+typedef struct Http_upstream_s {
+    Http_backend_t backends[HTTP_PROXY_MAX_BACKENDS]; 
+    size_t backend_count; 
+    size_t next; /* rotates between backends with the same load */ 
+} Http_upstream_t; 
+
+struct Http_upstream_con_s {
+    int fd; 
+    Http_upstream_con_state_t state; 
+    Http_upstream_t* upstream; 
+    Http_backend_t* backend; 
+    Http_server_context_t* ctx; 
+    Http_epoll_item_t* item; 
+    Http_connection_t* client; /* null while pooled */ 
+
+    /* request going to the backend */ 
+    char    out[HTTP_PROXY_BUFFER]; 
+    size_t  out_len; 
+    size_t  out_sent; 
+    size_t  body_remaining; /* request body bytes still to read from the client */ 
+    int     head_request; 
+    int     client_close; 
+
+    /* response coming back */ 
+    char    in[HTTP_PROXY_BUFFER]; 
+    size_t  in_len; 
+    size_t  in_pos; 
+    int     head_done; 
+    int     responded; /* something reached the client response buffer */ 
+    int     keep_alive; 
+    Http_upstream_body_t body; 
+    size_t  remaining; 
+    int     chunk_state; 
+    size_t  chunk_size; 
+    int     done; 
+    time_t  touched; /* last time the client timeout was pushed back */ 
+
+    Http_upstream_con_t* next; 
+}; 
+
+/* an upstream is a group of backends sharing the requests of proxy routes */ 
+Http_upstream_t* http_upstream_create(void); 
+/* resolves host once, returns -1 if it can't be resolved or the group is full */ 
+int  http_upstream_add_server(Http_upstream_t* upstream, const char* host, int port); 
+/* closes the pooled connections, call it after http_server_clean */ 
+void http_upstream_destroy(Http_upstream_t* upstream); 
+
+/* forward the parsed request of con, body_buffered bytes of its body follow the head in con->buff
+ * returns -1 if no backend could be used */ 
+int  http_proxy_start(Http_connection_t* con, Http_upstream_t* upstream, size_t body_buffered); 
+/* move data again after the client became readable or its response buffer got flushed */ 
+void http_proxy_resume(Http_connection_t* con); 
+/* returns 1 once part of the backend response was given to the client */ 
+int  http_proxy_responded(Http_connection_t* con); 
+/* drop the exchange, the backend connection can't be reused */ 
+void http_proxy_abort(Http_connection_t* con); 
+
+void http_proxy_event(Http_epoll_item_t* item, uint32_t events); 
+/* free the connections closed during the event batch */ 
+void http_proxy_reap(Http_server_context_t* ctx); 
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef QSBR_H
+#define QSBR_H
+
+#include <pthread.h> 
+#include <stddef.h> 
+#include <stdint.h> 
+
+#include "config.h"
+
+/* quiescent state based reclamation: readers (event loops) never lock, they only say
+ * when they hold no shared pointer. something retired is freed once every online reader
+ * went through such a point after it was retired */ 
+
+typedef struct Http_qsbr_retired_s {
+    void* ptr; 
+    void (*free_fn)(void* ptr); 
+    uint64_t epoch; 
+    struct Http_qsbr_retired_s* next; 
+} Http_qsbr_retired_t; 
+
+typedef struct Http_qsbr_s {
+    uint64_t epoch;                         /* bumped by every retire */ 
+    uint64_t seen[HTTP_QSBR_MAX_READERS];   /* epoch each reader saw at its last quiescent point, 0 when offline */ 
+    size_t   readers; 
+    pthread_mutex_t lock;                   /* retire list only, never taken by a lookup */ 
+    Http_qsbr_retired_t* retired; 
+} Http_qsbr_t; 
+
+int  http_qsbr_init(Http_qsbr_t* qsbr); 
+/* frees everything still retired, no reader may be left */ 
+void http_qsbr_clean(Http_qsbr_t* qsbr); 
+/* returns the reader id or -1 if there are too many */ 
+int  http_qsbr_register(Http_qsbr_t* qsbr); 
+
+/* the reader holds no shared pointer from now on */ 
+void http_qsbr_offline(Http_qsbr_t* qsbr, int reader); 
+/* the reader dropped what it held and may load shared pointers again */ 
+void http_qsbr_quiescent(Http_qsbr_t* qsbr, int reader); 
+
+/* free_fn(ptr) runs once no reader can see ptr anymore, ptr must be unreachable already.
+ * returns -1 if it couldn't be queued, then nothing is freed */ 
+int  http_qsbr_retire(Http_qsbr_t* qsbr, void* ptr, void (*free_fn)(void* ptr)); 
+/* free what is safe to free, cheap when nothing is retired */ 
+void http_qsbr_reclaim(Http_qsbr_t* qsbr); 
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdint.h> 
+#include <sys/socket.h> 
+
+#include "server_context.h"
+
+/* a client address with its token bucket, ipv4 addresses are stored mapped into ipv6 */ 
+typedef struct Http_ratelimit_entry_s {
+    uint8_t  addr[16]; 
+    uint64_t last;          /* last refill (ms) */ 
+    uint32_t tokens;        /* requests x1000 */ 
+    uint32_t connections;   /* an entry with connections is never reused */ 
+    int      used; 
+} Http_ratelimit_entry_t; 
+
+/* allocate the table if a per address limit is set, returns -1 on failure */ 
+int  http_ratelimit_init(Http_server_context_t* ctx); 
+void http_ratelimit_clean(Http_server_context_t* ctx); 
+
+/* a client connected, returns -1 if it has too many connections already
+ * entry is null when the address isn't tracked (limits disabled or table full) */ 
+int  http_ratelimit_connect(Http_server_context_t* ctx, const struct sockaddr_storage* addr,
+                            Http_ratelimit_entry_t** entry); 
+void http_ratelimit_disconnect(Http_ratelimit_entry_t* entry); 
+/* takes a token, returns 1 if the client must get the 429 instead */ 
+int  http_ratelimit_request(Http_server_context_t* ctx, Http_ratelimit_entry_t* entry); 
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef RESP_CACHE_H
+#define RESP_CACHE_H
+
+#include <stddef.h> 
+#include <stdint.h> 
+
+#include "config.h"
+#include "http_parser.h"
+
+/* per route micro cache holding fully serialized responses */ 
+
+typedef struct Http_cache_policy_s {
+    int ttl_ms;     /* how long an entry is fresh */ 
+    int stale_ms;   /* after ttl, how long it's served stale while one request refreshes it */ 
+    const char* vary[HTTP_CACHE_MAX_VARY]; /* request headers that are part of the key (null terminated) */ 
+} Http_cache_policy_t; 
+
+typedef struct Http_cache_entry_s {
+    uint64_t hash; 
+    char* key; 
+    size_t key_len; 
+    char* data;     /* serialized response */ 
+    size_t data_len; 
+    int connection_close; 
+    uint64_t fresh_until; 
+    uint64_t stale_until; 
+    int refreshing; /* a request is already refreshing it (single flight) */ 
+    struct Http_cache_entry_s* next; 
+} Http_cache_entry_t; 
+
+typedef struct Http_resp_cache_s {
+    Http_cache_policy_t policy; 
+    Http_cache_entry_t* buckets[HTTP_CACHE_BUCKETS]; 
+    size_t entries_count; 
+} Http_resp_cache_t; 
+
+typedef enum Http_cache_result_e {
+    HTTP_CACHE_MISS,        /* run the handler and store the result */ 
+    HTTP_CACHE_HIT,         /* send the entry */ 
+    HTTP_CACHE_STALE,       /* send the entry then refresh it */ 
+} Http_cache_result_t; 
+
+/* the key of a request, built in a buffer so a lookup allocates nothing */ 
+typedef struct Http_cache_key_s {
+    char buff[HTTP_CACHE_MAX_KEY]; 
+    size_t len; 
+    uint64_t hash; 
+} Http_cache_key_t; 
+
+Http_resp_cache_t* http_resp_cache_create(const Http_cache_policy_t* policy); 
+void http_resp_cache_destroy(Http_resp_cache_t* cache); 
+
+/* returns -1 if the request can't be cached (key too long) */ 
+int  http_resp_cache_key(Http_resp_cache_t* cache, Http_request_t* req, Http_cache_key_t* key); 
+/* entry is set for HIT and STALE, a STALE entry is marked as refreshing */ 
+Http_cache_result_t http_resp_cache_lookup(Http_resp_cache_t* cache, const Http_cache_key_t* key, Http_cache_entry_t** entry); 
+/* store a serialized response, returns -1 if it wasn't stored */ 
+int  http_resp_cache_store(Http_resp_cache_t* cache,
+                           const Http_cache_key_t* key,
+                           const char* data,
+                           size_t data_len,
+                           int connection_close); 
+/* a refresh that failed, the stale entry can be refreshed by another request */ 
+void http_resp_cache_refresh_failed(Http_resp_cache_t* cache, const Http_cache_key_t* key); 
+/* returns 1 if a response with this status can be cached */ 
+int  http_resp_cache_status_cacheable(int status_code); 
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "http_parser.h"
 #include "http_handler.h"
+#include "resp_cache.h"
 
 /* TODO: implement a faster data structure */
 typedef struct Http_route_s {
@@ -10,6 +11,8 @@ typedef struct Http_route_s {
     char* path; 
     Http_handler_t handler;
     void* data; /* user data */  
+    Http_resp_cache_t* cache; /* null if responses are not cached */ 
+    struct Http_upstream_s* upstream; /* proxy routes match every method and path under the prefix */ 
     struct Http_route_s* next; 
 } Http_route_t; 
 
@@ -22,10 +25,21 @@ int http_route_register(Http_router_t* router,
                         Http_method_t method, 
                         const char* path, 
                         Http_handler_t handler); 
+/* cache the responses of an already registered GET or HEAD route */ 
+int http_route_cache(Http_router_t* router,
+                     Http_method_t method,
+                     const char* path,
+                     const Http_cache_policy_t* policy); 
+/* forward the requests under prefix to a group of backends */ 
+int http_route_proxy(Http_router_t* router, const char* prefix, struct Http_upstream_s* upstream); 
 /* returns NULL if no routing exists */
 Http_handler_t http_router_find(Http_router_t* router, Http_method_t method, const char* path);
+Http_route_t*  http_router_find_route(Http_router_t* router, Http_method_t method, const char* path); 
 int http_router_init(Http_router_t* router); 
 void http_router_clean(Http_router_t* router); 
+/* a router on the heap, the one given to http_server_publish_router */ 
+Http_router_t* http_router_create(void); 
+void http_router_destroy(Http_router_t* router); 
 
 
 #endif
@@ -8,6 +8,10 @@
 #include "shutdown.h"
 #include "epoll_utils.h"
 #include "timer.h"
+#include "proxy.h"
+#include "sockopt.h"
+#include "websocket.h"
+#include "sse.h"
 
 
 /* prepare the context return -1 if an error */ 
@@ -16,6 +20,11 @@ int  http_server_start(Http_server_context_t* ctx, Http_config_t* config);
 void http_server_run(Http_server_context_t* ctx); 
 /* clean context */ 
 void http_server_clean(Http_server_context_t* ctx); 
+/* replace the routes while the server runs, callable from any thread.
+ * the server owns router (from http_router_create) from now on, requests already
+ * matched finish with the old one which is destroyed once no loop can see it.
+ * the router from the config is never freed, it must live until http_server_clean */ 
+int  http_server_publish_router(Http_server_context_t* ctx, Http_router_t* router); 
 
 /* generic static file handler */
 Http_handler_result_t http_handler_static_file(Http_request_t* req,
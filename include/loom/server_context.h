@@ -1,16 +1,67 @@
 #ifndef SERVER_CONTEXT_H
 #define SERVER_CONTEXT_H
 
+#include <stdint.h> 
+
 #include "timer.h"
 #include "config.h"
+#include "qsbr.h"
+
+#define HTTP_MAX_LISTENERS          2 /* plain and tls */ 
+#define HTTP_OVERLOAD_RESPONSE_SIZE 256
 
 typedef struct Http_server_context_s {
     int listen_fd; 
+    int tls_listen_fd; /* -1 if tls is disabled */ 
+    struct ssl_ctx_st* ssl_ctx; 
     int epoll_fd; 
     int shutdown_fd; 
     Http_timer_t* timer; 
     Http_config_t* cfg; 
+    struct Http_router_s* router; /* the published routes, swapped while running, read it with http_server_router */ 
+    Http_qsbr_t qsbr; /* frees replaced routers once no loop uses them */ 
+    int qsbr_reader; 
     size_t active_clients; /* keep track of clients number */ 
+    struct Http_upstream_con_s* upstream_graveyard; /* closed backend connections, freed after the event batch */ 
+    struct Http_epoll_item_s* item_graveyard; /* items of clients closed by another event, freed after the batch */ 
+    struct Http_cache_refresh_s* cache_refreshes; /* stale cache entries, refreshed after the batch */ 
+    struct Http_connection_s* connections; /* every client, closed when the server stops */ 
+    struct Http_connection_s* idle_head; /* keep-alive connections waiting for a request, oldest first */ 
+    struct Http_connection_s* idle_tail; 
+    size_t idle_count; 
+
+    /* graceful shutdown */ 
+    int handoff_fd; /* -1 if there is no handoff socket */ 
+    int draining; 
+    uint64_t drain_deadline; /* ms */ 
+
+    /* admission control */ 
+    size_t inflight; /* connections producing or sending a response */ 
+    uint64_t loop_lag; /* average lateness (ns x8) of the lag probe's wakeups */ 
+    int lag_fd; /* the lag probe timer, -1 if disabled */ 
+    uint64_t lag_expected; /* ns, its next expiry */ 
+    struct Http_epoll_item_s* paused[HTTP_MAX_LISTENERS]; /* listeners waiting for connections to close */ 
+    size_t paused_count; 
+    char overload_response[HTTP_OVERLOAD_RESPONSE_SIZE]; /* the serialized 503 */ 
+    size_t overload_response_len; 
+
+    /* per address limits, null if disabled */ 
+    struct Http_ratelimit_entry_s* ratelimit; 
+    char ratelimit_response[HTTP_OVERLOAD_RESPONSE_SIZE]; /* the serialized 429 */ 
+    size_t ratelimit_response_len; 
+
+    struct Http_access_log_s* access_log; /* null if disabled */ 
+    uint64_t trace_count; /* requests seen by the trace sampling */ 
+    struct Http_sse_registry_s* sse; /* event stream topics */ 
+
+    int worker; /* this loop's number, 0 with a single loop */ 
+    struct Http_workers_s* workers; /* the supervisor's children, null in a loop */ 
 } Http_server_context_t; 
 
+/* the router requests are matched against, valid until the loop's next epoll_wait */ 
+static inline struct Http_router_s* http_server_router(Http_server_context_t* ctx)
+{
+    return __atomic_load_n(&ctx->router, __ATOMIC_ACQUIRE); 
+}
+
 #endif
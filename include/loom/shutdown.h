@@ -4,9 +4,16 @@
 #include "server_context.h"
 #include "epoll_utils.h"
 
-/* returns shutdown fd if success or -1 if error */ 
-int  http_shutdown_setup(int epoll_fd);
+/* watch shutdown_fd (an eventfd) or a new one if it's -1, returns shutdown fd if success or -1 if error */ 
+int  http_shutdown_setup(int epoll_fd, int shutdown_fd); 
 void http_trigger_shutdown(Http_server_context_t* ctx);
 void http_shutdown_close(int shutdown_fd);
 
+/* stop accepting and give the connections cfg->drain_timeout seconds to finish */ 
+void http_shutdown_drain(Http_server_context_t* ctx); 
+/* how long the loop can wait for events (ms), -1 when not draining and 0 once the drain is over */ 
+int  http_shutdown_drain_wait(Http_server_context_t* ctx); 
+/* close the connections left when the loop stops */ 
+void http_shutdown_close_connections(Http_server_context_t* ctx); 
+
 #endif
@@ -0,0 +1,18 @@
+#ifndef SOCKOPT_H
+#define SOCKOPT_H
+
+#include "config.h"
+
+/* apply the tuning to a listening socket, returns -1 if an option was refused */ 
+int  http_sockopt_listener(int fd, const Http_socket_tuning_t* tuning); 
+/* what accepted connections don't inherit from the listener, failures are ignored */ 
+void http_sockopt_accepted(int fd, const Http_socket_tuning_t* tuning); 
+/* kernel busy polling for the loop's epoll instance, ignored before linux 6.9 (net.core.busy_poll does it then) */ 
+void http_sockopt_epoll(int epoll_fd, const Http_socket_tuning_t* tuning); 
+/* listeners of a SO_REUSEPORT group in the order they joined it, listeners[i] is accepted from on cpus[i]
+ * (-1 if not pinned). a connection goes to the listener of the cpu that received it, returns -1 if refused */ 
+int  http_sockopt_steer(const int* listeners, const int* cpus, int count); 
+/* "none", "low-latency" or "bulk", returns -1 for an unknown name */ 
+int  http_sockopt_preset(const char* name, Http_socket_tuning_t* tuning); 
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef SSE_H
+#define SSE_H
+
+#include <stddef.h> 
+#include <stdint.h> 
+
+#include "config.h"
+#include "server_context.h"
+#include "http_parser.h"
+#include "http_response.h"
+
+/* server-sent events: a route handler subscribes the request to a topic, every event
+ * published to the topic is serialized once and queued by reference for each subscriber */ 
+
+/* forward declaration */ 
+typedef struct Http_connection_s Http_connection_t; 
+
+/* a serialized event, freed once the last subscriber sent it */ 
+typedef struct Http_sse_event_s {
+    uint32_t refs; 
+    uint64_t key;   /* hash of the event name, 0 for unnamed events (never coalesced) */ 
+    size_t len; 
+    char data[]; 
+} Http_sse_event_t; 
+
+typedef struct Http_sse_s Http_sse_t; 
+
+typedef struct Http_sse_topic_s {
+    char* name; 
+    uint64_t hash; 
+    struct Http_sse_registry_s* registry; 
+    Http_sse_t* subscribers; 
+    size_t subscribers_count; 
+    uint64_t published; 
+    uint64_t dropped;   /* events slow subscribers never got (dropped or coalesced) */ 
+    struct Http_sse_topic_s* next; /* bucket */ 
+} Http_sse_topic_t; 
+
+/* the topics of a server, they live until http_server_clean */ 
+typedef struct Http_sse_registry_s {
+    Http_sse_topic_t* buckets[HTTP_SSE_TOPIC_BUCKETS]; 
+    Http_sse_t* dirty;  /* subscribers with new events, sent to after the event batch */ 
+} Http_sse_registry_t; 
+
+/* a subscribed connection, the events are sent straight from the shared buffers */ 
+struct Http_sse_s {
+    Http_connection_t* con; 
+    Http_sse_topic_t* topic; 
+    struct Http_sse_s* prev; /* topic subscribers */ 
+    struct Http_sse_s* next; 
+    struct Http_sse_s* dirty_prev; 
+    struct Http_sse_s* dirty_next; 
+    uint8_t dirty; 
+    uint8_t sent;       /* bytes went out since the last heartbeat tick */ 
+
+    Http_sse_event_t* queue[HTTP_SSE_QUEUE]; 
+    uint32_t head; 
+    uint32_t count; 
+    size_t head_sent;   /* bytes of the first queued event already sent */ 
+}; 
+
+int  http_sse_init(Http_server_context_t* ctx); 
+void http_sse_clean(Http_server_context_t* ctx); 
+
+/* from a route handler: answers with an event stream subscribed to the topic (created if needed).
+ * returns -1 if the request can't be subscribed (not http/1), resp is left alone then */ 
+int  http_sse_accept(Http_request_t* req, Http_response_t* resp, const char* topic); 
+
+/* the topic of that name, created if needed. null if out of memory */ 
+Http_sse_topic_t* http_sse_topic(Http_server_context_t* ctx, const char* name); 
+/* queue an event for every subscriber, from any code on the loop. event (the name) may be null,
+ * the lines of data become data fields. a slow subscriber loses an older event with the same
+ * name, or its oldest unsent one. returns -1 if the event is malformed or out of memory */ 
+int  http_sse_publish(Http_sse_topic_t* topic, const char* event, const char* data, size_t len); 
+/* after the event batch: one send per subscriber that got events */ 
+void http_sse_flush(Http_server_context_t* ctx); 
+
+/* used by the connection */ 
+int  http_sse_start(Http_connection_t* con, Http_sse_topic_t* topic); 
+void http_sse_free(Http_connection_t* con); 
+void http_sse_read(Http_connection_t* con); 
+/* called once con->response is flushed */ 
+void http_sse_write(Http_connection_t* con); 
+/* the connection timer expired, returns -1 if the client is gone or stuck */ 
+int  http_sse_timeout(Http_connection_t* con); 
+
+#endif
@@ -32,7 +32,9 @@ void http_timer_clean(Http_timer_t* timer);
 
 int  http_timer_add_timeout(Http_timer_t* timer, Http_connection_t* con, int timeout_sec); 
 void http_timer_invalid_timeout(Http_timer_t* timer, int event_index); 
-int  http_timer_reset_timeout(Http_timer_t* timer, Http_connection_t* con, int timeout_sec);
+/* move the connection's deadline in place, it must have one. returns -1 if the timer fd couldn't be
+ * set, the deadline is moved anyway */ 
+int  http_timer_update(Http_timer_t* timer, Http_connection_t* con, int timeout_sec); 
 int  http_timer_pop_recent(Http_timer_t* timer, Http_timer_event_t* event); 
 
 #endif
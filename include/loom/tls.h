@@ -0,0 +1,28 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <sys/types.h> 
+
+#include "server_context.h"
+
+/* forward declaration */ 
+typedef struct Http_connection_s Http_connection_t; 
+
+/* everything here is a stub returning an error unless built with HTTP_USE_TLS */ 
+
+/* load the certificate and the key from the config, returns -1 if an error */ 
+int  http_tls_init(Http_server_context_t* ctx); 
+void http_tls_clean(Http_server_context_t* ctx); 
+
+/* start a server side session on the connection socket */ 
+int  http_tls_accept(Http_server_context_t* ctx, Http_connection_t* con); 
+/* returns 1 when done, 0 if it needs more io (see HTTP_FLAG_TLS_WANT_WRITE) and -1 if an error */ 
+int  http_tls_handshake(Http_connection_t* con); 
+void http_tls_free(Http_connection_t* con); 
+
+/* same as read/send/sendfile, errno is EAGAIN if it would block */ 
+ssize_t http_tls_read(Http_connection_t* con, char* buff, size_t len); 
+ssize_t http_tls_write(Http_connection_t* con, const char* buff, size_t len); 
+ssize_t http_tls_sendfile(Http_connection_t* con, int fd, off_t* offset, size_t len); 
+
+#endif
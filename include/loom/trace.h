@@ -0,0 +1,52 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h> 
+#include <sys/socket.h> 
+
+#include "config.h"
+#include "utils.h"
+
+/* forward declaration */ 
+struct Http_connection_s; 
+
+typedef enum Http_trace_phase_e {
+    HTTP_TRACE_FIRST_BYTE,      /* first bytes of the request read from the socket */ 
+    HTTP_TRACE_HEADERS,         /* headers parsed */ 
+    HTTP_TRACE_HANDLER_START,   /* body read, the route is looked up */ 
+    HTTP_TRACE_HANDLER_END,     /* response made (for a proxy route: the backend's head arrived) */ 
+    HTTP_TRACE_FIRST_SENT,      /* first response bytes accepted by the socket */ 
+    HTTP_TRACE_LAST_SENT,       /* whole response accepted by the socket */ 
+    HTTP_TRACE_PHASES,
+} Http_trace_phase_t; 
+
+#define HTTP_TRACE_PATH_LEN 80
+
+/* the life of a http/1 request, given to config.trace_hook */ 
+typedef struct Http_trace_s {
+    uint64_t at[HTTP_TRACE_PHASES]; /* monotonic ns, 0 if the phase wasn't reached (client gone, error) */ 
+    int status;                     /* 0 if no response was made */ 
+    char method[8]; 
+    char path[HTTP_TRACE_PATH_LEN]; /* cut if longer */ 
+    const struct sockaddr_storage* peer; 
+} Http_trace_t; 
+
+/* one branch when the request isn't traced */ 
+#define HTTP_TRACE_MARK(con, phase) \
+    do { \
+        if ((con)->tracing) \
+            (con)->trace.at[phase] = http_time_ns(); \
+    } while (0)
+
+/* a request starts on the connection, it's traced if it's picked by config.trace_sample */ 
+void http_trace_begin(struct Http_connection_s* con); 
+/* the headers are parsed */ 
+void http_trace_request(struct Http_connection_s* con); 
+/* a response head was queued */ 
+void http_trace_response(struct Http_connection_s* con, const char* head, size_t len); 
+/* the response is out or the connection is closing, hands the trace to the hook */ 
+void http_trace_end(struct Http_connection_s* con, int closed); 
+/* the default hook, a line per trace on stderr */ 
+void http_trace_print(const Http_trace_t* trace, void* data); 
+
+#endif
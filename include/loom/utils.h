@@ -2,10 +2,38 @@
 #define UTILS_H
 
 #include <stddef.h> 
+#include <stdint.h> 
+#include <time.h> 
+
+#define HTTP_DATE_SIZE 30 /* "Sun, 06 Nov 1994 08:49:37 GMT" + '\0' */ 
+
+/* bytes inside a bigger buffer, not nul terminated. ptr is null for nothing */ 
+typedef struct Http_slice_s {
+    const char* ptr; 
+    size_t len; 
+} Http_slice_t; 
+
+/* case insensitive, for header names and tokens */ 
+int   http_slice_eq_nocase(Http_slice_t slice, const char* str); 
+/* the slice as a string in buf, null if there is no slice or it doesn't fit */ 
+char* http_slice_cstr(Http_slice_t slice, char* buf, size_t size); 
 
 /* make a socket nonblocking returns -1 in case of an error */ 
 int http_socket_set_nonblocking(int sockfd);
 
 int http_parse_sizet(const char* str, size_t* out); 
 
+/* monotonic clock in milliseconds (coarse, cheap to read) */ 
+uint64_t http_time_ms(void); 
+/* precise monotonic clock in nanoseconds */ 
+uint64_t http_time_ns(void); 
+
+/* FNV-1a */ 
+uint64_t http_hash_bytes(const void* data, size_t len); 
+
+/* IMF-fixdate used by Date, Last-Modified, If-Modified-Since... */ 
+void http_format_date(time_t t, char buf[HTTP_DATE_SIZE]); 
+/* returns -1 if the date is malformed */ 
+int  http_parse_date(const char* str, time_t* out); 
+
 #endif
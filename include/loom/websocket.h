@@ -0,0 +1,92 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <stddef.h> 
+#include <stdint.h> 
+
+#include "config.h"
+#include "http_parser.h"
+#include "http_response.h"
+
+/* forward declaration */ 
+typedef struct Http_connection_s Http_connection_t; 
+
+typedef enum Http_ws_opcode_e {
+    HTTP_WS_CONTINUATION = 0x0,
+    HTTP_WS_TEXT = 0x1,
+    HTTP_WS_BINARY = 0x2,
+    HTTP_WS_CLOSE = 0x8,
+    HTTP_WS_PING = 0x9,
+    HTTP_WS_PONG = 0xA,
+} Http_ws_opcode_t; 
+
+#define HTTP_WS_CLOSE_NORMAL        1000
+#define HTTP_WS_CLOSE_GOING_AWAY    1001
+#define HTTP_WS_CLOSE_PROTOCOL      1002
+#define HTTP_WS_CLOSE_NO_STATUS     1005
+#define HTTP_WS_CLOSE_ABNORMAL      1006 /* the connection dropped without a close frame */ 
+#define HTTP_WS_CLOSE_INVALID_DATA  1007 /* text that isn't utf-8 */ 
+#define HTTP_WS_CLOSE_TOO_BIG       1009
+
+typedef struct Http_ws_s Http_ws_t; 
+
+/* run on the event loop, ws stays valid until close returns */ 
+typedef struct Http_ws_handlers_s {
+    void (*open)(Http_ws_t* ws);    /* the 101 is queued, may be null */ 
+    /* a whole message (text or binary), data is only valid during the call */ 
+    void (*message)(Http_ws_t* ws, Http_ws_opcode_t opcode, const char* data, size_t len); 
+    void (*close)(Http_ws_t* ws, uint16_t code); /* the connection is going away, may be null */ 
+} Http_ws_handlers_t; 
+
+/* what an idle websocket costs besides its connection, the buffers are only there while they're used */ 
+struct Http_ws_s {
+    Http_connection_t* con; 
+    const Http_ws_handlers_t* handlers; 
+    void* data;             /* given to http_ws_accept */ 
+
+    /* a fragmented message or a frame bigger than the connection buffer */ 
+    char*   message; 
+    size_t  message_len; 
+    size_t  message_cap; 
+    uint8_t message_opcode; /* 0 when no message is being put together */ 
+    uint32_t utf8_state;    /* a sequence split between text frames, see utf8_check */ 
+
+    /* the frame being unmasked straight from the socket */ 
+    uint64_t frame_left; 
+    uint8_t frame_fin; 
+    uint8_t mask[4]; 
+    uint8_t mask_pos; 
+
+    /* frames that didn't fit in the connection response buffer */ 
+    char*   out; 
+    size_t  out_len; 
+    size_t  out_sent; 
+    size_t  out_cap; 
+
+    uint8_t seen;           /* a frame came since the last timer tick */ 
+    uint8_t ping_pending; 
+    uint8_t close_sent;     /* nothing is sent after it, data frames are dropped */ 
+    uint8_t close_received; /* the client's close came (or its stream is broken), nothing is read after it */ 
+    uint16_t close_code;    /* given to the close handler */ 
+}; 
+
+/* from a route handler: answers a websocket handshake with a 101, the connection switches once it's queued.
+ * returns -1 if req isn't a valid http/1.1 handshake, resp is left alone (answer 400 or 426 then) */ 
+int  http_ws_accept(Http_request_t* req, Http_response_t* resp, const Http_ws_handlers_t* handlers, void* data); 
+
+/* queue a text or binary message, from any code on the connection's loop.
+ * returns -1 if the websocket is closing or too much is queued already */ 
+int  http_ws_send(Http_ws_t* ws, Http_ws_opcode_t opcode, const void* data, size_t len); 
+/* send a close frame, the connection is closed once it's out. reason may be null */ 
+int  http_ws_close(Http_ws_t* ws, uint16_t code, const char* reason); 
+
+/* used by the connection */ 
+int  http_ws_start(Http_connection_t* con, const Http_ws_handlers_t* handlers, void* data); 
+void http_ws_free(Http_connection_t* con); 
+void http_ws_read(Http_connection_t* con); 
+/* called once con->response is flushed */ 
+void http_ws_write(Http_connection_t* con); 
+/* the connection timer expired, returns -1 if the client is gone */ 
+int  http_ws_timeout(Http_connection_t* con); 
+
+#endif
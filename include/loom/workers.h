@@ -0,0 +1,36 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <sys/types.h> 
+
+#include "config.h"
+#include "server_context.h"
+
+/* several event loops: each one is a forked process with its own listeners in a SO_REUSEPORT group,
+ * so nothing is shared between loops. the process that started them only supervises */ 
+
+typedef struct Http_worker_s {
+    pid_t pid; 
+    int pidfd;          /* -1 once it exited */ 
+    int shutdown_fd;    /* the worker's shutdown event, written to stop it */ 
+} Http_worker_t; 
+
+typedef struct Http_workers_s {
+    Http_worker_t worker[HTTP_MAX_WORKERS]; 
+    int count; 
+    int running; 
+} Http_workers_t; 
+
+/* "auto" (the cpus the process may run on) or a list like "0-3,8", returns how many or -1 */ 
+int  http_workers_cpus(const char* list, int* cpus, int max); 
+/* pin the calling thread to cpu (-1 to leave it), with numa the memory it touches from now on comes from the cpu's node */ 
+int  http_workers_pin(int cpu, int numa); 
+/* fork cfg->workers workers, listeners[i], tls_listeners[i] (or -1) and cpus[i] (or -1) are worker i's.
+ * the listeners are owned from now on. returns in every process: ctx->workers is set in the supervisor,
+ * ctx->worker, the listeners and the shutdown event in a worker. -1 if the workers couldn't be started */ 
+int  http_workers_start(Http_server_context_t* ctx, const int* listeners, const int* tls_listeners, const int* cpus); 
+/* until every worker exited, a shutdown trigger is passed on to all of them */ 
+void http_workers_run(Http_server_context_t* ctx); 
+void http_workers_clean(Http_server_context_t* ctx); 
+
+#endif
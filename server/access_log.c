@@ -0,0 +1,348 @@
+#include <errno.h> 
+#include <fcntl.h> 
+#include <stdio.h> 
+#include <stdlib.h> 
+#include <string.h> 
+#include <time.h> 
+#include <unistd.h> 
+#include <arpa/inet.h> 
+#include <netinet/in.h> 
+
+#include <loom/access_log.h> 
+#include <loom/connection.h> 
+#include <loom/utils.h> 
+#include <loom/http_response.h> 
+
+_Static_assert(sizeof(Http_access_record_t) == 128, "an access record should be two cache lines"); 
+_Static_assert((HTTP_ACCESS_LOG_RING & (HTTP_ACCESS_LOG_RING - 1)) == 0, "the ring size must be a power of 2"); 
+
+static void* writer_run(void* arg); 
+static int   log_open(Http_access_log_t* log); 
+static void  log_rotate(Http_access_log_t* log); 
+static int   log_write(Http_access_log_t* log, const char* buf, size_t len); 
+static size_t record_format(const Http_access_record_t* r, char* buf, size_t room, time_t* sec, char date[32]); 
+static void  record_push(Http_access_ring_t* ring, const Http_access_record_t* r); 
+static void  record_start(Http_access_record_t* r, const Http_connection_t* con, const Http_request_t* req); 
+
+int http_access_log_start(Http_server_context_t* ctx)
+{
+    ctx->access_log = NULL; 
+    if (!ctx->cfg->access_log[0])
+        return 0; 
+
+    Http_access_log_t* log = calloc(1, sizeof(Http_access_log_t)); 
+    if (!log)
+    {
+        perror("calloc"); 
+        return -1; 
+    }
+    log->ring = aligned_alloc(64, sizeof(Http_access_ring_t)); 
+    if (!log->ring)
+    {
+        perror("aligned_alloc"); 
+        free(log); 
+        return -1; 
+    }
+    memset(log->ring, 0, sizeof(Http_access_ring_t)); 
+    log->path = ctx->cfg->access_log; 
+    log->max_size = ctx->cfg->access_log_max_size; 
+    log->rotate_interval = ctx->cfg->access_log_rotate; 
+    if (log_open(log) == -1)
+    {
+        free(log->ring); 
+        free(log); 
+        return -1; 
+    }
+
+    int err = pthread_create(&log->thread, NULL, writer_run, log); 
+    if (err)
+    {
+        fprintf(stderr, "Error: can't start the access log thread: %s\n", strerror(err)); 
+        close(log->fd); 
+        free(log->ring); 
+        free(log); 
+        return -1; 
+    }
+    ctx->access_log = log; 
+    return 0; 
+}
+
+void http_access_log_stop(Http_server_context_t* ctx)
+{
+    Http_access_log_t* log = ctx->access_log; 
+    if (!log)
+        return; 
+    __atomic_store_n(&log->stop, 1, __ATOMIC_RELEASE); 
+    pthread_join(log->thread, NULL); 
+    close(log->fd); 
+    free(log->ring); 
+    free(log); 
+    ctx->access_log = NULL; 
+}
+
+uint64_t http_access_log_dropped(Http_server_context_t* ctx)
+{
+    if (!ctx->access_log)
+        return 0; 
+    return __atomic_load_n(&ctx->access_log->ring->dropped, __ATOMIC_RELAXED); 
+}
+
+void http_access_log_begin(Http_connection_t* con, const Http_request_t* req)
+{
+    if (!con->ctx->access_log)
+        return; 
+    if (con->access_start)
+        http_access_log_end(con); /* the previous response is queued, it's as done as the loop can tell */ 
+    con->access_start = http_time_ns(); 
+    con->access_sent = con->bytes_sent; 
+    record_start(&con->access, con, req); 
+}
+
+void http_access_log_response(Http_connection_t* con, const char* head, size_t len)
+{
+    if (!con->ctx->access_log)
+        return; 
+    /* responses written before a request was read (400, 413...) */ 
+    if (!con->access_start)
+    {
+        con->access_start = http_time_ns(); 
+        con->access_sent = con->bytes_sent; 
+        record_start(&con->access, con, NULL); 
+    }
+    int status = http_status_from_head(head, len); 
+    if (status)
+        con->access.status = status; 
+}
+
+void http_access_log_end(Http_connection_t* con)
+{
+    Http_access_log_t* log = con->ctx->access_log; 
+    if (!log || !con->access_start)
+        return; 
+    /* nothing was answered (upgraded to http/2, client gone before the backend answered) */ 
+    if (con->access.status)
+    {
+        con->access.latency_us = (http_time_ns() - con->access_start) / 1000; 
+        con->access.bytes = con->bytes_sent - con->access_sent; 
+        record_push(log->ring, &con->access); 
+    }
+    con->access_start = 0; 
+}
+
+void http_access_log_stream(Http_connection_t* con, const Http_request_t* req,
+                            int status, size_t bytes, uint64_t start_ns)
+{
+    Http_access_log_t* log = con->ctx->access_log; 
+    if (!log)
+        return; 
+    Http_access_record_t r; 
+    record_start(&r, con, req); 
+    r.status = status; 
+    r.bytes = bytes; 
+    r.latency_us = (http_time_ns() - start_ns) / 1000; 
+    record_push(log->ring, &r); 
+}
+
+static void record_start(Http_access_record_t* r, const Http_connection_t* con, const Http_request_t* req)
+{
+    struct timespec ts; 
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts); 
+    r->time_ms = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000; 
+    r->status = 0; 
+    r->bytes = 0; 
+    r->latency_us = 0; 
+
+    /* same keying as the rate limiter: ipv4 as ::ffff:a.b.c.d */ 
+    memset(r->addr, 0, sizeof r->addr); 
+    if (con->peer.ss_family == AF_INET)
+    {
+        r->addr[10] = r->addr[11] = 0xff; 
+        memcpy(r->addr + 12, &((const struct sockaddr_in*)&con->peer)->sin_addr, 4); 
+    }
+    else if (con->peer.ss_family == AF_INET6)
+        memcpy(r->addr, &((const struct sockaddr_in6*)&con->peer)->sin6_addr, 16); 
+
+    r->method[0] = '-'; 
+    r->method[1] = '\0'; 
+    r->path_len = 0; 
+    if (!req || !req->method_str || !req->target)
+        return; 
+    size_t len = strlen(req->method_str); 
+    if (len < sizeof r->method)
+        memcpy(r->method, req->method_str, len + 1); 
+    len = strlen(req->target); 
+    r->path_len = len < HTTP_ACCESS_LOG_PATH_LEN ? len : HTTP_ACCESS_LOG_PATH_LEN; 
+    memcpy(r->path, req->target, r->path_len); 
+}
+
+/* the only thing the loop pays: one record copied and the head published */ 
+static void record_push(Http_access_ring_t* ring, const Http_access_record_t* r)
+{
+    uint64_t head = ring->head; 
+    if (head - ring->cached_tail >= HTTP_ACCESS_LOG_RING)
+    {
+        ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE); 
+        if (head - ring->cached_tail >= HTTP_ACCESS_LOG_RING)
+        {
+            /* the writer is behind, losing a line beats stalling requests */ 
+            __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED); 
+            return; 
+        }
+    }
+    ring->records[head & (HTTP_ACCESS_LOG_RING - 1)] = *r; 
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE); 
+}
+
+static void* writer_run(void* arg)
+{
+    Http_access_log_t* log = arg; 
+    Http_access_ring_t* ring = log->ring; 
+    char* buf = malloc(HTTP_ACCESS_LOG_BUFFER); 
+    if (!buf)
+    {
+        perror("malloc"); 
+        return NULL; 
+    }
+    size_t len = 0; 
+    time_t sec = 0; 
+    char date[32]; 
+
+    for (;;)
+    {
+        int stop = __atomic_load_n(&log->stop, __ATOMIC_ACQUIRE); 
+        uint64_t tail = ring->tail; 
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE); 
+
+        for (; tail != head; tail++)
+        {
+            /* a line is at most a few hundred bytes */ 
+            if (HTTP_ACCESS_LOG_BUFFER - len < 512)
+            {
+                log_write(log, buf, len); 
+                len = 0; 
+            }
+            len += record_format(&ring->records[tail & (HTTP_ACCESS_LOG_RING - 1)],
+                                 buf + len, HTTP_ACCESS_LOG_BUFFER - len, &sec, date); 
+            /* hand the slot back as soon as it's copied out */ 
+            __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE); 
+        }
+
+        uint64_t dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED); 
+        if (dropped != log->dropped_seen)
+        {
+            len += snprintf(buf + len, HTTP_ACCESS_LOG_BUFFER - len, "# %llu records dropped, the log can't keep up\n",
+                            (unsigned long long)(dropped - log->dropped_seen)); 
+            log->dropped_seen = dropped; 
+        }
+        if (len)
+        {
+            log_write(log, buf, len); 
+            len = 0; 
+        }
+        if (stop)
+            break; 
+
+        if ((log->max_size && log->size >= log->max_size) ||
+            (log->rotate_interval && http_time_ms() - log->opened >= (uint64_t)log->rotate_interval * 1000))
+            log_rotate(log); 
+
+        /* the loop never wakes the writer, polling keeps it to a store per record */ 
+        struct timespec nap = { 0, HTTP_ACCESS_LOG_FLUSH_MS * 1000000L }; 
+        if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+            nanosleep(&nap, NULL); 
+    }
+    free(buf); 
+    return NULL; 
+}
+
+static size_t record_format(const Http_access_record_t* r, char* buf, size_t room, time_t* sec, char date[32])
+{
+    /* the date only changes once a second */ 
+    time_t t = r->time_ms / 1000; 
+    if (t != *sec)
+    {
+        struct tm tm; 
+        gmtime_r(&t, &tm); 
+        strftime(date, 32, "%Y-%m-%dT%H:%M:%S", &tm); 
+        *sec = t; 
+    }
+
+    char addr[INET6_ADDRSTRLEN]; 
+    if (IN6_IS_ADDR_V4MAPPED((const struct in6_addr*)r->addr))
+        inet_ntop(AF_INET, r->addr + 12, addr, sizeof addr); 
+    else
+        inet_ntop(AF_INET6, r->addr, addr, sizeof addr); 
+
+    int n = snprintf(buf, room, "%s.%03uZ %s %s %.*s%s %u %llu %uus\n",
+                     date, (unsigned)(r->time_ms % 1000), addr, r->method,
+                     r->path_len ? (int)r->path_len : 1, r->path_len ? r->path : "-",
+                     r->path_len == HTTP_ACCESS_LOG_PATH_LEN ? "..." : "",
+                     r->status, (unsigned long long)r->bytes, r->latency_us); 
+    if (n < 0)
+        return 0; 
+    return (size_t)n < room ? (size_t)n : room - 1; 
+}
+
+static int log_open(Http_access_log_t* log)
+{
+    log->fd = open(log->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644); 
+    if (log->fd == -1)
+    {
+        perror(log->path); 
+        return -1; 
+    }
+    off_t size = lseek(log->fd, 0, SEEK_END); 
+    log->size = size > 0 ? size : 0; 
+    log->opened = http_time_ms(); 
+    return 0; 
+}
+
+/* the current file becomes path.YYYYmmdd-HHMMSS[-n] and a new one is started */ 
+static void log_rotate(Http_access_log_t* log)
+{
+    char rotated[HTTP_MAX_PATH_LEN + 32]; 
+    char stamp[24]; 
+    time_t now = time(NULL); 
+    struct tm tm; 
+    gmtime_r(&now, &tm); 
+    strftime(stamp, sizeof stamp, "%Y%m%d-%H%M%S", &tm); 
+    snprintf(rotated, sizeof rotated, "%s.%s", log->path, stamp); 
+    /* more than one rotation in a second, don't overwrite the previous file */ 
+    for (int i = 1; access(rotated, F_OK) == 0; i++)
+        snprintf(rotated, sizeof rotated, "%s.%s-%d", log->path, stamp, i); 
+
+    if (rename(log->path, rotated) == -1)
+    {
+        perror("rename"); 
+        /* try again next period */ 
+        log->opened = http_time_ms(); 
+        log->size = 0; 
+        return; 
+    }
+    int old = log->fd; 
+    if (log_open(log) == -1)
+    {
+        log->fd = old; /* keep writing to the renamed file */ 
+        return; 
+    }
+    close(old); 
+}
+
+static int log_write(Http_access_log_t* log, const char* buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(log->fd, buf, len); 
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue; 
+            perror("access log"); 
+            return -1; 
+        }
+        buf += n; 
+        len -= n; 
+        log->size += n; 
+    }
+    return 0; 
+}
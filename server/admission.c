@@ -0,0 +1,131 @@
+#include <assert.h> 
+#include <stdio.h> 
+#include <unistd.h> 
+#include <sys/epoll.h> 
+#include <sys/timerfd.h> 
+
+#include <loom/admission.h> 
+#include <loom/epoll_utils.h> 
+#include <loom/http_response.h> 
+#include <loom/connection.h> 
+#include <loom/utils.h> 
+
+/* listeners resume once this many connections are gone, so they don't flap at the limit */ 
+#define RESUME_GAP(max) ((max) / 10 + 1)
+
+int http_admission_init(Http_server_context_t* ctx)
+{
+    Http_config_t* cfg = ctx->cfg; 
+    ctx->inflight = 0; 
+    ctx->loop_lag = 0; 
+    ctx->lag_fd = -1; 
+    ctx->paused_count = 0; 
+
+    Http_response_t response; 
+    http_response_make_error(&response, HTTP_SERVICE_UNAVAILABLE); 
+    http_response_set_retry_after(&response, cfg->retry_after); 
+    int len = http_response_raw(&response, ctx->overload_response, sizeof ctx->overload_response); 
+    http_response_free(&response); 
+    if (len == -1)
+        return -1; 
+    ctx->overload_response_len = len; 
+    return 0; 
+}
+
+/* a periodic timer on an absolute schedule: the loop knows when each expiry was due, the lag
+ * is how late it got to it. a batch taking long, or piling up, shows even when no batch is slow */ 
+int http_admission_probe_start(Http_server_context_t* ctx)
+{
+    if (!ctx->cfg->max_loop_lag_ms)
+        return 0; 
+    ctx->lag_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC); 
+    if (ctx->lag_fd == -1)
+    {
+        perror("timerfd_create"); 
+        return -1; 
+    }
+    uint64_t interval = (uint64_t)HTTP_LAG_PROBE_INTERVAL_MS * 1000000; 
+    ctx->lag_expected = http_time_ns() + interval; 
+    struct itimerspec its = {
+        .it_interval = { .tv_sec = interval / 1000000000, .tv_nsec = interval % 1000000000 },
+        .it_value = { .tv_sec = ctx->lag_expected / 1000000000, .tv_nsec = ctx->lag_expected % 1000000000 },
+    }; 
+    if (timerfd_settime(ctx->lag_fd, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+    {
+        perror("timerfd_settime"); 
+        return -1; 
+    }
+    return http_epoll_add_fd(ctx->epoll_fd, HTTP_ITEM_LAG_PROBE, ctx->lag_fd, EPOLLIN); 
+}
+
+void http_admission_clean(Http_server_context_t* ctx)
+{
+    if (ctx->lag_fd != -1)
+        close(ctx->lag_fd); 
+    ctx->lag_fd = -1; 
+}
+
+int http_admission_accept(Http_server_context_t* ctx, Http_epoll_item_t* listener)
+{
+    size_t max = ctx->cfg->max_connections; 
+    if (max == 0 || ctx->active_clients < max)
+        return 0; 
+    /* a client waiting for its first response beats one that may never send another request */ 
+    if (http_connection_evict_idle(ctx) == 0)
+        return 0; 
+
+    /* new connections wait in the kernel backlog instead of taking fds and timer slots */ 
+    assert(ctx->paused_count < HTTP_MAX_LISTENERS); 
+    struct epoll_event ev; 
+    ev.events = 0; 
+    ev.data.ptr = listener; 
+    if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_MOD, listener->fd, &ev) == -1)
+    {
+        perror("epoll_ctl"); 
+        return -1; 
+    }
+    ctx->paused[ctx->paused_count++] = listener; 
+    return -1; 
+}
+
+void http_admission_release(Http_server_context_t* ctx)
+{
+    if (ctx->paused_count == 0)
+        return; 
+    size_t max = ctx->cfg->max_connections; 
+    if (ctx->active_clients + RESUME_GAP(max) > max)
+        return; 
+
+    for (size_t i = 0; i < ctx->paused_count; i++)
+    {
+        struct epoll_event ev; 
+        ev.events = EPOLLIN; 
+        ev.data.ptr = ctx->paused[i]; 
+        if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_MOD, ctx->paused[i]->fd, &ev) == -1)
+            perror("epoll_ctl"); 
+    }
+    ctx->paused_count = 0; 
+}
+
+int http_admission_shed(Http_server_context_t* ctx)
+{
+    Http_config_t* cfg = ctx->cfg; 
+    if (cfg->max_inflight && ctx->inflight >= cfg->max_inflight)
+        return 1; 
+    if (cfg->max_loop_lag_ms && ctx->loop_lag / 8 > (uint64_t)cfg->max_loop_lag_ms * 1000000)
+        return 1; 
+    return 0; 
+}
+
+void http_admission_lag_probe(Http_server_context_t* ctx)
+{
+    uint64_t expirations; 
+    if (read(ctx->lag_fd, &expirations, sizeof expirations) != sizeof expirations)
+        return; 
+    uint64_t now = http_time_ns(); 
+    /* late since the oldest expiry it missed */ 
+    uint64_t lag = now > ctx->lag_expected ? now - ctx->lag_expected : 0; 
+    ctx->lag_expected += expirations * HTTP_LAG_PROBE_INTERVAL_MS * 1000000; 
+    /* moving average over ~8 wakeups, kept times 8 */ 
+    ctx->loop_lag += lag - ctx->loop_lag / 8; 
+}
@@ -0,0 +1,112 @@
+#include <stdarg.h> 
+#include <stdio.h> 
+#include <stdlib.h> 
+#include <string.h> 
+
+#include <loom/arena.h> 
+
+#define ARENA_ALIGN 16
+
+void http_arena_init(Http_arena_t* arena)
+{
+    arena->blocks = NULL; 
+    arena->ptr = NULL; 
+    arena->end = NULL; 
+}
+
+/* slow path, the current block is full */ 
+static void* arena_grow(Http_arena_t* arena, size_t size)
+{
+    size_t block_size = size > HTTP_ARENA_BLOCK ? size : HTTP_ARENA_BLOCK; 
+    Http_arena_block_t* block = malloc(sizeof(Http_arena_block_t) + block_size); 
+    if (!block)
+    {
+        perror("malloc"); 
+        return NULL; 
+    }
+    block->size = block_size; 
+    block->next = arena->blocks; 
+    arena->blocks = block; 
+    arena->ptr = block->data + size; 
+    arena->end = block->data + block_size; 
+    return block->data; 
+}
+
+void* http_arena_alloc(Http_arena_t* arena, size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1); 
+    if (size == 0)
+        size = ARENA_ALIGN; 
+    if ((size_t)(arena->end - arena->ptr) < size)
+        return arena_grow(arena, size); 
+    void* p = arena->ptr; 
+    arena->ptr += size; 
+    return p; 
+}
+
+char* http_arena_strdup(Http_arena_t* arena, const char* str)
+{
+    size_t len = strlen(str) + 1; 
+    char* copy = http_arena_alloc(arena, len); 
+    if (copy)
+        memcpy(copy, str, len); 
+    return copy; 
+}
+
+char* http_arena_printf(Http_arena_t* arena, const char* fmt, ...)
+{
+    va_list args; 
+    /* tried in place first, most strings fit in what's left of the block */ 
+    size_t room = arena->end - arena->ptr; 
+    va_start(args, fmt); 
+    int len = vsnprintf(arena->ptr, room, fmt, args); 
+    va_end(args); 
+    if (len < 0)
+        return NULL; 
+    if ((size_t)len < room)
+        return http_arena_alloc(arena, len + 1); /* the bytes written are where the allocation lands */ 
+
+    char* str = http_arena_alloc(arena, len + 1); 
+    if (!str)
+        return NULL; 
+    va_start(args, fmt); 
+    vsnprintf(str, len + 1, fmt, args); 
+    va_end(args); 
+    return str; 
+}
+
+void http_arena_reset(Http_arena_t* arena)
+{
+    Http_arena_block_t* block = arena->blocks; 
+    if (!block)
+        return; 
+    /* only a request that outgrew the first block has more to free */ 
+    while (block->next)
+    {
+        Http_arena_block_t* next = block->next; 
+        free(block); 
+        block = next; 
+    }
+    /* a first allocation bigger than a block made an oversized one, it isn't worth keeping */ 
+    if (block->size > HTTP_ARENA_BLOCK)
+    {
+        free(block); 
+        http_arena_init(arena); 
+        return; 
+    }
+    arena->blocks = block; 
+    arena->ptr = block->data; 
+    arena->end = block->data + block->size; 
+}
+
+void http_arena_free(Http_arena_t* arena)
+{
+    Http_arena_block_t* block = arena->blocks; 
+    while (block)
+    {
+        Http_arena_block_t* next = block->next; 
+        free(block); 
+        block = next; 
+    }
+    http_arena_init(arena); 
+}
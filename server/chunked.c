@@ -0,0 +1,157 @@
+#include <string.h> 
+
+#include <loom/chunked.h> 
+
+#define MAX_SIZE_DIGITS 16 /* a size_t in hex */ 
+
+void http_chunked_init(Http_chunked_t* chunked, size_t max_ext, size_t max_trailer)
+{
+    memset(chunked, 0, sizeof(Http_chunked_t)); 
+    chunked->state = HTTP_CHUNK_SIZE; 
+    chunked->max_ext = max_ext; 
+    chunked->max_trailer = max_trailer; 
+}
+
+static inline int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0'; 
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10; 
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10; 
+    return -1; 
+}
+
+int http_chunked_decode(Http_chunked_t* chunked, char* buf, size_t len, size_t* read, size_t* written)
+{
+    size_t r = *read, w = *written; 
+    int malformed = 0; 
+    while (r < len && chunked->state != HTTP_CHUNK_DONE && !malformed)
+    {
+        char c = buf[r]; 
+        switch (chunked->state)
+        {
+            case HTTP_CHUNK_SIZE: 
+            {
+                int v = hex_value(c); 
+                if (v != -1)
+                {
+                    if (++chunked->digits > MAX_SIZE_DIGITS)
+                    {
+                        malformed = 1; 
+                        break; 
+                    }
+                    chunked->size = (chunked->size << 4) | v; 
+                }
+                else if (chunked->digits == 0)
+                {
+                    malformed = 1; 
+                    break; 
+                }
+                else if (c == ';' || c == ' ' || c == '\t')
+                    chunked->state = HTTP_CHUNK_EXT; 
+                else if (c == '\r')
+                    chunked->state = HTTP_CHUNK_SIZE_LF; 
+                else
+                {
+                    malformed = 1; 
+                    break; 
+                }
+                r++; 
+            }
+            break; 
+            case HTTP_CHUNK_EXT: 
+                /* extensions are skipped, only their size is checked */ 
+                if (c == '\r')
+                    chunked->state = HTTP_CHUNK_SIZE_LF; 
+                else if (c == '\n' || ++chunked->ext_len > chunked->max_ext)
+                {
+                    malformed = 1; 
+                    break; 
+                }
+                r++; 
+            break; 
+            case HTTP_CHUNK_SIZE_LF: 
+                if (c != '\n')
+                {
+                    malformed = 1; 
+                    break; 
+                }
+                chunked->state = chunked->size ? HTTP_CHUNK_DATA : HTTP_CHUNK_TRAILER_START; 
+                chunked->digits = 0; 
+                chunked->ext_len = 0; 
+                r++; 
+            break; 
+            case HTTP_CHUNK_DATA: 
+            {
+                size_t take = len - r; 
+                if (take > chunked->size)
+                    take = chunked->size; 
+                /* the size lines before it are dropped, the data joins the previous chunk */ 
+                if (w != r)
+                    memmove(buf + w, buf + r, take); 
+                w += take; 
+                r += take; 
+                chunked->size -= take; 
+                if (chunked->size == 0)
+                    chunked->state = HTTP_CHUNK_DATA_CR; 
+            }
+            break; 
+            case HTTP_CHUNK_DATA_CR: 
+                if (c != '\r')
+                {
+                    malformed = 1; 
+                    break; 
+                }
+                chunked->state = HTTP_CHUNK_DATA_LF; 
+                r++; 
+            break; 
+            case HTTP_CHUNK_DATA_LF: 
+                if (c != '\n')
+                {
+                    malformed = 1; 
+                    break; 
+                }
+                chunked->state = HTTP_CHUNK_SIZE; 
+                r++; 
+            break; 
+            case HTTP_CHUNK_TRAILER_START: 
+                /* trailer fields are read past, the handler only sees the headers */ 
+                chunked->state = c == '\r' ? HTTP_CHUNK_FINAL_LF : HTTP_CHUNK_TRAILER_LINE; 
+                if (chunked->state == HTTP_CHUNK_TRAILER_LINE && ++chunked->trailer_len > chunked->max_trailer)
+                {
+                    malformed = 1; 
+                    break; 
+                }
+                r++; 
+            break; 
+            case HTTP_CHUNK_TRAILER_LINE: 
+                if (++chunked->trailer_len > chunked->max_trailer)
+                {
+                    malformed = 1; 
+                    break; 
+                }
+                if (c == '\n')
+                    chunked->state = HTTP_CHUNK_TRAILER_START; 
+                r++; 
+            break; 
+            case HTTP_CHUNK_FINAL_LF: 
+                if (c != '\n')
+                {
+                    malformed = 1; 
+                    break; 
+                }
+                chunked->state = HTTP_CHUNK_DONE; 
+                r++; 
+            break; 
+            case HTTP_CHUNK_DONE: 
+            break; 
+        }
+    }
+    *read = r; 
+    *written = w; 
+    if (malformed)
+        return -1; 
+    return chunked->state == HTTP_CHUNK_DONE; 
+}
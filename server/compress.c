@@ -0,0 +1,450 @@
+#define _GNU_SOURCE /* memfd_create */ 
+#include <assert.h> 
+#include <errno.h> 
+#include <pthread.h> 
+#include <stdint.h> 
+#include <stdio.h> 
+#include <stdlib.h> 
+#include <string.h> 
+#include <strings.h> 
+#include <sys/mman.h> 
+#include <unistd.h> 
+#include <zlib.h> 
+
+#include <loom/compress.h> 
+#include <loom/arena.h> 
+
+#define GZIP_WINDOW_BITS    (15 + 16) /* +16 to get a gzip wrapper instead of zlib */ 
+#define GZIP_MEM_LEVEL      8
+#define GZIP_CHUNK          (64 * 1024)
+
+#define GZIP_EMPTY      0
+#define GZIP_PENDING    1   /* queued or being compressed, the file is served as is meanwhile */ 
+#define GZIP_READY      2
+
+/* a cached gzip version of a file, the file is identified by its inode and its state */ 
+typedef struct Http_gzip_cache_entry_s {
+    int state; 
+    dev_t dev; 
+    ino_t ino; 
+    off_t size; 
+    struct timespec mtime; 
+    int fd;         /* memfd holding the compressed bytes or -1 if the file isn't worth it */ 
+    size_t len; 
+} Http_gzip_cache_entry_t; 
+
+/* a file to compress, fd is a dup the compression thread closes */ 
+typedef struct Http_gzip_job_s {
+    int fd; 
+    size_t slot; 
+    struct stat st; 
+} Http_gzip_job_t; 
+
+/* files are compressed by a thread started on first use, the loop only looks up the cache.
+ * the lock protects the cache and the queue, it's never held while compressing */ 
+static Http_gzip_cache_entry_t gzip_cache[HTTP_COMPRESS_CACHE_SLOTS]; 
+static Http_gzip_job_t gzip_queue[HTTP_COMPRESS_QUEUE]; 
+static size_t gzip_queue_head; 
+static size_t gzip_queue_count; 
+static pthread_mutex_t gzip_lock = PTHREAD_MUTEX_INITIALIZER; 
+static pthread_cond_t gzip_cond = PTHREAD_COND_INITIALIZER; 
+static pthread_t gzip_thread; 
+static int gzip_started;    /* 1 running, -1 couldn't be started */ 
+static int gzip_stop; 
+
+static int token_is(const char* token, size_t len, const char* name); 
+static int param_is_zero_q(const char* p, const char* end); 
+static int gzip_file(int in_fd, int out_fd, size_t* out_len); 
+static int gzip_queue_push(int fd, size_t slot, const struct stat* st); 
+static void* gzip_run(void* arg); 
+static int write_all(int fd, const unsigned char* data, size_t len); 
+
+unsigned int http_accept_encoding_parse(Http_slice_t value)
+{
+    unsigned int mask = 0; 
+    if (!value.ptr)
+        return 0; 
+
+    const char* p = value.ptr; 
+    const char* end = value.ptr + value.len; 
+    while (p < end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            p++; 
+        if (p == end)
+            break; 
+
+        const char* token = p; 
+        while (p < end && *p != ',' && *p != ';' && *p != ' ' && *p != '\t')
+            p++; 
+        size_t token_len = p - token; 
+
+        const char* params = p; 
+        while (p < end && *p != ',')
+            p++; 
+
+        /* "gzip;q=0" means the client refuses gzip */ 
+        if (param_is_zero_q(params, p))
+            continue; 
+
+        if (token_is(token, token_len, "gzip") || token_is(token, token_len, "x-gzip"))
+            mask |= HTTP_ENCODING_BIT(HTTP_ENCODING_GZIP); 
+        else if (token_is(token, token_len, "br"))
+            mask |= HTTP_ENCODING_BIT(HTTP_ENCODING_BR); 
+        else if (token_is(token, token_len, "*"))
+            mask |= HTTP_ENCODING_BIT(HTTP_ENCODING_GZIP) | HTTP_ENCODING_BIT(HTTP_ENCODING_BR); 
+    }
+
+    return mask; 
+}
+
+static int token_is(const char* token, size_t len, const char* name)
+{
+    return strlen(name) == len && !strncasecmp(token, name, len); 
+}
+
+/* params is everything between the coding and the next ',' */ 
+static int param_is_zero_q(const char* p, const char* end)
+{
+    while (p < end)
+    {
+        if (*p == ';')
+        {
+            p++; 
+            while (p < end && (*p == ' ' || *p == '\t'))
+                p++; 
+            if (p + 2 <= end && (p[0] == 'q' || p[0] == 'Q') && p[1] == '=')
+            {
+                p += 2; 
+                if (p >= end || *p != '0')
+                    return 0; 
+                p++; 
+                if (p < end && *p == '.')
+                {
+                    p++; 
+                    while (p < end && *p == '0')
+                        p++; 
+                    if (p < end && *p >= '1' && *p <= '9')
+                        return 0; 
+                }
+                return 1; 
+            }
+            continue; 
+        }
+        p++; 
+    }
+    return 0; 
+}
+
+int http_compress_response(Http_request_t* req, Http_response_t* resp)
+{
+    assert(req != NULL); 
+    assert(resp != NULL); 
+
+    if (resp->body_type != HTTP_BODY_BUFFER || resp->content_encoding != HTTP_ENCODING_NONE)
+        return 0; 
+    if (!http_content_type_compressible(resp->content_type))
+        return 0; 
+    if (resp->body_len < HTTP_COMPRESS_MIN_SIZE)
+        return 0; 
+    if (resp->status_code < 200 || resp->status_code == 204 || resp->status_code == 304)
+        return 0; 
+
+    /* the body depends on accept encoding from now on */ 
+    resp->vary_encoding = 1; 
+
+    unsigned int accept = http_accept_encoding_parse(http_request_header(req, "Accept-Encoding")); 
+    if (!(accept & HTTP_ENCODING_BIT(HTTP_ENCODING_GZIP)))
+        return 0; 
+
+    z_stream zs; 
+    memset(&zs, 0, sizeof zs); 
+    if (deflateInit2(&zs, HTTP_COMPRESS_LEVEL, Z_DEFLATED, GZIP_WINDOW_BITS, GZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+        return -1; 
+
+    uLong bound = deflateBound(&zs, resp->body_len); 
+    /* the request arena when there is one, its block is reused by the next request */ 
+    unsigned char* out = req->arena ? http_arena_alloc(req->arena, bound) : malloc(bound); 
+    if (!out)
+    {
+        if (!req->arena)
+            perror("malloc"); 
+        deflateEnd(&zs); 
+        return -1; 
+    }
+
+    zs.next_in = (unsigned char*)resp->body; 
+    zs.avail_in = resp->body_len; 
+    zs.next_out = out; 
+    zs.avail_out = bound; 
+
+    int ret = deflate(&zs, Z_FINISH); 
+    size_t out_len = zs.total_out; 
+    deflateEnd(&zs); 
+    if (ret != Z_STREAM_END || out_len >= resp->body_len)
+    {
+        if (!req->arena)
+            free(out); 
+        return ret == Z_STREAM_END ? 0 : -1; 
+    }
+
+    if (resp->body_mem == HTTP_MEM_OWNED)
+        free(resp->body); 
+
+    resp->body = (char*)out; 
+    resp->body_len = out_len; 
+    resp->body_mem = req->arena ? HTTP_MEM_ARENA : HTTP_MEM_OWNED; 
+    resp->content_encoding = HTTP_ENCODING_GZIP; 
+
+    return 0; 
+}
+
+static inline size_t cache_slot(const struct stat* st)
+{
+    uint64_t h = (uint64_t)st->st_ino * 0x9E3779B97F4A7C15ull ^ (uint64_t)st->st_dev; 
+    return (size_t)(h >> 32) & (HTTP_COMPRESS_CACHE_SLOTS - 1); 
+}
+
+static inline int cache_entry_matches(const Http_gzip_cache_entry_t* entry, const struct stat* st)
+{
+    return entry->state != GZIP_EMPTY &&
+        entry->dev == st->st_dev &&
+        entry->ino == st->st_ino &&
+        entry->size == st->st_size &&
+        entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+        entry->mtime.tv_nsec == st->st_mtim.tv_nsec; 
+}
+
+int http_compress_cache_get(int fd, const struct stat* st, size_t* gz_len)
+{
+    assert(fd != -1); 
+    assert(st != NULL); 
+    assert(gz_len != NULL); 
+
+    if (st->st_size < HTTP_COMPRESS_MIN_SIZE || st->st_size > HTTP_COMPRESS_STATIC_MAX_SIZE)
+        return -1; 
+
+    size_t slot = cache_slot(st); 
+    Http_gzip_cache_entry_t* entry = &gzip_cache[slot]; 
+    int dup_fd = -1; 
+
+    pthread_mutex_lock(&gzip_lock); 
+    if (!cache_entry_matches(entry, st))
+    {
+        /* miss: replace whatever was in the slot, a job still running for it will find out */ 
+        if (entry->state == GZIP_READY && entry->fd != -1)
+            close(entry->fd); 
+        entry->state = GZIP_EMPTY; 
+
+        /* a full queue leaves the slot empty, a later request queues it */ 
+        if (gzip_queue_push(fd, slot, st) == 0)
+        {
+            entry->state = GZIP_PENDING; 
+            entry->dev = st->st_dev; 
+            entry->ino = st->st_ino; 
+            entry->size = st->st_size; 
+            entry->mtime = st->st_mtim; 
+            entry->fd = -1; 
+        }
+    }
+    else if (entry->state == GZIP_READY && entry->fd != -1)
+    {
+        /* the caller owns its fd, sendfile uses its own offset so sharing the file is fine */ 
+        dup_fd = dup(entry->fd); 
+        if (dup_fd == -1)
+            perror("dup"); 
+        *gz_len = entry->len; 
+    }
+    pthread_mutex_unlock(&gzip_lock); 
+
+    return dup_fd; 
+}
+
+int http_compress_cache_ready(const struct stat* st)
+{
+    const Http_gzip_cache_entry_t* entry = &gzip_cache[cache_slot(st)]; 
+    pthread_mutex_lock(&gzip_lock); 
+    int ready = cache_entry_matches(entry, st) && entry->state == GZIP_READY && entry->fd != -1; 
+    pthread_mutex_unlock(&gzip_lock); 
+    return ready; 
+}
+
+/* with gzip_lock held */ 
+static int gzip_queue_push(int fd, size_t slot, const struct stat* st)
+{
+    if (gzip_queue_count == HTTP_COMPRESS_QUEUE || gzip_started == -1)
+        return -1; 
+    if (!gzip_started)
+    {
+        int err = pthread_create(&gzip_thread, NULL, gzip_run, NULL); 
+        if (err)
+        {
+            fprintf(stderr, "Error: can't start the compression thread: %s\n", strerror(err)); 
+            gzip_started = -1; 
+            return -1; 
+        }
+        gzip_started = 1; 
+    }
+
+    int job_fd = dup(fd); 
+    if (job_fd == -1)
+    {
+        perror("dup"); 
+        return -1; 
+    }
+    Http_gzip_job_t* job = &gzip_queue[(gzip_queue_head + gzip_queue_count) % HTTP_COMPRESS_QUEUE]; 
+    job->fd = job_fd; 
+    job->slot = slot; 
+    job->st = *st; 
+    gzip_queue_count++; 
+    pthread_cond_signal(&gzip_cond); 
+    return 0; 
+}
+
+static void* gzip_run(void* arg)
+{
+    (void)arg; 
+    pthread_mutex_lock(&gzip_lock); 
+    for (;;)
+    {
+        while (!gzip_queue_count && !gzip_stop)
+            pthread_cond_wait(&gzip_cond, &gzip_lock); 
+        if (gzip_stop)
+            break; 
+
+        Http_gzip_job_t job = gzip_queue[gzip_queue_head]; 
+        gzip_queue_head = (gzip_queue_head + 1) % HTTP_COMPRESS_QUEUE; 
+        gzip_queue_count--; 
+        pthread_mutex_unlock(&gzip_lock); 
+
+        size_t len = 0; 
+        int gz_fd = memfd_create("loom-gzip", MFD_CLOEXEC); 
+        if (gz_fd == -1)
+            perror("memfd_create"); 
+        else if (gzip_file(job.fd, gz_fd, &len) == -1)
+        {
+            close(gz_fd); 
+            gz_fd = -1; 
+        }
+        int ok = gz_fd != -1; 
+        /* remember incompressible files too so they are not compressed again */ 
+        if (ok && len >= (size_t)job.st.st_size)
+        {
+            close(gz_fd); 
+            gz_fd = -1; 
+        }
+        close(job.fd); 
+
+        pthread_mutex_lock(&gzip_lock); 
+        Http_gzip_cache_entry_t* entry = &gzip_cache[job.slot]; 
+        if (entry->state == GZIP_PENDING && cache_entry_matches(entry, &job.st))
+        {
+            /* an error empties the slot, the next request tries again */ 
+            entry->state = ok ? GZIP_READY : GZIP_EMPTY; 
+            entry->fd = gz_fd; 
+            entry->len = len; 
+        }
+        else if (gz_fd != -1)
+            close(gz_fd); 
+    }
+    pthread_mutex_unlock(&gzip_lock); 
+    return NULL; 
+}
+
+void http_compress_cache_clean(void)
+{
+    pthread_mutex_lock(&gzip_lock); 
+    gzip_stop = 1; 
+    pthread_cond_signal(&gzip_cond); 
+    pthread_mutex_unlock(&gzip_lock); 
+    if (gzip_started == 1)
+        pthread_join(gzip_thread, NULL); 
+    gzip_started = 0; 
+    gzip_stop = 0; 
+
+    for (; gzip_queue_count; gzip_queue_count--)
+    {
+        close(gzip_queue[gzip_queue_head].fd); 
+        gzip_queue_head = (gzip_queue_head + 1) % HTTP_COMPRESS_QUEUE; 
+    }
+    for (size_t i = 0; i < HTTP_COMPRESS_CACHE_SLOTS; i++)
+    {
+        if (gzip_cache[i].state == GZIP_READY && gzip_cache[i].fd != -1)
+            close(gzip_cache[i].fd); 
+        gzip_cache[i].state = GZIP_EMPTY; 
+    }
+}
+
+static int gzip_file(int in_fd, int out_fd, size_t* out_len)
+{
+    unsigned char* in = malloc(GZIP_CHUNK); 
+    unsigned char* out = malloc(GZIP_CHUNK); 
+    if (!in || !out)
+    {
+        perror("malloc"); 
+        free(in); 
+        free(out); 
+        return -1; 
+    }
+
+    z_stream zs; 
+    memset(&zs, 0, sizeof zs); 
+    if (deflateInit2(&zs, HTTP_COMPRESS_STATIC_LEVEL, Z_DEFLATED, GZIP_WINDOW_BITS, GZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        free(in); 
+        free(out); 
+        return -1; 
+    }
+
+    int result = -1; 
+    off_t offset = 0; 
+    int flush; 
+    do {
+        ssize_t n = pread(in_fd, in, GZIP_CHUNK, offset); 
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue; 
+            perror("pread"); 
+            goto end; 
+        }
+        offset += n; 
+        flush = n == 0 ? Z_FINISH : Z_NO_FLUSH; 
+        zs.next_in = in; 
+        zs.avail_in = n; 
+        do {
+            zs.next_out = out; 
+            zs.avail_out = GZIP_CHUNK; 
+            if (deflate(&zs, flush) == Z_STREAM_ERROR)
+                goto end; 
+            if (write_all(out_fd, out, GZIP_CHUNK - zs.avail_out) == -1)
+                goto end; 
+        } while (zs.avail_out == 0); 
+    } while (flush != Z_FINISH); 
+
+    *out_len = zs.total_out; 
+    result = 0; 
+end:
+    deflateEnd(&zs); 
+    free(in); 
+    free(out); 
+    return result; 
+}
+
+static int write_all(int fd, const unsigned char* data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len); 
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue; 
+            perror("write"); 
+            return -1; 
+        }
+        data += n; 
+        len -= n; 
+    }
+    return 0; 
+}
@@ -8,18 +8,59 @@
 #include <string.h> 
 #include <sys/socket.h> 
 #include <sys/epoll.h> 
+#include <sys/sendfile.h> 
 #include <netinet/in.h>
 #include <unistd.h> 
 
 #include <loom/connection.h>
+#include <loom/compress.h> 
+#include <loom/tls.h> 
+#include <loom/http2.h> 
+#include <loom/proxy.h> 
+#include <loom/admission.h> 
+#include <loom/ratelimit.h> 
+#include <loom/sockopt.h> 
+#include <loom/access_log.h> 
+#include <loom/trace.h> 
 
-static Http_connection_t* http_connection_create(int client_fd, Http_timer_t* timer, Http_config_t* cfg); 
+/* a stale cache entry refreshed after the event batch, with its own copy of the request */ 
+typedef struct Http_cache_refresh_s {
+    Http_resp_cache_t* cache; 
+    Http_handler_t handler; 
+    Http_cache_key_t key; 
+    Http_request_t request; /* points into fields */ 
+    Http_arena_t arena; 
+    char fields[HTTP_REQUEST_SIZE]; 
+    size_t fields_len; 
+    char raw[HTTP_RESPONSE_SIZE]; /* the serialized response */ 
+    struct Http_cache_refresh_s* next; 
+} Http_cache_refresh_t; 
+
+static Http_connection_t* http_connection_create(Http_server_context_t* ctx, int client_fd); 
 static int buffer_process(Http_connection_t* con); 
 static void socket_drain(Http_connection_t* con); 
-static void write_error_response(Http_connection_t* con, int status_code); 
+static int  request_dispatch(Http_connection_t* con); 
+static int  handler_respond(Http_connection_t* con,
+                            Http_handler_t handler,
+                            Http_resp_cache_t* cache,
+                            const Http_cache_key_t* key); 
+static int  cache_refresh_queue(Http_connection_t* con, Http_route_t* route, const Http_cache_key_t* key); 
+static char* refresh_field(Http_cache_refresh_t* refresh, const char* data, size_t len); 
+static void cache_refresh_run(Http_cache_refresh_t* refresh); 
+static int  response_append(Http_connection_t* con, const char* data, size_t len); 
+static int  continue_answer(Http_connection_t* con); 
+static int  request_begin(Http_connection_t* con); 
+static void request_refuse(Http_connection_t* con, int refused); 
+static int  file_send(Http_connection_t* con); 
+static void file_close(Http_connection_t* con); 
+static int  connection_idle(Http_connection_t* con); 
+static void connection_close_later(Http_server_context_t* ctx, Http_connection_t* con); 
+static void idle_enter(Http_connection_t* con); 
+static void idle_leave(Http_connection_t* con); 
+static int  keepalive_timeout(Http_server_context_t* ctx); 
 
 /* null if can't allocate memory */ 
-static Http_connection_t* http_connection_create(int client_fd, Http_timer_t* timer, Http_config_t* cfg)
+static Http_connection_t* http_connection_create(Http_server_context_t* ctx, int client_fd)
 {
     Http_connection_t* con = malloc(sizeof(Http_connection_t)); 
     if (!con)
@@ -29,9 +70,11 @@ static Http_connection_t* http_connection_create(int client_fd, Http_timer_t* ti
     }
     memset(con, 0, sizeof(Http_connection_t)); 
     con->client_fd = client_fd; 
-    con->router = cfg->router; 
+    con->file_fd = -1; 
+    con->ctx = ctx; 
+    con->request.arena = &con->arena; /* kept by the parser */ 
 
-    if (http_timer_add_timeout(timer, con, HTTP_CLIENT_TIMEOUT) == -1)
+    if (http_timer_add_timeout(ctx->timer, con, HTTP_CLIENT_TIMEOUT) == -1)
     {
         free(con); 
         return NULL; 
@@ -46,49 +89,248 @@ void http_connection_clean(Http_server_context_t* ctx, Http_connection_t* con)
 {
     if (con->timeout_index != -1)
         http_timer_invalid_timeout(ctx->timer, con->timeout_index); 
+    http_trace_end(con, 1); /* before the session is freed, http/2 isn't traced */ 
     http_epoll_del_con(ctx->epoll_fd, con); 
+    file_close(con); 
+    http_proxy_abort(con); 
+    http_h2_free(con); 
+    http_ws_free(con); 
+    http_sse_free(con); 
+    http_tls_free(con); 
     close(con->client_fd); 
+    if (HTTP_IS_INFLIGHT(con->flags))
+        ctx->inflight--; 
+    http_access_log_end(con); 
+    http_arena_free(&con->arena); 
+    http_ratelimit_disconnect(con->peer_limit); 
+    if (HTTP_IS_IDLE(con->flags))
+        idle_leave(con); 
+    if (con->prev)
+        con->prev->next = con->next; 
+    else
+        ctx->connections = con->next; 
+    if (con->next)
+        con->next->prev = con->prev; 
     free(con); 
 
     ctx->active_clients--; 
+    http_admission_release(ctx); 
+}
+
+void http_connection_timeout(Http_server_context_t* ctx, Http_connection_t* con)
+{
+    con->timeout_index = -1; 
+
+    /* the backend is too slow, the client still gets an answer */ 
+    if (con->upstream && !http_proxy_responded(con))
+    {
+        http_proxy_abort(con); 
+        http_connection_error(con, HTTP_GATEWAY_TIMEOUT); 
+        if (http_timer_add_timeout(ctx->timer, con, 1) == 0)
+        {
+            http_connection_update_events(ctx->epoll_fd, con->item); 
+            return; 
+        }
+    }
+
+    /* a websocket ping, or the client didn't answer the last one */ 
+    if (con->ws && http_ws_timeout(con) == 0)
+    {
+        http_connection_update_events(ctx->epoll_fd, con->item); 
+        return; 
+    }
+    /* an event stream heartbeat, or the subscriber is stuck */ 
+    if (con->sse && http_sse_timeout(con) == 0)
+    {
+        http_connection_update_events(ctx->epoll_fd, con->item); 
+        return; 
+    }
+
+    connection_close_later(ctx, con); 
 }
 
-void http_connection_accept(Http_server_context_t* ctx)
+int http_connection_admit(Http_connection_t* con)
+{
+    /* the abusive client first, it shouldn't count against everyone else */ 
+    if (http_ratelimit_request(con->ctx, con->peer_limit))
+        return HTTP_TOO_MANY_REQUESTS; 
+    if (http_admission_shed(con->ctx))
+        return HTTP_SERVICE_UNAVAILABLE; 
+    if (!HTTP_IS_INFLIGHT(con->flags))
+    {
+        HTTP_SET_INFLIGHT(con->flags); 
+        con->ctx->inflight++; 
+    }
+    return 0; 
+}
+
+void http_connection_accept(Http_server_context_t* ctx, int listen_fd)
 {
     assert(ctx != NULL); 
-    assert(ctx->epoll_fd != -1 && ctx->listen_fd != -1); 
-    struct sockaddr_in client_addr; 
+    assert(ctx->epoll_fd != -1 && listen_fd != -1); 
+    struct sockaddr_storage client_addr; 
     socklen_t socklen = sizeof(client_addr); 
-    int client_fd = accept(ctx->listen_fd, (struct sockaddr *)&client_addr, &socklen) ; 
+    int client_fd = accept(listen_fd, (struct sockaddr *)&client_addr, &socklen) ; 
     if (client_fd == -1)
     {
         perror("accept"); 
         return;  
     }
 
+    /* too many connections from that address, close before spending anything on it */ 
+    Http_ratelimit_entry_t* peer_limit; 
+    if (http_ratelimit_connect(ctx, &client_addr, &peer_limit) == -1)
+    {
+        close(client_fd); 
+        return; 
+    }
+
     if (http_socket_set_nonblocking(client_fd) == -1) 
     {
+        http_ratelimit_disconnect(peer_limit); 
         close(client_fd); 
         return; 
     }
+    http_sockopt_accepted(client_fd, &ctx->cfg->tuning); 
 
-    Http_connection_t* con = http_connection_create(client_fd, ctx->timer, ctx->cfg); 
+    Http_connection_t* con = http_connection_create(ctx, client_fd); 
     if (!con)
     {
+        http_ratelimit_disconnect(peer_limit); 
+        close(client_fd); 
+        return; 
+    }
+    con->peer = client_addr; 
+    con->peer_len = socklen; 
+    con->peer_limit = peer_limit; 
+
+    if (listen_fd == ctx->tls_listen_fd && http_tls_accept(ctx, con) == -1)
+    {
+        http_timer_invalid_timeout(ctx->timer, con->timeout_index); 
+        http_ratelimit_disconnect(peer_limit); 
+        free(con); 
         close(client_fd); 
         return; 
     }
 
     if (http_epoll_add_con(ctx->epoll_fd, con, EPOLLIN | EPOLLET | EPOLLRDHUP | EPOLLHUP) == -1) 
-    { free(con); 
+    {
+        http_timer_invalid_timeout(ctx->timer, con->timeout_index); 
+        http_tls_free(con); 
+        http_ratelimit_disconnect(peer_limit); 
+        free(con); 
         close(client_fd); 
         return; 
     }
 
+    con->next = ctx->connections; 
+    if (con->next)
+        con->next->prev = con; 
+    ctx->connections = con; 
     ctx->active_clients++; 
 }
 
-static void write_error_response(Http_connection_t* con, int status_code)
+void http_connection_drain(Http_server_context_t* ctx, Http_connection_t* con)
+{
+    if (con->h2)
+        http_h2_drain(con); 
+    if (con->ws)
+        http_ws_close(con->ws, HTTP_WS_CLOSE_GOING_AWAY, "server shutting down"); 
+    /* the client reconnects to the next server, what's queued goes out first */ 
+    if (con->sse)
+    {
+        HTTP_SET_SHOULD_CLOSE(con->flags); 
+        if (con->timeout_index != -1)
+            http_timer_update(ctx->timer, con, HTTP_DRAIN_IDLE_TIMEOUT); 
+    }
+    http_connection_update_events(ctx->epoll_fd, con->item); 
+}
+
+/* kept alive after a response with nothing buffered, a new connection gets to send its first request */ 
+static int connection_idle(Http_connection_t* con)
+{
+    return con->requests > 0 && !con->h2 && !con->ws && !con->sse && !con->upstream && con->buff_len == 0 &&
+        !HTTP_IS_WRITING(con->flags) && !HTTP_IS_SENDING_FILE(con->flags) &&
+        HTTP_GET_READ_STATE(con->flags) == HTTP_READING_HEADERS; 
+}
+
+int http_connection_last_request(Http_connection_t* con)
+{
+    size_t max = con->ctx->cfg->keepalive_requests; 
+    return con->ctx->draining || (max && con->requests >= max); 
+}
+
+int http_connection_evict_idle(Http_server_context_t* ctx)
+{
+    Http_connection_t* con = ctx->idle_head; 
+    if (!con)
+        return -1; 
+    connection_close_later(ctx, con); 
+    return 0; 
+}
+
+/* closed from another item's event (the timer, an accept), the client may have an event
+ * further in the batch so its item is freed after it */ 
+static void connection_close_later(Http_server_context_t* ctx, Http_connection_t* con)
+{
+    Http_epoll_item_t* item = con->item; 
+    http_connection_clean(ctx, con); 
+    item->type = HTTP_ITEM_CLOSED; 
+    item->next = ctx->item_graveyard; 
+    ctx->item_graveyard = item; 
+}
+
+/* the response is out and nothing else came, it goes last in the eviction order */ 
+static void idle_enter(Http_connection_t* con)
+{
+    Http_server_context_t* ctx = con->ctx; 
+    HTTP_SET_IDLE(con->flags); 
+    con->idle_next = NULL; 
+    con->idle_prev = ctx->idle_tail; 
+    if (ctx->idle_tail)
+        ctx->idle_tail->idle_next = con; 
+    else
+        ctx->idle_head = con; 
+    ctx->idle_tail = con; 
+    ctx->idle_count++; 
+    /* a timer that fires early would close it, it's closed now instead */ 
+    if (con->timeout_index != -1 && http_timer_update(ctx->timer, con, keepalive_timeout(ctx)) == -1)
+        HTTP_SET_SHOULD_CLOSE(con->flags); 
+}
+
+static void idle_leave(Http_connection_t* con)
+{
+    Http_server_context_t* ctx = con->ctx; 
+    HTTP_CLEAR_IDLE(con->flags); 
+    if (con->idle_prev)
+        con->idle_prev->idle_next = con->idle_next; 
+    else
+        ctx->idle_head = con->idle_next; 
+    if (con->idle_next)
+        con->idle_next->idle_prev = con->idle_prev; 
+    else
+        ctx->idle_tail = con->idle_prev; 
+    con->idle_prev = NULL; 
+    con->idle_next = NULL; 
+    ctx->idle_count--; 
+}
+
+/* the full timeout up to HTTP_KEEPALIVE_SHRINK_AT percent of max_connections, then down to
+ * the minimum at the limit: the fuller the server, the sooner an idle client gives its slot */ 
+static int keepalive_timeout(Http_server_context_t* ctx)
+{
+    Http_config_t* cfg = ctx->cfg; 
+    int timeout = cfg->keepalive_timeout; 
+    int min = cfg->keepalive_min_timeout; 
+    size_t max = cfg->max_connections; 
+    size_t from = max * HTTP_KEEPALIVE_SHRINK_AT / 100; 
+    if (max == 0 || ctx->active_clients <= from || timeout <= min)
+        return timeout; 
+    size_t over = ctx->active_clients < max ? ctx->active_clients - from : max - from; 
+    return timeout - (int)((size_t)(timeout - min) * over / (max - from)); 
+}
+
+void http_connection_error(Http_connection_t* con, int status_code)
 {
     HTTP_SET_SHOULD_CLOSE(con->flags); 
 
@@ -100,16 +342,37 @@ static void write_error_response(Http_connection_t* con, int status_code)
     if (used == -1)
         return; /* dont send the error */  
 
+    http_connection_responded(con, con->response + con->response_len, used); 
     con->response_len += used; 
     HTTP_SET_WRITING(con->flags); 
 }
 
+void http_connection_responded(Http_connection_t* con, const char* head, size_t len)
+{
+    http_access_log_response(con, head, len); 
+    http_trace_response(con, head, len); 
+}
+
+ssize_t http_connection_recv(Http_connection_t* con, char* buff, size_t len)
+{
+    if (con->ssl)
+        return http_tls_read(con, buff, len); 
+    return read(con->client_fd, buff, len); 
+}
+
+ssize_t http_connection_send(Http_connection_t* con, const char* buff, size_t len)
+{
+    if (con->ssl)
+        return http_tls_write(con, buff, len); 
+    /* MSG_NOSIGNAL to prevent SIGPIPE */ 
+    return send(con->client_fd, buff, len, MSG_NOSIGNAL); 
+}
+
 static void socket_drain(Http_connection_t* con)
 {
-    int client_fd = con->client_fd; 
     for (;;)  /* drain the buffer :3 */ 
     {
-        ssize_t n = read(client_fd, con->buff + con->buff_len, HTTP_REQUEST_SIZE - con->buff_len); 
+        ssize_t n = http_connection_recv(con, con->buff + con->buff_len, HTTP_REQUEST_SIZE - con->buff_len); 
         if (n == 0)
         {
             break; 
@@ -121,6 +384,17 @@ static void socket_drain(Http_connection_t* con)
             perror("read"); 
             break; 
         }
+        if (con->buff_len == 0 && HTTP_GET_READ_STATE(con->flags) == HTTP_READING_HEADERS)
+        {
+            /* a new request, it has the request timeout to come in */ 
+            if (HTTP_IS_IDLE(con->flags))
+            {
+                idle_leave(con); 
+                if (con->timeout_index != -1 && http_timer_update(con->ctx->timer, con, HTTP_CLIENT_TIMEOUT) == -1)
+                    HTTP_SET_SHOULD_CLOSE(con->flags); /* answered, then closed */ 
+            }
+            http_trace_begin(con); 
+        }
         con->buff_len += n; 
     }
 }
@@ -133,11 +407,28 @@ static int buffer_process(Http_connection_t* con)
 {
     for (;;) /* process what's in the buffer */ 
     {
+        /* responses must stay in order, wait for the file body or the backend response */ 
+        if (HTTP_IS_SENDING_FILE(con->flags) || con->upstream)
+            return -1; 
+
         /* reading headers state */ 
         switch (HTTP_GET_READ_STATE(con->flags))
         {
             case HTTP_READING_HEADERS: 
             {
+                /* http/2 with prior knowledge */ 
+                if (http_h2_is_preface(con->buff, con->buff_len))
+                {
+                    if (con->buff_len < HTTP_H2_PREFACE_LEN)
+                        return -1; 
+                    if (http_h2_start(con, 0) == -1)
+                    {
+                        HTTP_SET_SHOULD_CLOSE(con->flags); 
+                        return -1; 
+                    }
+                    return 0; 
+                }
+
                 char* end = NULL; 
 #ifdef HTTP_USE_MEMMEM
                 end = memmem(con->buff, con->buff_len, 
@@ -156,25 +447,54 @@ static int buffer_process(Http_connection_t* con)
                 if (!end)
                 {
                     if (con->buff_len >= HTTP_REQUEST_SIZE)
-                        write_error_response(con, HTTP_PAYLOAD_TOO_LARGE); 
+                        http_connection_error(con, HTTP_PAYLOAD_TOO_LARGE); 
                     return -1; 
                 }
                 
                 /* can parse the headers now */  
                 con->header_len = end - con->buff + HTTP_HEADER_DELIMITER_LEN;  
+                /* the previous response is serialized, the headers past the inline ones go here */ 
+                http_arena_reset(&con->arena); 
                 if (http_request_parse(&con->request, con->buff, con->header_len) == -1)
                 {
-                    write_error_response(con, HTTP_BAD_REQUEST); 
+                    http_connection_error(con, HTTP_BAD_REQUEST); 
                     return -1; 
                 }
+                http_trace_request(con); 
+                if (con->request.expect_continue && continue_answer(con) == -1)
+                    return -1; 
                 
-                if (con->request.body_len == 0) 
+                if (con->request.chunked)
+                {
+                    /* decoded right after the headers as it arrives */ 
+                    con->request.body = &con->buff[con->header_len]; 
+                    con->body_len = 0; 
+                    http_chunked_init(&con->chunked, con->ctx->cfg->max_chunk_ext, con->ctx->cfg->max_trailer_size); 
+                    HTTP_SET_READ_STATE(con->flags, HTTP_READING_CHUNKED); 
+                }
+                else if (con->request.body_len == 0)
                     HTTP_SET_READ_STATE(con->flags, HTTP_REQUEST_READY); 
                 else 
                 {
                     if (con->request.body_len >= HTTP_REQUEST_SIZE - con->header_len)
                     {
-                        write_error_response(con, HTTP_PAYLOAD_TOO_LARGE); 
+                        /* a body going to a backend doesn't have to fit */ 
+                        Http_route_t* route = http_router_find_route(http_server_router(con->ctx),
+                                                                     con->request.method,
+                                                                     con->request.path); 
+                        if (!route || !route->upstream)
+                        {
+                            http_connection_error(con, HTTP_PAYLOAD_TOO_LARGE); 
+                            return -1; 
+                        }
+                        if (request_begin(con) == -1)
+                            return -1; 
+                        if (http_proxy_start(con, route->upstream, con->buff_len - con->header_len) == -1)
+                        {
+                            http_connection_error(con, HTTP_BAD_GATEWAY); 
+                            return -1; 
+                        }
+                        con->buff_len = 0; 
                         return -1; 
                     }
                     con->request.body = &con->buff[con->header_len]; 
@@ -190,38 +510,61 @@ static int buffer_process(Http_connection_t* con)
             else 
                 return -1; 
             break; 
-            case HTTP_REQUEST_READY: 
+            case HTTP_READING_CHUNKED: 
             {
-                /* make the handler create a response */ 
-                Http_response_t response; 
-                memset(&response, 0, sizeof response); 
-
-                Http_handler_t handler = http_router_find(con->router, 
-                                                        con->request.method,
-                                                        con->request.path); 
-
-                /* router didn't find a handler */ 
-                if (!handler)
+                /* body_len bytes are decoded, the raw bytes left follow them */ 
+                char* body = con->buff + con->header_len; 
+                size_t raw_len = con->buff_len - con->header_len; 
+                size_t read = con->body_len, written = con->body_len; 
+                int done = http_chunked_decode(&con->chunked, body, raw_len, &read, &written); 
+                if (done == -1)
                 {
-                    write_error_response(con, HTTP_NOT_FOUND); 
+                    http_connection_error(con, HTTP_BAD_REQUEST); 
                     return -1; 
                 }
 
-                if (handler(&con->request, &response) == HTTP_HANDLER_ERR)
+                /* the framing is dropped, the next request (if any) moves down with what's left */ 
+                int was_full = con->buff_len >= HTTP_REQUEST_SIZE; 
+                if (read != written)
+                    memmove(body + written, body + read, raw_len - read); 
+                con->buff_len -= read - written; 
+                con->body_len = written; 
+                if (!done)
                 {
-                    write_error_response(con, HTTP_INTERNAL_SERVER_ERROR); 
-                    return -1; 
+                    if (con->buff_len >= HTTP_REQUEST_SIZE)
+                    {
+                        http_connection_error(con, HTTP_PAYLOAD_TOO_LARGE); 
+                        return -1; 
+                    }
+                    /* the socket wasn't drained while the buffer was full */ 
+                    return was_full ? 0 : -1; 
                 }
-                int used = http_response_raw(&response, con->response + con->response_len, HTTP_RESPONSE_SIZE - con->response_len); 
-                http_response_free(&response); 
-                if (used == -1)
-                {
-                    write_error_response(con, HTTP_PAYLOAD_TOO_LARGE); 
+                con->request.body_len = written; 
+                HTTP_SET_READ_STATE(con->flags, HTTP_REQUEST_READY); 
+            }
+            break; 
+            case HTTP_REQUEST_READY: 
+            {
+                if (request_begin(con) == -1)
                     return -1; 
+
+                /* h2c upgrade, the answer to this request is sent over http/2 */ 
+                if (!con->ssl && !con->ctx->draining && con->request.body_len == 0 && !con->request.chunked &&
+                    http_h2_upgrade_requested(&con->request))
+                {
+                    if (http_h2_start(con, 1) == -1)
+                    {
+                        HTTP_SET_SHOULD_CLOSE(con->flags); 
+                        return -1; 
+                    }
+                    return 0; 
                 }
-                con->response_len += used; 
-                HTTP_SET_WRITING(con->flags); 
-                if (response.connection_close)
+
+                HTTP_TRACE_MARK(con, HTTP_TRACE_HANDLER_START); 
+                int connection_close = request_dispatch(con); 
+                if (connection_close == -1)
+                    return -1; /* an error response was written */ 
+                if (connection_close)
                 {
                     HTTP_SET_SHOULD_CLOSE(con->flags); 
                     return -1; 
@@ -235,6 +578,10 @@ static int buffer_process(Http_connection_t* con)
                     HTTP_SET_READ_STATE(con->flags, HTTP_READING_HEADERS); 
                     con->buff_len = remains; 
                     con->body_len = 0; 
+                    if (con->ws || con->sse)
+                        return 0; /* what's left are frames, or dropped */ 
+                    if (remains > 0)
+                        http_trace_begin(con); /* pipelined, already read */ 
                     }
             }
             break; 
@@ -244,11 +591,373 @@ static int buffer_process(Http_connection_t* con)
     return 0; 
 }
 
+/* counted and logged like any request, then admitted. returns -1 if it was refused */ 
+static int request_begin(Http_connection_t* con)
+{
+    con->requests++; 
+    http_access_log_begin(con, &con->request); 
+    /* rate limited or overloaded, the pre-serialized 429/503 costs nothing to send */ 
+    int refused = 0; 
+    if (HTTP_IS_ADMITTED(con->flags))
+        HTTP_CLEAR_ADMITTED(con->flags); /* when the 100 was sent */ 
+    else
+        refused = http_connection_admit(con); 
+    if (refused)
+    {
+        request_refuse(con, refused); 
+        return -1; 
+    }
+    return 0; 
+}
+
+static void request_refuse(Http_connection_t* con, int refused)
+{
+    Http_server_context_t* ctx = con->ctx; 
+    if (refused == HTTP_TOO_MANY_REQUESTS)
+        response_append(con, ctx->ratelimit_response, ctx->ratelimit_response_len); 
+    else
+        response_append(con, ctx->overload_response, ctx->overload_response_len); 
+    HTTP_SET_SHOULD_CLOSE(con->flags); 
+}
+
+#define HTTP_CONTINUE_LINE      "HTTP/1.1 100 Continue\r\n\r\n"
+#define HTTP_CONTINUE_LINE_LEN  25
+
+/* Expect: 100-continue, the client holds the body back until it's told to go on.
+ * everything that can refuse the request is checked first so a refused body is never sent.
+ * returns -1 if an error response was written */ 
+static int continue_answer(Http_connection_t* con)
+{
+    Http_request_t* req = &con->request; 
+    Http_route_t* route = http_router_find_route(http_server_router(con->ctx), req->method, req->path); 
+    if (!route)
+    {
+        http_connection_error(con, HTTP_NOT_FOUND); 
+        return -1; 
+    }
+    int too_large = !req->chunked && req->body_len >= HTTP_REQUEST_SIZE - con->header_len; 
+    if (too_large && !route->upstream)
+    {
+        http_connection_error(con, HTTP_PAYLOAD_TOO_LARGE); 
+        return -1; 
+    }
+
+    int refused = http_connection_admit(con); 
+    if (refused)
+    {
+        request_refuse(con, refused); 
+        return -1; 
+    }
+    HTTP_SET_ADMITTED(con->flags); 
+    /* streamed to the backend with the Expect header, it answers */ 
+    if (too_large)
+        return 0; 
+
+    /* some clients stop waiting, no need to ask for what is already coming.
+     * an interim response isn't logged, it's written as is */ 
+    if (con->buff_len == con->header_len && HTTP_CONTINUE_LINE_LEN <= HTTP_RESPONSE_SIZE - con->response_len)
+    {
+        memcpy(con->response + con->response_len, HTTP_CONTINUE_LINE, HTTP_CONTINUE_LINE_LEN); 
+        con->response_len += HTTP_CONTINUE_LINE_LEN; 
+        HTTP_SET_WRITING(con->flags); 
+        req->expect_continue = 0; 
+    }
+    return 0; 
+}
+
+/* returns -1 if an error response was written or if the connection should be closed */ 
+static int request_dispatch(Http_connection_t* con)
+{
+    Http_route_t* route = http_router_find_route(http_server_router(con->ctx),
+                                                 con->request.method,
+                                                 con->request.path); 
+
+    /* router didn't find a handler */ 
+    if (!route)
+    {
+        http_connection_error(con, HTTP_NOT_FOUND); 
+        return -1; 
+    }
+
+    if (route->upstream)
+    {
+        if (http_proxy_start(con, route->upstream, con->body_len) == -1)
+        {
+            http_connection_error(con, HTTP_BAD_GATEWAY); 
+            return -1; 
+        }
+        return 0; 
+    }
+
+    Http_cache_key_t key; 
+    /* a cached response says keep-alive, for the last request the handler answers instead */ 
+    if (!route->cache || http_connection_last_request(con) || http_resp_cache_key(route->cache, &con->request, &key) == -1)
+        return handler_respond(con, route->handler, NULL, NULL); 
+
+    Http_cache_entry_t* entry; 
+    switch (http_resp_cache_lookup(route->cache, &key, &entry))
+    {
+        case HTTP_CACHE_HIT: 
+            if (response_append(con, entry->data, entry->data_len) == -1)
+                return handler_respond(con, route->handler, NULL, NULL); 
+            return entry->connection_close; 
+
+        case HTTP_CACHE_STALE: 
+        {
+            if (response_append(con, entry->data, entry->data_len) == -1)
+            {
+                http_resp_cache_refresh_failed(route->cache, &key); 
+                return handler_respond(con, route->handler, NULL, NULL); 
+            }
+            int connection_close = entry->connection_close; 
+            /* the client gets the stale response now, the handler runs after the batch */ 
+            http_connection_write(con); 
+            if (cache_refresh_queue(con, route, &key) == -1)
+                http_resp_cache_refresh_failed(route->cache, &key); 
+            return connection_close; 
+        }
+
+        case HTTP_CACHE_MISS: 
+        default: 
+            return handler_respond(con, route->handler, route->cache, &key); 
+    }
+}
+
+/* make the handler create a response, cache is null if it must not be stored */ 
+static int handler_respond(Http_connection_t* con,
+                           Http_handler_t handler,
+                           Http_resp_cache_t* cache,
+                           const Http_cache_key_t* key)
+{
+    Http_response_t response; 
+    http_response_init(&response); 
+
+    if (handler(&con->request, &response) == HTTP_HANDLER_ERR)
+    {
+        http_arena_reset(&con->arena); 
+        http_connection_error(con, HTTP_INTERNAL_SERVER_ERROR); 
+        return -1; 
+    }
+    /* no new websocket or event stream while draining, it would be closed right away */ 
+    if ((response.websocket || response.sse_topic) && con->ctx->draining)
+    {
+        http_response_free(&response); 
+        http_arena_reset(&con->arena); 
+        http_connection_error(con, HTTP_SERVICE_UNAVAILABLE); 
+        return -1; 
+    }
+    /* the name may be in the arena */ 
+    Http_sse_topic_t* topic = NULL; 
+    if (response.sse_topic && !(topic = http_sse_topic(con->ctx, response.sse_topic)))
+    {
+        http_response_free(&response); 
+        http_arena_reset(&con->arena); 
+        http_connection_error(con, HTTP_INTERNAL_SERVER_ERROR); 
+        return -1; 
+    }
+    http_compress_response(&con->request, &response); 
+    if (http_connection_last_request(con))
+        response.connection_close = 1; 
+    char* raw = con->response + con->response_len; 
+    int used = http_response_raw(&response, raw, HTTP_RESPONSE_SIZE - con->response_len); 
+    if (used != -1 && response.body_type == HTTP_BODY_FILE)
+    {
+        /* the connection takes the file */ 
+        con->file_fd = response.body_fd; 
+        con->file_offset = response.body_offset; 
+        con->file_remaining = response.body_len; 
+        con->file_owned = response.body_mem == HTTP_MEM_OWNED; 
+        response.body_fd = -1; 
+        /* the parts start once the head is out */ 
+        con->byteranges = response.byteranges; 
+        con->byteranges_part = 0; 
+        response.byteranges = NULL; 
+        if (con->byteranges)
+            con->file_remaining = 0; 
+        HTTP_SET_SENDING_FILE(con->flags); 
+    }
+    http_response_free(&response); 
+    /* serialized, nothing points into the arena anymore */ 
+    http_arena_reset(&con->arena); 
+    if (used == -1)
+    {
+        http_connection_error(con, HTTP_PAYLOAD_TOO_LARGE); 
+        return -1; 
+    }
+
+    http_connection_responded(con, raw, used); 
+
+    /* only complete responses can be cached */ 
+    if (cache && !topic && response.body_type == HTTP_BODY_BUFFER && http_resp_cache_status_cacheable(response.status_code))
+        http_resp_cache_store(cache, key, raw, used, response.connection_close); 
+
+    con->response_len += used; 
+    HTTP_SET_WRITING(con->flags); 
+    /* the 101 is queued, frames go after it */ 
+    if (response.websocket && http_ws_start(con, response.websocket, response.websocket_data) == -1)
+        return 1; 
+    if (topic && http_sse_start(con, topic) == -1)
+        return 1; 
+    return response.connection_close; 
+}
+
+/* copy what the handler can look at, the connection's buffer is reused by the next request */ 
+static int cache_refresh_queue(Http_connection_t* con, Http_route_t* route, const Http_cache_key_t* key)
+{
+    Http_cache_refresh_t* refresh = malloc(sizeof(Http_cache_refresh_t)); 
+    if (!refresh)
+    {
+        perror("malloc"); 
+        return -1; 
+    }
+    refresh->cache = route->cache; 
+    refresh->handler = route->handler; 
+    refresh->key = *key; 
+    refresh->fields_len = 0; 
+    http_arena_init(&refresh->arena); 
+
+    const Http_request_t* request = &con->request; 
+    Http_request_t* req = &refresh->request; 
+    memset(req, 0, sizeof(Http_request_t)); 
+    req->base = refresh->fields; 
+    req->arena = &refresh->arena; /* the headers past the inline ones */ 
+    req->method = request->method; 
+    memcpy(req->version, request->version, HTTP_VERSION_SIZE); 
+    req->method_str = refresh_field(refresh, request->method_str, strlen(request->method_str)); 
+    req->target = refresh_field(refresh, request->target, strlen(request->target)); 
+    int ok = req->method_str && req->target; 
+    for (size_t i = 0; ok && i < request->headers_count; i++)
+    {
+        Http_slice_t name, value; 
+        http_request_header_at(request, i, &name, &value); 
+        char* key_field = refresh_field(refresh, name.ptr, name.len); 
+        char* value_field = refresh_field(refresh, value.ptr, value.len); 
+        ok = key_field && value_field &&
+            http_request_add_header(req, key_field - refresh->fields, name.len, value_field - refresh->fields, value.len) == 0; 
+    }
+    if (ok && request->body_len)
+    {
+        req->body = refresh_field(refresh, request->body, request->body_len); 
+        req->body_len = request->body_len; 
+        ok = req->body != NULL; 
+    }
+    /* it was split once already, it can't fail */ 
+    if (!ok || http_request_set_target(req, req->target, strlen(req->target)) == -1)
+    {
+        http_arena_free(&refresh->arena); 
+        free(refresh); 
+        return -1; 
+    }
+
+    refresh->next = con->ctx->cache_refreshes; 
+    con->ctx->cache_refreshes = refresh; 
+    return 0; 
+}
+
+/* a nul terminated copy in refresh->fields, null if there is no room */ 
+static char* refresh_field(Http_cache_refresh_t* refresh, const char* data, size_t len)
+{
+    if (len + 1 > HTTP_REQUEST_SIZE - refresh->fields_len)
+        return NULL; 
+    char* field = refresh->fields + refresh->fields_len; 
+    memcpy(field, data, len); 
+    field[len] = '\0'; 
+    refresh->fields_len += len + 1; 
+    return field; 
+}
+
+void http_connection_cache_refresh(Http_server_context_t* ctx)
+{
+    /* routes and their caches stay valid until the loop's next epoll_wait */ 
+    Http_cache_refresh_t* refresh = ctx->cache_refreshes; 
+    ctx->cache_refreshes = NULL; 
+    while (refresh)
+    {
+        Http_cache_refresh_t* next = refresh->next; 
+        cache_refresh_run(refresh); 
+        http_arena_free(&refresh->arena); 
+        free(refresh); 
+        refresh = next; 
+    }
+}
+
+void http_connection_cache_refresh_drop(Http_server_context_t* ctx)
+{
+    Http_cache_refresh_t* refresh = ctx->cache_refreshes; 
+    ctx->cache_refreshes = NULL; 
+    while (refresh)
+    {
+        Http_cache_refresh_t* next = refresh->next; 
+        http_resp_cache_refresh_failed(refresh->cache, &refresh->key); 
+        http_arena_free(&refresh->arena); 
+        free(refresh); 
+        refresh = next; 
+    }
+}
+
+/* runs the handler again for a stale entry, the response is only stored */ 
+static void cache_refresh_run(Http_cache_refresh_t* refresh)
+{
+    Http_request_t* req = &refresh->request; 
+    Http_response_t response; 
+    http_response_init(&response); 
+
+    if (refresh->handler(req, &response) == HTTP_HANDLER_ERR)
+    {
+        http_resp_cache_refresh_failed(refresh->cache, &refresh->key); 
+        return; 
+    }
+    http_compress_response(req, &response); 
+
+    int used = -1; 
+    if (!response.sse_topic && !response.websocket && response.body_type == HTTP_BODY_BUFFER &&
+            http_resp_cache_status_cacheable(response.status_code))
+        used = http_response_raw(&response, refresh->raw, HTTP_RESPONSE_SIZE); 
+    http_response_free(&response); 
+
+    if (used == -1 || http_resp_cache_store(refresh->cache, &refresh->key, refresh->raw, used, response.connection_close) == -1)
+        http_resp_cache_refresh_failed(refresh->cache, &refresh->key); 
+}
+
+/* returns -1 if there is no room */ 
+static int response_append(Http_connection_t* con, const char* data, size_t len)
+{
+    if (len > HTTP_RESPONSE_SIZE - con->response_len)
+        return -1; 
+    /* always a whole response (cached or pre-serialized) */ 
+    http_connection_responded(con, data, len); 
+    memcpy(con->response + con->response_len, data, len); 
+    con->response_len += len; 
+    HTTP_SET_WRITING(con->flags); 
+    return 0; 
+}
+
 void http_connection_read(Http_connection_t* con)
 {
     assert(con != NULL && con->client_fd != -1); 
     for (;;)
     {
+        if (con->h2)
+        {
+            http_h2_read(con); 
+            return; 
+        }
+        if (con->ws)
+        {
+            http_ws_read(con); 
+            return; 
+        }
+        if (con->sse)
+        {
+            http_sse_read(con); 
+            return; 
+        }
+        if (con->upstream)
+        {
+            http_proxy_resume(con); /* the body goes straight to the backend */ 
+            return; 
+        }
+
         socket_drain(con); /* drain :3 */ 
 
         if (buffer_process(con) == -1)
@@ -258,32 +967,140 @@ void http_connection_read(Http_connection_t* con)
 
 void http_connection_write(Http_connection_t* con) 
 {
-    while (con->response_sent < con->response_len)   
+    for (;;)
     {
-        /* MSG_NOSIGNAL to prevent SIGPIPE */
-        ssize_t n = send(con->client_fd, 
-                con->response + con->response_sent, 
-                con->response_len - con->response_sent,
-                MSG_NOSIGNAL); 
-        if (n == -1) 
+        while (con->response_sent < con->response_len)
         {
-            if (errno == EAGAIN || errno == EWOULDBLOCK)
-                break; 
-            else 
+            ssize_t n = http_connection_send(con,
+                    con->response + con->response_sent,
+                    con->response_len - con->response_sent); 
+            if (n == -1)
             {
-                perror("write"); 
-                break; 
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break; 
+                else
+                {
+                    perror("write"); 
+                    break; 
+                }
             }
+
+            con->response_sent += n; 
+            con->bytes_sent += n; 
+            if (con->tracing && !con->trace.at[HTTP_TRACE_FIRST_SENT])
+                HTTP_TRACE_MARK(con, HTTP_TRACE_FIRST_SENT); 
+        }
+        if (con->response_sent < con->response_len)
+            return; 
+
+        con->response_len = 0; 
+        con->response_sent = 0; 
+
+        if (con->h2)
+        {
+            http_h2_write(con); /* the session manages the writing flag */ 
+            return; 
         }
+        if (con->ws)
+        {
+            http_ws_write(con); 
+            return; 
+        }
+        if (con->sse)
+        {
+            http_sse_write(con); 
+            return; 
+        }
+
+        if (con->upstream)
+        {
+            http_proxy_resume(con); /* room again for the backend response */ 
+            if (con->response_len > 0)
+                continue; 
+            break; 
+        }
+
+        if (!HTTP_IS_SENDING_FILE(con->flags))
+            break; 
+
+        int sent = file_send(con); 
+        if (sent == -1)
+            return; /* socket is full */ 
+        if (sent == 1)
+            continue; /* the next part head is in the response buffer */ 
+
+        HTTP_CLEAR_WRITING(con->flags); 
+        if (HTTP_SHOULD_CLOSE(con->flags))
+            return; 
 
-        con->response_sent += n; 
+        /* requests that came while the file was sent are still waiting */ 
+        http_connection_read(con); 
+        if (!HTTP_IS_WRITING(con->flags))
+            return; 
     }
-    if (con->response_sent >= con->response_len)
+
+    HTTP_CLEAR_WRITING(con->flags); 
+}
+
+/* returns -1 if the socket would block, 1 if a multipart head was put in the response buffer */ 
+static int file_send(Http_connection_t* con)
+{
+    for (;;)
     {
-        con->response_len = 0;
+        while (con->file_remaining > 0)
+        {
+            ssize_t n; 
+            if (con->ssl)
+                n = http_tls_sendfile(con, con->file_fd, &con->file_offset, con->file_remaining); 
+            else
+                n = sendfile(con->client_fd, con->file_fd, &con->file_offset, con->file_remaining); 
+            if (n == -1)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return -1; 
+                perror("sendfile"); 
+                HTTP_SET_SHOULD_CLOSE(con->flags); /* body is cut, the connection can't be reused */ 
+                goto done; 
+            }
+            if (n == 0) /* file got truncated */ 
+            {
+                HTTP_SET_SHOULD_CLOSE(con->flags); 
+                goto done; 
+            }
+            con->file_remaining -= n; 
+            con->bytes_sent += n; 
+        }
+
+        Http_byteranges_t* byteranges = con->byteranges; 
+        if (!byteranges || con->byteranges_part > byteranges->count)
+            break; 
+
+        /* the head of the next part, or the closing delimiter after the last one */ 
+        int part = con->byteranges_part++; 
+        con->response_len = http_byteranges_head(byteranges, part, con->response, HTTP_RESPONSE_SIZE); 
         con->response_sent = 0; 
-        HTTP_CLEAR_WRITING(con->flags); 
+        if (part < byteranges->count)
+        {
+            con->file_offset = byteranges->ranges[part].start; 
+            con->file_remaining = byteranges->ranges[part].end - byteranges->ranges[part].start + 1; 
+        }
+        return 1; 
     }
+
+done:
+    file_close(con); 
+    return 0; 
+}
+
+static void file_close(Http_connection_t* con)
+{
+    if (con->file_fd != -1 && con->file_owned)
+        close(con->file_fd); 
+    con->file_fd = -1; 
+    con->file_remaining = 0; 
+    free(con->byteranges); 
+    con->byteranges = NULL; 
+    HTTP_CLEAR_SENDING_FILE(con->flags); 
 }
 
 void http_connection_update_events(int epoll_fd, Http_epoll_item_t* con_item)
@@ -293,6 +1110,30 @@ void http_connection_update_events(int epoll_fd, Http_epoll_item_t* con_item)
     assert(con_item->con != NULL); 
 
     Http_connection_t* con = con_item->con; 
+    /* the response is out, it no longer counts against the in-flight limit */ 
+    if (HTTP_IS_INFLIGHT(con->flags) && !HTTP_IS_WRITING(con->flags) &&
+        !HTTP_IS_SENDING_FILE(con->flags) && !con->upstream)
+    {
+        HTTP_CLEAR_INFLIGHT(con->flags); 
+        con->ctx->inflight--; 
+    }
+    if (!HTTP_IS_WRITING(con->flags) && !HTTP_IS_SENDING_FILE(con->flags) && !con->upstream)
+    {
+        http_access_log_end(con); 
+        http_trace_end(con, 0); 
+    }
+
+    /* draining: responses made from now on say Connection: close. closing a connection kept
+     * alive before would drop the request the client may be sending, it gets a moment to
+     * send one before the timer closes it */ 
+    if (con->ctx->draining && connection_idle(con) && con->timeout_index != -1)
+    {
+        if (http_timer_update(con->ctx->timer, con, HTTP_DRAIN_IDLE_TIMEOUT) == -1)
+            HTTP_SET_SHOULD_CLOSE(con->flags); 
+    }
+    else if (!HTTP_IS_IDLE(con->flags) && !HTTP_SHOULD_CLOSE(con->flags) && connection_idle(con))
+        idle_enter(con); 
+
     /* if it's not writing and should close flags is set close the connection */ 
     if (!HTTP_IS_WRITING(con->flags) && HTTP_SHOULD_CLOSE(con->flags))
         HTTP_SET_CLOSING(con->flags); 
@@ -303,6 +1144,13 @@ void http_connection_update_events(int epoll_fd, Http_epoll_item_t* con_item)
 
     uint32_t events = EPOLLET | EPOLLRDHUP | EPOLLHUP;  
 
+    if (HTTP_IS_HANDSHAKING(con->flags)) /* wait for what the handshake needs */ 
+    {
+        events |= HTTP_TLS_WANT_WRITE(con->flags) ? EPOLLOUT : EPOLLIN; 
+        http_epoll_mod_con(epoll_fd, con_item, events); 
+        return; 
+    }
+
     if (HTTP_IS_WRITING(con->flags)) /* if writing flag is set then add OUT event */ 
         events |= EPOLLOUT; 
     if (!HTTP_SHOULD_CLOSE(con->flags)) /* if should close is not set than add IN event */ 
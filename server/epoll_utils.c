@@ -7,6 +7,12 @@
 #include <sys/eventfd.h> 
 
 #include <loom/epoll_utils.h>
+#include <loom/tls.h> 
+#include <loom/admission.h> 
+#include <loom/utils.h> 
+#include <loom/handoff.h> 
+#include <loom/shutdown.h> 
+#include <loom/sse.h> 
 
 int http_epoll_create_instance(void)
 {
@@ -102,6 +108,7 @@ int http_epoll_add_con(int epoll_fd, Http_connection_t* con, uint32_t events)
         free(item); 
         return -1; 
     }
+    con->item = item; 
 
     return 0; 
 }
@@ -130,6 +137,57 @@ void http_epoll_del_con(int epoll_fd, Http_connection_t* con)
     epoll_ctl(epoll_fd, EPOLL_CTL_DEL, con->client_fd, NULL); 
 }
 
+int http_epoll_add_upstream(int epoll_fd, Http_upstream_con_t* up, uint32_t events)
+{
+    assert(epoll_fd != -1); 
+    assert(up != NULL); 
+    struct epoll_event ev; 
+    ev.events = events; 
+    Http_epoll_item_t* item = malloc(sizeof(Http_epoll_item_t)); 
+    if (!item)
+    {
+        perror("malloc"); 
+        return -1; 
+    }
+
+    item->type = HTTP_ITEM_UPSTREAM; 
+    item->upstream = up; 
+
+    ev.data.ptr = item; 
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, up->fd, &ev) == -1)
+    {
+        perror("epoll_ctl"); 
+        free(item); 
+        return -1; 
+    }
+    up->item = item; 
+
+    return 0; 
+}
+
+int http_epoll_mod_upstream(int epoll_fd, Http_upstream_con_t* up, uint32_t events)
+{
+    assert(epoll_fd != -1); 
+    assert(up != NULL); 
+    struct epoll_event ev; 
+    ev.events = events; 
+    ev.data.ptr = up->item; 
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, up->fd, &ev) == -1)
+    {
+        perror("epoll_ctl"); 
+        return -1; 
+    }
+
+    return 0; 
+}
+
+void http_epoll_del_upstream(int epoll_fd, Http_upstream_con_t* up)
+{
+    assert(epoll_fd != -1); 
+    assert(up != NULL); 
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, up->fd, NULL); 
+}
+
 typedef enum {
     HANDLE_SHUTDOWN,  
     HANDLE_CONTINUE, 
@@ -139,6 +197,7 @@ typedef enum {
 static Handle_result handle_item_event(Http_server_context_t* ctx, Http_epoll_item_t* item, uint32_t events); 
 static void handle_client(Http_server_context_t* ctx, Http_epoll_item_t* con_item, uint32_t events); 
 static void close_client(Http_server_context_t* ctx, Http_epoll_item_t* con_item); 
+static void items_reap(Http_server_context_t* ctx); 
 
 static Handle_result handle_item_event(Http_server_context_t* ctx, Http_epoll_item_t* item, uint32_t events)
 {
@@ -154,8 +213,11 @@ static Handle_result handle_item_event(Http_server_context_t* ctx, Http_epoll_it
             return HANDLE_SHUTDOWN; 
         }
         case HTTP_ITEM_LISTENER: /* it's a new connection */  
+        case HTTP_ITEM_TLS_LISTENER: 
         {
-            http_connection_accept(ctx); 
+            if (http_admission_accept(ctx, item) == -1)
+                return HANDLE_CONTINUE; 
+            http_connection_accept(ctx, item->fd); 
             return HANDLE_CONTINUE; 
         } 
         case HTTP_ITEM_CLIENT: /* handle a client */  
@@ -175,13 +237,27 @@ static Handle_result handle_item_event(Http_server_context_t* ctx, Http_epoll_it
             }
             
             if (event.flag == HTTP_TIMER_EVENT_VALID)
-            {
-                event.con->timeout_index = -1; 
-                http_connection_clean(ctx, event.con); 
-            }
+                http_connection_timeout(ctx, event.con); 
 
             return HANDLE_CONTINUE; 
         }
+        case HTTP_ITEM_UPSTREAM: 
+        {
+            http_proxy_event(item, events); 
+            return HANDLE_CONTINUE; 
+        }
+        case HTTP_ITEM_CLOSED: 
+            return HANDLE_CONTINUE; 
+        case HTTP_ITEM_LAG_PROBE: 
+            http_admission_lag_probe(ctx); 
+            return HANDLE_CONTINUE; 
+        case HTTP_ITEM_HANDOFF: 
+        {
+            /* the new process accepts from now on, finish what we have */ 
+            if (http_handoff_send(ctx) == -1)
+                return HANDLE_CONTINUE; 
+            return HANDLE_SHUTDOWN; 
+        }
         default: 
             fprintf(stderr, "Unexpected epoll type\n"); 
             return HANDLE_ERROR; 
@@ -192,6 +268,23 @@ static void handle_client(Http_server_context_t* ctx, Http_epoll_item_t* con_ite
 {
     Http_connection_t* con = con_item->con; 
 
+    if (HTTP_IS_HANDSHAKING(con->flags) && !(events & (EPOLLHUP | EPOLLERR)))
+    {
+        int result = http_tls_handshake(con); 
+        if (result == -1)
+        {
+            close_client(ctx, con_item); 
+            return; 
+        }
+        if (result == 0)
+        {
+            http_connection_update_events(ctx->epoll_fd, con_item); 
+            return; 
+        }
+        /* the request may already be buffered in the tls session */ 
+        events |= EPOLLIN; 
+    }
+
     if (events & EPOLLIN)
     {
         http_connection_read(con); 
@@ -228,6 +321,18 @@ static void close_client(Http_server_context_t* ctx, Http_epoll_item_t* con_item
     free(con_item); 
 }
 
+static void items_reap(Http_server_context_t* ctx)
+{
+    Http_epoll_item_t* item = ctx->item_graveyard; 
+    while (item)
+    {
+        Http_epoll_item_t* next = item->next; 
+        free(item); 
+        item = next; 
+    }
+    ctx->item_graveyard = NULL; 
+}
+
 int http_epoll_run_loop(Http_server_context_t* ctx)
 {
     struct epoll_event *events = calloc(ctx->cfg->max_events, sizeof(struct epoll_event)); 
@@ -237,9 +342,38 @@ int http_epoll_run_loop(Http_server_context_t* ctx)
         return -1; 
     }
 
+    /* busy polling: after events the loop polls without sleeping for a window. the window is halved
+     * each time it ends empty, so a quiet loop sleeps again, and is full again once events come closer */ 
+    uint64_t spin_max = (uint64_t)ctx->cfg->busy_poll_us * 1000; 
+    uint64_t spin = spin_max; 
+    uint64_t idle_since = 0; /* ns, end of the last batch */ 
+    int spinning = 0; 
+
     for (;;)
     {
-        int nfds = epoll_wait(ctx->epoll_fd, events, ctx->cfg->max_events, -1); 
+        int timeout = http_shutdown_drain_wait(ctx); 
+        if (timeout == 0)
+            break; 
+        int nfds; 
+        if (spinning && http_time_ns() - idle_since < spin)
+        {
+            /* no sleep, no wakeup */ 
+            nfds = epoll_wait(ctx->epoll_fd, events, ctx->cfg->max_events, 0); 
+            http_qsbr_quiescent(&ctx->qsbr, ctx->qsbr_reader); 
+            if (nfds == 0)
+                continue; 
+        }
+        else
+        {
+            if (spinning)
+                spin /= 2; 
+            spinning = 0; 
+            /* nothing from the published tables is held while sleeping, replaced ones can go */ 
+            http_qsbr_offline(&ctx->qsbr, ctx->qsbr_reader); 
+            http_qsbr_reclaim(&ctx->qsbr); 
+            nfds = epoll_wait(ctx->epoll_fd, events, ctx->cfg->max_events, timeout); 
+            http_qsbr_quiescent(&ctx->qsbr, ctx->qsbr_reader); 
+        }
         if (nfds < 0)
         {
             if (errno == EINTR) 
@@ -247,6 +381,9 @@ int http_epoll_run_loop(Http_server_context_t* ctx)
             perror("epoll_wait"); 
             break; 
         }
+        if (spin_max && nfds > 0 && http_time_ns() - idle_since < spin_max)
+            spin = spin_max; 
+        int drain = 0; 
         for (int i = 0; i < nfds; i++)
         {
             Http_epoll_item_t* item = events[i].data.ptr; 
@@ -256,7 +393,10 @@ int http_epoll_run_loop(Http_server_context_t* ctx)
             switch (result)
             {
                 case HANDLE_SHUTDOWN:
-                    goto shutdown; 
+                    if (ctx->draining)
+                        goto shutdown; /* asked again, don't wait */ 
+                    drain = 1; /* connections are closed, wait for the end of the batch */ 
+                    break; 
 
                 case HANDLE_ERROR:
                     fprintf(stderr, "Error handling event\n");
@@ -267,8 +407,23 @@ int http_epoll_run_loop(Http_server_context_t* ctx)
                     break;
             }
         }
+        if (drain)
+            http_shutdown_drain(ctx); 
+        http_connection_cache_refresh(ctx); /* stale entries served by the batch, the clients already have them */ 
+        http_sse_flush(ctx); /* what the batch published, one send per subscriber */ 
+        http_proxy_reap(ctx); 
+        items_reap(ctx); 
+        if (spin_max && nfds > 0)
+        {
+            idle_since = http_time_ns(); 
+            spinning = spin != 0; 
+        }
     }
 shutdown: 
+    http_connection_cache_refresh_drop(ctx); 
+    http_shutdown_close_connections(ctx); 
+    http_proxy_reap(ctx); 
+    items_reap(ctx); 
     free(events); 
     return 0;
 }
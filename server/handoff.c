@@ -0,0 +1,176 @@
+#define _GNU_SOURCE /* accept4 */ 
+#include <assert.h> 
+#include <errno.h> 
+#include <stdio.h> 
+#include <string.h> 
+#include <sys/socket.h> 
+#include <sys/time.h> 
+#include <sys/un.h> 
+#include <unistd.h> 
+
+#include <loom/handoff.h> 
+
+#define HANDOFF_PLAIN   0x1
+#define HANDOFF_TLS     0x2
+
+static int unix_address(const char* path, struct sockaddr_un* addr); 
+
+int http_handoff_receive(const char* path, int fds[HTTP_MAX_LISTENERS])
+{
+    fds[0] = fds[1] = -1; 
+    struct sockaddr_un addr; 
+    if (unix_address(path, &addr) == -1)
+        return -1; 
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0); 
+    if (sock == -1)
+    {
+        perror("socket"); 
+        return -1; 
+    }
+
+    if (connect(sock, (struct sockaddr*)&addr, sizeof addr) == -1)
+    {
+        close(sock); 
+        /* no previous server (or a stale socket file), bind as usual */ 
+        if (errno == ENOENT || errno == ECONNREFUSED)
+            return 0; 
+        perror("connect"); 
+        return -1; 
+    }
+
+    /* the old server answers from its event loop, don't hang if it's stuck */ 
+    struct timeval tv = { HTTP_HANDOFF_TIMEOUT, 0 }; 
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv); 
+
+    unsigned char which = 0; 
+    struct iovec iov = { &which, 1 }; 
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HTTP_MAX_LISTENERS)]; 
+        struct cmsghdr align; 
+    } control; 
+    struct msghdr msg; 
+    memset(&msg, 0, sizeof msg); 
+    msg.msg_iov = &iov; 
+    msg.msg_iovlen = 1; 
+    msg.msg_control = control.buf; 
+    msg.msg_controllen = sizeof control.buf; 
+
+    ssize_t n; 
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC); 
+    } while (n == -1 && errno == EINTR); 
+    close(sock); 
+    if (n != 1)
+    {
+        if (n == -1)
+            perror("recvmsg"); 
+        return -1; 
+    }
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); 
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        return -1; 
+    int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int); 
+    int received[HTTP_MAX_LISTENERS]; 
+    memcpy(received, CMSG_DATA(cmsg), count * sizeof(int)); 
+
+    int expected = !!(which & HANDOFF_PLAIN) + !!(which & HANDOFF_TLS); 
+    if (count != expected || !(which & HANDOFF_PLAIN))
+    {
+        for (int i = 0; i < count; i++)
+            close(received[i]); 
+        return -1; 
+    }
+    fds[0] = received[0]; 
+    if (which & HANDOFF_TLS)
+        fds[1] = received[1]; 
+    return 1; 
+}
+
+int http_handoff_listen(const char* path)
+{
+    struct sockaddr_un addr; 
+    if (unix_address(path, &addr) == -1)
+        return -1; 
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0); 
+    if (sock == -1)
+    {
+        perror("socket"); 
+        return -1; 
+    }
+
+    /* the previous server keeps its connected socket, the path is ours now */ 
+    unlink(path); 
+    if (bind(sock, (struct sockaddr*)&addr, sizeof addr) == -1 || listen(sock, 1) == -1)
+    {
+        perror("handoff socket"); 
+        close(sock); 
+        return -1; 
+    }
+    return sock; 
+}
+
+int http_handoff_send(Http_server_context_t* ctx)
+{
+    assert(ctx->handoff_fd != -1); 
+    int sock = accept4(ctx->handoff_fd, NULL, NULL, SOCK_CLOEXEC); 
+    if (sock == -1)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            perror("accept"); 
+        return -1; 
+    }
+
+    unsigned char which = HANDOFF_PLAIN; 
+    int fds[HTTP_MAX_LISTENERS] = { ctx->listen_fd }; 
+    int count = 1; 
+    if (ctx->tls_listen_fd != -1)
+    {
+        which |= HANDOFF_TLS; 
+        fds[count++] = ctx->tls_listen_fd; 
+    }
+
+    struct iovec iov = { &which, 1 }; 
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HTTP_MAX_LISTENERS)]; 
+        struct cmsghdr align; 
+    } control; 
+    memset(&control, 0, sizeof control); 
+    struct msghdr msg; 
+    memset(&msg, 0, sizeof msg); 
+    msg.msg_iov = &iov; 
+    msg.msg_iovlen = 1; 
+    msg.msg_control = control.buf; 
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count); 
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); 
+    cmsg->cmsg_level = SOL_SOCKET; 
+    cmsg->cmsg_type = SCM_RIGHTS; 
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count); 
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count); 
+
+    /* one byte on a fresh unix socket, it doesn't block */ 
+    ssize_t n = sendmsg(sock, &msg, MSG_NOSIGNAL); 
+    close(sock); 
+    if (n != 1)
+    {
+        perror("sendmsg"); 
+        return -1; 
+    }
+    return 0; 
+}
+
+static int unix_address(const char* path, struct sockaddr_un* addr)
+{
+    memset(addr, 0, sizeof *addr); 
+    addr->sun_family = AF_UNIX; 
+    if (strlen(path) >= sizeof addr->sun_path)
+    {
+        fprintf(stderr, "Error: %s is too long for a unix socket\n", path); 
+        return -1; 
+    }
+    strcpy(addr->sun_path, path); 
+    return 0; 
+}
@@ -0,0 +1,621 @@
+#include <assert.h> 
+#include <stdio.h> 
+#include <stdlib.h> 
+#include <string.h> 
+
+#include <loom/hpack.h> 
+
+typedef struct Static_entry_s {
+    const char* name; 
+    const char* value; 
+} Static_entry_t; 
+
+#define STATIC_TABLE_LEN 61
+
+/* index 1 to 61 */ 
+static const Static_entry_t static_table[STATIC_TABLE_LEN] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+}; 
+
+/* huffman code from RFC 7541 appendix B, it's canonical so decoding only needs the first code of every length */ 
+static const uint32_t huff_codes[257] = {
+    0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+    0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+    0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+    0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+    0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+    0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+    0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+    0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+    0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+    0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+    0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+    0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+    0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+    0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+    0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+    0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+    0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+    0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+    0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+    0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+    0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+    0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+    0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+    0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+    0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+    0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+    0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+    0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+    0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+    0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+    0x3fffffff,
+}; 
+static const uint8_t huff_lens[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+}; 
+/* symbols sorted by code */ 
+static const uint16_t huff_syms[257] = {
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51,
+    52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109,
+    110, 112, 114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+    77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118,
+    119, 120, 121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39,
+    43, 124, 35, 62, 0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+    195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+    179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+    163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+    233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+    158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239, 9, 142,
+    144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+    200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+    212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+    2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+    21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220, 249, 10, 13, 22,
+    256,
+}; 
+/* a left aligned 32 bits window is below limit[len] if its code is len bits long */ 
+static const uint64_t huff_limit[31] = {
+    0, 0, 0, 0, 0, 0x50000000ull, 0xb8000000ull, 0xf8000000ull, 0xfe000000ull, 0, 0xff400000ull, 0xffa00000ull, 0xffc00000ull, 0xfff00000ull, 0xfff80000ull, 0xfffe0000ull, 0, 0, 0, 0xfffe6000ull, 0xfffee000ull, 0xffff4800ull, 0xffffb000ull, 0xffffea00ull, 0xfffff600ull, 0xfffff800ull, 0xfffffbc0ull, 0xfffffe20ull, 0xfffffff0ull, 0, 0x100000000ull,
+}; 
+static const uint32_t huff_first_code[31] = {
+    0, 0, 0, 0, 0, 0x0, 0x14, 0x5c, 0xf8, 0, 0x3f8, 0x7fa, 0xffa, 0x1ff8, 0x3ffc, 0x7ffc, 0, 0, 0, 0x7fff0, 0xfffe6, 0x1fffdc, 0x3fffd2, 0x7fffd8, 0xffffea, 0x1ffffec, 0x3ffffe0, 0x7ffffde, 0xfffffe2, 0, 0x3ffffffc,
+}; 
+static const uint16_t huff_first_index[31] = {
+    0, 0, 0, 0, 0, 0, 10, 36, 68, 0, 74, 79, 82, 84, 90, 92, 0, 0, 0, 95, 98, 106, 119, 145, 174, 186, 190, 205, 224, 0, 253,
+}; 
+
+/* fields that change with every response are not worth a table entry */ 
+static const char* never_indexed[] = {
+    "content-length", "content-range", "etag", "last-modified", "date", "age", "expires", "set-cookie",
+}; 
+
+static int int_decode(const uint8_t** p, const uint8_t* end, int prefix, size_t* out); 
+static int int_encode(uint8_t* out, size_t out_len, int prefix, uint8_t first, size_t value); 
+static int string_decode(const uint8_t** p, const uint8_t* end,
+                         char* scratch, size_t scratch_len,
+                         const char** str, size_t* len); 
+static int string_encode(uint8_t* out, size_t out_len, const char* str, size_t len); 
+static int huff_decode(const uint8_t* in, size_t len, char* out, size_t out_len); 
+static size_t huff_encoded_len(const char* str, size_t len); 
+static void huff_encode(const char* str, size_t len, uint8_t* out); 
+static int field_get(const Http_hpack_table_t* table, size_t index,
+                     const char** name, size_t* name_len,
+                     const char** value, size_t* value_len); 
+static void table_evict(Http_hpack_table_t* table, size_t needed); 
+static int table_add(Http_hpack_table_t* table,
+                     const char* name, size_t name_len,
+                     const char* value, size_t value_len); 
+
+void http_hpack_table_init(Http_hpack_table_t* table, size_t limit)
+{
+    assert(table != NULL); 
+    assert(limit <= HTTP_H2_HPACK_TABLE_SIZE); 
+    memset(table, 0, sizeof(Http_hpack_table_t)); 
+    table->max_size = limit; 
+    table->limit = limit; 
+}
+
+void http_hpack_table_clean(Http_hpack_table_t* table)
+{
+    table_evict(table, table->max_size + 1); /* everything */ 
+}
+
+void http_hpack_table_set_limit(Http_hpack_table_t* table, size_t limit)
+{
+    if (limit > HTTP_H2_HPACK_TABLE_SIZE)
+        limit = HTTP_H2_HPACK_TABLE_SIZE; /* we are free to use less than the peer allows */ 
+    if (limit == table->max_size)
+        return; 
+    table->limit = limit; 
+    table->max_size = limit; 
+    table_evict(table, 0); 
+    table->size_update = 1; 
+}
+
+int http_hpack_decode(Http_hpack_table_t* table, const uint8_t* in, size_t len,
+                      Http_hpack_field_cb cb, void* arg)
+{
+    assert(table != NULL); 
+    assert(cb != NULL); 
+
+    /* huffman strings grow at most 8/5, the name goes first and the value after it */ 
+    char scratch[HTTP_H2_MAX_HEADER_BLOCK * 8 / 5 + 1]; 
+    const uint8_t* p = in; 
+    const uint8_t* end = in + len; 
+    int fields = 0; 
+
+    while (p < end)
+    {
+        const char* name; 
+        const char* value; 
+        size_t name_len, value_len, index; 
+        uint8_t b = *p; 
+
+        if (b & 0x80) /* indexed field */ 
+        {
+            if (int_decode(&p, end, 7, &index) == -1 ||
+                field_get(table, index, &name, &name_len, &value, &value_len) == -1)
+                return -1; 
+        }
+        else if ((b & 0xe0) == 0x20) /* dynamic table size update */ 
+        {
+            size_t size; 
+            if (fields || int_decode(&p, end, 5, &size) == -1 || size > table->limit)
+                return -1; 
+            table->max_size = size; 
+            table_evict(table, 0); 
+            continue; 
+        }
+        else /* literal, 01 is added to the table, 0000 and 0001 are not */ 
+        {
+            int indexing = (b & 0xc0) == 0x40; 
+            if (int_decode(&p, end, indexing ? 6 : 4, &index) == -1)
+                return -1; 
+
+            if (index)
+            {
+                const char* unused; 
+                size_t unused_len; 
+                if (field_get(table, index, &name, &name_len, &unused, &unused_len) == -1)
+                    return -1; 
+            }
+            else if (string_decode(&p, end, scratch, sizeof scratch, &name, &name_len) == -1)
+                return -1; 
+
+            size_t used = name == scratch ? name_len : 0; 
+            if (string_decode(&p, end, scratch + used, sizeof scratch - used, &value, &value_len) == -1)
+                return -1; 
+
+            if (indexing)
+            {
+                /* an indexed name is one of the entries the add can evict, the callback gets the copy */ 
+                int stored = name_len + value_len + HTTP_HPACK_ENTRY_OVERHEAD <= table->max_size; 
+                if (index && !stored)
+                {
+                    /* the table is emptied and nothing is stored, the name goes after the value */ 
+                    size_t at = value == scratch ? value_len : 0; 
+                    if (name_len > sizeof scratch - at)
+                        return -1; 
+                    memcpy(scratch + at, name, name_len); 
+                    name = scratch + at; 
+                }
+                if (table_add(table, name, name_len, value, value_len) == -1)
+                    return -1; 
+                if (stored)
+                {
+                    const Http_hpack_entry_t* entry = &table->entries[table->head]; 
+                    name = entry->name; 
+                    value = entry->value; 
+                }
+            }
+        }
+
+        fields++; 
+        if (cb(arg, name, name_len, value, value_len) == -1)
+            return -1; 
+    }
+    return 0; 
+}
+
+int http_hpack_encode(Http_hpack_table_t* table, uint8_t* out, size_t out_len,
+                      const char* name, size_t name_len,
+                      const char* value, size_t value_len)
+{
+    assert(table != NULL); 
+    assert(out != NULL); 
+
+    size_t n = 0; 
+    int r; 
+    if (table->size_update)
+    {
+        if ((r = int_encode(out, out_len, 5, 0x20, table->max_size)) == -1)
+            return -1; 
+        n += r; 
+        table->size_update = 0; 
+    }
+
+    size_t name_index = 0; 
+    for (size_t i = 0; i < STATIC_TABLE_LEN; i++)
+    {
+        const Static_entry_t* entry = &static_table[i]; 
+        if (strlen(entry->name) != name_len || memcmp(entry->name, name, name_len))
+            continue; 
+        if (!name_index)
+            name_index = i + 1; 
+        if (strlen(entry->value) == value_len && !memcmp(entry->value, value, value_len))
+        {
+            if ((r = int_encode(out + n, out_len - n, 7, 0x80, i + 1)) == -1)
+                return -1; 
+            return n + r; 
+        }
+    }
+    for (size_t i = 1; i <= table->count; i++)
+    {
+        const char *entry_name, *entry_value; 
+        size_t entry_name_len, entry_value_len; 
+        field_get(table, STATIC_TABLE_LEN + i, &entry_name, &entry_name_len, &entry_value, &entry_value_len); 
+        if (entry_name_len != name_len || memcmp(entry_name, name, name_len))
+            continue; 
+        if (!name_index)
+            name_index = STATIC_TABLE_LEN + i; 
+        if (entry_value_len == value_len && !memcmp(entry_value, value, value_len))
+        {
+            if ((r = int_encode(out + n, out_len - n, 7, 0x80, STATIC_TABLE_LEN + i)) == -1)
+                return -1; 
+            return n + r; 
+        }
+    }
+
+    int indexing = name_len + value_len + HTTP_HPACK_ENTRY_OVERHEAD <= table->max_size; 
+    for (size_t i = 0; indexing && i < sizeof never_indexed / sizeof never_indexed[0]; i++)
+    {
+        if (strlen(never_indexed[i]) == name_len && !memcmp(never_indexed[i], name, name_len))
+            indexing = 0; 
+    }
+
+    if ((r = int_encode(out + n, out_len - n, indexing ? 6 : 4, indexing ? 0x40 : 0x00, name_index)) == -1)
+        return -1; 
+    n += r; 
+    if (!name_index)
+    {
+        if ((r = string_encode(out + n, out_len - n, name, name_len)) == -1)
+            return -1; 
+        n += r; 
+    }
+    if ((r = string_encode(out + n, out_len - n, value, value_len)) == -1)
+        return -1; 
+    n += r; 
+
+    /* the decoder adds it too, both tables stay the same */ 
+    if (indexing && table_add(table, name, name_len, value, value_len) == -1)
+        return -1; 
+    return n; 
+}
+
+static int int_decode(const uint8_t** p, const uint8_t* end, int prefix, size_t* out)
+{
+    if (*p >= end)
+        return -1; 
+    size_t max = (1u << prefix) - 1; 
+    size_t value = *(*p)++ & max; 
+    if (value < max)
+    {
+        *out = value; 
+        return 0; 
+    }
+
+    for (unsigned shift = 0; *p < end && shift <= 28; shift += 7)
+    {
+        uint8_t b = *(*p)++; 
+        value += (size_t)(b & 0x7f) << shift; 
+        if (!(b & 0x80))
+        {
+            *out = value; 
+            return 0; 
+        }
+    }
+    return -1; /* truncated or way too big */ 
+}
+
+static int int_encode(uint8_t* out, size_t out_len, int prefix, uint8_t first, size_t value)
+{
+    size_t max = (1u << prefix) - 1; 
+    size_t n = 0; 
+    if (out_len < 1)
+        return -1; 
+    if (value < max)
+    {
+        out[0] = first | value; 
+        return 1; 
+    }
+
+    out[n++] = first | max; 
+    value -= max; 
+    while (value >= 0x80)
+    {
+        if (n >= out_len)
+            return -1; 
+        out[n++] = (value & 0x7f) | 0x80; 
+        value >>= 7; 
+    }
+    if (n >= out_len)
+        return -1; 
+    out[n++] = value; 
+    return n; 
+}
+
+/* raw strings point into the input, huffman ones are decoded into scratch */ 
+static int string_decode(const uint8_t** p, const uint8_t* end,
+                         char* scratch, size_t scratch_len,
+                         const char** str, size_t* len)
+{
+    if (*p >= end)
+        return -1; 
+    int huffman = **p & 0x80; 
+    size_t raw_len; 
+    if (int_decode(p, end, 7, &raw_len) == -1 || raw_len > (size_t)(end - *p))
+        return -1; 
+
+    if (huffman)
+    {
+        int n = huff_decode(*p, raw_len, scratch, scratch_len); 
+        if (n == -1)
+            return -1; 
+        *str = scratch; 
+        *len = n; 
+    }
+    else
+    {
+        *str = (const char*)*p; 
+        *len = raw_len; 
+    }
+    *p += raw_len; 
+    return 0; 
+}
+
+static int string_encode(uint8_t* out, size_t out_len, const char* str, size_t len)
+{
+    size_t huff_len = huff_encoded_len(str, len); 
+    int huffman = huff_len < len; 
+    size_t data_len = huffman ? huff_len : len; 
+
+    int n = int_encode(out, out_len, 7, huffman ? 0x80 : 0x00, data_len); 
+    if (n == -1 || data_len > out_len - n)
+        return -1; 
+    if (huffman)
+        huff_encode(str, len, out + n); 
+    else
+        memcpy(out + n, str, len); 
+    return n + data_len; 
+}
+
+static int huff_decode(const uint8_t* in, size_t len, char* out, size_t out_len)
+{
+    const uint8_t* end = in + len; 
+    uint64_t acc = 0; 
+    unsigned nbits = 0; 
+    size_t n = 0; 
+
+    for (;;)
+    {
+        while (nbits <= 56 && in < end)
+        {
+            acc = acc << 8 | *in++; 
+            nbits += 8; 
+        }
+        if (nbits == 0)
+            break; 
+
+        /* the next 32 bits, the missing ones at the end are 1 like the padding */ 
+        uint32_t window; 
+        if (nbits >= 32)
+            window = (uint32_t)(acc >> (nbits - 32)); 
+        else
+            window = (uint32_t)(acc << (32 - nbits)) | (uint32_t)((1ull << (32 - nbits)) - 1); 
+
+        unsigned code_len = 5; 
+        while (window >= huff_limit[code_len])
+            code_len++; 
+
+        if (code_len > nbits) /* only padding is left: at most 7 bits, all 1 */ 
+        {
+            uint64_t mask = (1ull << nbits) - 1; 
+            if (nbits > 7 || (acc & mask) != mask)
+                return -1; 
+            break; 
+        }
+
+        uint16_t sym = huff_syms[huff_first_index[code_len] + (window >> (32 - code_len)) - huff_first_code[code_len]]; 
+        if (sym == 256 || n >= out_len) /* EOS can't be in a string */ 
+            return -1; 
+        out[n++] = sym; 
+        nbits -= code_len; 
+    }
+    return n; 
+}
+
+static size_t huff_encoded_len(const char* str, size_t len)
+{
+    size_t bits = 0; 
+    for (size_t i = 0; i < len; i++)
+        bits += huff_lens[(uint8_t)str[i]]; 
+    return (bits + 7) / 8; 
+}
+
+static void huff_encode(const char* str, size_t len, uint8_t* out)
+{
+    uint64_t acc = 0; 
+    unsigned nbits = 0; 
+    for (size_t i = 0; i < len; i++)
+    {
+        uint8_t c = str[i]; 
+        acc = acc << huff_lens[c] | huff_codes[c]; 
+        nbits += huff_lens[c]; 
+        while (nbits >= 8)
+        {
+            *out++ = acc >> (nbits - 8); 
+            nbits -= 8; 
+        }
+    }
+    if (nbits) /* pad with the start of EOS */ 
+        *out = (acc << (8 - nbits)) | (0xff >> nbits); 
+}
+
+/* index is 1 based, the static table comes first */ 
+static int field_get(const Http_hpack_table_t* table, size_t index,
+                     const char** name, size_t* name_len,
+                     const char** value, size_t* value_len)
+{
+    if (index == 0)
+        return -1; 
+    if (index <= STATIC_TABLE_LEN)
+    {
+        *name = static_table[index - 1].name; 
+        *name_len = strlen(*name); 
+        *value = static_table[index - 1].value; 
+        *value_len = strlen(*value); 
+        return 0; 
+    }
+
+    index -= STATIC_TABLE_LEN; 
+    if (index > table->count)
+        return -1; 
+    const Http_hpack_entry_t* entry = &table->entries[(table->head + HTTP_HPACK_MAX_ENTRIES - (index - 1)) % HTTP_HPACK_MAX_ENTRIES]; 
+    *name = entry->name; 
+    *name_len = entry->name_len; 
+    *value = entry->value; 
+    *value_len = entry->value_len; 
+    return 0; 
+}
+
+/* drop the oldest entries until there is room for needed bytes */ 
+static void table_evict(Http_hpack_table_t* table, size_t needed)
+{
+    while (table->count > 0 && table->size + needed > table->max_size)
+    {
+        size_t oldest = (table->head + HTTP_HPACK_MAX_ENTRIES - (table->count - 1)) % HTTP_HPACK_MAX_ENTRIES; 
+        Http_hpack_entry_t* entry = &table->entries[oldest]; 
+        table->size -= entry->name_len + entry->value_len + HTTP_HPACK_ENTRY_OVERHEAD; 
+        free(entry->name); 
+        entry->name = entry->value = NULL; 
+        table->count--; 
+    }
+}
+
+static int table_add(Http_hpack_table_t* table,
+                     const char* name, size_t name_len,
+                     const char* value, size_t value_len)
+{
+    size_t size = name_len + value_len + HTTP_HPACK_ENTRY_OVERHEAD; 
+
+    /* copy first, the name can come from an entry that is about to be evicted (the caller re-points it) */ 
+    char* mem = NULL; 
+    if (size <= table->max_size)
+    {
+        mem = malloc(name_len + value_len + 2); 
+        if (!mem)
+        {
+            perror("malloc"); 
+            return -1; 
+        }
+        memcpy(mem, name, name_len); 
+        mem[name_len] = '\0'; 
+        memcpy(mem + name_len + 1, value, value_len); 
+        mem[name_len + 1 + value_len] = '\0'; 
+    }
+
+    /* an entry bigger than the table just empties it */ 
+    table_evict(table, size); 
+    if (!mem)
+        return 0; 
+
+    assert(table->count < HTTP_HPACK_MAX_ENTRIES); 
+    table->head = (table->head + 1) % HTTP_HPACK_MAX_ENTRIES; 
+    Http_hpack_entry_t* entry = &table->entries[table->head]; 
+    entry->name = mem; 
+    entry->name_len = name_len; 
+    entry->value = mem + name_len + 1; 
+    entry->value_len = value_len; 
+    table->size += size; 
+    table->count++; 
+    return 0; 
+}
@@ -0,0 +1,1334 @@
+#include <assert.h> 
+#include <ctype.h> 
+#include <errno.h> 
+#include <stdio.h> 
+#include <stdlib.h> 
+#include <string.h> 
+#include <strings.h> 
+#include <unistd.h> 
+
+#include <loom/http2.h> 
+#include <loom/connection.h> 
+#include <loom/compress.h> 
+#include <loom/access_log.h> 
+
+/* frame types */ 
+#define FRAME_DATA              0x0
+#define FRAME_HEADERS           0x1
+#define FRAME_PRIORITY          0x2
+#define FRAME_RST_STREAM        0x3
+#define FRAME_SETTINGS          0x4
+#define FRAME_PUSH_PROMISE      0x5
+#define FRAME_PING              0x6
+#define FRAME_GOAWAY            0x7
+#define FRAME_WINDOW_UPDATE     0x8
+#define FRAME_CONTINUATION      0x9
+
+/* frame flags */ 
+#define FLAG_END_STREAM         0x1
+#define FLAG_ACK                0x1
+#define FLAG_END_HEADERS        0x4
+#define FLAG_PADDED             0x8
+#define FLAG_PRIORITY           0x20
+
+#define SETTINGS_HEADER_TABLE_SIZE      0x1
+#define SETTINGS_ENABLE_PUSH            0x2
+#define SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define SETTINGS_INITIAL_WINDOW_SIZE    0x4
+#define SETTINGS_MAX_FRAME_SIZE         0x5
+#define SETTINGS_MAX_HEADER_LIST_SIZE   0x6
+
+/* error codes */ 
+#define ERR_NO_ERROR            0x0
+#define ERR_PROTOCOL            0x1
+#define ERR_INTERNAL            0x2
+#define ERR_FLOW_CONTROL        0x3
+#define ERR_STREAM_CLOSED       0x5
+#define ERR_FRAME_SIZE          0x6
+#define ERR_REFUSED_STREAM      0x7
+#define ERR_COMPRESSION         0x9
+#define ERR_ENHANCE_YOUR_CALM   0xb
+
+#define DEFAULT_WINDOW          65535
+#define MAX_WINDOW              0x7fffffff
+#define MAX_FRAME_SIZE_LIMIT    16777215
+#define MAX_SETTINGS_HEADER     256 /* HTTP2-Settings of an upgrade */ 
+
+#define SWITCHING_PROTOCOLS \
+    "HTTP/1.1 101 Switching Protocols\r\n" \
+    "Connection: Upgrade\r\n" \
+    "Upgrade: h2c\r\n\r\n"
+
+/* not allowed in http/2 (the framing replaces them) */ 
+static const char* hop_by_hop_headers[] = {
+    "connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade",
+}; 
+
+static void session_process(Http_connection_t* con, Http_h2_session_t* s); 
+static void session_schedule(Http_connection_t* con, Http_h2_session_t* s); 
+static int  session_produce(Http_h2_session_t* s); 
+static int  session_can_produce(const Http_h2_session_t* s); 
+static void connection_error(Http_connection_t* con, Http_h2_session_t* s, uint32_t code); 
+static void frame_handle(Http_connection_t* con, Http_h2_session_t* s,
+                         uint8_t type, uint8_t flags, uint32_t id,
+                         const uint8_t* payload, size_t len); 
+static void data_frame(Http_connection_t* con, Http_h2_session_t* s,
+                       uint8_t flags, uint32_t id, const uint8_t* payload, size_t len); 
+static void headers_frame(Http_connection_t* con, Http_h2_session_t* s,
+                          uint8_t flags, uint32_t id, const uint8_t* payload, size_t len); 
+static void continuation_frame(Http_connection_t* con, Http_h2_session_t* s,
+                               uint8_t flags, uint32_t id, const uint8_t* payload, size_t len); 
+static void header_block(Http_connection_t* con, Http_h2_session_t* s,
+                         uint32_t id, const uint8_t* block, size_t len, int end_stream); 
+static int  settings_apply(Http_h2_session_t* s, const uint8_t* payload, size_t len, uint32_t* error); 
+static void window_update_frame(Http_connection_t* con, Http_h2_session_t* s,
+                                uint32_t id, const uint8_t* payload, size_t len); 
+static uint8_t* frame_reserve(Http_h2_session_t* s, uint8_t type, uint8_t flags, uint32_t id, size_t len); 
+static int  frame_write(Http_h2_session_t* s, uint8_t type, uint8_t flags, uint32_t id,
+                        const void* payload, size_t len); 
+static int  window_update_write(Http_h2_session_t* s, uint32_t id, uint32_t increment); 
+static Http_h2_stream_t* stream_open(Http_h2_session_t* s, uint32_t id); 
+static Http_h2_stream_t* stream_find(Http_h2_session_t* s, uint32_t id); 
+static void stream_close(Http_h2_session_t* s, Http_h2_stream_t* st); 
+static void stream_reset(Http_h2_session_t* s, Http_h2_stream_t* st, uint32_t code); 
+static void stream_dispatch(Http_connection_t* con, Http_h2_session_t* s, Http_h2_stream_t* st); 
+static int  stream_send_headers(Http_h2_session_t* s, Http_h2_stream_t* st); 
+static int  stream_send_data(Http_h2_session_t* s, Http_h2_stream_t* st); 
+static char* field_store(Http_h2_stream_t* st, const char* str, size_t len); 
+static int  field_add(void* arg, const char* name, size_t name_len, const char* value, size_t value_len); 
+static int  field_ignore(void* arg, const char* name, size_t name_len, const char* value, size_t value_len); 
+static int  stream_from_request(Http_h2_stream_t* st, Http_request_t* request); 
+static int  base64url_decode(Http_slice_t in, uint8_t* out, size_t out_len); 
+
+static inline uint32_t read_u32(const uint8_t* p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3]; 
+}
+
+static inline void write_u32(uint8_t* p, uint32_t v)
+{
+    p[0] = v >> 24; 
+    p[1] = v >> 16; 
+    p[2] = v >> 8; 
+    p[3] = v; 
+}
+
+int http_h2_is_preface(const char* buff, size_t len)
+{
+    if (len == 0)
+        return 0; 
+    if (len > HTTP_H2_PREFACE_LEN)
+        len = HTTP_H2_PREFACE_LEN; 
+    return !memcmp(buff, HTTP_H2_PREFACE, len); 
+}
+
+int http_h2_upgrade_requested(Http_request_t* request)
+{
+    Http_slice_t upgrade = http_request_header(request, "Upgrade"); 
+    Http_slice_t settings = http_request_header(request, "HTTP2-Settings"); 
+    if (!upgrade.ptr || !settings.ptr)
+        return 0; 
+
+    /* the settings must be valid or the request is served over http/1.1 */ 
+    uint8_t payload[MAX_SETTINGS_HEADER]; 
+    int len = base64url_decode(settings, payload, sizeof payload); 
+    if (len == -1 || len % 6)
+        return 0; 
+
+    /* Upgrade is a list of protocols */ 
+    const char* p = upgrade.ptr; 
+    const char* end = upgrade.ptr + upgrade.len; 
+    while (p < end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            p++; 
+        const char* token = p; 
+        while (p < end && *p != ',' && *p != ' ' && *p != '\t')
+            p++; 
+        if (p - token == 3 && !strncasecmp(token, "h2c", 3))
+            return 1; 
+    }
+    return 0; 
+}
+
+int http_h2_start(Http_connection_t* con, int upgrade)
+{
+    assert(con != NULL && con->h2 == NULL); 
+
+    Http_h2_session_t* s = calloc(1, sizeof(Http_h2_session_t)); 
+    if (!s)
+    {
+        perror("calloc"); 
+        return -1; 
+    }
+    http_hpack_table_init(&s->decoder, HTTP_H2_HPACK_TABLE_SIZE); 
+    http_hpack_table_init(&s->encoder, HTTP_H2_HPACK_TABLE_SIZE); 
+    s->send_window = DEFAULT_WINDOW; 
+    s->peer_initial_window = DEFAULT_WINDOW; 
+    s->peer_max_frame = HTTP_H2_MAX_FRAME_SIZE; 
+    s->preface_pending = 1; 
+    con->h2 = s; 
+
+    size_t consumed = 0; 
+    if (upgrade)
+    {
+        size_t len = sizeof SWITCHING_PROTOCOLS - 1; 
+        if (len > HTTP_RESPONSE_SIZE - con->response_len)
+            return -1; 
+        memcpy(con->response + con->response_len, SWITCHING_PROTOCOLS, len); 
+        con->response_len += len; 
+
+        /* the settings of the upgrade act like the first SETTINGS frame of the client */ 
+        uint8_t payload[MAX_SETTINGS_HEADER]; 
+        uint32_t error; 
+        int payload_len = base64url_decode(http_request_header(&con->request, "HTTP2-Settings"),
+                                           payload, sizeof payload); 
+        if (payload_len == -1 || settings_apply(s, payload, payload_len, &error) == -1)
+            return -1; 
+        consumed = con->header_len + con->body_len; 
+    }
+
+    /* the server preface */ 
+    uint8_t settings[12]; 
+    settings[0] = 0; 
+    settings[1] = SETTINGS_MAX_CONCURRENT_STREAMS; 
+    write_u32(settings + 2, HTTP_H2_MAX_STREAMS); 
+    settings[6] = 0; 
+    settings[7] = SETTINGS_MAX_HEADER_LIST_SIZE; 
+    write_u32(settings + 8, HTTP_REQUEST_SIZE); 
+    if (frame_write(s, FRAME_SETTINGS, 0, 0, settings, sizeof settings) == -1)
+        return -1; 
+
+    if (upgrade)
+    {
+        /* the request that asked for the upgrade is answered on stream 1 */ 
+        Http_h2_stream_t* st = stream_open(s, 1); 
+        if (!st)
+            return -1; 
+        s->last_stream_id = 1; 
+        if (stream_from_request(st, &con->request) == -1)
+            st->too_large = 1; 
+        stream_dispatch(con, s, st); 
+    }
+
+    /* what's left is http/2 already */ 
+    size_t remains = con->buff_len - consumed; 
+    memcpy(s->in, con->buff + consumed, remains); 
+    s->in_len = remains; 
+    con->buff_len = 0; 
+    con->body_len = 0; 
+    HTTP_SET_READ_STATE(con->flags, HTTP_READING_HEADERS); 
+
+    session_process(con, s); 
+    session_schedule(con, s); 
+    return 0; 
+}
+
+void http_h2_free(Http_connection_t* con)
+{
+    Http_h2_session_t* s = con->h2; 
+    if (!s)
+        return; 
+
+    for (size_t i = 0; i < HTTP_H2_MAX_STREAMS; i++)
+    {
+        if (s->streams[i])
+            stream_close(s, s->streams[i]); 
+    }
+    http_hpack_table_clean(&s->decoder); 
+    http_hpack_table_clean(&s->encoder); 
+    free(s->block); 
+    free(s->out); 
+    free(s); 
+    con->h2 = NULL; 
+}
+
+void http_h2_read(Http_connection_t* con)
+{
+    Http_h2_session_t* s = con->h2; 
+    assert(s != NULL); 
+
+    while (!s->goaway_sent)
+    {
+        /* a whole frame always fits so there is room after processing */ 
+        ssize_t n = http_connection_recv(con, (char*)s->in + s->in_len, sizeof s->in - s->in_len); 
+        if (n == 0)
+            break; 
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("read"); 
+            break; 
+        }
+        s->in_len += n; 
+        session_process(con, s); 
+    }
+    session_schedule(con, s); 
+}
+
+void http_h2_write(Http_connection_t* con)
+{
+    Http_h2_session_t* s = con->h2; 
+    assert(s != NULL); 
+
+    for (;;)
+    {
+        while (s->out_sent < s->out_len)
+        {
+            ssize_t n = http_connection_send(con, (char*)s->out + s->out_sent, s->out_len - s->out_sent); 
+            if (n == -1)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return; 
+                perror("write"); 
+                HTTP_SET_SHOULD_CLOSE(con->flags); 
+                HTTP_CLEAR_WRITING(con->flags); 
+                return; 
+            }
+            s->out_sent += n; 
+        }
+        s->out_len = 0; 
+        s->out_sent = 0; 
+
+        if (s->goaway_sent || !session_produce(s))
+            break; 
+    }
+
+    HTTP_CLEAR_WRITING(con->flags); 
+    if (s->goaway_received && s->stream_count == 0)
+        HTTP_SET_SHOULD_CLOSE(con->flags); 
+}
+
+void http_h2_drain(Http_connection_t* con)
+{
+    Http_h2_session_t* s = con->h2; 
+    assert(s != NULL); 
+    if (s->goaway_sent || s->goaway_received)
+        return; 
+
+    if (s->stream_count == 0)
+    {
+        connection_error(con, s, ERR_NO_ERROR); 
+        return; 
+    }
+
+    /* the same as the client's own GOAWAY: no new streams, close after the last one */ 
+    uint8_t payload[8]; 
+    write_u32(payload, s->last_stream_id); 
+    write_u32(payload + 4, ERR_NO_ERROR); 
+    frame_write(s, FRAME_GOAWAY, 0, 0, payload, sizeof payload); 
+    s->goaway_received = 1; 
+    HTTP_SET_WRITING(con->flags); 
+}
+
+/* handle every complete frame of the input buffer */ 
+static void session_process(Http_connection_t* con, Http_h2_session_t* s)
+{
+    size_t pos = 0; 
+
+    if (s->preface_pending)
+    {
+        if (s->in_len == 0)
+            return; 
+        if (!http_h2_is_preface((char*)s->in, s->in_len))
+        {
+            connection_error(con, s, ERR_PROTOCOL); 
+            return; 
+        }
+        if (s->in_len < HTTP_H2_PREFACE_LEN)
+            return; 
+        pos = HTTP_H2_PREFACE_LEN; 
+        s->preface_pending = 0; 
+    }
+
+    while (!s->goaway_sent && s->in_len - pos >= HTTP_H2_FRAME_HEADER)
+    {
+        const uint8_t* h = s->in + pos; 
+        size_t len = (size_t)h[0] << 16 | (size_t)h[1] << 8 | h[2]; 
+        if (len > HTTP_H2_MAX_FRAME_SIZE)
+        {
+            connection_error(con, s, ERR_FRAME_SIZE); 
+            break; 
+        }
+        if (s->in_len - pos < HTTP_H2_FRAME_HEADER + len)
+            break; 
+
+        frame_handle(con, s, h[3], h[4], read_u32(h + 5) & MAX_WINDOW, h + HTTP_H2_FRAME_HEADER, len); 
+        pos += HTTP_H2_FRAME_HEADER + len; 
+    }
+
+    if (s->goaway_sent)
+    {
+        s->in_len = 0; 
+        return; 
+    }
+    if (pos > 0)
+    {
+        memmove(s->in, s->in + pos, s->in_len - pos); 
+        s->in_len -= pos; 
+    }
+
+    /* give the connection window back in big steps */ 
+    if (s->recv_consumed >= DEFAULT_WINDOW / 2)
+    {
+        window_update_write(s, 0, s->recv_consumed); 
+        s->recv_consumed = 0; 
+    }
+}
+
+static void session_schedule(Http_connection_t* con, Http_h2_session_t* s)
+{
+    if (s->goaway_received && s->stream_count == 0 && !s->goaway_sent)
+        connection_error(con, s, ERR_NO_ERROR); 
+    if (s->out_len > s->out_sent || session_can_produce(s))
+        HTTP_SET_WRITING(con->flags); 
+}
+
+static void connection_error(Http_connection_t* con, Http_h2_session_t* s, uint32_t code)
+{
+    if (s->goaway_sent)
+        return; 
+
+    uint8_t payload[8]; 
+    write_u32(payload, s->last_stream_id); 
+    write_u32(payload + 4, code); 
+    frame_write(s, FRAME_GOAWAY, 0, 0, payload, sizeof payload); 
+    s->goaway_sent = 1; 
+
+    /* flush the GOAWAY and close */ 
+    HTTP_SET_SHOULD_CLOSE(con->flags); 
+    HTTP_SET_WRITING(con->flags); 
+}
+
+static void frame_handle(Http_connection_t* con, Http_h2_session_t* s,
+                         uint8_t type, uint8_t flags, uint32_t id,
+                         const uint8_t* payload, size_t len)
+{
+    /* nothing can come between a header block and its continuations */ 
+    if (s->continuation_id && type != FRAME_CONTINUATION)
+    {
+        connection_error(con, s, ERR_PROTOCOL); 
+        return; 
+    }
+
+    switch (type)
+    {
+        case FRAME_DATA: 
+            data_frame(con, s, flags, id, payload, len); 
+            break; 
+
+        case FRAME_HEADERS: 
+            headers_frame(con, s, flags, id, payload, len); 
+            break; 
+
+        case FRAME_CONTINUATION: 
+            continuation_frame(con, s, flags, id, payload, len); 
+            break; 
+
+        case FRAME_PRIORITY: /* every stream gets the same share */ 
+            if (id == 0)
+                connection_error(con, s, ERR_PROTOCOL); 
+            else if (len != 5)
+                connection_error(con, s, ERR_FRAME_SIZE); 
+            break; 
+
+        case FRAME_RST_STREAM: 
+        {
+            if (id == 0 || id > s->last_stream_id)
+            {
+                connection_error(con, s, ERR_PROTOCOL); 
+                break; 
+            }
+            if (len != 4)
+            {
+                connection_error(con, s, ERR_FRAME_SIZE); 
+                break; 
+            }
+            Http_h2_stream_t* st = stream_find(s, id); 
+            if (st)
+                stream_close(s, st); 
+        }
+        break; 
+
+        case FRAME_SETTINGS: 
+        {
+            if (id != 0)
+            {
+                connection_error(con, s, ERR_PROTOCOL); 
+                break; 
+            }
+            if (flags & FLAG_ACK)
+            {
+                if (len != 0)
+                    connection_error(con, s, ERR_FRAME_SIZE); 
+                break; 
+            }
+            uint32_t error; 
+            if (settings_apply(s, payload, len, &error) == -1)
+            {
+                connection_error(con, s, error); 
+                break; 
+            }
+            frame_write(s, FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0); 
+        }
+        break; 
+
+        case FRAME_PUSH_PROMISE: /* clients can't push */ 
+            connection_error(con, s, ERR_PROTOCOL); 
+            break; 
+
+        case FRAME_PING: 
+            if (id != 0)
+                connection_error(con, s, ERR_PROTOCOL); 
+            else if (len != 8)
+                connection_error(con, s, ERR_FRAME_SIZE); 
+            else if (!(flags & FLAG_ACK))
+                frame_write(s, FRAME_PING, FLAG_ACK, 0, payload, len); 
+            break; 
+
+        case FRAME_GOAWAY: /* finish the streams we have and close */ 
+            if (id != 0)
+                connection_error(con, s, ERR_PROTOCOL); 
+            else
+                s->goaway_received = 1; 
+            break; 
+
+        case FRAME_WINDOW_UPDATE: 
+            window_update_frame(con, s, id, payload, len); 
+            break; 
+
+        default: /* unknown frames are ignored */ 
+            break; 
+    }
+}
+
+/* removes the padding, returns -1 if the frame is malformed */ 
+static int frame_unpad(uint8_t flags, const uint8_t** payload, size_t* len)
+{
+    if (!(flags & FLAG_PADDED))
+        return 0; 
+    if (*len < 1)
+        return -1; 
+    size_t pad = (*payload)[0]; 
+    if (pad >= *len)
+        return -1; 
+    *payload += 1; 
+    *len -= 1 + pad; 
+    return 0; 
+}
+
+static void data_frame(Http_connection_t* con, Http_h2_session_t* s,
+                       uint8_t flags, uint32_t id, const uint8_t* payload, size_t len)
+{
+    if (id == 0)
+    {
+        connection_error(con, s, ERR_PROTOCOL); 
+        return; 
+    }
+    /* the padding counts for flow control too */ 
+    s->recv_consumed += len; 
+    size_t frame_len = len; 
+    if (frame_unpad(flags, &payload, &len) == -1)
+    {
+        connection_error(con, s, ERR_PROTOCOL); 
+        return; 
+    }
+
+    Http_h2_stream_t* st = stream_find(s, id); 
+    if (!st)
+    {
+        if (id > s->last_stream_id)
+        {
+            connection_error(con, s, ERR_PROTOCOL); 
+            return; 
+        }
+        uint8_t code[4]; 
+        write_u32(code, ERR_STREAM_CLOSED); 
+        frame_write(s, FRAME_RST_STREAM, 0, id, code, sizeof code); 
+        return; 
+    }
+    if (st->state != HTTP_H2_STREAM_OPEN)
+    {
+        stream_reset(s, st, ERR_STREAM_CLOSED); 
+        return; 
+    }
+
+    if (!st->too_large && len > 0)
+    {
+        size_t body_len = st->request.body_len; 
+        if (len > HTTP_REQUEST_SIZE - body_len)
+        {
+            st->too_large = 1; /* the rest is dropped */ 
+        }
+        else
+        {
+            if (body_len + len > st->body_cap)
+            {
+                size_t cap = st->body_cap ? st->body_cap : 1024; 
+                while (cap < body_len + len)
+                    cap *= 2; 
+                char* body = realloc(st->body, cap); 
+                if (!body)
+                {
+                    perror("realloc"); 
+                    stream_reset(s, st, ERR_INTERNAL); 
+                    return; 
+                }
+                st->body = body; 
+                st->body_cap = cap; 
+            }
+            memcpy(st->body + body_len, payload, len); 
+            st->request.body_len += len; 
+        }
+    }
+
+    if (flags & FLAG_END_STREAM)
+        stream_dispatch(con, s, st); 
+    else if (frame_len > 0)
+        window_update_write(s, id, frame_len); 
+}
+
+static void headers_frame(Http_connection_t* con, Http_h2_session_t* s,
+                          uint8_t flags, uint32_t id, const uint8_t* payload, size_t len)
+{
+    if (id == 0 || !(id & 1)) /* client streams are odd */ 
+    {
+        connection_error(con, s, ERR_PROTOCOL); 
+        return; 
+    }
+    if (frame_unpad(flags, &payload, &len) == -1)
+    {
+        connection_error(con, s, ERR_PROTOCOL); 
+        return; 
+    }
+    if (flags & FLAG_PRIORITY)
+    {
+        if (len < 5)
+        {
+            connection_error(con, s, ERR_FRAME_SIZE); 
+            return; 
+        }
+        payload += 5; 
+        len -= 5; 
+    }
+
+    if (flags & FLAG_END_HEADERS)
+    {
+        header_block(con, s, id, payload, len, flags & FLAG_END_STREAM); 
+        return; 
+    }
+
+    /* wait for the CONTINUATION frames */ 
+    if (!s->block)
+    {
+        s->block = malloc(HTTP_H2_MAX_HEADER_BLOCK); 
+        if (!s->block)
+        {
+            perror("malloc"); 
+            connection_error(con, s, ERR_INTERNAL); 
+            return; 
+        }
+    }
+    if (len > HTTP_H2_MAX_HEADER_BLOCK)
+    {
+        connection_error(con, s, ERR_ENHANCE_YOUR_CALM); 
+        return; 
+    }
+    memcpy(s->block, payload, len); 
+    s->block_len = len; 
+    s->continuation_id = id; 
+    s->continuation_end_stream = flags & FLAG_END_STREAM; 
+}
+
+static void continuation_frame(Http_connection_t* con, Http_h2_session_t* s,
+                               uint8_t flags, uint32_t id, const uint8_t* payload, size_t len)
+{
+    if (!s->continuation_id || id != s->continuation_id)
+    {
+        connection_error(con, s, ERR_PROTOCOL); 
+        return; 
+    }
+    if (len > HTTP_H2_MAX_HEADER_BLOCK - s->block_len)
+    {
+        connection_error(con, s, ERR_ENHANCE_YOUR_CALM); 
+        return; 
+    }
+    memcpy(s->block + s->block_len, payload, len); 
+    s->block_len += len; 
+
+    if (flags & FLAG_END_HEADERS)
+    {
+        s->continuation_id = 0; 
+        header_block(con, s, id, s->block, s->block_len, s->continuation_end_stream); 
+    }
+}
+
+/* a complete header block, every block must be decoded to keep the hpack tables in sync */ 
+static void header_block(Http_connection_t* con, Http_h2_session_t* s,
+                         uint32_t id, const uint8_t* block, size_t len, int end_stream)
+{
+    Http_h2_stream_t* st = stream_find(s, id); 
+    if (st) /* trailers */ 
+    {
+        if (http_hpack_decode(&s->decoder, block, len, field_ignore, NULL) == -1)
+        {
+            connection_error(con, s, ERR_COMPRESSION); 
+            return; 
+        }
+        if (st->state != HTTP_H2_STREAM_OPEN)
+            stream_reset(s, st, ERR_STREAM_CLOSED); 
+        else if (!end_stream)
+            stream_reset(s, st, ERR_PROTOCOL); 
+        else
+            stream_dispatch(con, s, st); 
+        return; 
+    }
+
+    if (id <= s->last_stream_id)
+    {
+        connection_error(con, s, ERR_PROTOCOL); 
+        return; 
+    }
+    s->last_stream_id = id; 
+
+    st = s->goaway_received ? NULL : stream_open(s, id); 
+    if (!st)
+    {
+        if (http_hpack_decode(&s->decoder, block, len, field_ignore, NULL) == -1)
+        {
+            connection_error(con, s, ERR_COMPRESSION); 
+            return; 
+        }
+        uint8_t code[4]; 
+        write_u32(code, ERR_REFUSED_STREAM); 
+        frame_write(s, FRAME_RST_STREAM, 0, id, code, sizeof code); 
+        return; 
+    }
+
+    if (http_hpack_decode(&s->decoder, block, len, field_add, st) == -1)
+    {
+        connection_error(con, s, ERR_COMPRESSION); 
+        return; 
+    }
+    if (end_stream)
+        stream_dispatch(con, s, st); 
+}
+
+/* returns -1 and sets error if a setting is invalid */ 
+static int settings_apply(Http_h2_session_t* s, const uint8_t* payload, size_t len, uint32_t* error)
+{
+    if (len % 6)
+    {
+        *error = ERR_FRAME_SIZE; 
+        return -1; 
+    }
+
+    for (size_t i = 0; i < len; i += 6)
+    {
+        uint16_t key = (uint16_t)payload[i] << 8 | payload[i + 1]; 
+        uint32_t value = read_u32(payload + i + 2); 
+        switch (key)
+        {
+            case SETTINGS_HEADER_TABLE_SIZE: 
+                http_hpack_table_set_limit(&s->encoder, value); 
+                break; 
+            case SETTINGS_ENABLE_PUSH: 
+                if (value > 1)
+                {
+                    *error = ERR_PROTOCOL; 
+                    return -1; 
+                }
+                break; 
+            case SETTINGS_INITIAL_WINDOW_SIZE: 
+            {
+                if (value > MAX_WINDOW)
+                {
+                    *error = ERR_FLOW_CONTROL; 
+                    return -1; 
+                }
+                /* the change applies to the open streams too */ 
+                int64_t delta = (int64_t)value - s->peer_initial_window; 
+                for (size_t j = 0; j < HTTP_H2_MAX_STREAMS; j++)
+                {
+                    if (s->streams[j])
+                        s->streams[j]->send_window += delta; 
+                }
+                s->peer_initial_window = value; 
+            }
+            break; 
+            case SETTINGS_MAX_FRAME_SIZE: 
+                if (value < HTTP_H2_MAX_FRAME_SIZE || value > MAX_FRAME_SIZE_LIMIT)
+                {
+                    *error = ERR_PROTOCOL; 
+                    return -1; 
+                }
+                s->peer_max_frame = value; 
+                break; 
+            default: /* MAX_CONCURRENT_STREAMS and MAX_HEADER_LIST_SIZE only matter for requests we don't send */ 
+                break; 
+        }
+    }
+    return 0; 
+}
+
+static void window_update_frame(Http_connection_t* con, Http_h2_session_t* s,
+                                uint32_t id, const uint8_t* payload, size_t len)
+{
+    if (len != 4)
+    {
+        connection_error(con, s, ERR_FRAME_SIZE); 
+        return; 
+    }
+    uint32_t increment = read_u32(payload) & MAX_WINDOW; 
+
+    if (id == 0)
+    {
+        if (increment == 0)
+            connection_error(con, s, ERR_PROTOCOL); 
+        else if (s->send_window + increment > MAX_WINDOW)
+            connection_error(con, s, ERR_FLOW_CONTROL); 
+        else
+            s->send_window += increment; 
+        return; 
+    }
+
+    Http_h2_stream_t* st = stream_find(s, id); 
+    if (!st)
+    {
+        if (id > s->last_stream_id)
+            connection_error(con, s, ERR_PROTOCOL); 
+        return; /* the stream is already done */ 
+    }
+    if (increment == 0)
+        stream_reset(s, st, ERR_PROTOCOL); 
+    else if (st->send_window + increment > MAX_WINDOW)
+        stream_reset(s, st, ERR_FLOW_CONTROL); 
+    else
+        st->send_window += increment; 
+}
+
+/* make room for a frame in the output, returns its payload or null if out of memory */ 
+static uint8_t* frame_reserve(Http_h2_session_t* s, uint8_t type, uint8_t flags, uint32_t id, size_t len)
+{
+    size_t needed = s->out_len + HTTP_H2_FRAME_HEADER + len; 
+    if (needed > s->out_cap)
+    {
+        size_t cap = s->out_cap ? s->out_cap : 16 * 1024; 
+        while (cap < needed)
+            cap *= 2; 
+        uint8_t* out = realloc(s->out, cap); 
+        if (!out)
+        {
+            perror("realloc"); 
+            return NULL; 
+        }
+        s->out = out; 
+        s->out_cap = cap; 
+    }
+
+    uint8_t* h = s->out + s->out_len; 
+    h[0] = len >> 16; 
+    h[1] = len >> 8; 
+    h[2] = len; 
+    h[3] = type; 
+    h[4] = flags; 
+    write_u32(h + 5, id); 
+    s->out_len = needed; 
+    return h + HTTP_H2_FRAME_HEADER; 
+}
+
+static int frame_write(Http_h2_session_t* s, uint8_t type, uint8_t flags, uint32_t id,
+                       const void* payload, size_t len)
+{
+    uint8_t* p = frame_reserve(s, type, flags, id, len); 
+    if (!p)
+        return -1; 
+    if (len > 0)
+        memcpy(p, payload, len); 
+    return 0; 
+}
+
+static int window_update_write(Http_h2_session_t* s, uint32_t id, uint32_t increment)
+{
+    uint8_t payload[4]; 
+    write_u32(payload, increment); 
+    return frame_write(s, FRAME_WINDOW_UPDATE, 0, id, payload, sizeof payload); 
+}
+
+/* null if there are too many streams already */ 
+static Http_h2_stream_t* stream_open(Http_h2_session_t* s, uint32_t id)
+{
+    if (s->stream_count >= HTTP_H2_MAX_STREAMS)
+        return NULL; 
+
+    Http_h2_stream_t* st = calloc(1, sizeof(Http_h2_stream_t)); 
+    if (!st)
+    {
+        perror("calloc"); 
+        return NULL; 
+    }
+    st->id = id; 
+    st->state = HTTP_H2_STREAM_OPEN; 
+    st->send_window = s->peer_initial_window; 
+    memcpy(st->request.version, "2.0", sizeof "2.0"); 
+    st->request.base = st->fields; 
+    st->request.arena = &st->arena; 
+
+    for (size_t i = 0; i < HTTP_H2_MAX_STREAMS; i++)
+    {
+        if (!s->streams[i])
+        {
+            s->streams[i] = st; 
+            break; 
+        }
+    }
+    s->stream_count++; 
+    return st; 
+}
+
+static Http_h2_stream_t* stream_find(Http_h2_session_t* s, uint32_t id)
+{
+    for (size_t i = 0; i < HTTP_H2_MAX_STREAMS; i++)
+    {
+        if (s->streams[i] && s->streams[i]->id == id)
+            return s->streams[i]; 
+    }
+    return NULL; 
+}
+
+static void stream_close(Http_h2_session_t* s, Http_h2_stream_t* st)
+{
+    for (size_t i = 0; i < HTTP_H2_MAX_STREAMS; i++)
+    {
+        if (s->streams[i] == st)
+        {
+            s->streams[i] = NULL; 
+            break; 
+        }
+    }
+    s->stream_count--; 
+
+    if (st->responding)
+        http_response_free(&st->response); 
+    http_arena_free(&st->arena); 
+    free(st->body); 
+    free(st); 
+}
+
+static void stream_reset(Http_h2_session_t* s, Http_h2_stream_t* st, uint32_t code)
+{
+    uint8_t payload[4]; 
+    write_u32(payload, code); 
+    frame_write(s, FRAME_RST_STREAM, 0, st->id, payload, sizeof payload); 
+    stream_close(s, st); 
+}
+
+/* the request is complete, run the handler and send the response headers */ 
+static void stream_dispatch(Http_connection_t* con, Http_h2_session_t* s, Http_h2_stream_t* st)
+{
+    Http_request_t* req = &st->request; 
+    Http_response_t* resp = &st->response; 
+    int refused; 
+    uint64_t start = con->ctx->access_log ? http_time_ns() : 0; 
+    st->state = HTTP_H2_STREAM_HALF_CLOSED_REMOTE; 
+
+    if (st->malformed || !req->method_str || !req->target ||
+        http_request_set_target(req, req->target, strlen(req->target)) == -1)
+    {
+        stream_reset(s, st, ERR_PROTOCOL); 
+        return; 
+    }
+    req->body = st->body; 
+
+    http_response_init(resp); 
+    if (st->too_large)
+    {
+        http_response_make_error(resp, HTTP_PAYLOAD_TOO_LARGE); 
+    }
+    else if ((refused = http_connection_admit(con)))
+    {
+        http_response_make_error(resp, refused); 
+        http_response_set_retry_after(resp, refused == HTTP_TOO_MANY_REQUESTS ? 1 : con->ctx->cfg->retry_after); 
+    }
+    else
+    {
+        Http_route_t* route = http_router_find_route(http_server_router(con->ctx), req->method, req->path); 
+        if (!route)
+            http_response_make_error(resp, HTTP_NOT_FOUND); 
+        else if (route->upstream) /* backends are only reached from http/1 */ 
+            http_response_make_error(resp, HTTP_BAD_GATEWAY); 
+        else if (route->handler(req, resp) == HTTP_HANDLER_ERR)
+            http_response_make_error(resp, HTTP_INTERNAL_SERVER_ERROR); 
+        else
+            http_compress_response(req, resp); 
+    }
+    st->responding = 1; 
+    st->send_body = req->method != HTTP_METHOD_HEAD &&
+                    http_status_has_body(resp->status_code) &&
+                    resp->body_len > 0; 
+    http_access_log_stream(con, req, resp->status_code, st->send_body ? resp->body_len : 0, start); 
+
+    if (stream_send_headers(s, st) == -1)
+    {
+        connection_error(con, s, ERR_INTERNAL); 
+        return; 
+    }
+    if (!st->send_body)
+        stream_close(s, st); 
+}
+
+#define ENCODE_FIELD(name, value, value_len) \
+    do { \
+        int n = http_hpack_encode(&s->encoder, block + block_len, sizeof block - block_len, \
+                                  name, strlen(name), value, value_len); \
+        if (n == -1) \
+            return -1; \
+        block_len += n; \
+    } while (0)
+
+/* returns -1 if the block is too big, the encoder can't be rolled back so it's a connection error */ 
+static int stream_send_headers(Http_h2_session_t* s, Http_h2_stream_t* st)
+{
+    const Http_response_t* resp = &st->response; 
+    uint8_t block[HTTP_H2_MAX_HEADER_BLOCK]; 
+    size_t block_len = 0; 
+    char value[32]; 
+
+    int value_len = snprintf(value, sizeof value, "%d", resp->status_code); 
+    ENCODE_FIELD(":status", value, value_len); 
+
+    for (size_t i = 0; i < resp->headers_count; i++)
+    {
+        const Http_response_header_t* header = http_response_header_at(resp, i); 
+        /* field names are lowercase in http/2 */ 
+        char name[HTTP_MAX_HEADER_LINE]; 
+        size_t name_len = strlen(header->key); 
+        if (name_len >= sizeof name)
+            continue; 
+        for (size_t j = 0; j < name_len; j++)
+            name[j] = tolower((unsigned char)header->key[j]); 
+        name[name_len] = '\0'; 
+
+        int hop_by_hop = 0; 
+        for (size_t j = 0; j < sizeof hop_by_hop_headers / sizeof hop_by_hop_headers[0]; j++)
+        {
+            if (!strcmp(name, hop_by_hop_headers[j]))
+                hop_by_hop = 1; 
+        }
+        if (!hop_by_hop)
+            ENCODE_FIELD(name, header->value, strlen(header->value)); 
+    }
+
+    char cache_control[HTTP_CACHE_CONTROL_SIZE]; 
+    const char* cache_control_value = http_cache_control_value(resp, cache_control, sizeof cache_control); 
+    if (cache_control_value)
+        ENCODE_FIELD("cache-control", cache_control_value, strlen(cache_control_value)); 
+    if (resp->etag)
+        ENCODE_FIELD("etag", resp->etag, strlen(resp->etag)); 
+    if (resp->last_modified)
+    {
+        char date[HTTP_DATE_SIZE]; 
+        http_format_date(resp->last_modified, date); 
+        ENCODE_FIELD("last-modified", date, strlen(date)); 
+    }
+    if (resp->location)
+        ENCODE_FIELD("location", resp->location, strlen(resp->location)); 
+    if (resp->retry_after)
+    {
+        value_len = snprintf(value, sizeof value, "%u", resp->retry_after); 
+        ENCODE_FIELD("retry-after", value, value_len); 
+    }
+
+    const char* content_type_value = http_content_type_value(resp->content_type); 
+    if (content_type_value)
+        ENCODE_FIELD("content-type", content_type_value, strlen(content_type_value)); 
+
+    const char* content_encoding_value = http_content_encoding_value(resp->content_encoding); 
+    if (content_encoding_value)
+        ENCODE_FIELD("content-encoding", content_encoding_value, strlen(content_encoding_value)); 
+
+    if (resp->vary_encoding)
+        ENCODE_FIELD("vary", "accept-encoding", strlen("accept-encoding")); 
+
+    if (http_status_has_body(resp->status_code))
+    {
+        value_len = snprintf(value, sizeof value, "%zu", resp->body_len); 
+        ENCODE_FIELD("content-length", value, value_len); 
+    }
+
+    /* HEADERS then CONTINUATION frames if the block is bigger than a frame */ 
+    uint8_t flags = st->send_body ? 0 : FLAG_END_STREAM; 
+    uint8_t type = FRAME_HEADERS; 
+    size_t sent = 0; 
+    do {
+        size_t len = block_len - sent; 
+        if (len > s->peer_max_frame)
+            len = s->peer_max_frame; 
+        if (sent + len == block_len)
+            flags |= FLAG_END_HEADERS; 
+        if (frame_write(s, type, flags, st->id, block + sent, len) == -1)
+            return -1; 
+        sent += len; 
+        type = FRAME_CONTINUATION; 
+        flags = 0; 
+    } while (sent < block_len); 
+
+    return 0; 
+}
+
+#undef ENCODE_FIELD
+
+/* one DATA frame, as big as the flow control windows allow */ 
+static int stream_send_data(Http_h2_session_t* s, Http_h2_stream_t* st)
+{
+    Http_response_t* resp = &st->response; 
+    size_t len = resp->body_len - st->body_sent; 
+    if (len > s->peer_max_frame)
+        len = s->peer_max_frame; 
+    if ((int64_t)len > s->send_window)
+        len = s->send_window; 
+    if ((int64_t)len > st->send_window)
+        len = st->send_window; 
+
+    size_t start = s->out_len; 
+    uint8_t* payload = frame_reserve(s, FRAME_DATA, 0, st->id, len); 
+    if (!payload)
+        return -1; 
+
+    if (resp->body_type == HTTP_BODY_FILE)
+    {
+        ssize_t n; 
+        if (resp->byteranges)
+            n = http_byteranges_pread(resp->byteranges, resp->body_fd, (char*)payload, len, st->body_sent); 
+        else
+        {
+            do {
+                n = pread(resp->body_fd, payload, len, resp->body_offset + st->body_sent); 
+            } while (n == -1 && errno == EINTR); 
+        }
+        if (n <= 0) /* error or the file got truncated */ 
+        {
+            if (n == -1)
+                perror("pread"); 
+            s->out_len = start; 
+            stream_reset(s, st, ERR_INTERNAL); 
+            return 0; 
+        }
+        if ((size_t)n < len)
+        {
+            /* short read, fix the frame length */ 
+            len = n; 
+            s->out_len = start + HTTP_H2_FRAME_HEADER + len; 
+            s->out[start] = len >> 16; 
+            s->out[start + 1] = len >> 8; 
+            s->out[start + 2] = len; 
+        }
+    }
+    else
+    {
+        memcpy(payload, resp->body + st->body_sent, len); 
+    }
+
+    st->body_sent += len; 
+    s->send_window -= len; 
+    st->send_window -= len; 
+    if (st->body_sent == resp->body_len)
+    {
+        s->out[start + 4] = FLAG_END_STREAM; 
+        stream_close(s, st); 
+    }
+    return 0; 
+}
+
+/* DATA frames for the streams in turn, returns 1 if something was added to the output */ 
+static int session_produce(Http_h2_session_t* s)
+{
+    int produced = 0; 
+    while (s->out_len < HTTP_H2_OUTPUT_HIGH && s->send_window > 0)
+    {
+        int progress = 0; 
+        for (size_t i = 0; i < HTTP_H2_MAX_STREAMS && s->out_len < HTTP_H2_OUTPUT_HIGH && s->send_window > 0; i++)
+        {
+            size_t slot = (s->next_stream + i) % HTTP_H2_MAX_STREAMS; 
+            Http_h2_stream_t* st = s->streams[slot]; 
+            if (!st || !st->send_body || st->send_window <= 0)
+                continue; 
+            if (stream_send_data(s, st) == -1)
+                return produced; 
+            s->next_stream = (slot + 1) % HTTP_H2_MAX_STREAMS; 
+            progress = 1; 
+        }
+        if (!progress)
+            break; 
+        produced = 1; 
+    }
+    return produced; 
+}
+
+static int session_can_produce(const Http_h2_session_t* s)
+{
+    if (s->goaway_sent || s->send_window <= 0)
+        return 0; 
+    for (size_t i = 0; i < HTTP_H2_MAX_STREAMS; i++)
+    {
+        const Http_h2_stream_t* st = s->streams[i]; 
+        if (st && st->send_body && st->send_window > 0)
+            return 1; 
+    }
+    return 0; 
+}
+
+/* copy a string to the stream, null if there is no room (the stream gets a 413) */ 
+static char* field_store(Http_h2_stream_t* st, const char* str, size_t len)
+{
+    if (len + 1 > HTTP_REQUEST_SIZE - st->fields_len)
+    {
+        st->too_large = 1; 
+        return NULL; 
+    }
+    char* dst = st->fields + st->fields_len; 
+    memcpy(dst, str, len); 
+    dst[len] = '\0'; 
+    st->fields_len += len + 1; 
+    return dst; 
+}
+
+static int field_is(const char* name, size_t name_len, const char* str)
+{
+    return strlen(str) == name_len && !memcmp(name, str, name_len); 
+}
+
+/* hpack callback, never stops the decoding (the tables must stay in sync) */ 
+static int field_add(void* arg, const char* name, size_t name_len, const char* value, size_t value_len)
+{
+    Http_h2_stream_t* st = arg; 
+    Http_request_t* req = &st->request; 
+    if (st->too_large || st->malformed)
+        return 0; 
+
+    if (name_len > 0 && name[0] == ':')
+    {
+        /* pseudo headers come first and only once */ 
+        if (req->headers_count > 0)
+        {
+            st->malformed = 1; 
+            return 0; 
+        }
+        if (field_is(name, name_len, ":method") && !req->method_str)
+        {
+            req->method_str = field_store(st, value, value_len); 
+            req->method = http_method_from_string(req->method_str); 
+        }
+        else if (field_is(name, name_len, ":path") && !req->target && value_len > 0)
+        {
+            req->target = field_store(st, value, value_len); 
+        }
+        else if (field_is(name, name_len, ":authority"))
+        {
+            /* handlers look for Host */ 
+            char* key = field_store(st, "host", 4); 
+            char* host = field_store(st, value, value_len); 
+            if (key && host)
+                http_request_add_header(req, key - st->fields, 4, host - st->fields, value_len); 
+        }
+        else if (!field_is(name, name_len, ":scheme"))
+        {
+            st->malformed = 1; 
+        }
+        return 0; 
+    }
+
+    for (size_t i = 0; i < name_len; i++)
+    {
+        if (name[i] >= 'A' && name[i] <= 'Z')
+        {
+            st->malformed = 1; 
+            return 0; 
+        }
+    }
+    for (size_t i = 0; i < sizeof hop_by_hop_headers / sizeof hop_by_hop_headers[0]; i++)
+    {
+        if (field_is(name, name_len, hop_by_hop_headers[i]))
+        {
+            st->malformed = 1; 
+            return 0; 
+        }
+    }
+
+    char* key = field_store(st, name, name_len); 
+    char* val = field_store(st, value, value_len); 
+    if (!key || !val)
+        return 0; 
+    if (http_request_add_header(req, key - st->fields, name_len, val - st->fields, value_len) == -1)
+        st->too_large = 1; 
+    return 0; 
+}
+
+static int field_ignore(void* arg, const char* name, size_t name_len, const char* value, size_t value_len)
+{
+    (void)arg; 
+    (void)name; 
+    (void)name_len; 
+    (void)value; 
+    (void)value_len; 
+    return 0; 
+}
+
+/* stream 1 of an upgrade is the http/1.1 request, its strings point to con->buff */ 
+static int stream_from_request(Http_h2_stream_t* st, Http_request_t* request)
+{
+    Http_request_t* req = &st->request; 
+    req->method = request->method; 
+    req->method_str = field_store(st, request->method_str, strlen(request->method_str)); 
+    req->target = field_store(st, request->target, strlen(request->target)); 
+    if (!req->method_str || !req->target)
+        return -1; 
+
+    for (size_t i = 0; i < request->headers_count; i++)
+    {
+        Http_slice_t name, value; 
+        http_request_header_at(request, i, &name, &value); 
+        char* key = field_store(st, name.ptr, name.len); 
+        char* val = field_store(st, value.ptr, value.len); 
+        if (!key || !val ||
+            http_request_add_header(req, key - st->fields, name.len, val - st->fields, value.len) == -1)
+            return -1; 
+    }
+    return 0; 
+}
+
+/* unpadded base64url, returns the decoded length or -1 */ 
+static int base64url_decode(Http_slice_t in, uint8_t* out, size_t out_len)
+{
+    uint32_t acc = 0; 
+    int bits = 0; 
+    size_t n = 0; 
+    for (size_t i = 0; i < in.len && in.ptr[i] != '='; i++)
+    {
+        int v; 
+        char c = in.ptr[i]; 
+        if (c >= 'A' && c <= 'Z')
+            v = c - 'A'; 
+        else if (c >= 'a' && c <= 'z')
+            v = c - 'a' + 26; 
+        else if (c >= '0' && c <= '9')
+            v = c - '0' + 52; 
+        else if (c == '-' || c == '+')
+            v = 62; 
+        else if (c == '_' || c == '/')
+            v = 63; 
+        else
+            return -1; 
+
+        acc = acc << 6 | v; 
+        bits += 6; 
+        if (bits >= 8)
+        {
+            bits -= 8; 
+            if (n >= out_len)
+                return -1; 
+            out[n++] = acc >> bits; 
+        }
+    }
+    return n; 
+}
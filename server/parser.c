@@ -3,8 +3,15 @@
 #include <string.h> 
 #include <strings.h> 
 #include <stdio.h> /* debug */ 
+#ifdef __SSE2__
+#include <emmintrin.h> 
+#endif
 
 #include <loom/http_parser.h>
+#include <loom/arena.h> 
+
+/* header offsets and lengths are 16 bits */ 
+_Static_assert(HTTP_REQUEST_SIZE <= UINT16_MAX, "the request buffer is too big for the header offsets"); 
 
 static const Http_method_mapping_t http_methods_table[] = {
     { HTTP_METHOD_GET,     "GET"     },
@@ -33,14 +40,62 @@ Http_method_t http_method_from_string(char* str)
     return HTTP_METHOD_UNKNOWN; 
 }
 
-char* http_request_search_header(Http_request_t* request, const char* key)
+static inline const Http_header_t* header_slot(const Http_request_t* request, size_t i)
 {
+    if (i < HTTP_REQUEST_INLINE_HEADERS)
+        return &request->headers[i]; 
+    return &request->headers_more[i - HTTP_REQUEST_INLINE_HEADERS]; 
+}
+
+Http_slice_t http_request_header(const Http_request_t* request, const char* key)
+{
+    Http_slice_t value = { NULL, 0 }; 
+    size_t key_len = strlen(key); 
     for (size_t i = 0; i < request->headers_count; i++)
     {
-        if (!strcasecmp(request->headers[i].key, key))
-            return request->headers[i].value; 
+        const Http_header_t* header = header_slot(request, i); 
+        if (header->key_len == key_len && !strncasecmp(request->base + header->key_off, key, key_len))
+        {
+            value.ptr = request->base + header->value_off; 
+            value.len = header->value_len; 
+            break; 
+        }
+    }
+    return value; 
+}
+
+void http_request_header_at(const Http_request_t* request, size_t i, Http_slice_t* key, Http_slice_t* value)
+{
+    assert(i < request->headers_count); 
+    const Http_header_t* header = header_slot(request, i); 
+    key->ptr = request->base + header->key_off; 
+    key->len = header->key_len; 
+    value->ptr = request->base + header->value_off; 
+    value->len = header->value_len; 
+}
+
+int http_request_add_header(Http_request_t* request, size_t key_off, size_t key_len, size_t value_off, size_t value_len)
+{
+    if (request->headers_count >= HTTP_MAX_HEADERS)
+        return -1; 
+    /* typical requests fit inline, the array for the others is taken once */ 
+    if (request->headers_count == HTTP_REQUEST_INLINE_HEADERS && !request->headers_more)
+    {
+        if (!request->arena)
+            return -1; 
+        request->headers_more = http_arena_alloc(request->arena,
+                (HTTP_MAX_HEADERS - HTTP_REQUEST_INLINE_HEADERS) * sizeof(Http_header_t)); 
+        if (!request->headers_more)
+            return -1; 
     }
-    return NULL; 
+
+    Http_header_t* header = (Http_header_t*)header_slot(request, request->headers_count); 
+    header->key_off = key_off; 
+    header->key_len = key_len; 
+    header->value_off = value_off; 
+    header->value_len = value_len; 
+    request->headers_count++; 
+    return 0; 
 }
 
 static const char tchar_table[256] = {
@@ -71,6 +126,9 @@ static inline int isfchar(char c);
 /* returns offset if parsed correctly or -1 if malforemed */ 
 static int parse_request_line(Http_request_t* request, char* raw, size_t raw_len);  
 static int parse_request_headers(Http_request_t* request, char* raw, size_t raw_len, size_t offset); 
+static int target_is_plain(const char* target, size_t len); 
+static size_t path_normalize(char* path, size_t len); 
+static int hex_value(char c); 
 
 #define MIN_RAW_REQUEST_SIZE 14 /* sus if under 14 bytes */ 
 #define HTTP_VERSION_PREFIX "HTTP/"
@@ -83,7 +141,21 @@ int http_request_parse(Http_request_t* request, char* request_raw, size_t reques
     assert(request_raw != NULL); 
     if (request_raw_len < MIN_RAW_REQUEST_SIZE)
         return -1; 
-    memset(request, 0, sizeof(Http_request_t)); 
+    /* no memset, the header array is only valid up to headers_count */ 
+    request->method = HTTP_METHOD_UNKNOWN; 
+    request->method_str = NULL; 
+    request->target = NULL; 
+    request->path = NULL; 
+    request->query.ptr = NULL; 
+    request->query.len = 0; 
+    request->version[0] = '\0'; 
+    request->base = request_raw; 
+    request->headers_count = 0; 
+    request->headers_more = NULL; 
+    request->body = NULL; 
+    request->body_len = 0; 
+    request->chunked = 0; 
+    request->expect_continue = 0; 
     int offset; 
 
     /* parse first line */ 
@@ -96,13 +168,28 @@ int http_request_parse(Http_request_t* request, char* request_raw, size_t reques
         return -1; 
 
     /* find body length */ 
-    char* content_length_value = http_request_search_header(request, "Content-Length"); 
-    if (content_length_value)
+    Http_slice_t content_length = http_request_header(request, "Content-Length"); 
+    Http_slice_t transfer_encoding = http_request_header(request, "Transfer-Encoding"); 
+    if (transfer_encoding.ptr)
+    {
+        /* no other coding is supported, and a length on top of it is how requests get smuggled */ 
+        if (content_length.ptr || !http_slice_eq_nocase(transfer_encoding, "chunked"))
+            return -1; 
+        request->chunked = 1; 
+    }
+    else if (content_length.ptr)
     {
-        if (http_parse_sizet(content_length_value, &request->body_len) == -1)
+        char value[32]; 
+        if (!http_slice_cstr(content_length, value, sizeof value) ||
+            http_parse_sizet(value, &request->body_len) == -1)
             return -1; 
     }
 
+    /* http/1.0 clients don't wait for the 100 */ 
+    if ((request->chunked || request->body_len) && !strcmp(request->version, "1.1") &&
+        http_slice_eq_nocase(http_request_header(request, "Expect"), "100-continue"))
+        request->expect_continue = 1; 
+
     return offset; 
 }
 
@@ -140,7 +227,6 @@ static int parse_request_line(Http_request_t* req, char* raw, size_t raw_len)
 
     /* parse PATH */ 
     prev_offset = offset; 
-    req->path = &raw[offset]; 
     while (offset < raw_len && raw[offset] != ' ')
     {
         if (!ispchar(raw[offset]))
@@ -150,6 +236,8 @@ static int parse_request_line(Http_request_t* req, char* raw, size_t raw_len)
     if (offset >= raw_len || offset == prev_offset)
         return -1; 
     raw[offset] = '\0'; 
+    if (http_request_set_target(req, &raw[prev_offset], offset - prev_offset) == -1)
+        return -1; 
     offset++; 
 
     /* parse vesrion */ 
@@ -188,7 +276,7 @@ static int parse_request_line(Http_request_t* req, char* raw, size_t raw_len)
 
 static int parse_request_headers(Http_request_t* req, char* raw, size_t raw_len, size_t offset)
 {
-    size_t prev_offset, end_offset; 
+    size_t prev_offset, end_offset, key_offset, key_len; 
     while (offset + 1 < raw_len)
     {
         if (raw[offset] == '\r' && raw[offset+1] == '\n')
@@ -199,7 +287,7 @@ static int parse_request_headers(Http_request_t* req, char* raw, size_t raw_len,
         
         /* parsing name */ 
         prev_offset = offset; 
-        req->headers[req->headers_count].key = &raw[offset]; 
+        key_offset = offset; 
         while (offset < raw_len && raw[offset] != ':')
         {
             if (!istchar(raw[offset]))
@@ -213,7 +301,7 @@ static int parse_request_headers(Http_request_t* req, char* raw, size_t raw_len,
         if (offset == prev_offset) 
             return -1; 
 
-        raw[offset] = '\0'; 
+        key_len = offset - key_offset; 
         offset++; 
         /* parsing value */ 
         while (offset < raw_len && (raw[offset] == ' ' || raw[offset] == '\t'))
@@ -224,7 +312,6 @@ static int parse_request_headers(Http_request_t* req, char* raw, size_t raw_len,
         if (offset >= raw_len || raw[offset] == ' ' || raw[offset] == '\t')
             return -1; 
 
-        req->headers[req->headers_count].value = &raw[offset]; 
         prev_offset = offset; 
         while (offset < raw_len && raw[offset] != '\r')
         {
@@ -240,23 +327,212 @@ static int parse_request_headers(Http_request_t* req, char* raw, size_t raw_len,
         {
             end_offset--;   
         }
-        raw[end_offset] = '\0'; 
         offset += 2; 
-        req->headers_count++; 
-        if (req->headers_count >= HTTP_MAX_HEADERS)
+        /* too many headers */ 
+        if (http_request_add_header(req, key_offset, key_len, prev_offset, end_offset - prev_offset) == -1)
+            return -1; 
+    }
+    return -1; 
+}
+
+int http_request_set_target(Http_request_t* request, char* target, size_t len)
+{
+    request->target = target; 
+    request->path = target; 
+    request->query.ptr = NULL; 
+    request->query.len = 0; 
+    /* "*" or an absolute url, nothing to normalize */ 
+    if (target[0] != '/' || target_is_plain(target, len))
+        return 0; 
+
+    const char* query = memchr(target, '?', len); 
+    size_t path_len = query ? (size_t)(query - target) : len; 
+    if (query)
+    {
+        request->query.ptr = query + 1; 
+        request->query.len = len - path_len - 1; 
+    }
+    if (!request->arena)
+        return -1; 
+    char* path = http_arena_alloc(request->arena, path_len + 1); 
+    if (!path)
+        return -1; 
+
+    /* decoded first so %2e%2e is a dot segment too */ 
+    size_t n = 0; 
+    for (size_t i = 0; i < path_len; i++)
+    {
+        char c = target[i]; 
+        if (c == '%')
         {
-            /* too many headers */  
-            if (offset + 1 >= raw_len || raw[offset] != '\r' || raw[offset+1] != '\n') 
-            {
-                return -1;
-            }
-            offset += 2; 
-            return offset; 
+            if (i + 2 >= path_len)
+                return -1; 
+            int hi = hex_value(target[i + 1]); 
+            int lo = hex_value(target[i + 2]); 
+            if (hi == -1 || lo == -1 || (hi | lo) == 0) /* no nul in a path */ 
+                return -1; 
+            c = (char)(hi << 4 | lo); 
+            i += 2; 
+        }
+        path[n++] = c; 
+    }
+    n = path_normalize(path, n); 
+    path[n] = '\0'; 
+    request->path = path; 
+    return 0; 
+}
+
+/* nothing to do unless there's a '%', a '?', "//" or "/." */ 
+static int target_is_plain(const char* target, size_t len)
+{
+    size_t i = 0; 
+#ifdef __SSE2__
+    const __m128i percent = _mm_set1_epi8('%'); 
+    const __m128i question = _mm_set1_epi8('?'); 
+    const __m128i slash = _mm_set1_epi8('/'); 
+    const __m128i dot = _mm_set1_epi8('.'); 
+    /* the byte after each one is loaded too, the block's last byte is compared with the next block's first */ 
+    for (; i + 17 <= len; i += 16)
+    {
+        __m128i cur = _mm_loadu_si128((const __m128i*)(target + i)); 
+        __m128i next = _mm_loadu_si128((const __m128i*)(target + i + 1)); 
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(cur, percent), _mm_cmpeq_epi8(cur, question)); 
+        __m128i segment = _mm_and_si128(_mm_cmpeq_epi8(cur, slash),
+                                        _mm_or_si128(_mm_cmpeq_epi8(next, slash), _mm_cmpeq_epi8(next, dot))); 
+        if (_mm_movemask_epi8(_mm_or_si128(special, segment)))
+            return 0; 
+    }
+#endif
+    for (; i < len; i++)
+    {
+        char c = target[i]; 
+        if (c == '%' || c == '?')
+            return 0; 
+        if (c == '/' && i + 1 < len && (target[i + 1] == '/' || target[i + 1] == '.'))
+            return 0; 
+    }
+    return 1; 
+}
+
+/* remove_dot_segments (rfc 3986) and repeated slashes, in place. ".." never goes above the root */ 
+static size_t path_normalize(char* path, size_t len)
+{
+    size_t w = 0, r = 0; 
+    int trailing = 0; /* the last segment ends with a slash */ 
+    while (r < len)
+    {
+        while (r < len && path[r] == '/')
+            r++; 
+        size_t start = r; 
+        while (r < len && path[r] != '/')
+            r++; 
+        size_t seg_len = r - start; 
+
+        trailing = 1; 
+        if (seg_len == 0 || (seg_len == 1 && path[start] == '.'))
+            continue; 
+        if (seg_len == 2 && path[start] == '.' && path[start + 1] == '.')
+        {
+            while (w > 0 && path[w - 1] != '/')
+                w--; 
+            if (w > 0)
+                w--; 
+            continue; 
         }
+        /* the slashes before it were at least one byte, w stays behind start */ 
+        path[w++] = '/'; 
+        memmove(path + w, path + start, seg_len); 
+        w += seg_len; 
+        trailing = 0; 
+    }
+    if (w == 0 || trailing)
+        path[w++] = '/'; 
+    return w; 
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0'; 
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10; 
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10; 
+    return -1; 
+}
+
+int http_request_query_next(const Http_request_t* request, size_t* pos, Http_slice_t* key, Http_slice_t* value)
+{
+    const char* query = request->query.ptr; 
+    size_t len = request->query.len; 
+    while (*pos < len)
+    {
+        size_t start = *pos; 
+        const char* amp = memchr(query + start, '&', len - start); 
+        size_t end = amp ? (size_t)(amp - query) : len; 
+        *pos = amp ? end + 1 : len; 
+        if (end == start) /* "a=1&&b=2" */ 
+            continue; 
+
+        const char* eq = memchr(query + start, '=', end - start); 
+        size_t key_end = eq ? (size_t)(eq - query) : end; 
+        key->ptr = query + start; 
+        key->len = key_end - start; 
+        value->ptr = eq ? eq + 1 : query + end; 
+        value->len = eq ? end - key_end - 1 : 0; 
+        return 0; 
     }
     return -1; 
 }
 
+Http_slice_t http_request_query(const Http_request_t* request, const char* key)
+{
+    Http_slice_t k, v; 
+    size_t key_len = strlen(key); 
+    size_t pos = 0; 
+    while (http_request_query_next(request, &pos, &k, &v) == 0)
+    {
+        if (k.len == key_len && !memcmp(k.ptr, key, key_len))
+            return v; 
+    }
+    v.ptr = NULL; 
+    v.len = 0; 
+    return v; 
+}
+
+int http_query_decode(Http_slice_t slice, char* buf, size_t size, size_t* len)
+{
+    size_t n = 0; 
+    for (size_t i = 0; i < slice.len; i++)
+    {
+        if (n + 1 >= size)
+            return -1; 
+        char c = slice.ptr[i]; 
+        if (c == '+')
+        {
+            c = ' '; 
+        }
+        else if (c == '%')
+        {
+            if (i + 2 >= slice.len)
+                return -1; 
+            int hi = hex_value(slice.ptr[i + 1]); 
+            int lo = hex_value(slice.ptr[i + 2]); 
+            if (hi == -1 || lo == -1)
+                return -1; 
+            c = (char)(hi << 4 | lo); 
+            i += 2; 
+        }
+        buf[n++] = c; 
+    }
+    if (n >= size)
+        return -1; 
+    buf[n] = '\0'; 
+    if (len)
+        *len = n; 
+    return 0; 
+}
+
 /* debug */ 
 void http_request_print(Http_request_t* request)
 {
@@ -267,10 +543,13 @@ void http_request_print(Http_request_t* request)
     }
     
     printf("Http method : %s\n", request->method_str); 
+    printf("Target : %s\n", request->target); 
     printf("Path : %s\n", request->path); 
     printf("version : %3s\n", request->version); 
     for (size_t i = 0; i < request->headers_count; i++)
     {
-        printf("Header: %s -> %s\n", request->headers[i].key,request->headers[i].value); 
+        Http_slice_t key, value; 
+        http_request_header_at(request, i, &key, &value); 
+        printf("Header: %.*s -> %.*s\n", (int)key.len, key.ptr, (int)value.len, value.ptr); 
     }
 }
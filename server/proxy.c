@@ -0,0 +1,1040 @@
+#include <assert.h> 
+#include <errno.h> 
+#include <netdb.h> 
+#include <netinet/in.h> 
+#include <netinet/tcp.h> 
+#include <stdio.h> 
+#include <stdlib.h> 
+#include <string.h> 
+#include <strings.h> 
+#include <sys/epoll.h> 
+#include <sys/socket.h> 
+#include <unistd.h> 
+
+#include <loom/proxy.h> 
+#include <loom/connection.h> 
+#include <loom/epoll_utils.h> 
+#include <loom/utils.h> 
+
+#define UPSTREAM_EVENTS (EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP)
+
+/* chunked response states, the bytes are passed through as they are */ 
+enum {
+    CHUNK_SIZE,
+    CHUNK_EXT,
+    CHUNK_SIZE_LF,
+    CHUNK_DATA,
+    CHUNK_DATA_CR,
+    CHUNK_DATA_LF,
+    CHUNK_TRAILER_START,
+    CHUNK_TRAILER_LINE,
+    CHUNK_FINAL_LF,
+}; 
+
+static Http_backend_t* backend_pick(Http_upstream_t* upstream); 
+static Http_upstream_con_t* pool_take(Http_backend_t* backend); 
+static void pool_remove(Http_upstream_con_t* up); 
+static Http_upstream_con_t* upstream_connect(Http_server_context_t* ctx, Http_backend_t* backend); 
+static Http_upstream_con_t* backend_connection(Http_server_context_t* ctx, Http_backend_t* backend); 
+static void upstream_close(Http_upstream_con_t* up); 
+static int  out_append(Http_upstream_con_t* up, const char* data, size_t len); 
+static int  request_head_write(Http_upstream_con_t* up, Http_request_t* req); 
+static void proxy_pump(Http_upstream_con_t* up); 
+static ssize_t body_pull(Http_upstream_con_t* up); 
+static ssize_t response_read(Http_upstream_con_t* up); 
+static int  response_head(Http_upstream_con_t* up, size_t head_len); 
+static ssize_t body_consume(Http_upstream_con_t* up, const char* data, size_t len); 
+static ssize_t chunked_scan(Http_upstream_con_t* up, const char* data, size_t len); 
+static void proxy_finish(Http_upstream_con_t* up, int reusable); 
+static void proxy_fail(Http_upstream_con_t* up, int status_code); 
+static void proxy_retry(Http_upstream_con_t* up); 
+static void client_kick(Http_connection_t* con); 
+
+Http_upstream_t* http_upstream_create(void)
+{
+    Http_upstream_t* upstream = malloc(sizeof(Http_upstream_t)); 
+    if (!upstream)
+    {
+        perror("malloc"); 
+        return NULL; 
+    }
+    memset(upstream, 0, sizeof(Http_upstream_t)); 
+    return upstream; 
+}
+
+int http_upstream_add_server(Http_upstream_t* upstream, const char* host, int port)
+{
+    if (!upstream || !host || upstream->backend_count >= HTTP_PROXY_MAX_BACKENDS)
+        return -1; 
+
+    struct addrinfo hints, *res; 
+    char port_str[NI_MAXSERV]; 
+    memset(&hints, 0, sizeof hints); 
+    hints.ai_family = AF_UNSPEC; 
+    hints.ai_socktype = SOCK_STREAM; 
+    snprintf(port_str, sizeof port_str, "%d", port); 
+
+    int status = getaddrinfo(host, port_str, &hints, &res); 
+    if (status != 0)
+    {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(status)); 
+        return -1; 
+    }
+
+    Http_backend_t* backend = &upstream->backends[upstream->backend_count++]; 
+    memset(backend, 0, sizeof(Http_backend_t)); 
+    memcpy(&backend->addr, res->ai_addr, res->ai_addrlen); 
+    backend->addr_len = res->ai_addrlen; 
+    freeaddrinfo(res); 
+    return 0; 
+}
+
+void http_upstream_destroy(Http_upstream_t* upstream)
+{
+    if (!upstream)
+        return; 
+    for (size_t i = 0; i < upstream->backend_count; i++)
+    {
+        Http_upstream_con_t *up, *up_next; 
+        for (up = upstream->backends[i].idle; up != NULL; up = up_next)
+        {
+            up_next = up->next; 
+            close(up->fd); 
+            free(up->item); 
+            free(up); 
+        }
+    }
+    free(upstream); 
+}
+
+/* least connections, backends that just refused a connection come last */ 
+static Http_backend_t* backend_pick(Http_upstream_t* upstream)
+{
+    if (upstream->backend_count == 0)
+        return NULL; 
+
+    uint64_t now = http_time_ms(); 
+    Http_backend_t* best = NULL; 
+    int best_down = 1; 
+    for (size_t i = 0; i < upstream->backend_count; i++)
+    {
+        Http_backend_t* backend = &upstream->backends[(upstream->next + i) % upstream->backend_count]; 
+        int down = backend->down_until > now; 
+        if (!best || down < best_down || (down == best_down && backend->active < best->active))
+        {
+            best = backend; 
+            best_down = down; 
+        }
+    }
+    upstream->next++; 
+    return best; 
+}
+
+static Http_upstream_con_t* pool_take(Http_backend_t* backend)
+{
+    while (backend->idle)
+    {
+        Http_upstream_con_t* up = backend->idle; 
+        backend->idle = up->next; 
+        backend->idle_count--; 
+        up->next = NULL; 
+
+        /* the backend may have closed it since the last event */ 
+        char c; 
+        ssize_t n = recv(up->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT); 
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return up; 
+        upstream_close(up); 
+    }
+    return NULL; 
+}
+
+static void pool_remove(Http_upstream_con_t* up)
+{
+    Http_upstream_con_t** link = &up->backend->idle; 
+    while (*link && *link != up)
+        link = &(*link)->next; 
+    if (*link)
+    {
+        *link = up->next; 
+        up->backend->idle_count--; 
+    }
+    up->next = NULL; 
+}
+
+static Http_upstream_con_t* upstream_connect(Http_server_context_t* ctx, Http_backend_t* backend)
+{
+    int fd = socket(backend->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0); 
+    if (fd == -1)
+    {
+        perror("socket"); 
+        return NULL; 
+    }
+
+    int yes = 1; 
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes); 
+
+    Http_upstream_con_state_t state = HTTP_UPSTREAM_ACTIVE; 
+    if (connect(fd, (struct sockaddr*)&backend->addr, backend->addr_len) == -1)
+    {
+        if (errno != EINPROGRESS)
+        {
+            perror("connect"); 
+            close(fd); 
+            return NULL; 
+        }
+        state = HTTP_UPSTREAM_CONNECTING; 
+    }
+
+    Http_upstream_con_t* up = malloc(sizeof(Http_upstream_con_t)); 
+    if (!up)
+    {
+        perror("malloc"); 
+        close(fd); 
+        return NULL; 
+    }
+    memset(up, 0, sizeof(Http_upstream_con_t)); 
+    up->fd = fd; 
+    up->state = state; 
+    up->backend = backend; 
+    up->ctx = ctx; 
+
+    /* the first EPOLLOUT tells when the connect is done */ 
+    if (http_epoll_add_upstream(ctx->epoll_fd, up, UPSTREAM_EVENTS) == -1)
+    {
+        close(fd); 
+        free(up); 
+        return NULL; 
+    }
+    return up; 
+}
+
+/* a pooled connection or a new one */ 
+static Http_upstream_con_t* backend_connection(Http_server_context_t* ctx, Http_backend_t* backend)
+{
+    Http_upstream_con_t* up = pool_take(backend); 
+    if (up)
+    {
+        up->state = HTTP_UPSTREAM_ACTIVE; 
+        /* an idle socket is already writable, rearm it to get the edge again */ 
+        if (http_epoll_mod_upstream(ctx->epoll_fd, up, UPSTREAM_EVENTS) == 0)
+            return up; 
+        upstream_close(up); 
+    }
+
+    up = upstream_connect(ctx, backend); 
+    if (!up)
+        backend->down_until = http_time_ms() + HTTP_PROXY_DOWN_MS; 
+    return up; 
+}
+
+static void upstream_close(Http_upstream_con_t* up)
+{
+    http_epoll_del_upstream(up->ctx->epoll_fd, up); 
+    close(up->fd); 
+    up->fd = -1; 
+    up->state = HTTP_UPSTREAM_CLOSED; 
+
+    /* an event for it may still be in the batch being handled */ 
+    up->next = up->ctx->upstream_graveyard; 
+    up->ctx->upstream_graveyard = up; 
+}
+
+void http_proxy_reap(Http_server_context_t* ctx)
+{
+    Http_upstream_con_t *up, *up_next; 
+    for (up = ctx->upstream_graveyard; up != NULL; up = up_next)
+    {
+        up_next = up->next; 
+        free(up->item); 
+        free(up); 
+    }
+    ctx->upstream_graveyard = NULL; 
+}
+
+int http_proxy_start(Http_connection_t* con, Http_upstream_t* upstream, size_t body_buffered)
+{
+    assert(con->upstream == NULL); 
+
+    Http_backend_t* backend = NULL; 
+    Http_upstream_con_t* up = NULL; 
+    for (size_t tries = 0; !up && tries < upstream->backend_count; tries++)
+    {
+        backend = backend_pick(upstream); 
+        up = backend_connection(con->ctx, backend); 
+    }
+    if (!up)
+        return -1; 
+
+    up->client = con; 
+    up->upstream = upstream; 
+    up->out_len = 0; 
+    up->out_sent = 0; 
+    up->in_len = 0; 
+    up->in_pos = 0; 
+    up->head_done = 0; 
+    up->responded = 0; 
+    up->done = 0; 
+    up->touched = time(NULL); 
+    up->head_request = con->request.method == HTTP_METHOD_HEAD; 
+
+    if (request_head_write(up, &con->request) == -1 ||
+        out_append(up, con->buff + con->header_len, body_buffered) == -1)
+    {
+        up->client = NULL; 
+        upstream_close(up); 
+        return -1; 
+    }
+    up->body_remaining = con->request.body_len - body_buffered; 
+
+    backend->active++; 
+    con->upstream = up; 
+    http_timer_update(con->ctx->timer, con, HTTP_PROXY_TIMEOUT); 
+    return 0; 
+}
+
+static int out_append(Http_upstream_con_t* up, const char* data, size_t len)
+{
+    if (len > HTTP_PROXY_BUFFER - up->out_len)
+        return -1; 
+    memcpy(up->out + up->out_len, data, len); 
+    up->out_len += len; 
+    return 0; 
+}
+
+/* the decoded path encoded again where it has to be, an encoded '/' stays a '/' */ 
+static int out_append_path(Http_upstream_con_t* up, const char* path)
+{
+    static const char hex[] = "0123456789ABCDEF"; 
+    for (const unsigned char* p = (const unsigned char*)path; *p; p++)
+    {
+        unsigned char c = *p; 
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || strchr("-._~!$&'()*+,;=:@/", c))
+        {
+            if (out_append(up, (const char*)p, 1) == -1)
+                return -1; 
+            continue; 
+        }
+        char escaped[3] = { '%', hex[c >> 4], hex[c & 15] }; 
+        if (out_append(up, escaped, 3) == -1)
+            return -1; 
+    }
+    return 0; 
+}
+
+static int header_has_token(const char* value, const char* token)
+{
+    size_t len = strlen(token); 
+    const char* p = value; 
+    while (*p)
+    {
+        while (*p == ' ' || *p == '\t' || *p == ',')
+            p++; 
+        const char* start = p; 
+        while (*p && *p != ',')
+            p++; 
+        const char* end = p; 
+        while (end > start && (end[-1] == ' ' || end[-1] == '\t'))
+            end--; 
+        if ((size_t)(end - start) == len && !strncasecmp(start, token, len))
+            return 1; 
+    }
+    return 0; 
+}
+
+/* hop by hop headers stay between the client and us */ 
+static int header_is_hop(const char* name, size_t len)
+{
+    static const char* hops[] = { "connection", "keep-alive", "proxy-connection", "upgrade" }; 
+    for (size_t i = 0; i < sizeof hops / sizeof hops[0]; i++)
+    {
+        if (strlen(hops[i]) == len && !strncasecmp(name, hops[i], len))
+            return 1; 
+    }
+    return 0; 
+}
+
+static int request_head_write(Http_upstream_con_t* up, Http_request_t* req)
+{
+    char connection_value[HTTP_MAX_HEADER_LINE]; 
+    const char* connection = http_slice_cstr(http_request_header(req, "Connection"),
+                                             connection_value, sizeof connection_value); 
+    if (!strcmp(req->version, "1.0"))
+        up->client_close = !connection || !header_has_token(connection, "keep-alive"); 
+    else
+        up->client_close = connection && header_has_token(connection, "close"); 
+
+    /* the backend gets the path the route matched ("/x/..%2Fapi/y" is "/api/y"), not one it
+     * would resolve differently. the query goes as sent */ 
+    if (out_append(up, req->method_str, strlen(req->method_str)) == -1 ||
+        out_append(up, " ", 1) == -1)
+        return -1; 
+    if (req->path == req->target)
+    {
+        if (out_append(up, req->target, strlen(req->target)) == -1)
+            return -1; 
+    }
+    else if (out_append_path(up, req->path) == -1 ||
+             (req->query.ptr && (out_append(up, "?", 1) == -1 || out_append(up, req->query.ptr, req->query.len) == -1)))
+        return -1; 
+    /* the backend connection is ours, always ask to keep it */ 
+    if (out_append(up, " HTTP/1.1\r\n", 11) == -1)
+        return -1; 
+
+    for (size_t i = 0; i < req->headers_count; i++)
+    {
+        Http_slice_t key, value; 
+        http_request_header_at(req, i, &key, &value); 
+        if (header_is_hop(key.ptr, key.len))
+            continue; 
+        /* the body was decoded, it goes out with a length */ 
+        if (req->chunked && key.len == 17 && !strncasecmp(key.ptr, "transfer-encoding", 17))
+            continue; 
+        /* answered already, the body is on its way */ 
+        if (!req->expect_continue && key.len == 6 && !strncasecmp(key.ptr, "expect", 6))
+            continue; 
+        if (out_append(up, key.ptr, key.len) == -1 ||
+            out_append(up, ": ", 2) == -1 ||
+            out_append(up, value.ptr, value.len) == -1 ||
+            out_append(up, "\r\n", 2) == -1)
+            return -1; 
+    }
+
+    if (req->chunked)
+    {
+        char length[48]; 
+        int n = snprintf(length, sizeof length, "Content-Length: %zu\r\n", req->body_len); 
+        if (out_append(up, length, n) == -1)
+            return -1; 
+    }
+
+    return out_append(up, "Connection: keep-alive\r\n\r\n", 26); 
+}
+
+void http_proxy_resume(Http_connection_t* con)
+{
+    if (con->upstream && con->upstream->state == HTTP_UPSTREAM_ACTIVE)
+        proxy_pump(con->upstream); 
+}
+
+int http_proxy_responded(Http_connection_t* con)
+{
+    return con->upstream && con->upstream->responded; 
+}
+
+void http_proxy_abort(Http_connection_t* con)
+{
+    Http_upstream_con_t* up = con->upstream; 
+    if (!up)
+        return; 
+    up->backend->active--; 
+    up->client = NULL; 
+    con->upstream = NULL; 
+    upstream_close(up); 
+}
+
+void http_proxy_event(Http_epoll_item_t* item, uint32_t events)
+{
+    assert(item->type == HTTP_ITEM_UPSTREAM); 
+    Http_upstream_con_t* up = item->upstream; 
+
+    switch (up->state)
+    {
+        case HTTP_UPSTREAM_CLOSED: 
+            return; 
+
+        case HTTP_UPSTREAM_IDLE: /* closed by the backend or it sent something nobody asked for */ 
+            if (!(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+                return; /* acks freeing send buffer space */ 
+            pool_remove(up); 
+            upstream_close(up); 
+            return; 
+
+        case HTTP_UPSTREAM_CONNECTING: 
+        {
+            if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+                return; 
+            int err = 0; 
+            socklen_t len = sizeof err; 
+            if (getsockopt(up->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0)
+            {
+                Http_connection_t* con = up->client; 
+                up->backend->down_until = http_time_ms() + HTTP_PROXY_DOWN_MS; 
+                proxy_retry(up); 
+                client_kick(con); 
+                return; 
+            }
+            up->state = HTTP_UPSTREAM_ACTIVE; 
+        }
+        /* fall through */ 
+        case HTTP_UPSTREAM_ACTIVE: 
+        default: 
+        {
+            Http_connection_t* con = up->client; 
+            proxy_pump(up); 
+            client_kick(con); 
+        }
+    }
+}
+
+/* move bytes until neither side can make progress */ 
+static void proxy_pump(Http_upstream_con_t* up)
+{
+    Http_connection_t* con = up->client; 
+    for (;;)
+    {
+        ssize_t moved = 0; 
+
+        if (up->body_remaining > 0)
+        {
+            ssize_t n = body_pull(up); 
+            if (n == -1)
+                return; 
+            moved += n; 
+        }
+
+        while (up->out_sent < up->out_len)
+        {
+            ssize_t n = send(up->fd, up->out + up->out_sent, up->out_len - up->out_sent, MSG_NOSIGNAL); 
+            if (n == -1)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break; 
+                proxy_fail(up, HTTP_BAD_GATEWAY); 
+                return; 
+            }
+            up->out_sent += n; 
+            moved += n; 
+        }
+        if (up->out_sent == up->out_len)
+        {
+            up->out_len = 0; 
+            up->out_sent = 0; 
+        }
+
+        ssize_t n = response_read(up); 
+        if (n == -1)
+            return; /* the exchange is over */ 
+        moved += n; 
+
+        if (moved == 0)
+            break; 
+
+        /* a slow but moving exchange doesn't time out */ 
+        time_t now = time(NULL); 
+        if (now != up->touched && con->timeout_index != -1)
+        {
+            up->touched = now; 
+            http_timer_update(con->ctx->timer, con, HTTP_PROXY_TIMEOUT); 
+        }
+    }
+}
+
+/* the request body goes straight from the client socket to the backend buffer */ 
+static ssize_t body_pull(Http_upstream_con_t* up)
+{
+    Http_connection_t* con = up->client; 
+    if (up->out_sent > 0)
+    {
+        memmove(up->out, up->out + up->out_sent, up->out_len - up->out_sent); 
+        up->out_len -= up->out_sent; 
+        up->out_sent = 0; 
+    }
+
+    ssize_t moved = 0; 
+    while (up->body_remaining > 0 && up->out_len < HTTP_PROXY_BUFFER)
+    {
+        size_t room = HTTP_PROXY_BUFFER - up->out_len; 
+        if (room > up->body_remaining)
+            room = up->body_remaining; 
+        ssize_t n = http_connection_recv(con, up->out + up->out_len, room); 
+        if (n == 0)
+            break; /* the client is gone, its hangup closes everything */ 
+        if (n == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("read"); 
+            break; 
+        }
+        up->out_len += n; 
+        up->body_remaining -= n; 
+        moved += n; 
+    }
+    return moved; 
+}
+
+#define HEAD_DELIMITER      "\r\n\r\n"
+#define HEAD_DELIMITER_LEN  4
+
+/* returns -1 once the exchange ended, otherwise the number of bytes moved */ 
+static ssize_t response_read(Http_upstream_con_t* up)
+{
+    Http_connection_t* con = up->client; 
+    ssize_t moved = 0; 
+
+    while (!up->head_done)
+    {
+        /* look for the end of the head in what's buffered */ 
+        char* end = NULL; 
+        for (size_t i = 0; i + HEAD_DELIMITER_LEN <= up->in_len; i++)
+        {
+            if (!memcmp(up->in + i, HEAD_DELIMITER, HEAD_DELIMITER_LEN))
+            {
+                end = up->in + i; 
+                break; 
+            }
+        }
+        if (end)
+        {
+            int result = response_head(up, end - up->in + HEAD_DELIMITER_LEN); 
+            if (result == -1)
+            {
+                proxy_fail(up, HTTP_BAD_GATEWAY); 
+                return -1; 
+            }
+            if (result == 0)
+                return moved; /* wait for the client to take the pending responses */ 
+            continue; 
+        }
+
+        if (up->in_len == HTTP_PROXY_BUFFER)
+        {
+            proxy_fail(up, HTTP_BAD_GATEWAY); 
+            return -1; 
+        }
+        ssize_t n = read(up->fd, up->in + up->in_len, HTTP_PROXY_BUFFER - up->in_len); 
+        if (n == 0)
+        {
+            proxy_fail(up, HTTP_BAD_GATEWAY); 
+            return -1; 
+        }
+        if (n == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return moved; 
+            proxy_fail(up, HTTP_BAD_GATEWAY); 
+            return -1; 
+        }
+        up->in_len += n; 
+        moved += n; 
+    }
+
+    if (up->body == HTTP_UPSTREAM_BODY_NONE)
+    {
+        proxy_finish(up, up->in_pos == up->in_len); 
+        return -1; 
+    }
+
+    /* body bytes that came with the head */ 
+    while (up->in_pos < up->in_len)
+    {
+        size_t room = HTTP_RESPONSE_SIZE - con->response_len; 
+        if (room == 0)
+            return moved; 
+        size_t len = up->in_len - up->in_pos; 
+        if (len > room)
+            len = room; 
+        ssize_t used = body_consume(up, up->in + up->in_pos, len); 
+        if (used == -1)
+        {
+            proxy_fail(up, HTTP_BAD_GATEWAY); 
+            return -1; 
+        }
+        memcpy(con->response + con->response_len, up->in + up->in_pos, used); 
+        con->response_len += used; 
+        up->in_pos += used; 
+        moved += used; 
+        HTTP_SET_WRITING(con->flags); 
+        if (up->done)
+        {
+            proxy_finish(up, up->in_pos == up->in_len); 
+            return -1; 
+        }
+    }
+
+    /* then read straight into the client response buffer */ 
+    for (;;)
+    {
+        size_t room = HTTP_RESPONSE_SIZE - con->response_len; 
+        if (room == 0)
+            return moved; 
+        if (up->body == HTTP_UPSTREAM_BODY_LENGTH && room > up->remaining)
+            room = up->remaining; 
+        char* dst = con->response + con->response_len; 
+        ssize_t n = read(up->fd, dst, room); 
+        if (n == 0)
+        {
+            if (up->body == HTTP_UPSTREAM_BODY_CLOSE)
+                proxy_finish(up, 0); 
+            else
+                proxy_fail(up, HTTP_BAD_GATEWAY); 
+            return -1; 
+        }
+        if (n == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return moved; 
+            proxy_fail(up, HTTP_BAD_GATEWAY); 
+            return -1; 
+        }
+        ssize_t used = body_consume(up, dst, n); 
+        if (used == -1)
+        {
+            proxy_fail(up, HTTP_BAD_GATEWAY); 
+            return -1; 
+        }
+        con->response_len += used; 
+        moved += used; 
+        HTTP_SET_WRITING(con->flags); 
+        if (up->done)
+        {
+            proxy_finish(up, used == n); 
+            return -1; 
+        }
+    }
+}
+
+static int name_is(const char* name, size_t len, const char* expected)
+{
+    return strlen(expected) == len && !strncasecmp(name, expected, len); 
+}
+
+/* rewrite the head into the client response buffer
+ * returns 0 if it doesn't fit yet, 1 once it was written and -1 if it's malformed */ 
+static int response_head(Http_upstream_con_t* up, size_t head_len)
+{
+    Http_connection_t* con = up->client; 
+    char* head = up->in; 
+    char* head_end = up->in + head_len - 2; /* the empty line */ 
+
+    char* eol = memchr(head, '\r', head_end - head); 
+    if (!eol || eol - head < 12 || memcmp(head, "HTTP/1.", 7) ||
+        head[9] < '1' || head[9] > '5' || head[10] < '0' || head[10] > '9' || head[11] < '0' || head[11] > '9')
+        return -1; 
+    int status = (head[9] - '0') * 100 + (head[10] - '0') * 10 + (head[11] - '0'); 
+
+    char* dst = con->response + con->response_len; 
+    size_t room = HTTP_RESPONSE_SIZE - con->response_len; 
+    size_t used = 0; 
+
+    /* interim responses go as they are, the final one follows */ 
+    if (status < 200)
+    {
+        if (status == 101)
+            return -1; /* upgrades are not proxied */ 
+        if (head_len > room)
+            return con->response_len > 0 ? 0 : -1; 
+        memcpy(dst, head, head_len); 
+        con->response_len += head_len; 
+        HTTP_SET_WRITING(con->flags); 
+        up->responded = 1; 
+        memmove(up->in, up->in + head_len, up->in_len - head_len); 
+        up->in_len -= head_len; 
+        return 1; 
+    }
+
+    http_connection_responded(con, head, head_len); 
+    int keep_alive = head[7] == '1'; 
+    int chunked = 0, other_coding = 0, has_length = 0; 
+    size_t length = 0; 
+
+#define HEAD_COPY(p, n) do { \
+        if ((n) > room - used) \
+            return con->response_len > 0 ? 0 : -1; \
+        memcpy(dst + used, (p), (n)); \
+        used += (n); \
+    } while (0)
+
+    HEAD_COPY(head, (size_t)(eol - head) + 2); 
+    for (char* line = eol + 2; line < head_end; line = eol + 2)
+    {
+        eol = memchr(line, '\r', head_end - line); 
+        if (!eol)
+            return -1; 
+        char* colon = memchr(line, ':', eol - line); 
+        if (!colon || colon == line)
+            return -1; 
+        size_t name_len = colon - line; 
+
+        /* the value without the surrounding spaces */ 
+        char value[HTTP_MAX_HEADER_LINE]; 
+        char* v = colon + 1; 
+        char* v_end = eol; 
+        while (v < v_end && (*v == ' ' || *v == '\t'))
+            v++; 
+        while (v_end > v && (v_end[-1] == ' ' || v_end[-1] == '\t'))
+            v_end--; 
+        if ((size_t)(v_end - v) >= sizeof value)
+            return -1; 
+        memcpy(value, v, v_end - v); 
+        value[v_end - v] = '\0'; 
+
+        if (name_is(line, name_len, "connection"))
+        {
+            if (header_has_token(value, "close"))
+                keep_alive = 0; 
+            else if (header_has_token(value, "keep-alive"))
+                keep_alive = 1; 
+            continue; 
+        }
+        if (header_is_hop(line, name_len))
+            continue; 
+        if (name_is(line, name_len, "transfer-encoding"))
+        {
+            size_t len = strlen(value); 
+            if (len >= 7 && !strcasecmp(value + len - 7, "chunked"))
+                chunked = 1; 
+            else
+                other_coding = 1; 
+        }
+        else if (name_is(line, name_len, "content-length"))
+        {
+            if (http_parse_sizet(value, &length) == -1)
+                return -1; 
+            has_length = 1; 
+        }
+        HEAD_COPY(line, (size_t)(eol - line) + 2); 
+    }
+
+    if (up->head_request || status == HTTP_NO_CONTENT || status == HTTP_NOT_MODIFIED)
+        up->body = HTTP_UPSTREAM_BODY_NONE; 
+    else if (chunked)
+        up->body = HTTP_UPSTREAM_BODY_CHUNKED; 
+    else if (other_coding || !has_length)
+        up->body = HTTP_UPSTREAM_BODY_CLOSE; 
+    else
+        up->body = length > 0 ? HTTP_UPSTREAM_BODY_LENGTH : HTTP_UPSTREAM_BODY_NONE; 
+
+    /* the server is going away or the client had its share, it should not send another request */ 
+    if (http_connection_last_request(con))
+        up->client_close = 1; 
+
+    /* without framing the end of the body is the end of the connection */ 
+    if (up->body == HTTP_UPSTREAM_BODY_CLOSE)
+    {
+        up->client_close = 1; 
+        keep_alive = 0; 
+    }
+
+    if (up->client_close)
+        HEAD_COPY("Connection: close\r\n\r\n", (size_t)21); 
+    else
+        HEAD_COPY("Connection: keep-alive\r\n\r\n", (size_t)26); 
+#undef HEAD_COPY
+
+    con->response_len += used; 
+    HTTP_SET_WRITING(con->flags); 
+    up->responded = 1; 
+    up->head_done = 1; 
+    up->in_pos = head_len; 
+    up->keep_alive = keep_alive; 
+    up->remaining = length; 
+    up->chunk_state = CHUNK_SIZE; 
+    up->chunk_size = 0; 
+    return 1; 
+}
+
+/* returns how many of the bytes belong to the response or -1 if the framing is broken */ 
+static ssize_t body_consume(Http_upstream_con_t* up, const char* data, size_t len)
+{
+    switch (up->body)
+    {
+        case HTTP_UPSTREAM_BODY_LENGTH: 
+            if (len > up->remaining)
+                len = up->remaining; 
+            up->remaining -= len; 
+            up->done = up->remaining == 0; 
+            return len; 
+
+        case HTTP_UPSTREAM_BODY_CHUNKED: 
+            return chunked_scan(up, data, len); 
+
+        case HTTP_UPSTREAM_BODY_CLOSE: 
+            return len; 
+
+        case HTTP_UPSTREAM_BODY_NONE: 
+        default: 
+            up->done = 1; 
+            return 0; 
+    }
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0'; 
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10; 
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10; 
+    return -1; 
+}
+
+/* only finds where the chunked body ends */ 
+static ssize_t chunked_scan(Http_upstream_con_t* up, const char* data, size_t len)
+{
+    size_t i = 0; 
+    while (i < len)
+    {
+        char c = data[i]; 
+        switch (up->chunk_state)
+        {
+            case CHUNK_SIZE: 
+            {
+                int v = hex_value(c); 
+                if (v != -1)
+                {
+                    if (up->chunk_size > (SIZE_MAX >> 4))
+                        return -1; 
+                    up->chunk_size = (up->chunk_size << 4) | v; 
+                }
+                else if (c == ';' || c == ' ' || c == '\t')
+                    up->chunk_state = CHUNK_EXT; 
+                else if (c == '\r')
+                    up->chunk_state = CHUNK_SIZE_LF; 
+                else
+                    return -1; 
+                i++; 
+            }
+            break; 
+            case CHUNK_EXT: 
+                if (c == '\r')
+                    up->chunk_state = CHUNK_SIZE_LF; 
+                i++; 
+            break; 
+            case CHUNK_SIZE_LF: 
+                if (c != '\n')
+                    return -1; 
+                up->chunk_state = up->chunk_size ? CHUNK_DATA : CHUNK_TRAILER_START; 
+                i++; 
+            break; 
+            case CHUNK_DATA: 
+            {
+                size_t take = len - i; 
+                if (take > up->chunk_size)
+                    take = up->chunk_size; 
+                up->chunk_size -= take; 
+                i += take; 
+                if (up->chunk_size == 0)
+                    up->chunk_state = CHUNK_DATA_CR; 
+            }
+            break; 
+            case CHUNK_DATA_CR: 
+                if (c != '\r')
+                    return -1; 
+                up->chunk_state = CHUNK_DATA_LF; 
+                i++; 
+            break; 
+            case CHUNK_DATA_LF: 
+                if (c != '\n')
+                    return -1; 
+                up->chunk_state = CHUNK_SIZE; 
+                i++; 
+            break; 
+            case CHUNK_TRAILER_START: 
+                up->chunk_state = c == '\r' ? CHUNK_FINAL_LF : CHUNK_TRAILER_LINE; 
+                i++; 
+            break; 
+            case CHUNK_TRAILER_LINE: 
+                if (c == '\n')
+                    up->chunk_state = CHUNK_TRAILER_START; 
+                i++; 
+            break; 
+            case CHUNK_FINAL_LF: 
+                if (c != '\n')
+                    return -1; 
+                up->done = 1; 
+                return i + 1; 
+        }
+    }
+    return i; 
+}
+
+/* the response is complete, reusable is 0 if the backend sent more than asked */ 
+static void proxy_finish(Http_upstream_con_t* up, int reusable)
+{
+    Http_connection_t* con = up->client; 
+    Http_backend_t* backend = up->backend; 
+
+    backend->active--; 
+    up->client = NULL; 
+    con->upstream = NULL; 
+
+    if (reusable && up->keep_alive && up->body_remaining == 0 && up->out_len == 0 &&
+        backend->idle_count < HTTP_PROXY_MAX_IDLE)
+    {
+        up->state = HTTP_UPSTREAM_IDLE; 
+        up->next = backend->idle; 
+        backend->idle = up; 
+        backend->idle_count++; 
+    }
+    else
+        upstream_close(up); 
+
+    if (up->client_close)
+    {
+        HTTP_SET_SHOULD_CLOSE(con->flags); 
+        return; 
+    }
+
+    if (con->timeout_index != -1)
+        http_timer_update(con->ctx->timer, con, HTTP_CLIENT_TIMEOUT); 
+
+    /* requests that came while proxying are still waiting */ 
+    http_connection_read(con); 
+}
+
+static void proxy_fail(Http_upstream_con_t* up, int status_code)
+{
+    Http_connection_t* con = up->client; 
+    int responded = up->responded; 
+
+    http_proxy_abort(con); 
+    if (!responded)
+        http_connection_error(con, status_code); 
+    else
+        HTTP_SET_SHOULD_CLOSE(con->flags); /* the response is cut */ 
+}
+
+/* nothing was sent yet, another backend can take the request */ 
+static void proxy_retry(Http_upstream_con_t* up)
+{
+    Http_connection_t* con = up->client; 
+    Http_backend_t* backend = backend_pick(up->upstream); 
+    if (backend->down_until > http_time_ms())
+    {
+        proxy_fail(up, HTTP_BAD_GATEWAY); 
+        return; 
+    }
+
+    Http_upstream_con_t* retry = backend_connection(up->ctx, backend); 
+    if (!retry)
+    {
+        proxy_fail(up, HTTP_BAD_GATEWAY); 
+        return; 
+    }
+
+    retry->client = con; 
+    retry->upstream = up->upstream; 
+    memcpy(retry->out, up->out, up->out_len); 
+    retry->out_len = up->out_len; 
+    retry->body_remaining = up->body_remaining; 
+    retry->head_request = up->head_request; 
+    retry->client_close = up->client_close; 
+    retry->touched = up->touched; 
+
+    up->backend->active--; 
+    up->client = NULL; 
+    upstream_close(up); 
+    backend->active++; 
+    con->upstream = retry; 
+}
+
+/* the client socket has no event coming for what the backend did */ 
+static void client_kick(Http_connection_t* con)
+{
+    /* an empty write still goes through the handler that closes it */ 
+    if (HTTP_SHOULD_CLOSE(con->flags))
+        HTTP_SET_WRITING(con->flags); 
+    http_connection_update_events(con->ctx->epoll_fd, con->item); 
+}
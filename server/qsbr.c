@@ -0,0 +1,123 @@
+#include <assert.h> 
+#include <stdio.h> 
+#include <stdlib.h> 
+
+#include <loom/qsbr.h> 
+
+#define QSBR_OFFLINE 0
+
+int http_qsbr_init(Http_qsbr_t* qsbr)
+{
+    qsbr->epoch = 1; /* 0 means offline */ 
+    qsbr->readers = 0; 
+    qsbr->retired = NULL; 
+    for (size_t i = 0; i < HTTP_QSBR_MAX_READERS; i++)
+        qsbr->seen[i] = QSBR_OFFLINE; 
+    if (pthread_mutex_init(&qsbr->lock, NULL) != 0)
+    {
+        fprintf(stderr, "Error: failed creating the reclamation lock\n"); 
+        return -1; 
+    }
+    return 0; 
+}
+
+void http_qsbr_clean(Http_qsbr_t* qsbr)
+{
+    Http_qsbr_retired_t *node, *next; 
+    for (node = qsbr->retired; node != NULL; node = next)
+    {
+        next = node->next; 
+        node->free_fn(node->ptr); 
+        free(node); 
+    }
+    qsbr->retired = NULL; 
+    pthread_mutex_destroy(&qsbr->lock); 
+}
+
+int http_qsbr_register(Http_qsbr_t* qsbr)
+{
+    size_t id = __atomic_fetch_add(&qsbr->readers, 1, __ATOMIC_SEQ_CST); 
+    if (id >= HTTP_QSBR_MAX_READERS)
+    {
+        __atomic_fetch_sub(&qsbr->readers, 1, __ATOMIC_SEQ_CST); 
+        return -1; 
+    }
+    http_qsbr_quiescent(qsbr, id); 
+    return id; 
+}
+
+void http_qsbr_offline(Http_qsbr_t* qsbr, int reader)
+{
+    __atomic_store_n(&qsbr->seen[reader], QSBR_OFFLINE, __ATOMIC_SEQ_CST); 
+}
+
+void http_qsbr_quiescent(Http_qsbr_t* qsbr, int reader)
+{
+    /* seq_cst so the loads of the shared pointers that follow can't move before it */ 
+    __atomic_store_n(&qsbr->seen[reader], __atomic_load_n(&qsbr->epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST); 
+}
+
+int http_qsbr_retire(Http_qsbr_t* qsbr, void* ptr, void (*free_fn)(void* ptr))
+{
+    Http_qsbr_retired_t* node = malloc(sizeof(Http_qsbr_retired_t)); 
+    if (!node)
+    {
+        perror("malloc"); 
+        return -1; 
+    }
+    node->ptr = ptr; 
+    node->free_fn = free_fn; 
+
+    pthread_mutex_lock(&qsbr->lock); 
+    /* a reader that saw this epoch or a later one loaded its pointers after ptr was unpublished */ 
+    node->epoch = __atomic_add_fetch(&qsbr->epoch, 1, __ATOMIC_SEQ_CST); 
+    node->next = qsbr->retired; 
+    __atomic_store_n(&qsbr->retired, node, __ATOMIC_RELEASE); 
+    pthread_mutex_unlock(&qsbr->lock); 
+
+    http_qsbr_reclaim(qsbr); 
+    return 0; 
+}
+
+void http_qsbr_reclaim(Http_qsbr_t* qsbr)
+{
+    if (!__atomic_load_n(&qsbr->retired, __ATOMIC_ACQUIRE))
+        return; 
+    /* somebody else is at it, whatever is left goes on the next call */ 
+    if (pthread_mutex_trylock(&qsbr->lock) != 0)
+        return; 
+
+    uint64_t min = UINT64_MAX; 
+    size_t readers = __atomic_load_n(&qsbr->readers, __ATOMIC_SEQ_CST); 
+    for (size_t i = 0; i < readers && i < HTTP_QSBR_MAX_READERS; i++)
+    {
+        uint64_t seen = __atomic_load_n(&qsbr->seen[i], __ATOMIC_SEQ_CST); 
+        if (seen != QSBR_OFFLINE && seen < min)
+            min = seen; 
+    }
+
+    /* unlink what every reader moved past, free it without the lock */ 
+    Http_qsbr_retired_t* freed = NULL; 
+    Http_qsbr_retired_t** link = &qsbr->retired; 
+    while (*link)
+    {
+        Http_qsbr_retired_t* node = *link; 
+        if (node->epoch <= min)
+        {
+            *link = node->next; 
+            node->next = freed; 
+            freed = node; 
+        }
+        else
+            link = &node->next; 
+    }
+    pthread_mutex_unlock(&qsbr->lock); 
+
+    while (freed)
+    {
+        Http_qsbr_retired_t* next = freed->next; 
+        freed->free_fn(freed->ptr); 
+        free(freed); 
+        freed = next; 
+    }
+}
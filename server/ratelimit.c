@@ -0,0 +1,159 @@
+#include <assert.h> 
+#include <stdio.h> 
+#include <stdlib.h> 
+#include <string.h> 
+#include <netinet/in.h> 
+
+#include <loom/ratelimit.h> 
+#include <loom/http_response.h> 
+#include <loom/utils.h> 
+
+static void addr_key(const struct sockaddr_storage* addr, uint8_t key[16]); 
+static Http_ratelimit_entry_t* entry_find(Http_server_context_t* ctx, const uint8_t key[16], uint64_t now); 
+static void bucket_refill(Http_server_context_t* ctx, Http_ratelimit_entry_t* entry, uint64_t now); 
+
+int http_ratelimit_init(Http_server_context_t* ctx)
+{
+    Http_config_t* cfg = ctx->cfg; 
+    ctx->ratelimit = NULL; 
+    if (cfg->rate_limit <= 0 && cfg->max_connections_per_ip == 0)
+        return 0; 
+
+    Http_response_t response; 
+    http_response_make_error(&response, HTTP_TOO_MANY_REQUESTS); 
+    http_response_set_retry_after(&response, 1); 
+    int len = http_response_raw(&response, ctx->ratelimit_response, sizeof ctx->ratelimit_response); 
+    http_response_free(&response); 
+    if (len == -1)
+        return -1; 
+    ctx->ratelimit_response_len = len; 
+
+    ctx->ratelimit = calloc(HTTP_RATELIMIT_SLOTS, sizeof(Http_ratelimit_entry_t)); 
+    if (!ctx->ratelimit)
+    {
+        perror("calloc"); 
+        return -1; 
+    }
+    return 0; 
+}
+
+void http_ratelimit_clean(Http_server_context_t* ctx)
+{
+    free(ctx->ratelimit); 
+    ctx->ratelimit = NULL; 
+}
+
+int http_ratelimit_connect(Http_server_context_t* ctx, const struct sockaddr_storage* addr,
+                           Http_ratelimit_entry_t** entry)
+{
+    *entry = NULL; 
+    if (!ctx->ratelimit)
+        return 0; 
+
+    uint8_t key[16]; 
+    addr_key(addr, key); 
+    uint64_t now = http_time_ms(); 
+    Http_ratelimit_entry_t* e = entry_find(ctx, key, now); 
+    if (!e)
+        return 0; /* every slot nearby is held by connected clients, let it through untracked */ 
+
+    size_t max = ctx->cfg->max_connections_per_ip; 
+    if (max && e->connections >= max)
+        return -1; 
+
+    bucket_refill(ctx, e, now); 
+    e->connections++; 
+    *entry = e; 
+    return 0; 
+}
+
+void http_ratelimit_disconnect(Http_ratelimit_entry_t* entry)
+{
+    if (!entry)
+        return; 
+    assert(entry->connections > 0); 
+    entry->connections--; 
+}
+
+int http_ratelimit_request(Http_server_context_t* ctx, Http_ratelimit_entry_t* entry)
+{
+    if (!entry || ctx->cfg->rate_limit <= 0)
+        return 0; 
+
+    bucket_refill(ctx, entry, http_time_ms()); 
+    if (entry->tokens < 1000)
+        return 1; 
+    entry->tokens -= 1000; 
+    return 0; 
+}
+
+/* ipv4 goes in as ::ffff:a.b.c.d so it matches what a dual stack listener sees,
+ * ipv6 clients are keyed by their /64, one host usually owns the whole prefix */ 
+static void addr_key(const struct sockaddr_storage* addr, uint8_t key[16])
+{
+    memset(key, 0, 16); 
+    if (addr->ss_family == AF_INET)
+    {
+        const struct sockaddr_in* in = (const struct sockaddr_in*)addr; 
+        key[10] = 0xff; 
+        key[11] = 0xff; 
+        memcpy(key + 12, &in->sin_addr, 4); 
+    }
+    else if (addr->ss_family == AF_INET6)
+    {
+        const struct sockaddr_in6* in6 = (const struct sockaddr_in6*)addr; 
+        if (IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr))
+            memcpy(key, &in6->sin6_addr, 16); 
+        else
+            memcpy(key, &in6->sin6_addr, 8); 
+    }
+}
+
+static inline int entry_expired(const Http_ratelimit_entry_t* e, uint64_t now)
+{
+    return e->connections == 0 && now - e->last > HTTP_RATELIMIT_IDLE_MS; 
+}
+
+/* linear probing over a short window, the whole window is always searched
+ * so slots can be reused in place without tombstones */ 
+static Http_ratelimit_entry_t* entry_find(Http_server_context_t* ctx, const uint8_t key[16], uint64_t now)
+{
+    size_t slot = http_hash_bytes(key, 16) & (HTTP_RATELIMIT_SLOTS - 1); 
+    Http_ratelimit_entry_t* free_slot = NULL; 
+    Http_ratelimit_entry_t* oldest = NULL; 
+
+    for (size_t i = 0; i < HTTP_RATELIMIT_PROBE; i++)
+    {
+        Http_ratelimit_entry_t* e = &ctx->ratelimit[(slot + i) & (HTTP_RATELIMIT_SLOTS - 1)]; 
+        if (e->used && !memcmp(e->addr, key, 16))
+            return e; 
+        if (free_slot)
+            continue; 
+        if (!e->used || entry_expired(e, now))
+            free_slot = e; 
+        else if (e->connections == 0 && (!oldest || e->last < oldest->last))
+            oldest = e; 
+    }
+
+    /* the window is full: forget the client that was idle the longest */ 
+    Http_ratelimit_entry_t* e = free_slot ? free_slot : oldest; 
+    if (!e)
+        return NULL; 
+
+    memcpy(e->addr, key, 16); 
+    e->used = 1; 
+    e->last = now; 
+    e->tokens = (ctx->cfg->rate_burst > 0 ? ctx->cfg->rate_burst : ctx->cfg->rate_limit) * 1000u; 
+    e->connections = 0; 
+    return e; 
+}
+
+static void bucket_refill(Http_server_context_t* ctx, Http_ratelimit_entry_t* entry, uint64_t now)
+{
+    int rate = ctx->cfg->rate_limit; 
+    uint64_t cap = (uint64_t)(ctx->cfg->rate_burst > 0 ? ctx->cfg->rate_burst : rate) * 1000; 
+    /* rate tokens per second is rate x1000 per 1000 ms */ 
+    uint64_t tokens = entry->tokens + (now - entry->last) * (uint64_t)(rate > 0 ? rate : 0); 
+    entry->tokens = tokens > cap ? cap : tokens; 
+    entry->last = now; 
+}
@@ -0,0 +1,245 @@
+#include <assert.h> 
+#include <stdio.h> 
+#include <stdlib.h> 
+#include <string.h> 
+
+#include <loom/resp_cache.h> 
+#include <loom/compress.h> 
+#include <loom/utils.h> 
+
+#define BUCKET(hash) ((hash) & (HTTP_CACHE_BUCKETS - 1))
+
+static int  key_append(Http_cache_key_t* key, const char* data, size_t len); 
+static int  key_append_slice(Http_cache_key_t* key, Http_slice_t value); 
+static Http_cache_entry_t* entry_find(Http_resp_cache_t* cache, const Http_cache_key_t* key); 
+static void entry_free(Http_cache_entry_t* entry); 
+static void bucket_evict_dead(Http_resp_cache_t* cache, size_t bucket, uint64_t now); 
+
+Http_resp_cache_t* http_resp_cache_create(const Http_cache_policy_t* policy)
+{
+    assert(policy != NULL); 
+    Http_resp_cache_t* cache = malloc(sizeof(Http_resp_cache_t)); 
+    if (!cache)
+    {
+        perror("malloc"); 
+        return NULL; 
+    }
+    memset(cache, 0, sizeof(Http_resp_cache_t)); 
+    cache->policy = *policy; 
+    return cache; 
+}
+
+void http_resp_cache_destroy(Http_resp_cache_t* cache)
+{
+    if (!cache)
+        return; 
+    for (size_t i = 0; i < HTTP_CACHE_BUCKETS; i++)
+    {
+        Http_cache_entry_t *entry, *entry_next; 
+        for (entry = cache->buckets[i]; entry != NULL; entry = entry_next)
+        {
+            entry_next = entry->next; 
+            entry_free(entry); 
+        }
+    }
+    free(cache); 
+}
+
+static int key_append(Http_cache_key_t* key, const char* data, size_t len)
+{
+    /* length first, "a" "bc" and "ab" "c" are different keys whatever bytes they hold */ 
+    uint16_t field_len = len; 
+    if (key->len + sizeof field_len + len > HTTP_CACHE_MAX_KEY)
+        return -1; 
+    memcpy(key->buff + key->len, &field_len, sizeof field_len); 
+    key->len += sizeof field_len; 
+    memcpy(key->buff + key->len, data, len); 
+    key->len += len; 
+    return 0; 
+}
+
+/* a field that may be missing is always written, with a marker, so it can't take the next one's place */ 
+static int key_append_slice(Http_cache_key_t* key, Http_slice_t value)
+{
+    char present = value.ptr ? '+' : '-'; 
+    if (key_append(key, &present, 1) == -1)
+        return -1; 
+    if (value.ptr && key_append(key, value.ptr, value.len) == -1)
+        return -1; 
+    return 0; 
+}
+
+int http_resp_cache_key(Http_resp_cache_t* cache, Http_request_t* req, Http_cache_key_t* key)
+{
+    assert(cache != NULL); 
+    assert(req != NULL); 
+    assert(key != NULL); 
+    key->len = 0; 
+
+    if (key_append(key, req->method_str, strlen(req->method_str)) == -1 ||
+        key_append(key, req->path, strlen(req->path)) == -1 ||
+        key_append(key, req->version, strlen(req->version)) == -1)
+        return -1; 
+    /* what the handler sees, "/a//b?x" and "/a/b?x" are the same entry */ 
+    if (key_append_slice(key, req->query) == -1)
+        return -1; 
+
+    /* the serialized bytes depend on keep-alive and compression */ 
+    if (key_append_slice(key, http_request_header(req, "Connection")) == -1)
+        return -1; 
+    unsigned int accept = http_accept_encoding_parse(http_request_header(req, "Accept-Encoding")); 
+    char gzip = (accept & HTTP_ENCODING_BIT(HTTP_ENCODING_GZIP)) ? 'g' : '-'; 
+    if (key_append(key, &gzip, 1) == -1)
+        return -1; 
+
+    for (size_t i = 0; i < HTTP_CACHE_MAX_VARY && cache->policy.vary[i]; i++)
+    {
+        if (key_append_slice(key, http_request_header(req, cache->policy.vary[i])) == -1)
+            return -1; 
+    }
+
+    key->hash = http_hash_bytes(key->buff, key->len); 
+    return 0; 
+}
+
+static Http_cache_entry_t* entry_find(Http_resp_cache_t* cache, const Http_cache_key_t* key)
+{
+    for (Http_cache_entry_t* entry = cache->buckets[BUCKET(key->hash)]; entry != NULL; entry = entry->next)
+    {
+        if (entry->hash == key->hash && entry->key_len == key->len && !memcmp(entry->key, key->buff, key->len))
+            return entry; 
+    }
+    return NULL; 
+}
+
+Http_cache_result_t http_resp_cache_lookup(Http_resp_cache_t* cache, const Http_cache_key_t* key, Http_cache_entry_t** entry)
+{
+    assert(cache != NULL); 
+    assert(key != NULL); 
+    assert(entry != NULL); 
+
+    Http_cache_entry_t* found = entry_find(cache, key); 
+    if (!found)
+        return HTTP_CACHE_MISS; 
+
+    uint64_t now = http_time_ms(); 
+    if (now < found->fresh_until)
+    {
+        *entry = found; 
+        return HTTP_CACHE_HIT; 
+    }
+    if (now < found->stale_until)
+    {
+        *entry = found; 
+        if (found->refreshing) /* someone else is on it */ 
+            return HTTP_CACHE_HIT; 
+        found->refreshing = 1; 
+        return HTTP_CACHE_STALE; 
+    }
+    return HTTP_CACHE_MISS; 
+}
+
+int http_resp_cache_store(Http_resp_cache_t* cache,
+                          const Http_cache_key_t* key,
+                          const char* data,
+                          size_t data_len,
+                          int connection_close)
+{
+    assert(cache != NULL); 
+    assert(key != NULL); 
+    assert(data != NULL); 
+
+    uint64_t now = http_time_ms(); 
+    Http_cache_entry_t* entry = entry_find(cache, key); 
+    if (!entry)
+    {
+        size_t bucket = BUCKET(key->hash); 
+        if (cache->entries_count >= HTTP_CACHE_MAX_ENTRIES)
+        {
+            bucket_evict_dead(cache, bucket, now); 
+            if (cache->entries_count >= HTTP_CACHE_MAX_ENTRIES)
+                return -1; /* full of live entries */ 
+        }
+
+        entry = malloc(sizeof(Http_cache_entry_t)); 
+        if (!entry)
+            return -1; 
+        memset(entry, 0, sizeof(Http_cache_entry_t)); 
+        entry->key = malloc(key->len); 
+        if (!entry->key)
+        {
+            free(entry); 
+            return -1; 
+        }
+        memcpy(entry->key, key->buff, key->len); 
+        entry->key_len = key->len; 
+        entry->hash = key->hash; 
+
+        entry->next = cache->buckets[bucket]; 
+        cache->buckets[bucket] = entry; 
+        cache->entries_count++; 
+    }
+
+    /* replace the data, the old one was already copied to the connections */ 
+    char* new_data = malloc(data_len); 
+    if (!new_data)
+    {
+        entry->refreshing = 0; 
+        return -1; 
+    }
+    memcpy(new_data, data, data_len); 
+    free(entry->data); 
+    entry->data = new_data; 
+    entry->data_len = data_len; 
+    entry->connection_close = connection_close; 
+    entry->fresh_until = now + cache->policy.ttl_ms; 
+    entry->stale_until = entry->fresh_until + cache->policy.stale_ms; 
+    entry->refreshing = 0; 
+    return 0; 
+}
+
+void http_resp_cache_refresh_failed(Http_resp_cache_t* cache, const Http_cache_key_t* key)
+{
+    Http_cache_entry_t* entry = entry_find(cache, key); 
+    if (entry)
+        entry->refreshing = 0; 
+}
+
+int http_resp_cache_status_cacheable(int status_code)
+{
+    switch (status_code)
+    {
+        case HTTP_OK: 
+        case HTTP_NO_CONTENT: 
+        case HTTP_MOVED_PERMANENTLY: 
+        case HTTP_NOT_FOUND: 
+        case HTTP_GONE: 
+            return 1; 
+        default: 
+            return 0; 
+    }
+}
+
+static void bucket_evict_dead(Http_resp_cache_t* cache, size_t bucket, uint64_t now)
+{
+    Http_cache_entry_t** link = &cache->buckets[bucket]; 
+    while (*link)
+    {
+        Http_cache_entry_t* entry = *link; 
+        if (now >= entry->stale_until && !entry->refreshing)
+        {
+            *link = entry->next; 
+            entry_free(entry); 
+            cache->entries_count--; 
+        }
+        else
+            link = &entry->next; 
+    }
+}
+
+static void entry_free(Http_cache_entry_t* entry)
+{
+    free(entry->key); 
+    free(entry->data); 
+    free(entry); 
+}
@@ -1,6 +1,10 @@
 #include <assert.h> 
+#include <errno.h> 
+#include <stddef.h> 
 #include <stdio.h> 
 #include <stdlib.h> 
+#include <string.h> 
+#include <unistd.h> 
 
 #include <loom/http_response.h> 
 
@@ -11,6 +15,7 @@ static const char *http_status_reasons_table[HTTP_MAX_STATUS_CODE + 1] = {
     [201] = "Created",
     [202] = "Accepted",
     [204] = "No Content",
+    [206] = "Partial Content",
     [301] = "Moved Permanently",
     [302] = "Found",
     [304] = "Not Modified",
@@ -23,6 +28,8 @@ static const char *http_status_reasons_table[HTTP_MAX_STATUS_CODE + 1] = {
     [410] = "Gone",
     [413] = "Payload Too Large",
     [415] = "Unsupported Media Type",
+    [416] = "Range Not Satisfiable",
+    [429] = "Too Many Requests",
     [500] = "Internal Server Error",
     [501] = "Not Implemented",
     [502] = "Bad Gateway",
@@ -38,6 +45,19 @@ const char *http_status_reason_phrase(int code)
     return http_status_reasons_table[code];
 }
 
+int http_status_has_body(int status_code)
+{
+    return status_code >= 200 && status_code != HTTP_NO_CONTENT && status_code != HTTP_NOT_MODIFIED; 
+}
+
+int http_status_from_head(const char* head, size_t len)
+{
+    if (len < 12 || memcmp(head, "HTTP/1.", 7) || head[9] < '1' || head[9] > '5' ||
+        head[10] < '0' || head[10] > '9' || head[11] < '0' || head[11] > '9')
+        return 0; 
+    return (head[9] - '0') * 100 + (head[10] - '0') * 10 + (head[11] - '0'); 
+}
+
 static const char* content_type_table[HTTP_CONTENT_TYPE_LAST + 1] = {
     [HTTP_CONTENT_NONE]             = NULL, 
     [HTTP_CONTENT_TEXT_PLAIN]       = "text/plain", 
@@ -48,6 +68,7 @@ static const char* content_type_table[HTTP_CONTENT_TYPE_LAST + 1] = {
     [HTTP_CONTENT_IMAGE_JPEG]       = "image/jpeg",
     [HTTP_CONTENT_IMAGE_GIF]        = "image/gif",
     [HTTP_CONTENT_IMAGE_SVG]        = "image/svg+xml",
+    [HTTP_CONTENT_TEXT_EVENT_STREAM] = "text/event-stream",
 };
 
 const char* http_content_type_value(Http_content_type_t content_type)
@@ -58,10 +79,46 @@ const char* http_content_type_value(Http_content_type_t content_type)
     return content_type_table[content_type]; 
 }
 
+static const char content_type_compressible_table[HTTP_CONTENT_TYPE_LAST + 1] = {
+    [HTTP_CONTENT_TEXT_PLAIN]       = 1,
+    [HTTP_CONTENT_TEXT_HTML]        = 1,
+    [HTTP_CONTENT_TEXT_CSS]         = 1,
+    [HTTP_CONTENT_APPLICATION_JS]   = 1,
+    [HTTP_CONTENT_IMAGE_SVG]        = 1,
+}; 
+
+int http_content_type_compressible(Http_content_type_t content_type)
+{
+    if (content_type < 0 || content_type > HTTP_CONTENT_TYPE_LAST)
+        return 0; 
+
+    return content_type_compressible_table[content_type]; 
+}
+
+static const char* content_encoding_table[HTTP_CONTENT_ENCODING_LAST + 1] = {
+    [HTTP_ENCODING_NONE]    = NULL,
+    [HTTP_ENCODING_GZIP]    = "gzip",
+    [HTTP_ENCODING_BR]      = "br",
+}; 
+
+const char* http_content_encoding_value(Http_content_encoding_t encoding)
+{
+    if (encoding < 0 || encoding > HTTP_CONTENT_ENCODING_LAST)
+        return NULL; 
+
+    return content_encoding_table[encoding]; 
+}
+
+void http_response_init(Http_response_t* resp)
+{
+    assert(resp != NULL); 
+    memset(resp, 0, offsetof(Http_response_t, headers)); 
+}
+
 void http_response_make_error(Http_response_t* resp, int status_code)
 {
     assert(resp != NULL); 
-    memset(resp, 0, sizeof(Http_response_t)); 
+    http_response_init(resp); 
 
     resp->status_code = status_code; 
 
@@ -74,10 +131,111 @@ void http_response_make_error(Http_response_t* resp, int status_code)
     resp->connection_close = 1; 
 }
 
+int http_response_add_header(Http_response_t* resp,
+                             char* key, Http_memory_flag_t key_mem,
+                             char* value, Http_memory_flag_t value_mem)
+{
+    assert(resp != NULL); 
+    if (resp->headers_count >= HTTP_MAX_HEADERS)
+        return -1; 
+
+    Http_response_header_t* header; 
+    size_t more = resp->headers_count - HTTP_RESPONSE_INLINE_HEADERS; 
+    if (resp->headers_count < HTTP_RESPONSE_INLINE_HEADERS)
+        header = &resp->headers[resp->headers_count]; 
+    else
+    {
+        if (more == resp->headers_more_cap)
+        {
+            size_t cap = resp->headers_more_cap ? resp->headers_more_cap * 2 : HTTP_RESPONSE_INLINE_HEADERS; 
+            Http_response_header_t* grown = realloc(resp->headers_more, cap * sizeof(Http_response_header_t)); 
+            if (!grown)
+            {
+                perror("realloc"); 
+                return -1; 
+            }
+            resp->headers_more = grown; 
+            resp->headers_more_cap = cap; 
+        }
+        header = &resp->headers_more[more]; 
+    }
+    resp->headers_count++; 
+    header->key = key; 
+    header->key_mem = key_mem; 
+    header->value = value; 
+    header->value_mem = value_mem; 
+    return 0; 
+}
+
+const Http_response_header_t* http_response_header_at(const Http_response_t* resp, size_t i)
+{
+    assert(i < resp->headers_count); 
+    if (i < HTTP_RESPONSE_INLINE_HEADERS)
+        return &resp->headers[i]; 
+    return &resp->headers_more[i - HTTP_RESPONSE_INLINE_HEADERS]; 
+}
+
+void http_response_set_cache_control(Http_response_t* resp, Http_cache_control_t cache_control, uint32_t max_age)
+{
+    resp->cache_control = cache_control; 
+    resp->max_age = max_age; 
+}
+
+void http_response_set_last_modified(Http_response_t* resp, time_t mtime)
+{
+    resp->last_modified = mtime; 
+}
+
+void http_response_set_etag(Http_response_t* resp, char* etag, Http_memory_flag_t mem)
+{
+    if (resp->etag_mem == HTTP_MEM_OWNED)
+        free(resp->etag); 
+    resp->etag = etag; 
+    resp->etag_mem = mem; 
+}
+
+void http_response_set_location(Http_response_t* resp, char* location, Http_memory_flag_t mem)
+{
+    if (resp->location_mem == HTTP_MEM_OWNED)
+        free(resp->location); 
+    resp->location = location; 
+    resp->location_mem = mem; 
+}
+
+void http_response_set_retry_after(Http_response_t* resp, uint32_t seconds)
+{
+    resp->retry_after = seconds; 
+}
+
+/* the whole value when there is no max-age, the prefix otherwise */ 
+static const char* cache_control_table[HTTP_CACHE_CONTROL_LAST + 1] = {
+    [HTTP_CACHE_CONTROL_NONE]       = NULL,
+    [HTTP_CACHE_CONTROL_NO_STORE]   = "no-store",
+    [HTTP_CACHE_CONTROL_NO_CACHE]   = "no-cache",
+    [HTTP_CACHE_CONTROL_PRIVATE]    = "private, max-age=",
+    [HTTP_CACHE_CONTROL_PUBLIC]     = "public, max-age=",
+    [HTTP_CACHE_CONTROL_IMMUTABLE]  = "public, max-age=",
+}; 
+
+const char* http_cache_control_value(const Http_response_t* resp, char* buf, size_t size)
+{
+    Http_cache_control_t cache_control = resp->cache_control; 
+    if (cache_control <= HTTP_CACHE_CONTROL_NONE || cache_control > HTTP_CACHE_CONTROL_LAST)
+        return NULL; 
+    if (cache_control < HTTP_CACHE_CONTROL_PRIVATE)
+        return cache_control_table[cache_control]; 
+
+    int n = snprintf(buf, size, "%s%u%s", cache_control_table[cache_control], resp->max_age,
+                     cache_control == HTTP_CACHE_CONTROL_IMMUTABLE ? ", immutable" : ""); 
+    if (n < 0 || (size_t)n >= size)
+        return NULL; 
+    return buf; 
+}
+
 #define RAW_WRITE(fmt, ...) \
     do { \
         n = snprintf(buffer + written, buffer_len - written, fmt, __VA_ARGS__); \
-        if (n < 0 || (size_t)n >= buffer_len) \
+        if (n < 0 || (size_t)n >= buffer_len - written) \
             return -1; \
         written += n; \
     } while(0)
@@ -94,23 +252,55 @@ int http_response_raw(const Http_response_t* resp, char* buffer, size_t buffer_l
             http_status_reason_phrase(resp->status_code)); 
 
     /* headers */  
-    const char* conn_val = resp->connection_close ? "close" : "keep-alive";
+    const char* conn_val = resp->status_code == HTTP_SWITCHING_PROTOCOLS ? "Upgrade" :
+                           resp->connection_close ? "close" : "keep-alive"; 
     RAW_WRITE("Connection: %s\r\n", conn_val); 
 
     for (size_t i = 0; i < resp->headers_count; i++)
     {
-        RAW_WRITE("%s: %s\r\n", 
-            resp->headers[i].key, 
-            resp->headers[i].value); 
+        const Http_response_header_t* header = http_response_header_at(resp, i); 
+        RAW_WRITE("%s: %s\r\n", header->key, header->value); 
     }
 
+    char cache_control[HTTP_CACHE_CONTROL_SIZE]; 
+    const char* cache_control_value = http_cache_control_value(resp, cache_control, sizeof cache_control); 
+    if (cache_control_value)
+        RAW_WRITE("Cache-Control: %s\r\n", cache_control_value); 
+    if (resp->etag)
+        RAW_WRITE("ETag: %s\r\n", resp->etag); 
+    if (resp->last_modified)
+    {
+        char date[HTTP_DATE_SIZE]; 
+        http_format_date(resp->last_modified, date); 
+        RAW_WRITE("Last-Modified: %s\r\n", date); 
+    }
+    if (resp->location)
+        RAW_WRITE("Location: %s\r\n", resp->location); 
+    if (resp->retry_after)
+        RAW_WRITE("Retry-After: %u\r\n", resp->retry_after); 
+
     const char* content_type_value = http_content_type_value(resp->content_type); 
     if (content_type_value)
     {
         RAW_WRITE("Content-Type: %s\r\n", content_type_value); 
     }
 
-    RAW_WRITE("Content-Length: %zu\r\n", resp->body_len); 
+    const char* content_encoding_value = http_content_encoding_value(resp->content_encoding); 
+    if (content_encoding_value)
+    {
+        RAW_WRITE("Content-Encoding: %s\r\n", content_encoding_value); 
+    }
+
+    if (resp->vary_encoding)
+    {
+        RAW_WRITE("%s", "Vary: Accept-Encoding\r\n"); 
+    }
+
+    /* an event stream ends with the connection */ 
+    if (http_status_has_body(resp->status_code) && !resp->sse_topic)
+    {
+        RAW_WRITE("Content-Length: %zu\r\n", resp->body_len); 
+    }
 
     /* delimitier */ 
     if (buffer_len - written < 2) return -1;
@@ -118,6 +308,9 @@ int http_response_raw(const Http_response_t* resp, char* buffer, size_t buffer_l
     written += 2;
 
     /* body :3 */ 
+    if (resp->body_type == HTTP_BODY_FILE) /* the connection sends it */ 
+        return written; 
+
     if (buffer_len - written < resp->body_len)
         return -1; 
     
@@ -155,23 +348,55 @@ int http_response_raw_circ(const Http_response_t* resp, Http_circ_buff_t* resp_b
             http_status_reason_phrase(resp->status_code)); 
 
     /* headers */  
-    const char* conn_val = resp->connection_close ? "close" : "keep-alive";
+    const char* conn_val = resp->status_code == HTTP_SWITCHING_PROTOCOLS ? "Upgrade" :
+                           resp->connection_close ? "close" : "keep-alive"; 
     CIRC_WRITE("Connection: %s\r\n", conn_val); 
 
     for (size_t i = 0; i < resp->headers_count; i++)
     {
-        CIRC_WRITE("%s: %s\r\n", 
-            resp->headers[i].key, 
-            resp->headers[i].value); 
+        const Http_response_header_t* header = http_response_header_at(resp, i); 
+        CIRC_WRITE("%s: %s\r\n", header->key, header->value); 
     }
 
+    char cache_control[HTTP_CACHE_CONTROL_SIZE]; 
+    const char* cache_control_value = http_cache_control_value(resp, cache_control, sizeof cache_control); 
+    if (cache_control_value)
+        CIRC_WRITE("Cache-Control: %s\r\n", cache_control_value); 
+    if (resp->etag)
+        CIRC_WRITE("ETag: %s\r\n", resp->etag); 
+    if (resp->last_modified)
+    {
+        char date[HTTP_DATE_SIZE]; 
+        http_format_date(resp->last_modified, date); 
+        CIRC_WRITE("Last-Modified: %s\r\n", date); 
+    }
+    if (resp->location)
+        CIRC_WRITE("Location: %s\r\n", resp->location); 
+    if (resp->retry_after)
+        CIRC_WRITE("Retry-After: %u\r\n", resp->retry_after); 
+
     const char* content_type_value = http_content_type_value(resp->content_type); 
     if (content_type_value)
     {
         CIRC_WRITE("Content-Type: %s\r\n", content_type_value); 
     }
 
-    CIRC_WRITE("Content-Length: %zu\r\n", resp->body_len); 
+    const char* content_encoding_value = http_content_encoding_value(resp->content_encoding); 
+    if (content_encoding_value)
+    {
+        CIRC_WRITE("Content-Encoding: %s\r\n", content_encoding_value); 
+    }
+
+    if (resp->vary_encoding)
+    {
+        CIRC_WRITE("%s", "Vary: Accept-Encoding\r\n"); 
+    }
+
+    /* an event stream ends with the connection */ 
+    if (http_status_has_body(resp->status_code) && !resp->sse_topic)
+    {
+        CIRC_WRITE("Content-Length: %zu\r\n", resp->body_len); 
+    }
 
     /* delimitier */ 
     if (http_circ_write(resp_buff, "\r\n", 2) == -1) 
@@ -179,6 +404,9 @@ int http_response_raw_circ(const Http_response_t* resp, Http_circ_buff_t* resp_b
     written += 2;
 
     /* body :3 */ 
+    if (resp->body_type == HTTP_BODY_FILE)
+        return written; 
+
     if (http_circ_write(resp_buff, resp->body, resp->body_len) == -1) 
         return -1; 
     written += resp->body_len; 
@@ -193,14 +421,100 @@ void http_response_free(Http_response_t* resp)
     assert(resp != NULL); 
     if (resp->body_mem == HTTP_MEM_OWNED)
     {
-        free(resp->body); 
+        if (resp->body_type == HTTP_BODY_FILE)
+        {
+            if (resp->body_fd != -1)
+                close(resp->body_fd); 
+        }
+        else
+            free(resp->body); 
     }
+    free(resp->byteranges); 
     for (size_t i = 0; i < resp->headers_count; i++)
     {
-        if (resp->headers[i].key_mem == HTTP_MEM_OWNED)
-            free(resp->headers[i].key); 
+        const Http_response_header_t* header = http_response_header_at(resp, i); 
+        if (header->key_mem == HTTP_MEM_OWNED)
+            free(header->key); 
+
+        if (header->value_mem == HTTP_MEM_OWNED)
+            free(header->value); 
+    }
+    free(resp->headers_more); 
+
+    if (resp->etag_mem == HTTP_MEM_OWNED)
+        free(resp->etag); 
+    if (resp->location_mem == HTTP_MEM_OWNED)
+        free(resp->location); 
+}
+
+size_t http_byteranges_head(const Http_byteranges_t* byteranges, int i, char* buf, size_t size)
+{
+    int n; 
+    if (i == byteranges->count)
+        n = snprintf(buf, size, "\r\n--%s--\r\n", byteranges->boundary); 
+    else if (byteranges->part_type)
+        n = snprintf(buf, size, "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                byteranges->boundary, byteranges->part_type,
+                (long long)byteranges->ranges[i].start, (long long)byteranges->ranges[i].end, (long long)byteranges->size); 
+    else
+        n = snprintf(buf, size, "\r\n--%s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                byteranges->boundary,
+                (long long)byteranges->ranges[i].start, (long long)byteranges->ranges[i].end, (long long)byteranges->size); 
+    assert(n > 0 && (size_t)n < size); 
+    return n; 
+}
+
+size_t http_byteranges_len(const Http_byteranges_t* byteranges)
+{
+    char head[HTTP_BYTERANGES_HEAD_SIZE]; 
+    size_t len = http_byteranges_head(byteranges, byteranges->count, head, sizeof head); 
+    for (int i = 0; i < byteranges->count; i++)
+    {
+        len += http_byteranges_head(byteranges, i, head, sizeof head); 
+        len += byteranges->ranges[i].end - byteranges->ranges[i].start + 1; 
+    }
+    return len; 
+}
 
-        if (resp->headers[i].value_mem == HTTP_MEM_OWNED)
-            free(resp->headers[i].value); 
+ssize_t http_byteranges_pread(const Http_byteranges_t* byteranges, int fd, char* buf, size_t len, size_t pos)
+{
+    char head[HTTP_BYTERANGES_HEAD_SIZE]; 
+    size_t done = 0; 
+    size_t at = 0; /* where the current piece starts in the body */ 
+    for (int i = 0; i <= byteranges->count && done < len; i++)
+    {
+        size_t head_len = http_byteranges_head(byteranges, i, head, sizeof head); 
+        if (pos < at + head_len)
+        {
+            size_t n = at + head_len - pos; 
+            if (n > len - done)
+                n = len - done; 
+            memcpy(buf + done, head + (pos - at), n); 
+            done += n; 
+            pos += n; 
+        }
+        at += head_len; 
+        if (i == byteranges->count || done == len)
+            break; 
+
+        size_t part_len = byteranges->ranges[i].end - byteranges->ranges[i].start + 1; 
+        if (pos < at + part_len)
+        {
+            size_t n = at + part_len - pos; 
+            if (n > len - done)
+                n = len - done; 
+            ssize_t r; 
+            do {
+                r = pread(fd, buf + done, n, byteranges->ranges[i].start + (pos - at)); 
+            } while (r == -1 && errno == EINTR); 
+            if (r == -1)
+                return -1; 
+            done += r; 
+            pos += r; 
+            if ((size_t)r < n) /* truncated */ 
+                return done; 
+        }
+        at += part_len; 
     }
+    return done; 
 }
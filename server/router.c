@@ -33,12 +33,66 @@ int http_route_register(Http_router_t* router,
     return 0; 
 }
 
+int http_route_proxy(Http_router_t* router, const char* prefix, struct Http_upstream_s* upstream)
+{
+    if (!router || !prefix || !upstream)
+        return -1; 
+
+    Http_route_t* route = malloc(sizeof(Http_route_t)); 
+    if (!route)
+        return -1; 
+
+    memset(route, 0, sizeof(Http_route_t)); 
+    route->path = strdup(prefix); 
+    if (!route->path)
+    {
+        free(route); 
+        return -1; 
+    }
+    route->upstream = upstream; 
+
+    route_add(router, route); 
+
+    return 0; 
+}
+
+int http_route_cache(Http_router_t* router,
+                     Http_method_t method,
+                     const char* path,
+                     const Http_cache_policy_t* policy)
+{
+    if (!router || !path || !policy)
+        return -1; 
+    if (method != HTTP_METHOD_GET && method != HTTP_METHOD_HEAD)
+        return -1; 
+
+    Http_route_t* route = http_router_find_route(router, method, path); 
+    if (!route || route->cache || route->upstream)
+        return -1; 
+
+    route->cache = http_resp_cache_create(policy); 
+    if (!route->cache)
+        return -1; 
+    return 0; 
+}
+
 Http_handler_t http_router_find(Http_router_t* router, Http_method_t method, const char* path)
+{
+    Http_route_t* route = http_router_find_route(router, method, path); 
+    return route ? route->handler : NULL; 
+}
+
+Http_route_t* http_router_find_route(Http_router_t* router, Http_method_t method, const char* path)
 {
     for (Http_route_t* route = router->routes; route != NULL; route = route->next)
     {
-        if (route->method == method && !strcmp(route->path, path))
-            return route->handler; 
+        if (route->upstream)
+        {
+            if (!strncmp(route->path, path, strlen(route->path)))
+                return route; 
+        }
+        else if (route->method == method && !strcmp(route->path, path))
+            return route; 
     }
     return NULL; 
 }
@@ -57,11 +111,29 @@ void http_router_clean(Http_router_t* router)
     for (route = router->routes; route != NULL; route = route_next)
     {
         route_next = route->next;  
+        http_resp_cache_destroy(route->cache); 
         free(route->path); 
         free(route); 
     }
 }
 
+Http_router_t* http_router_create(void)
+{
+    Http_router_t* router = malloc(sizeof(Http_router_t)); 
+    if (!router)
+        return NULL; 
+    http_router_init(router); 
+    return router; 
+}
+
+void http_router_destroy(Http_router_t* router)
+{
+    if (!router)
+        return; 
+    http_router_clean(router); 
+    free(router); 
+}
+
 static void route_add(Http_router_t* router, Http_route_t* route)
 {
     route->next = router->routes; 
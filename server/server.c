@@ -9,9 +9,18 @@
 #include <sys/epoll.h>
 
 #include <loom/server.h>
-
-static int http_server_setup(Http_config_t* cfg); 
+#include <loom/compress.h> 
+#include <loom/tls.h> 
+#include <loom/admission.h> 
+#include <loom/ratelimit.h> 
+#include <loom/handoff.h> 
+#include <loom/sockopt.h> 
+#include <loom/access_log.h> 
+#include <loom/workers.h> 
+
+static int http_server_setup(Http_config_t* cfg, int port, int reuseport); 
 static void http_server_close(int server_fd); 
+static int server_spawn(Http_server_context_t* ctx, const int* cpus, int cpus_count); 
 
 int http_server_start(Http_server_context_t* ctx, Http_config_t* config)
 {
@@ -28,22 +37,118 @@ int http_server_start(Http_server_context_t* ctx, Http_config_t* config)
 
     ctx->cfg = config; 
     ctx->active_clients = 0; 
+    ctx->listen_fd = -1; 
+    ctx->tls_listen_fd = -1; 
+    ctx->shutdown_fd = -1; 
+    ctx->ssl_ctx = NULL; 
+    ctx->upstream_graveyard = NULL; 
+    ctx->item_graveyard = NULL; 
+    ctx->cache_refreshes = NULL; 
+    ctx->connections = NULL; 
+    ctx->idle_head = NULL; 
+    ctx->idle_tail = NULL; 
+    ctx->idle_count = 0; 
+    ctx->handoff_fd = -1; 
+    ctx->draining = 0; 
+    ctx->router = config->router; 
+    ctx->worker = 0; 
+    ctx->workers = NULL; 
+    if (http_qsbr_init(&ctx->qsbr) == -1)
+        return -1; 
+    ctx->qsbr_reader = http_qsbr_register(&ctx->qsbr); 
+
+    int cpus[HTTP_MAX_WORKERS]; 
+    int cpus_count = 0; 
+    if (config->cpus[0] && (cpus_count = http_workers_cpus(config->cpus, cpus, HTTP_MAX_WORKERS)) == -1)
+    {
+        fprintf(stderr, "Error: %s is not a list of cpus\n", config->cpus); 
+        return -1; 
+    }
+    if (config->workers > 1)
+    {
+        if (server_spawn(ctx, cpus, cpus_count) == -1)
+            return -1; 
+        if (ctx->workers)
+            return 0; /* the supervisor, every worker goes on setting itself up */ 
+    }
+    else if (http_workers_pin(cpus_count ? cpus[0] : -1, config->numa) == -1)
+    {
+        return -1; 
+    }
 
-    ctx->listen_fd = http_server_setup(config);
+    if (http_admission_init(ctx) == -1)
+    {
+        fprintf(stderr, "Error: failed preparing the overload response\n"); 
+        return -1; 
+    }
+    if (http_ratelimit_init(ctx) == -1)
+    {
+        fprintf(stderr, "Error: failed setting up the rate limit\n"); 
+        return -1; 
+    }
+    if (http_access_log_start(ctx) == -1)
+    {
+        fprintf(stderr, "Error: failed opening the access log\n"); 
+        return -1; 
+    }
+    if (http_sse_init(ctx) == -1)
+        return -1; 
+
+    /* tls first, the previous server stops accepting once it gave its listeners so failing later leaves nobody */ 
+    if (config->tls_port && http_tls_init(ctx) == -1)
+    {
+        fprintf(stderr, "Error: failed setting up tls\n"); 
+        return -1; 
+    }
+
+    int inherited[HTTP_MAX_LISTENERS] = { -1, -1 }; 
+    if (config->handoff_path[0] && http_handoff_receive(config->handoff_path, inherited) == -1)
+    {
+        fprintf(stderr, "Error: failed getting the listeners from %s\n", config->handoff_path); 
+        return -1; 
+    }
+    if (inherited[1] != -1 && !config->tls_port)
+    {
+        close(inherited[1]); 
+        inherited[1] = -1; 
+    }
+    /* the tuning may have changed with the new config */ 
+    for (int i = 0; i < HTTP_MAX_LISTENERS; i++)
+    {
+        if (inherited[i] != -1 && http_sockopt_listener(inherited[i], &config->tuning) == -1)
+        {
+            fprintf(stderr, "Error: failed tuning the inherited listeners\n"); 
+            return -1; 
+        }
+    }
+
+    if (ctx->listen_fd == -1)
+        ctx->listen_fd = inherited[0] != -1 ? inherited[0] : http_server_setup(config, config->port, 0); 
     if (ctx->listen_fd == -1)
     {
         fprintf(stderr, "Error: failed getting listening socket\n");
         return -1;
     }
 
+    if (config->tls_port && ctx->tls_listen_fd == -1)
+    {
+        ctx->tls_listen_fd = inherited[1] != -1 ? inherited[1] : http_server_setup(config, config->tls_port, 0); 
+        if (ctx->tls_listen_fd == -1)
+        {
+            fprintf(stderr, "Error: failed getting tls listening socket\n"); 
+            return -1; 
+        }
+    }
+
     ctx->epoll_fd = http_epoll_create_instance();
     if (ctx->epoll_fd == -1)
     {
         fprintf(stderr, "Error: failed creating epoll instance\n");
         return -1;
     }
+    http_sockopt_epoll(ctx->epoll_fd, &config->tuning); 
 
-    ctx->shutdown_fd = http_shutdown_setup(ctx->epoll_fd); 
+    ctx->shutdown_fd = http_shutdown_setup(ctx->epoll_fd, ctx->shutdown_fd); 
     if (ctx->shutdown_fd == -1)
     {
         fprintf(stderr, "Error: failed setting up shutdown event\n");
@@ -62,6 +167,11 @@ int http_server_start(Http_server_context_t* ctx, Http_config_t* config)
         fprintf(stderr, "error :failed adding timer to epoll\n"); 
         return -1; 
     }
+    if (http_admission_probe_start(ctx) == -1)
+    {
+        fprintf(stderr, "Error: failed setting up the loop lag probe\n"); 
+        return -1; 
+    }
 
     printf("server listening on %s:%d\n", config->host, config->port);
 
@@ -69,16 +179,116 @@ int http_server_start(Http_server_context_t* ctx, Http_config_t* config)
     {
         return -1;
     }
+
+    if (ctx->tls_listen_fd != -1)
+    {
+        printf("server listening on %s:%d (tls)\n", config->host, config->tls_port); 
+        if (http_epoll_add_fd(ctx->epoll_fd, HTTP_ITEM_TLS_LISTENER, ctx->tls_listen_fd, EPOLLIN) == -1)
+            return -1; 
+    }
+
+    if (config->handoff_path[0])
+    {
+        ctx->handoff_fd = http_handoff_listen(config->handoff_path); 
+        if (ctx->handoff_fd == -1 ||
+            http_epoll_add_fd(ctx->epoll_fd, HTTP_ITEM_HANDOFF, ctx->handoff_fd, EPOLLIN) == -1)
+        {
+            fprintf(stderr, "Error: failed setting up the handoff socket\n"); 
+            return -1; 
+        }
+    }
     return 0; 
 }
 
 void http_server_run(Http_server_context_t* ctx)
 {
+    if (ctx->workers)
+    {
+        http_workers_run(ctx); 
+        return; 
+    }
     /* main loop */
     http_epoll_run_loop(ctx); 
 }
 
-int http_server_setup(Http_config_t* cfg)
+/* a listener per worker in a SO_REUSEPORT group, in the order of the workers, then fork them */ 
+static int server_spawn(Http_server_context_t* ctx, const int* cpus, int cpus_count)
+{
+    Http_config_t* config = ctx->cfg; 
+    int count = config->workers; 
+    if (count > HTTP_MAX_WORKERS)
+    {
+        fprintf(stderr, "Error: at most %d workers\n", HTTP_MAX_WORKERS); 
+        return -1; 
+    }
+    if (config->handoff_path[0])
+    {
+        fprintf(stderr, "Error: the listeners of several workers can't be handed off\n"); 
+        return -1; 
+    }
+
+    int listeners[HTTP_MAX_WORKERS]; 
+    int tls_listeners[HTTP_MAX_WORKERS]; 
+    int worker_cpus[HTTP_MAX_WORKERS]; 
+    int created; 
+    for (created = 0; created < count; created++)
+    {
+        worker_cpus[created] = cpus_count ? cpus[created % cpus_count] : -1; 
+        listeners[created] = http_server_setup(config, config->port, 1); 
+        tls_listeners[created] = -1; 
+        if (listeners[created] != -1 && config->tls_port)
+        {
+            tls_listeners[created] = http_server_setup(config, config->tls_port, 1); 
+            if (tls_listeners[created] == -1)
+            {
+                close(listeners[created]); 
+                listeners[created] = -1; 
+            }
+        }
+        if (listeners[created] == -1)
+            break; 
+    }
+
+    if (created < count)
+        fprintf(stderr, "Error: failed getting the listening sockets of the workers\n"); 
+    else if (config->steer && (http_sockopt_steer(listeners, worker_cpus, count) == -1 ||
+             (config->tls_port && http_sockopt_steer(tls_listeners, worker_cpus, count) == -1)))
+        fprintf(stderr, "Error: failed steering the connections to the workers\n"); 
+    else
+        return http_workers_start(ctx, listeners, tls_listeners, worker_cpus); 
+
+    for (int i = 0; i < created; i++)
+    {
+        close(listeners[i]); 
+        if (tls_listeners[i] != -1)
+            close(tls_listeners[i]); 
+    }
+    return -1; 
+}
+
+static void router_free(void* router)
+{
+    http_router_destroy(router); 
+}
+
+int http_server_publish_router(Http_server_context_t* ctx, Http_router_t* router)
+{
+    if (!router)
+        return -1; 
+
+    Http_router_t* old = __atomic_exchange_n(&ctx->router, router, __ATOMIC_SEQ_CST); 
+    if (old == ctx->cfg->router)
+        return 0; /* the user's */ 
+    if (http_qsbr_retire(&ctx->qsbr, old, router_free) == -1)
+    {
+        /* leaking it beats freeing it under a loop */ 
+        fprintf(stderr, "Error: the previous router couldn't be retired\n"); 
+        return -1; 
+    }
+    return 0; 
+}
+
+int http_server_setup(Http_config_t* cfg, int port, int reuseport)
 {
     if (!cfg)
         return -1; 
@@ -94,7 +304,7 @@ int http_server_setup(Http_config_t* cfg)
     hints.ai_socktype = SOCK_STREAM;/* HTTP is built on top of the TCP duh */  
     hints.ai_flags    = AI_PASSIVE; /* fill the ip */  
 
-    snprintf(port_str, sizeof port_str, "%d", cfg->port); 
+    snprintf(port_str, sizeof port_str, "%d", port); 
 
     if ((status = getaddrinfo(cfg->host, port_str, &hints, &res)) != 0)
     {
@@ -117,6 +327,13 @@ int http_server_setup(Http_config_t* cfg)
             goto fail; 
         }
 
+        /* every worker gets its own accept queue */ 
+        if (reuseport && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof yes) == -1)
+        {
+            perror("setsockopt"); 
+            goto fail; 
+        }
+
         if (bind(listen_fd, p->ai_addr, p->ai_addrlen) == -1)
         {
             perror("bind"); 
@@ -138,6 +355,12 @@ fail:
     if (http_socket_set_nonblocking(listen_fd) == -1)
         return -1; 
 
+    if (http_sockopt_listener(listen_fd, &cfg->tuning) == -1)
+    {
+        close(listen_fd); 
+        return -1; 
+    }
+
     if (listen(listen_fd, cfg->backlog) == -1)
     {
         perror("listen"); 
@@ -157,75 +380,32 @@ static void http_server_close(int server_fd)
 
 void http_server_clean(Http_server_context_t* ctx)
 {
+    if (ctx->workers)
+    {
+        /* the supervisor has nothing else */ 
+        http_workers_clean(ctx); 
+        if (ctx->router != ctx->cfg->router)
+            http_router_destroy(ctx->router); 
+        http_qsbr_clean(&ctx->qsbr); 
+        return; 
+    }
     /* clean up */
     http_epoll_close(ctx->epoll_fd);
     http_timer_clean(ctx->timer); 
-    http_server_close(ctx->listen_fd);
+    if (ctx->listen_fd != -1)
+        http_server_close(ctx->listen_fd); 
+    if (ctx->tls_listen_fd != -1)
+        http_server_close(ctx->tls_listen_fd); 
+    http_tls_clean(ctx); 
     http_shutdown_close(ctx->shutdown_fd);
-}
-
-
-Http_handler_result_t http_handler_static_file(Http_request_t* req,
-                                               Http_response_t* resp,
-                                               const char* file_path,
-                                               Http_content_type_t content_type)
-{
-    (void) req; 
-
-    FILE* file = fopen(file_path, "rb"); 
-    if (!file)
-    {
-        http_response_make_error(resp, HTTP_NOT_FOUND); 
-        return HTTP_HANDLER_OK; 
-    }
-
-    if (fseek(file, 0, SEEK_END) != 0)
-    {
-        fclose(file); 
-        http_response_make_error(resp, HTTP_INTERNAL_SERVER_ERROR); 
-        return HTTP_HANDLER_OK; 
-    }
-
-    long file_size = ftell(file); 
-    if (file_size < 0)
-    {
-        fclose(file); 
-        http_response_make_error(resp, HTTP_NOT_FOUND); 
-        return HTTP_HANDLER_OK; 
-    }
-
-    if (file_size == 0)
-    {
-        fclose(file); 
-        http_response_make_error(resp, HTTP_NOT_FOUND); 
-        return HTTP_HANDLER_OK; 
-    }
-
-    rewind(file); 
-
-    char* buffer = malloc(file_size); 
-    if (!buffer)
-    {   
-        fclose(file); 
-        http_response_make_error(resp, HTTP_INTERNAL_SERVER_ERROR); 
-        return HTTP_HANDLER_OK; 
-    }
-
-    size_t read_bytes = fread(buffer, 1, (size_t)file_size, file); 
-    fclose(file); 
-    if (read_bytes != (size_t)file_size)
-    {
-        free(buffer); 
-        http_response_make_error(resp, HTTP_INTERNAL_SERVER_ERROR); 
-        return HTTP_HANDLER_OK; 
-    }
-
-    resp->status_code = HTTP_OK; 
-    resp->content_type = content_type; 
-    resp->body = buffer; 
-    resp->body_len = (size_t)file_size; 
-    resp->body_mem = HTTP_MEM_OWNED; /* free memory */ 
-    resp->connection_close = 0; 
-
-    return HTTP_HANDLER_OK; 
+    if (ctx->handoff_fd != -1)
+        close(ctx->handoff_fd); 
+    http_compress_cache_clean(); 
+    http_admission_clean(ctx); 
+    http_ratelimit_clean(ctx); 
+    http_access_log_stop(ctx); 
+    http_sse_clean(ctx); 
+    if (ctx->router != ctx->cfg->router)
+        http_router_destroy(ctx->router); 
+    http_qsbr_clean(&ctx->qsbr); 
 }
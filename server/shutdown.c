@@ -1,14 +1,17 @@
 #include <assert.h> 
 #include <stdio.h> 
+#include <stdlib.h> 
 #include <sys/epoll.h> 
 #include <sys/eventfd.h> 
 #include <unistd.h> 
 
 #include <loom/shutdown.h>
+#include <loom/utils.h> 
 
-int http_shutdown_setup(int epoll_fd)
+int http_shutdown_setup(int epoll_fd, int shutdown_fd)
 {
-    int shutdown_fd = eventfd(0, EFD_NONBLOCK);
+    if (shutdown_fd == -1)
+        shutdown_fd = eventfd(0, EFD_NONBLOCK); 
     if (shutdown_fd == -1)
     {
         perror("eventfd");
@@ -36,3 +39,58 @@ void http_shutdown_close(int shutdown_fd)
     assert(shutdown_fd != -1); 
     close(shutdown_fd);
 }
+
+void http_shutdown_drain(Http_server_context_t* ctx)
+{
+    assert(ctx != NULL); 
+    if (ctx->draining)
+        return; 
+    ctx->draining = 1; 
+    ctx->drain_deadline = http_time_ms() + (uint64_t)ctx->cfg->drain_timeout * 1000; 
+
+    /* new clients are refused right away, or keep waiting in the queue of the process the listeners were handed to */ 
+    epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, ctx->listen_fd, NULL); 
+    close(ctx->listen_fd); 
+    ctx->listen_fd = -1; 
+    if (ctx->tls_listen_fd != -1)
+    {
+        epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, ctx->tls_listen_fd, NULL); 
+        close(ctx->tls_listen_fd); 
+        ctx->tls_listen_fd = -1; 
+    }
+    ctx->paused_count = 0; 
+    if (ctx->handoff_fd != -1)
+    {
+        epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, ctx->handoff_fd, NULL); 
+        close(ctx->handoff_fd); 
+        ctx->handoff_fd = -1; 
+    }
+
+    Http_connection_t* con = ctx->connections; 
+    while (con)
+    {
+        Http_connection_t* next = con->next; 
+        http_connection_drain(ctx, con); 
+        con = next; 
+    }
+}
+
+int http_shutdown_drain_wait(Http_server_context_t* ctx)
+{
+    if (!ctx->draining)
+        return -1; 
+    uint64_t now = http_time_ms(); 
+    if (ctx->active_clients == 0 || now >= ctx->drain_deadline)
+        return 0; 
+    return (int)(ctx->drain_deadline - now); 
+}
+
+void http_shutdown_close_connections(Http_server_context_t* ctx)
+{
+    while (ctx->connections)
+    {
+        Http_epoll_item_t* item = ctx->connections->item; 
+        http_connection_clean(ctx, ctx->connections); 
+        free(item); 
+    }
+}
@@ -0,0 +1,140 @@
+#include <stdint.h> 
+#include <stdio.h> 
+#include <string.h> 
+#include <linux/filter.h> 
+#include <netinet/in.h> 
+#include <netinet/tcp.h> 
+#include <sys/ioctl.h> 
+#include <sys/socket.h> 
+
+#include <loom/sockopt.h> 
+
+/* linux 6.9, not in older headers */ 
+#ifndef EPIOCSPARAMS
+struct epoll_params {
+    uint32_t busy_poll_usecs; 
+    uint16_t busy_poll_budget; 
+    uint8_t prefer_busy_poll; 
+    uint8_t pad; 
+}; 
+#define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
+
+static int sockopt_set(int fd, int level, int name, int value, const char* what); 
+
+int http_sockopt_listener(int fd, const Http_socket_tuning_t* tuning)
+{
+    /* buffers before anything else, the window scale is chosen from them at the handshake */ 
+    if (tuning->rcvbuf && sockopt_set(fd, SOL_SOCKET, SO_RCVBUF, tuning->rcvbuf, "SO_RCVBUF") == -1)
+        return -1; 
+    if (tuning->sndbuf && sockopt_set(fd, SOL_SOCKET, SO_SNDBUF, tuning->sndbuf, "SO_SNDBUF") == -1)
+        return -1; 
+    if (tuning->nodelay && sockopt_set(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY") == -1)
+        return -1; 
+    if (tuning->defer_accept && sockopt_set(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, tuning->defer_accept, "TCP_DEFER_ACCEPT") == -1)
+        return -1; 
+    if (tuning->fastopen && sockopt_set(fd, IPPROTO_TCP, TCP_FASTOPEN, tuning->fastopen, "TCP_FASTOPEN") == -1)
+        return -1; 
+    if (tuning->notsent_lowat && sockopt_set(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, tuning->notsent_lowat, "TCP_NOTSENT_LOWAT") == -1)
+        return -1; 
+    if (tuning->rcvlowat && sockopt_set(fd, SOL_SOCKET, SO_RCVLOWAT, tuning->rcvlowat, "SO_RCVLOWAT") == -1)
+        return -1; 
+    if (tuning->busy_poll && sockopt_set(fd, SOL_SOCKET, SO_BUSY_POLL, tuning->busy_poll, "SO_BUSY_POLL") == -1)
+        return -1; 
+    if (tuning->prefer_busy_poll && sockopt_set(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, 1, "SO_PREFER_BUSY_POLL") == -1)
+        return -1; 
+    if (tuning->keepalive_idle)
+    {
+        if (sockopt_set(fd, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE") == -1 ||
+            sockopt_set(fd, IPPROTO_TCP, TCP_KEEPIDLE, tuning->keepalive_idle, "TCP_KEEPIDLE") == -1)
+            return -1; 
+        if (tuning->keepalive_interval &&
+            sockopt_set(fd, IPPROTO_TCP, TCP_KEEPINTVL, tuning->keepalive_interval, "TCP_KEEPINTVL") == -1)
+            return -1; 
+        if (tuning->keepalive_count &&
+            sockopt_set(fd, IPPROTO_TCP, TCP_KEEPCNT, tuning->keepalive_count, "TCP_KEEPCNT") == -1)
+            return -1; 
+    }
+    return 0; 
+}
+
+void http_sockopt_accepted(int fd, const Http_socket_tuning_t* tuning)
+{
+    /* the rest is copied from the listener, quickack isn't and the kernel may go back to delayed acks later */ 
+    if (tuning->quickack)
+    {
+        int yes = 1; 
+        setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &yes, sizeof yes); 
+    }
+}
+
+void http_sockopt_epoll(int epoll_fd, const Http_socket_tuning_t* tuning)
+{
+    if (!tuning->busy_poll)
+        return; 
+    /* the sockets' options only count for epoll with the sysctl, this works without it */ 
+    struct epoll_params params = {
+        .busy_poll_usecs = tuning->busy_poll,
+        .prefer_busy_poll = tuning->prefer_busy_poll ? 1 : 0,
+    }; 
+    ioctl(epoll_fd, EPIOCSPARAMS, &params); 
+}
+
+int http_sockopt_steer(const int* listeners, const int* cpus, int count)
+{
+    /* each listener says its cpu, recent kernels match it themselves if the program is refused */ 
+    int pinned = 0; 
+    for (int i = 0; i < count; i++)
+    {
+        if (cpus[i] == -1)
+            continue; 
+        pinned++; 
+        sockopt_set(listeners[i], SOL_SOCKET, SO_INCOMING_CPU, cpus[i], "SO_INCOMING_CPU"); 
+    }
+
+    /* A = the cpu handling the SYN, a pinned loop's cpu gives its listener and any other cpu A % count */ 
+    struct sock_filter code[2 * HTTP_MAX_WORKERS + 3]; 
+    unsigned short len = 0; 
+    code[len++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU); 
+    for (int i = 0; i < count && pinned; i++)
+    {
+        if (cpus[i] == -1)
+            continue; 
+        code[len++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, cpus[i], 0, 1); 
+        code[len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, i); 
+    }
+    code[len++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, count); 
+    code[len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0); 
+
+    /* one program for the whole group */ 
+    struct sock_fprog prog = { .len = len, .filter = code }; 
+    if (setsockopt(listeners[0], SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof prog) == -1)
+    {
+        perror("SO_ATTACH_REUSEPORT_CBPF"); 
+        return pinned ? 0 : -1; 
+    }
+    return 0; 
+}
+
+int http_sockopt_preset(const char* name, Http_socket_tuning_t* tuning)
+{
+    if (!strcmp(name, "none"))
+        *tuning = HTTP_TUNING_NONE; 
+    else if (!strcmp(name, "low-latency"))
+        *tuning = HTTP_TUNING_LOW_LATENCY; 
+    else if (!strcmp(name, "bulk"))
+        *tuning = HTTP_TUNING_BULK; 
+    else
+        return -1; 
+    return 0; 
+}
+
+static int sockopt_set(int fd, int level, int name, int value, const char* what)
+{
+    if (setsockopt(fd, level, name, &value, sizeof value) == -1)
+    {
+        perror(what); 
+        return -1; 
+    }
+    return 0; 
+}
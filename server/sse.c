@@ -0,0 +1,418 @@
+#include <assert.h> 
+#include <errno.h> 
+#include <stdio.h> 
+#include <stdlib.h> 
+#include <string.h> 
+#include <sys/socket.h> 
+#include <sys/uio.h> 
+
+#include <loom/sse.h> 
+#include <loom/connection.h> 
+
+#define BUCKET(hash)    ((hash) & (HTTP_SSE_TOPIC_BUCKETS - 1))
+#define SLOT(sub, i)    ((sub)->queue[((sub)->head + (i)) & (HTTP_SSE_QUEUE - 1)])
+
+#define SSE_HEARTBEAT       ":\n\n"
+#define SSE_HEARTBEAT_LEN   3
+
+static Http_sse_event_t* event_create(const char* event, const char* data, size_t len); 
+static void event_release(Http_sse_event_t* ev); 
+static void sse_push(Http_sse_t* sub, Http_sse_event_t* ev); 
+static void sse_consume(Http_sse_t* sub, size_t n); 
+static ssize_t sse_send(Http_connection_t* con, Http_sse_t* sub); 
+static void dirty_add(Http_sse_registry_t* reg, Http_sse_t* sub); 
+static void dirty_remove(Http_sse_registry_t* reg, Http_sse_t* sub); 
+
+int http_sse_init(Http_server_context_t* ctx)
+{
+    ctx->sse = calloc(1, sizeof(Http_sse_registry_t)); 
+    if (!ctx->sse)
+    {
+        perror("calloc"); 
+        return -1; 
+    }
+    return 0; 
+}
+
+void http_sse_clean(Http_server_context_t* ctx)
+{
+    Http_sse_registry_t* reg = ctx->sse; 
+    if (!reg)
+        return; 
+    /* the connections are closed, no topic has subscribers anymore */ 
+    for (size_t i = 0; i < HTTP_SSE_TOPIC_BUCKETS; i++)
+    {
+        Http_sse_topic_t* topic = reg->buckets[i]; 
+        while (topic)
+        {
+            Http_sse_topic_t* next = topic->next; 
+            free(topic->name); 
+            free(topic); 
+            topic = next; 
+        }
+    }
+    free(reg); 
+    ctx->sse = NULL; 
+}
+
+int http_sse_accept(Http_request_t* req, Http_response_t* resp, const char* topic)
+{
+    assert(topic != NULL); 
+    /* an http/2 stream would need its own flow control, only http/1 connections are held */ 
+    if (!req->arena || strncmp(req->version, "1.", 2))
+        return -1; 
+    resp->status_code = HTTP_OK; 
+    resp->content_type = HTTP_CONTENT_TEXT_EVENT_STREAM; 
+    resp->cache_control = HTTP_CACHE_CONTROL_NO_CACHE; 
+    resp->connection_close = 0; 
+    resp->sse_topic = topic; 
+    return 0; 
+}
+
+Http_sse_topic_t* http_sse_topic(Http_server_context_t* ctx, const char* name)
+{
+    Http_sse_registry_t* reg = ctx->sse; 
+    size_t name_len = strlen(name); 
+    uint64_t hash = http_hash_bytes(name, name_len); 
+    for (Http_sse_topic_t* topic = reg->buckets[BUCKET(hash)]; topic != NULL; topic = topic->next)
+    {
+        if (topic->hash == hash && !strcmp(topic->name, name))
+            return topic; 
+    }
+
+    Http_sse_topic_t* topic = calloc(1, sizeof(Http_sse_topic_t)); 
+    if (!topic)
+    {
+        perror("calloc"); 
+        return NULL; 
+    }
+    topic->name = strdup(name); 
+    if (!topic->name)
+    {
+        perror("strdup"); 
+        free(topic); 
+        return NULL; 
+    }
+    topic->hash = hash; 
+    topic->registry = reg; 
+    topic->next = reg->buckets[BUCKET(hash)]; 
+    reg->buckets[BUCKET(hash)] = topic; 
+    return topic; 
+}
+
+int http_sse_publish(Http_sse_topic_t* topic, const char* event, const char* data, size_t len)
+{
+    if (!topic->subscribers)
+        return 0; 
+    Http_sse_event_t* ev = event_create(event, data, len); 
+    if (!ev)
+        return -1; 
+
+    /* no send here: whatever else is published in this batch goes out with it */ 
+    ev->refs = 1; 
+    for (Http_sse_t* sub = topic->subscribers; sub != NULL; sub = sub->next)
+    {
+        sse_push(sub, ev); 
+        /* a subscriber waiting for EPOLLOUT is sent to when the socket drains */ 
+        if (!HTTP_IS_WRITING(sub->con->flags))
+            dirty_add(topic->registry, sub); 
+    }
+    topic->published++; 
+    event_release(ev); 
+    return 0; 
+}
+
+void http_sse_flush(Http_server_context_t* ctx)
+{
+    Http_sse_registry_t* reg = ctx->sse; 
+    while (reg->dirty)
+    {
+        Http_sse_t* sub = reg->dirty; 
+        dirty_remove(reg, sub); 
+        Http_connection_t* con = sub->con; 
+        if (HTTP_IS_WRITING(con->flags) || HTTP_IS_CLOSING(con->flags))
+            continue; 
+
+        HTTP_SET_WRITING(con->flags); 
+        http_connection_write(con); 
+        /* all of it went out, the registered events are still right */ 
+        if (!HTTP_IS_WRITING(con->flags) && !HTTP_SHOULD_CLOSE(con->flags))
+            continue; 
+        http_connection_update_events(ctx->epoll_fd, con->item); 
+        if (HTTP_IS_CLOSING(con->flags))
+        {
+            Http_epoll_item_t* item = con->item; 
+            http_connection_clean(ctx, con); 
+            free(item); 
+        }
+    }
+}
+
+int http_sse_start(Http_connection_t* con, Http_sse_topic_t* topic)
+{
+    assert(con != NULL && con->sse == NULL); 
+
+    Http_sse_t* sub = calloc(1, sizeof(Http_sse_t)); 
+    if (!sub)
+    {
+        perror("calloc"); 
+        return -1; 
+    }
+    sub->con = con; 
+    sub->topic = topic; 
+    sub->next = topic->subscribers; 
+    if (sub->next)
+        sub->next->prev = sub; 
+    topic->subscribers = sub; 
+    topic->subscribers_count++; 
+    con->sse = sub; 
+
+    /* held open, the timer is the heartbeat clock from now on */ 
+    return http_timer_update(con->ctx->timer, con, HTTP_SSE_HEARTBEAT); 
+}
+
+void http_sse_free(Http_connection_t* con)
+{
+    Http_sse_t* sub = con->sse; 
+    if (!sub)
+        return; 
+    Http_sse_topic_t* topic = sub->topic; 
+    if (sub->prev)
+        sub->prev->next = sub->next; 
+    else
+        topic->subscribers = sub->next; 
+    if (sub->next)
+        sub->next->prev = sub->prev; 
+    topic->subscribers_count--; 
+    if (sub->dirty)
+        dirty_remove(topic->registry, sub); 
+
+    while (sub->count)
+    {
+        event_release(SLOT(sub, 0)); 
+        sub->head++; 
+        sub->count--; 
+    }
+    free(sub); 
+    con->sse = NULL; 
+}
+
+void http_sse_read(Http_connection_t* con)
+{
+    /* nothing is expected from the client, what it sends is dropped */ 
+    con->buff_len = 0; 
+    for (;;)
+    {
+        ssize_t n = http_connection_recv(con, con->buff, HTTP_REQUEST_SIZE); 
+        if (n == 0)
+        {
+            HTTP_SET_SHOULD_CLOSE(con->flags); 
+            break; 
+        }
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("read"); 
+            break; 
+        }
+    }
+}
+
+void http_sse_write(Http_connection_t* con)
+{
+    Http_sse_t* sub = con->sse; 
+    assert(sub != NULL); 
+
+    while (sub->count)
+    {
+        ssize_t n = sse_send(con, sub); 
+        if (n == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return; 
+            perror("write"); 
+            HTTP_SET_SHOULD_CLOSE(con->flags); 
+            HTTP_CLEAR_WRITING(con->flags); 
+            return; 
+        }
+        sub->sent = 1; 
+        con->bytes_sent += n; 
+        sse_consume(sub, n); 
+    }
+    HTTP_CLEAR_WRITING(con->flags); 
+}
+
+int http_sse_timeout(Http_connection_t* con)
+{
+    Http_sse_t* sub = con->sse; 
+    /* draining, or the client is gone */ 
+    if (HTTP_SHOULD_CLOSE(con->flags))
+        return -1; 
+    /* the client didn't take a byte for a whole interval, its queue only drops events */ 
+    if (HTTP_IS_WRITING(con->flags) && !sub->sent)
+        return -1; 
+    /* a comment keeps proxies from timing out an idle stream */ 
+    if (!HTTP_IS_WRITING(con->flags) && !sub->sent && SSE_HEARTBEAT_LEN <= HTTP_RESPONSE_SIZE - con->response_len)
+    {
+        memcpy(con->response + con->response_len, SSE_HEARTBEAT, SSE_HEARTBEAT_LEN); 
+        con->response_len += SSE_HEARTBEAT_LEN; 
+        HTTP_SET_WRITING(con->flags); 
+    }
+    sub->sent = 0; 
+    return http_timer_add_timeout(con->ctx->timer, con, HTTP_SSE_HEARTBEAT); 
+}
+
+/* "event: name" then one "data: line" per line, null if the name has a line break */ 
+static Http_sse_event_t* event_create(const char* event, const char* data, size_t len)
+{
+    size_t name_len = event ? strlen(event) : 0; 
+    if (name_len && strpbrk(event, "\r\n"))
+        return NULL; 
+
+    /* \r\n is counted twice, it's only a bound */ 
+    size_t lines = 1; 
+    for (size_t i = 0; i < len; i++)
+    {
+        if (data[i] == '\n' || data[i] == '\r')
+            lines++; 
+    }
+    size_t bound = (name_len ? sizeof "event: \n" - 1 + name_len : 0) + len + lines * (sizeof "data: \n" - 1) + 1; 
+    Http_sse_event_t* ev = malloc(sizeof(Http_sse_event_t) + bound); 
+    if (!ev)
+    {
+        perror("malloc"); 
+        return NULL; 
+    }
+    ev->key = name_len ? http_hash_bytes(event, name_len) | 1 : 0; 
+
+    char* p = ev->data; 
+    if (name_len)
+    {
+        memcpy(p, "event: ", 7); 
+        memcpy(p + 7, event, name_len); 
+        p += 7 + name_len; 
+        *p++ = '\n'; 
+    }
+    size_t start = 0; 
+    for (size_t i = 0; i <= len; i++)
+    {
+        if (i < len && data[i] != '\n' && data[i] != '\r')
+            continue; 
+        memcpy(p, "data: ", 6); 
+        memcpy(p + 6, data + start, i - start); 
+        p += 6 + i - start; 
+        *p++ = '\n'; 
+        if (i + 1 < len && data[i] == '\r' && data[i + 1] == '\n')
+            i++; 
+        start = i + 1; 
+    }
+    *p++ = '\n'; 
+    ev->len = p - ev->data; 
+    return ev; 
+}
+
+static void event_release(Http_sse_event_t* ev)
+{
+    if (--ev->refs == 0)
+        free(ev); 
+}
+
+/* a full queue means a slow subscriber, it loses events instead of holding more memory */ 
+static void sse_push(Http_sse_t* sub, Http_sse_event_t* ev)
+{
+    if (sub->count == HTTP_SSE_QUEUE)
+    {
+        sub->topic->dropped++; 
+        /* the event being sent stays, the stream can't be cut in the middle of it */ 
+        uint32_t first = sub->head_sent ? 1 : 0; 
+        /* a newer event with the same name replaces the queued one */ 
+        for (uint32_t i = sub->count; ev->key && i-- > first;)
+        {
+            if (SLOT(sub, i)->key == ev->key)
+            {
+                event_release(SLOT(sub, i)); 
+                ev->refs++; 
+                SLOT(sub, i) = ev; 
+                return; 
+            }
+        }
+        /* otherwise the oldest unsent one goes */ 
+        event_release(SLOT(sub, first)); 
+        for (uint32_t i = first; i + 1 < sub->count; i++)
+            SLOT(sub, i) = SLOT(sub, i + 1); 
+        sub->count--; 
+    }
+    ev->refs++; 
+    SLOT(sub, sub->count) = ev; 
+    sub->count++; 
+}
+
+/* n bytes went out, the events sent in full are released */ 
+static void sse_consume(Http_sse_t* sub, size_t n)
+{
+    while (n > 0)
+    {
+        Http_sse_event_t* ev = SLOT(sub, 0); 
+        size_t left = ev->len - sub->head_sent; 
+        if (n < left)
+        {
+            sub->head_sent += n; 
+            return; 
+        }
+        n -= left; 
+        sub->head_sent = 0; 
+        event_release(ev); 
+        sub->head++; 
+        sub->count--; 
+    }
+}
+
+/* the whole queue in one call, tls takes one event at a time */ 
+static ssize_t sse_send(Http_connection_t* con, Http_sse_t* sub)
+{
+    if (con->ssl)
+    {
+        Http_sse_event_t* ev = SLOT(sub, 0); 
+        return http_connection_send(con, ev->data + sub->head_sent, ev->len - sub->head_sent); 
+    }
+
+    struct iovec iov[HTTP_SSE_QUEUE]; 
+    for (uint32_t i = 0; i < sub->count; i++)
+    {
+        Http_sse_event_t* ev = SLOT(sub, i); 
+        size_t skip = i ? 0 : sub->head_sent; 
+        iov[i].iov_base = ev->data + skip; 
+        iov[i].iov_len = ev->len - skip; 
+    }
+    struct msghdr msg; 
+    memset(&msg, 0, sizeof msg); 
+    msg.msg_iov = iov; 
+    msg.msg_iovlen = sub->count; 
+    /* MSG_NOSIGNAL to prevent SIGPIPE */ 
+    return sendmsg(con->client_fd, &msg, MSG_NOSIGNAL); 
+}
+
+static void dirty_add(Http_sse_registry_t* reg, Http_sse_t* sub)
+{
+    if (sub->dirty)
+        return; 
+    sub->dirty = 1; 
+    sub->dirty_prev = NULL; 
+    sub->dirty_next = reg->dirty; 
+    if (reg->dirty)
+        reg->dirty->dirty_prev = sub; 
+    reg->dirty = sub; 
+}
+
+static void dirty_remove(Http_sse_registry_t* reg, Http_sse_t* sub)
+{
+    if (sub->dirty_prev)
+        sub->dirty_prev->dirty_next = sub->dirty_next; 
+    else
+        reg->dirty = sub->dirty_next; 
+    if (sub->dirty_next)
+        sub->dirty_next->dirty_prev = sub->dirty_prev; 
+    sub->dirty = 0; 
+    sub->dirty_prev = NULL; 
+    sub->dirty_next = NULL; 
+}
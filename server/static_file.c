@@ -0,0 +1,542 @@
+#include <errno.h> 
+#include <fcntl.h> 
+#include <limits.h> 
+#include <stdint.h> 
+#include <stdio.h> 
+#include <stdlib.h> 
+#include <string.h> 
+#include <strings.h> 
+#include <sys/stat.h> 
+#include <unistd.h> 
+
+#include <loom/server.h> 
+#include <loom/compress.h> 
+
+#define HTTP_ETAG_SIZE 64
+#define HTTP_CONTENT_RANGE_SIZE 64
+#define HTTP_BOUNDARY_PREFIX "LOOM_BYTERANGES_"
+
+static int open_sidecar(const char* file_path, const char* suffix, struct stat* st); 
+static int has_sidecar(const char* file_path, const char* suffix); 
+static Http_content_encoding_t cached_encoding(Http_request_t* req, const char* file_path, const struct stat* file_st); 
+static void make_etag(const struct stat* st, char etag[HTTP_ETAG_SIZE]); 
+static int etag_list_matches(const char* list, const char* etag); 
+static int not_modified(Http_request_t* req, const char* etag, time_t mtime); 
+static int add_validators(Http_response_t* resp, const char* etag, Http_content_encoding_t encoding, time_t mtime); 
+static int if_range_matches(Http_request_t* req, const char* etag, time_t mtime); 
+static int parse_ranges(const char* value, off_t size, Http_byte_range_t* ranges, int max_ranges); 
+static int parse_offset(const char** p, off_t* out); 
+static int merge_ranges(Http_byte_range_t* ranges, int count, off_t size); 
+static int serve_ranges(Http_response_t* resp,
+                        const char* file_path,
+                        const struct stat* file_st,
+                        Http_content_type_t content_type,
+                        Http_byte_range_t* ranges,
+                        int ranges_count); 
+
+/* returns the fd of "<file_path><suffix>" or -1 if there is no such regular file */ 
+static int open_sidecar(const char* file_path, const char* suffix, struct stat* st)
+{
+    char sidecar_path[PATH_MAX]; 
+    int n = snprintf(sidecar_path, sizeof sidecar_path, "%s%s", file_path, suffix); 
+    if (n < 0 || (size_t)n >= sizeof sidecar_path)
+        return -1; 
+
+    int fd = open(sidecar_path, O_RDONLY | O_CLOEXEC); 
+    if (fd == -1)
+        return -1; 
+
+    if (fstat(fd, st) == -1 || !S_ISREG(st->st_mode))
+    {
+        close(fd); 
+        return -1; 
+    }
+    return fd; 
+}
+
+static int has_sidecar(const char* file_path, const char* suffix)
+{
+    char sidecar_path[PATH_MAX]; 
+    struct stat st; 
+    int n = snprintf(sidecar_path, sizeof sidecar_path, "%s%s", file_path, suffix); 
+    if (n < 0 || (size_t)n >= sizeof sidecar_path)
+        return 0; 
+    return stat(sidecar_path, &st) == 0 && S_ISREG(st.st_mode); 
+}
+
+/* the version a 200 would send, picked the same way without opening anything */ 
+static Http_content_encoding_t cached_encoding(Http_request_t* req, const char* file_path, const struct stat* file_st)
+{
+    unsigned int accept = http_accept_encoding_parse(http_request_header(req, "Accept-Encoding")); 
+    if ((accept & HTTP_ENCODING_BIT(HTTP_ENCODING_BR)) && has_sidecar(file_path, ".br"))
+        return HTTP_ENCODING_BR; 
+    if ((accept & HTTP_ENCODING_BIT(HTTP_ENCODING_GZIP)) &&
+            (has_sidecar(file_path, ".gz") || http_compress_cache_ready(file_st)))
+        return HTTP_ENCODING_GZIP; 
+    return HTTP_ENCODING_NONE; 
+}
+
+/* "inode-size-mtime" of the original file, encoded versions get a suffix */ 
+static void make_etag(const struct stat* st, char etag[HTTP_ETAG_SIZE])
+{
+    unsigned long long mtime_ns = (unsigned long long)st->st_mtim.tv_sec * 1000000000ull + st->st_mtim.tv_nsec; 
+    snprintf(etag, HTTP_ETAG_SIZE, "%llx-%llx-%llx",
+            (unsigned long long)st->st_ino,
+            (unsigned long long)st->st_size,
+            mtime_ns); 
+}
+
+/* weak comparison, the encoding suffix is ignored since all versions change together */ 
+static int etag_list_matches(const char* list, const char* etag)
+{
+    size_t etag_len = strlen(etag); 
+    const char* p = list; 
+    while (*p)
+    {
+        while (*p == ' ' || *p == '\t' || *p == ',')
+            p++; 
+        if (*p == '*')
+            return 1; 
+        if (!strncmp(p, "W/", 2))
+            p += 2; 
+        if (*p != '"')
+            return 0; /* malformed */ 
+        p++; 
+
+        const char* end = strchr(p, '"'); 
+        if (!end)
+            return 0; 
+
+        size_t len = end - p; 
+        if (len >= etag_len && !memcmp(p, etag, etag_len))
+        {
+            const char* suffix = p + etag_len; 
+            size_t suffix_len = len - etag_len; 
+            if (suffix_len == 0 ||
+                    (suffix_len == 3 && !memcmp(suffix, "-gz", 3)) ||
+                    (suffix_len == 3 && !memcmp(suffix, "-br", 3)))
+                return 1; 
+        }
+        p = end + 1; 
+    }
+    return 0; 
+}
+
+/* returns 1 if the client's copy is still valid */ 
+static int not_modified(Http_request_t* req, const char* etag, time_t mtime)
+{
+    if (req->method != HTTP_METHOD_GET && req->method != HTTP_METHOD_HEAD)
+        return 0; 
+
+    /* If-None-Match takes precedence over If-Modified-Since */ 
+    char value[HTTP_MAX_HEADER_LINE]; 
+    Http_slice_t if_none_match = http_request_header(req, "If-None-Match"); 
+    if (if_none_match.ptr)
+        return http_slice_cstr(if_none_match, value, sizeof value) && etag_list_matches(value, etag); 
+
+    char* if_modified_since = http_slice_cstr(http_request_header(req, "If-Modified-Since"), value, sizeof value); 
+    time_t since; 
+    if (if_modified_since && http_parse_date(if_modified_since, &since) == 0)
+        return mtime <= since; 
+
+    return 0; 
+}
+
+static int add_validators(Http_response_t* resp, const char* etag, Http_content_encoding_t encoding, time_t mtime)
+{
+    char* etag_value = malloc(HTTP_ETAG_SIZE + 8); 
+    if (!etag_value)
+        return -1; 
+
+    const char* suffix = ""; 
+    if (encoding == HTTP_ENCODING_GZIP)
+        suffix = "-gz"; 
+    else if (encoding == HTTP_ENCODING_BR)
+        suffix = "-br"; 
+    snprintf(etag_value, HTTP_ETAG_SIZE + 8, "\"%s%s\"", etag, suffix); 
+
+    http_response_set_etag(resp, etag_value, HTTP_MEM_OWNED); 
+    http_response_set_last_modified(resp, mtime); 
+    return 0; 
+}
+
+/* If-Range uses a strong comparison, only the identity version can match */ 
+static int if_range_matches(Http_request_t* req, const char* etag, time_t mtime)
+{
+    Http_slice_t if_range_value = http_request_header(req, "If-Range"); 
+    if (!if_range_value.ptr)
+        return 1; 
+    char value[HTTP_MAX_HEADER_LINE]; 
+    char* if_range = http_slice_cstr(if_range_value, value, sizeof value); 
+    if (!if_range)
+        return 0; 
+
+    if (if_range[0] == '"')
+    {
+        size_t etag_len = strlen(etag); 
+        return strlen(if_range) == etag_len + 2 &&
+            !memcmp(if_range + 1, etag, etag_len) &&
+            if_range[etag_len + 1] == '"'; 
+    }
+
+    time_t date; 
+    if (http_parse_date(if_range, &date) == -1)
+        return 0; 
+    return date == mtime; 
+}
+
+static int parse_offset(const char** p, off_t* out)
+{
+    const char* s = *p; 
+    off_t value = 0; 
+    if (*s < '0' || *s > '9')
+        return -1; 
+    while (*s >= '0' && *s <= '9')
+    {
+        if (value > (INT64_MAX - 9) / 10)
+            return -1; 
+        value = value * 10 + (*s - '0'); 
+        s++; 
+    }
+    *p = s; 
+    *out = value; 
+    return 0; 
+}
+
+/* returns the number of satisfiable ranges (0 means 416) or -1 if the header must be ignored.
+ * the ranges are sorted and merged */ 
+static int parse_ranges(const char* value, off_t size, Http_byte_range_t* ranges, int max_ranges)
+{
+    if (strncasecmp(value, "bytes=", 6))
+        return -1; 
+
+    int count = 0; 
+    const char* p = value + 6; 
+    for (;;)
+    {
+        while (*p == ' ' || *p == '\t')
+            p++; 
+
+        off_t start, end; 
+        if (*p == '-') /* suffix range "-500" */ 
+        {
+            p++; 
+            off_t suffix; 
+            if (parse_offset(&p, &suffix) == -1)
+                return -1; 
+            if (suffix == 0)
+                goto next; /* unsatisfiable */ 
+            start = suffix >= size ? 0 : size - suffix; 
+            end = size - 1; 
+        }
+        else
+        {
+            if (parse_offset(&p, &start) == -1 || *p != '-')
+                return -1; 
+            p++; 
+            end = size - 1; 
+            if (*p >= '0' && *p <= '9')
+            {
+                if (parse_offset(&p, &end) == -1)
+                    return -1; 
+                if (end < start)
+                    return -1; 
+                if (end >= size)
+                    end = size - 1; 
+            }
+            if (start >= size)
+                goto next; /* unsatisfiable */ 
+        }
+
+        if (count >= max_ranges)
+            return -1; /* too many, send everything */ 
+        ranges[count].start = start; 
+        ranges[count].end = end; 
+        count++; 
+next:
+        while (*p == ' ' || *p == '\t')
+            p++; 
+        if (*p == '\0')
+            break; 
+        if (*p != ',')
+            return -1; 
+        p++; 
+    }
+
+    return merge_ranges(ranges, count, size); 
+}
+
+/* "0-,0-,0-..." would send the file many times over, ranges adding up to more than the file
+ * get the whole file once. overlapping or adjacent ones become one part */ 
+static int merge_ranges(Http_byte_range_t* ranges, int count, off_t size)
+{
+    off_t total = 0; 
+    for (int i = 0; i < count; i++)
+    {
+        total += ranges[i].end - ranges[i].start + 1; 
+        if (total > size)
+            return -1; 
+    }
+
+    /* insertion sort, there are at most HTTP_MAX_RANGES */ 
+    for (int i = 1; i < count; i++)
+    {
+        Http_byte_range_t range = ranges[i]; 
+        int j = i; 
+        for (; j > 0 && ranges[j - 1].start > range.start; j--)
+            ranges[j] = ranges[j - 1]; 
+        ranges[j] = range; 
+    }
+
+    int merged = 0; 
+    for (int i = 0; i < count; i++)
+    {
+        if (merged && ranges[i].start <= ranges[merged - 1].end + 1)
+        {
+            if (ranges[i].end > ranges[merged - 1].end)
+                ranges[merged - 1].end = ranges[i].end; 
+        }
+        else
+            ranges[merged++] = ranges[i]; 
+    }
+    return merged; 
+}
+
+/* returns -1 if an error */ 
+static int serve_ranges(Http_response_t* resp,
+                        const char* file_path,
+                        const struct stat* file_st,
+                        Http_content_type_t content_type,
+                        Http_byte_range_t* ranges,
+                        int ranges_count)
+{
+    struct stat st; 
+    int fd = open(file_path, O_RDONLY | O_CLOEXEC); 
+    if (fd == -1)
+        return -1; 
+
+    /* the ranges were computed for this exact version */ 
+    if (fstat(fd, &st) == -1 || st.st_ino != file_st->st_ino || st.st_size != file_st->st_size)
+    {
+        close(fd); 
+        return -1; 
+    }
+
+    resp->status_code = HTTP_PARTIAL_CONTENT; 
+    resp->connection_close = 0; 
+
+    if (ranges_count == 1) /* served straight from the file */ 
+    {
+        char* content_range = malloc(HTTP_CONTENT_RANGE_SIZE); 
+        if (!content_range)
+        {
+            close(fd); 
+            return -1; 
+        }
+        snprintf(content_range, HTTP_CONTENT_RANGE_SIZE, "bytes %lld-%lld/%lld",
+                (long long)ranges[0].start, (long long)ranges[0].end, (long long)st.st_size); 
+        if (http_response_add_header(resp, "Content-Range", HTTP_MEM_STATIC, content_range, HTTP_MEM_OWNED) == -1)
+        {
+            free(content_range); 
+            close(fd); 
+            return -1; 
+        }
+
+        resp->content_type = content_type; 
+        resp->body_type = HTTP_BODY_FILE; 
+        resp->body_mem = HTTP_MEM_OWNED; 
+        resp->body_fd = fd; 
+        resp->body_offset = ranges[0].start; 
+        resp->body_len = ranges[0].end - ranges[0].start + 1; 
+        return 0; 
+    }
+
+    /* multipart/byteranges, the connection sends the part heads and each part from the file */ 
+    Http_byteranges_t* byteranges = malloc(sizeof(Http_byteranges_t)); 
+    if (!byteranges)
+    {
+        perror("malloc"); 
+        close(fd); 
+        return -1; 
+    }
+    snprintf(byteranges->boundary, sizeof byteranges->boundary, HTTP_BOUNDARY_PREFIX "%llx%llx",
+            (unsigned long long)st.st_ino, (unsigned long long)st.st_mtim.tv_nsec); 
+    byteranges->part_type = http_content_type_value(content_type); 
+    byteranges->size = st.st_size; 
+    byteranges->count = ranges_count; 
+    memcpy(byteranges->ranges, ranges, ranges_count * sizeof(Http_byte_range_t)); 
+
+    size_t content_type_len = sizeof("multipart/byteranges; boundary=") + strlen(byteranges->boundary); 
+    char* multipart_type = malloc(content_type_len); 
+    if (!multipart_type)
+    {
+        free(byteranges); 
+        close(fd); 
+        return -1; 
+    }
+    snprintf(multipart_type, content_type_len, "multipart/byteranges; boundary=%s", byteranges->boundary); 
+    if (http_response_add_header(resp, "Content-Type", HTTP_MEM_STATIC, multipart_type, HTTP_MEM_OWNED) == -1)
+    {
+        free(multipart_type); 
+        free(byteranges); 
+        close(fd); 
+        return -1; 
+    }
+
+    resp->content_type = HTTP_CONTENT_NONE; /* sent as a header, it carries the boundary */ 
+    resp->body_type = HTTP_BODY_FILE; 
+    resp->body_mem = HTTP_MEM_OWNED; 
+    resp->body_fd = fd; 
+    resp->body_offset = 0; 
+    resp->body_len = http_byteranges_len(byteranges); 
+    resp->byteranges = byteranges; 
+    return 0; 
+}
+
+Http_handler_result_t http_handler_static_file(Http_request_t* req,
+                                               Http_response_t* resp,
+                                               const char* file_path,
+                                               Http_content_type_t content_type)
+{
+    struct stat file_st, st; 
+    Http_content_encoding_t encoding = HTTP_ENCODING_NONE; 
+    int fd = -1; 
+
+    if (stat(file_path, &file_st) == -1 || !S_ISREG(file_st.st_mode) || file_st.st_size == 0)
+    {
+        http_response_make_error(resp, HTTP_NOT_FOUND); 
+        return HTTP_HANDLER_OK; 
+    }
+
+    char etag[HTTP_ETAG_SIZE]; 
+    make_etag(&file_st, etag); 
+    time_t mtime = file_st.st_mtim.tv_sec; 
+    int compressible = http_content_type_compressible(content_type); 
+
+    /* revalidation: answer with only stats, no file is opened */ 
+    if (not_modified(req, etag, mtime))
+    {
+        resp->status_code = HTTP_NOT_MODIFIED; 
+        resp->content_type = HTTP_CONTENT_NONE; 
+        resp->vary_encoding = compressible; 
+        resp->connection_close = 0; 
+        /* the etag of the version a 200 would carry, with its suffix */ 
+        if (compressible)
+            encoding = cached_encoding(req, file_path, &file_st); 
+        if (add_validators(resp, etag, encoding, mtime) == -1)
+        {
+            http_response_free(resp); 
+            return HTTP_HANDLER_ERR; 
+        }
+        return HTTP_HANDLER_OK; 
+    }
+
+    /* ranges are served from the identity version */ 
+    /* a range list too long to copy is ignored like a malformed one */ 
+    char range_value[HTTP_MAX_HEADER_LINE]; 
+    char* range = req->method == HTTP_METHOD_GET ?
+        http_slice_cstr(http_request_header(req, "Range"), range_value, sizeof range_value) : NULL; 
+    if (range && if_range_matches(req, etag, mtime))
+    {
+        Http_byte_range_t ranges[HTTP_MAX_RANGES]; 
+        int ranges_count = parse_ranges(range, file_st.st_size, ranges, HTTP_MAX_RANGES); 
+        if (ranges_count == 0)
+        {
+            char* content_range = malloc(HTTP_CONTENT_RANGE_SIZE); 
+            if (!content_range)
+                return HTTP_HANDLER_ERR; 
+            snprintf(content_range, HTTP_CONTENT_RANGE_SIZE, "bytes */%lld", (long long)file_st.st_size); 
+
+            http_response_make_error(resp, HTTP_RANGE_NOT_SATISFIABLE); 
+            resp->connection_close = 0; 
+            if (http_response_add_header(resp, "Content-Range", HTTP_MEM_STATIC, content_range, HTTP_MEM_OWNED) == -1)
+            {
+                free(content_range); 
+                return HTTP_HANDLER_ERR; 
+            }
+            return HTTP_HANDLER_OK; 
+        }
+        if (ranges_count > 0)
+        {
+            if (serve_ranges(resp, file_path, &file_st, content_type, ranges, ranges_count) == -1 ||
+                add_validators(resp, etag, HTTP_ENCODING_NONE, mtime) == -1)
+            {
+                http_response_free(resp); 
+                return HTTP_HANDLER_ERR; 
+            }
+            return HTTP_HANDLER_OK; 
+        }
+        /* malformed or too many ranges, the whole file is sent */ 
+    }
+
+    unsigned int accept = 0; 
+    if (compressible)
+        accept = http_accept_encoding_parse(http_request_header(req, "Accept-Encoding")); 
+
+    /* precompressed sidecars first, "file.br" then "file.gz" */ 
+    if (accept & HTTP_ENCODING_BIT(HTTP_ENCODING_BR))
+    {
+        fd = open_sidecar(file_path, ".br", &st); 
+        if (fd != -1)
+            encoding = HTTP_ENCODING_BR; 
+    }
+    if (fd == -1 && (accept & HTTP_ENCODING_BIT(HTTP_ENCODING_GZIP)))
+    {
+        fd = open_sidecar(file_path, ".gz", &st); 
+        if (fd != -1)
+            encoding = HTTP_ENCODING_GZIP; 
+    }
+
+    if (fd == -1)
+    {
+        fd = open(file_path, O_RDONLY | O_CLOEXEC); 
+        if (fd == -1)
+        {
+            http_response_make_error(resp, HTTP_NOT_FOUND); 
+            return HTTP_HANDLER_OK; 
+        }
+
+        if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        {
+            close(fd); 
+            http_response_make_error(resp, HTTP_NOT_FOUND); 
+            return HTTP_HANDLER_OK; 
+        }
+    }
+
+    size_t body_len = (size_t)st.st_size; 
+
+    /* no sidecar, use the cached gzip version (compressed on first use) */ 
+    if (encoding == HTTP_ENCODING_NONE && (accept & HTTP_ENCODING_BIT(HTTP_ENCODING_GZIP)))
+    {
+        size_t gz_len; 
+        int gz_fd = http_compress_cache_get(fd, &st, &gz_len); 
+        if (gz_fd != -1)
+        {
+            close(fd); 
+            fd = gz_fd; 
+            body_len = gz_len; 
+            encoding = HTTP_ENCODING_GZIP; 
+        }
+    }
+
+    resp->status_code = HTTP_OK; 
+    resp->content_type = content_type; 
+    resp->content_encoding = encoding; 
+    resp->vary_encoding = compressible; 
+    resp->body_type = HTTP_BODY_FILE; 
+    resp->body_fd = fd; 
+    resp->body_offset = 0; 
+    resp->body_len = body_len; 
+    resp->body_mem = HTTP_MEM_OWNED; /* close the file once sent */ 
+    resp->connection_close = 0; 
+
+    if (add_validators(resp, etag, encoding, mtime) == -1 ||
+            http_response_add_header(resp, "Accept-Ranges", HTTP_MEM_STATIC, "bytes", HTTP_MEM_STATIC) == -1)
+    {
+        http_response_free(resp); 
+        return HTTP_HANDLER_ERR; 
+    }
+
+    return HTTP_HANDLER_OK; 
+}
@@ -25,6 +25,7 @@
 
 static int insert(Http_timer_t* timer, Http_connection_t* connection, time_t real_timeout); 
 static void heapify(Http_timer_t* timer, int i); 
+static int sift_up(Http_timer_t* timer, int i); 
 static int timer_update(Http_timer_t* timer); 
 static time_t timer_recent_time(Http_timer_t* timer); 
 
@@ -80,13 +81,25 @@ void http_timer_invalid_timeout(Http_timer_t* timer, int event_index)
     timer->events[event_index].flag = HTTP_TIMER_EVENT_INVALID; 
 }
 
-int http_timer_reset_timeout(Http_timer_t* timer, Http_connection_t* con, int timeout_sec)
+int http_timer_update(Http_timer_t* timer, Http_connection_t* con, int timeout_sec)
 {
-    /* invalid the old one and create a new one */ 
+    /* rewritten where it is, a new event per request would fill the heap with dead ones */ 
     assert(timer != NULL); 
     assert(con != NULL); 
-    http_timer_invalid_timeout(timer, con->timeout_index); 
-    return http_timer_add_timeout(timer, con, timeout_sec); 
+    assert(con->timeout_index >= 0 && (size_t)con->timeout_index < timer->events_count); 
+    int i = con->timeout_index; 
+    time_t real_timeout = time(NULL) + timeout_sec; 
+    if (timer->events[i].timeout == real_timeout)
+        return 0; 
+    timer->events[i].timeout = real_timeout; 
+
+    int moved = sift_up(timer, i); 
+    if (!moved)
+        heapify(timer, i); 
+    /* the timer fd only follows the earliest one */ 
+    if (i == ROOT || con->timeout_index == ROOT)
+        return timer_update(timer); 
+    return 0; 
 }
 
 int http_timer_pop_recent(Http_timer_t* timer, Http_timer_event_t* event)
@@ -124,14 +137,22 @@ static int insert(Http_timer_t* timer, Http_connection_t* con, time_t real_timeo
     timer->events[i].con->timeout_index = i; 
 
     timer->events_count++; 
+    sift_up(timer, i); 
+
+    return 0; 
+}
 
+/* returns 1 if the event went up */ 
+static int sift_up(Http_timer_t* timer, int i)
+{
+    int moved = 0; 
     while (i != ROOT && CMP_EVENTS(timer->events, i, PARENT(i)))
     {
         SWAP_EVENTS(timer->events, i, PARENT(i)); 
         i = PARENT(i); 
+        moved = 1; 
     }
-
-    return 0; 
+    return moved; 
 }
 
 int timer_update(Http_timer_t* timer)
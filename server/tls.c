@@ -0,0 +1,257 @@
+#include <assert.h> 
+#include <errno.h> 
+#include <stdio.h> 
+#include <unistd.h> 
+
+#include <loom/tls.h> 
+#include <loom/connection.h> 
+
+#ifdef HTTP_USE_TLS
+
+#include <openssl/err.h> 
+#include <openssl/ssl.h> 
+
+#define TLS_FALLBACK_CHUNK (16 * 1024) /* one TLS record */ 
+
+static ssize_t io_result(Http_connection_t* con, int ret); 
+static int alpn_select(SSL* ssl, const unsigned char** out, unsigned char* out_len,
+                       const unsigned char* in, unsigned int in_len, void* arg); 
+
+/* preferred first, wire format */ 
+static const unsigned char alpn_protocols[] = "\x02h2\x08http/1.1"; 
+
+int http_tls_init(Http_server_context_t* ctx)
+{
+    assert(ctx != NULL && ctx->cfg != NULL); 
+
+    SSL_CTX* ssl_ctx = SSL_CTX_new(TLS_server_method()); 
+    if (!ssl_ctx)
+    {
+        ERR_print_errors_fp(stderr); 
+        return -1; 
+    }
+
+    SSL_CTX_set_min_proto_version(ssl_ctx, TLS1_2_VERSION); 
+    /* hand the session keys to the kernel (TCP_ULP "tls") when it supports it */ 
+    SSL_CTX_set_options(ssl_ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION); 
+    /* a write that would block is retried from con->response which may have moved */ 
+    SSL_CTX_set_mode(ssl_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER); 
+
+    if (SSL_CTX_use_certificate_chain_file(ssl_ctx, ctx->cfg->tls_cert) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ssl_ctx, ctx->cfg->tls_key, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ssl_ctx) != 1)
+    {
+        ERR_print_errors_fp(stderr); 
+        SSL_CTX_free(ssl_ctx); 
+        return -1; 
+    }
+
+    /* an "h2" client starts with the preface, the connection switches like prior knowledge */ 
+    SSL_CTX_set_alpn_select_cb(ssl_ctx, alpn_select, NULL); 
+
+    ctx->ssl_ctx = ssl_ctx; 
+    return 0; 
+}
+
+static int alpn_select(SSL* ssl, const unsigned char** out, unsigned char* out_len,
+                       const unsigned char* in, unsigned int in_len, void* arg)
+{
+    (void)ssl; 
+    (void)arg; 
+    if (SSL_select_next_proto((unsigned char**)out, out_len, alpn_protocols, sizeof alpn_protocols - 1,
+                              in, in_len) != OPENSSL_NPN_NEGOTIATED)
+        return SSL_TLSEXT_ERR_NOACK; /* no common protocol, stay on http/1.1 */ 
+    return SSL_TLSEXT_ERR_OK; 
+}
+
+void http_tls_clean(Http_server_context_t* ctx)
+{
+    if (ctx->ssl_ctx)
+        SSL_CTX_free(ctx->ssl_ctx); 
+    ctx->ssl_ctx = NULL; 
+}
+
+int http_tls_accept(Http_server_context_t* ctx, Http_connection_t* con)
+{
+    assert(ctx->ssl_ctx != NULL); 
+
+    SSL* ssl = SSL_new(ctx->ssl_ctx); 
+    if (!ssl)
+    {
+        ERR_print_errors_fp(stderr); 
+        return -1; 
+    }
+    if (SSL_set_fd(ssl, con->client_fd) != 1)
+    {
+        ERR_print_errors_fp(stderr); 
+        SSL_free(ssl); 
+        return -1; 
+    }
+    SSL_set_accept_state(ssl); 
+
+    con->ssl = ssl; 
+    HTTP_SET_HANDSHAKING(con->flags); 
+    return 0; 
+}
+
+int http_tls_handshake(Http_connection_t* con)
+{
+    assert(con->ssl != NULL); 
+
+    HTTP_CLEAR_TLS_WANT_WRITE(con->flags); 
+    int ret = SSL_do_handshake(con->ssl); 
+    if (ret == 1)
+    {
+        HTTP_CLEAR_HANDSHAKING(con->flags); 
+        if (BIO_get_ktls_send(SSL_get_wbio(con->ssl)))
+            HTTP_SET_KTLS_SEND(con->flags); 
+        return 1; 
+    }
+
+    switch (SSL_get_error(con->ssl, ret))
+    {
+        case SSL_ERROR_WANT_READ: 
+            return 0; 
+        case SSL_ERROR_WANT_WRITE: 
+            HTTP_SET_TLS_WANT_WRITE(con->flags); 
+            return 0; 
+        default: 
+            ERR_clear_error(); /* most likely a client that doesn't trust the certificate */ 
+            return -1; 
+    }
+}
+
+void http_tls_free(Http_connection_t* con)
+{
+    if (!con->ssl)
+        return; 
+    /* best effort close_notify, the socket is closed right after */ 
+    if (!HTTP_IS_HANDSHAKING(con->flags))
+        SSL_shutdown(con->ssl); 
+    SSL_free(con->ssl); 
+    ERR_clear_error(); 
+    con->ssl = NULL; 
+}
+
+static ssize_t io_result(Http_connection_t* con, int ret)
+{
+    if (ret > 0)
+        return ret; 
+
+    switch (SSL_get_error(con->ssl, ret))
+    {
+        case SSL_ERROR_WANT_READ: 
+        case SSL_ERROR_WANT_WRITE: 
+            errno = EAGAIN; 
+            return -1; 
+        case SSL_ERROR_ZERO_RETURN: /* close_notify */ 
+            return 0; 
+        case SSL_ERROR_SYSCALL: 
+            ERR_clear_error(); 
+            if (errno == 0)
+                return 0; /* eof without close_notify */ 
+            return -1; 
+        default: 
+            ERR_clear_error(); 
+            errno = EIO; 
+            return -1; 
+    }
+}
+
+ssize_t http_tls_read(Http_connection_t* con, char* buff, size_t len)
+{
+    errno = 0; 
+    return io_result(con, SSL_read(con->ssl, buff, len)); 
+}
+
+ssize_t http_tls_write(Http_connection_t* con, const char* buff, size_t len)
+{
+    errno = 0; 
+    return io_result(con, SSL_write(con->ssl, buff, len)); 
+}
+
+ssize_t http_tls_sendfile(Http_connection_t* con, int fd, off_t* offset, size_t len)
+{
+    errno = 0; 
+    if (HTTP_IS_KTLS_SEND(con->flags)) /* zero copy, the kernel encrypts */ 
+    {
+        ossl_ssize_t n = SSL_sendfile(con->ssl, fd, *offset, len, 0); 
+        if (n < 0)
+            return io_result(con, (int)n); 
+        *offset += n; 
+        return n; 
+    }
+
+    /* no kTLS: read a record worth of the file and encrypt it in user space */ 
+    char chunk[TLS_FALLBACK_CHUNK]; 
+    ssize_t n = pread(fd, chunk, len < sizeof chunk ? len : sizeof chunk, *offset); 
+    if (n <= 0)
+        return n; 
+
+    n = io_result(con, SSL_write(con->ssl, chunk, n)); 
+    if (n > 0)
+        *offset += n; 
+    return n; 
+}
+
+#else /* HTTP_USE_TLS */ 
+
+int http_tls_init(Http_server_context_t* ctx)
+{
+    (void)ctx; 
+    fprintf(stderr, "Error: loom was built without TLS support (make TLS=1)\n"); 
+    return -1; 
+}
+
+void http_tls_clean(Http_server_context_t* ctx)
+{
+    (void)ctx; 
+}
+
+int http_tls_accept(Http_server_context_t* ctx, Http_connection_t* con)
+{
+    (void)ctx; 
+    (void)con; 
+    return -1; 
+}
+
+int http_tls_handshake(Http_connection_t* con)
+{
+    (void)con; 
+    return -1; 
+}
+
+void http_tls_free(Http_connection_t* con)
+{
+    (void)con; 
+}
+
+ssize_t http_tls_read(Http_connection_t* con, char* buff, size_t len)
+{
+    (void)con; 
+    (void)buff; 
+    (void)len; 
+    errno = ENOTSUP; 
+    return -1; 
+}
+
+ssize_t http_tls_write(Http_connection_t* con, const char* buff, size_t len)
+{
+    (void)con; 
+    (void)buff; 
+    (void)len; 
+    errno = ENOTSUP; 
+    return -1; 
+}
+
+ssize_t http_tls_sendfile(Http_connection_t* con, int fd, off_t* offset, size_t len)
+{
+    (void)con; 
+    (void)fd; 
+    (void)offset; 
+    (void)len; 
+    errno = ENOTSUP; 
+    return -1; 
+}
+
+#endif /* HTTP_USE_TLS */ 
@@ -0,0 +1,113 @@
+#include <stdio.h> 
+#include <string.h> 
+#include <arpa/inet.h> 
+#include <netinet/in.h> 
+
+#include <loom/trace.h> 
+#include <loom/connection.h> 
+#include <loom/http_response.h> 
+
+void http_trace_begin(Http_connection_t* con)
+{
+    Http_server_context_t* ctx = con->ctx; 
+    int sample = ctx->cfg->trace_sample; 
+    if (sample <= 0)
+        return; 
+    /* pipelined, the previous response is queued but not sent yet */ 
+    if (con->tracing)
+        http_trace_end(con, 0); 
+    if (ctx->trace_count++ % sample)
+        return; 
+
+    memset(&con->trace, 0, sizeof con->trace); 
+    con->trace.peer = &con->peer; 
+    con->trace.method[0] = '-'; 
+    con->trace.path[0] = '-'; 
+    con->tracing = 1; 
+    con->trace.at[HTTP_TRACE_FIRST_BYTE] = http_time_ns(); 
+}
+
+void http_trace_request(Http_connection_t* con)
+{
+    if (!con->tracing)
+        return; 
+    Http_trace_t* trace = &con->trace; 
+    trace->at[HTTP_TRACE_HEADERS] = http_time_ns(); 
+
+    /* the request lives in the connection buffer, it's gone by the time the hook runs */ 
+    const Http_request_t* req = &con->request; 
+    if (req->method_str && strlen(req->method_str) < sizeof trace->method)
+        strcpy(trace->method, req->method_str); 
+    if (req->target)
+    {
+        strncpy(trace->path, req->target, HTTP_TRACE_PATH_LEN - 1); 
+        trace->path[HTTP_TRACE_PATH_LEN - 1] = '\0'; 
+    }
+}
+
+void http_trace_response(Http_connection_t* con, const char* head, size_t len)
+{
+    if (!con->tracing)
+        return; 
+    int status = http_status_from_head(head, len); 
+    if (!status || status < 200)
+        return; /* interim responses from a backend */ 
+    con->trace.status = status; 
+    con->trace.at[HTTP_TRACE_HANDLER_END] = http_time_ns(); 
+}
+
+void http_trace_end(Http_connection_t* con, int closed)
+{
+    if (!con->tracing)
+        return; 
+    /* still waiting for the response */ 
+    if (!closed && !con->trace.status)
+        return; 
+    con->tracing = 0; 
+    /* upgraded to http/2, its streams aren't traced */ 
+    if (con->h2)
+        return; 
+    if (!closed)
+        con->trace.at[HTTP_TRACE_LAST_SENT] = http_time_ns(); 
+
+    Http_config_t* cfg = con->ctx->cfg; 
+    if (cfg->trace_hook)
+        cfg->trace_hook(&con->trace, cfg->trace_data); 
+    else
+        http_trace_print(&con->trace, NULL); 
+}
+
+/* microseconds between two phases, -1 if one of them wasn't reached */ 
+static long phase_us(const Http_trace_t* trace, Http_trace_phase_t from, Http_trace_phase_t to)
+{
+    if (!trace->at[from] || !trace->at[to])
+        return -1; 
+    return (long)((trace->at[to] - trace->at[from]) / 1000); 
+}
+
+void http_trace_print(const Http_trace_t* trace, void* data)
+{
+    (void)data; 
+    char addr[INET6_ADDRSTRLEN] = "-"; 
+    if (trace->peer->ss_family == AF_INET)
+        inet_ntop(AF_INET, &((const struct sockaddr_in*)trace->peer)->sin_addr, addr, sizeof addr); 
+    else if (trace->peer->ss_family == AF_INET6)
+        inet_ntop(AF_INET6, &((const struct sockaddr_in6*)trace->peer)->sin6_addr, addr, sizeof addr); 
+
+    /* the end is the last phase reached */ 
+    Http_trace_phase_t last = HTTP_TRACE_FIRST_BYTE; 
+    for (int i = 0; i < HTTP_TRACE_PHASES; i++)
+    {
+        if (trace->at[i])
+            last = i; 
+    }
+
+    fprintf(stderr, "trace %s %s %s %d (us) headers=%ld body=%ld handler=%ld queued=%ld send=%ld total=%ld\n",
+            addr, trace->method, trace->path, trace->status,
+            phase_us(trace, HTTP_TRACE_FIRST_BYTE, HTTP_TRACE_HEADERS),
+            phase_us(trace, HTTP_TRACE_HEADERS, HTTP_TRACE_HANDLER_START),
+            phase_us(trace, HTTP_TRACE_HANDLER_START, HTTP_TRACE_HANDLER_END),
+            phase_us(trace, HTTP_TRACE_HANDLER_END, HTTP_TRACE_FIRST_SENT),
+            phase_us(trace, HTTP_TRACE_FIRST_SENT, HTTP_TRACE_LAST_SENT),
+            phase_us(trace, HTTP_TRACE_FIRST_BYTE, last)); 
+}
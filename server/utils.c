@@ -1,9 +1,12 @@
+#define _GNU_SOURCE /* strptime, timegm */ 
 #include <fcntl.h> 
 #include <stdio.h> 
 #include <stdlib.h> 
 #include <limits.h> 
 #include <stdint.h> 
 #include <errno.h> 
+#include <string.h> 
+#include <strings.h> 
 
 #include <loom/utils.h>
 
@@ -40,3 +43,67 @@ int http_parse_sizet(const char *str, size_t *out) {
     *out = (size_t)val;
     return 0; 
 }
+
+int http_slice_eq_nocase(Http_slice_t slice, const char* str)
+{
+    return slice.ptr && strlen(str) == slice.len && !strncasecmp(slice.ptr, str, slice.len); 
+}
+
+char* http_slice_cstr(Http_slice_t slice, char* buf, size_t size)
+{
+    if (!slice.ptr || slice.len >= size)
+        return NULL; 
+    memcpy(buf, slice.ptr, slice.len); 
+    buf[slice.len] = '\0'; 
+    return buf; 
+}
+
+uint64_t http_time_ms(void)
+{
+    struct timespec ts; 
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts); 
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000; 
+}
+
+uint64_t http_time_ns(void)
+{
+    struct timespec ts; 
+    clock_gettime(CLOCK_MONOTONIC, &ts); 
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec; 
+}
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ull
+#define FNV_PRIME        0x100000001b3ull
+
+uint64_t http_hash_bytes(const void* data, size_t len)
+{
+    const unsigned char* p = data; 
+    uint64_t hash = FNV_OFFSET_BASIS; 
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= p[i]; 
+        hash *= FNV_PRIME; 
+    }
+    return hash; 
+}
+
+#define HTTP_DATE_FORMAT "%a, %d %b %Y %H:%M:%S GMT"
+
+void http_format_date(time_t t, char buf[HTTP_DATE_SIZE])
+{
+    struct tm tm; 
+    gmtime_r(&t, &tm); 
+    strftime(buf, HTTP_DATE_SIZE, HTTP_DATE_FORMAT, &tm); 
+}
+
+int http_parse_date(const char* str, time_t* out)
+{
+    struct tm tm; 
+    memset(&tm, 0, sizeof tm); 
+    const char* end = strptime(str, HTTP_DATE_FORMAT, &tm); 
+    if (!end || *end != '\0')
+        return -1; 
+
+    *out = timegm(&tm); 
+    return 0; 
+}
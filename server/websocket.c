@@ -0,0 +1,745 @@
+#include <assert.h> 
+#include <errno.h> 
+#include <stdio.h> 
+#include <stdlib.h> 
+#include <string.h> 
+#include <strings.h> 
+#ifdef __SSE2__
+#include <emmintrin.h> 
+#endif
+
+#include <loom/websocket.h> 
+#include <loom/connection.h> 
+#include <loom/arena.h> 
+
+#define WS_GUID             "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_KEY_LEN          24 /* base64 of 16 bytes */ 
+#define WS_ACCEPT_LEN       28 /* base64 of a sha-1 */ 
+#define WS_MAX_CONTROL      125
+
+static int  header_has_token(Http_slice_t value, const char* token); 
+static void sha1(const uint8_t* data, size_t len, uint8_t digest[20]); 
+static void base64_encode(const uint8_t* data, size_t len, char* out); 
+static void ws_unmask(uint8_t* data, size_t len, const uint8_t mask[4], size_t offset); 
+static void ws_process(Http_connection_t* con, Http_ws_t* ws); 
+static void ws_control(Http_ws_t* ws, uint8_t opcode, const uint8_t* payload, size_t len); 
+static int  ws_queue(Http_ws_t* ws, uint8_t opcode, const void* data, size_t len); 
+static void ws_kick(Http_ws_t* ws); 
+static void ws_fail(Http_ws_t* ws, uint16_t code); 
+static void ws_closing(Http_ws_t* ws, uint16_t code); 
+static int  message_append(Http_ws_t* ws, const uint8_t* data, size_t len); 
+static void message_deliver(Http_ws_t* ws); 
+static int  text_check(Http_ws_t* ws, uint8_t opcode, const uint8_t* data, size_t len, int fin); 
+static int  utf8_check(uint32_t* state, const uint8_t* data, size_t len); 
+
+int http_ws_accept(Http_request_t* req, Http_response_t* resp, const Http_ws_handlers_t* handlers, void* data)
+{
+    assert(handlers != NULL && handlers->message != NULL); 
+    /* no websocket over http/2 (that needs extended CONNECT) */ 
+    if (req->method != HTTP_METHOD_GET || strcmp(req->version, "1.1") || !req->arena)
+        return -1; 
+    if (!header_has_token(http_request_header(req, "Upgrade"), "websocket") ||
+        !header_has_token(http_request_header(req, "Connection"), "upgrade") ||
+        !http_slice_eq_nocase(http_request_header(req, "Sec-WebSocket-Version"), "13"))
+        return -1; 
+    Http_slice_t key = http_request_header(req, "Sec-WebSocket-Key"); 
+    if (!key.ptr || key.len != WS_KEY_LEN)
+        return -1; 
+
+    uint8_t digest[20]; 
+    char concat[WS_KEY_LEN + sizeof WS_GUID]; 
+    memcpy(concat, key.ptr, WS_KEY_LEN); 
+    memcpy(concat + WS_KEY_LEN, WS_GUID, sizeof WS_GUID - 1); 
+    sha1((const uint8_t*)concat, WS_KEY_LEN + sizeof WS_GUID - 1, digest); 
+    char* accept = http_arena_alloc(req->arena, WS_ACCEPT_LEN + 1); 
+    if (!accept)
+        return -1; 
+    base64_encode(digest, sizeof digest, accept); 
+
+    if (http_response_add_header(resp, "Upgrade", HTTP_MEM_STATIC, "websocket", HTTP_MEM_STATIC) == -1 ||
+        http_response_add_header(resp, "Sec-WebSocket-Accept", HTTP_MEM_STATIC, accept, HTTP_MEM_ARENA) == -1)
+        return -1; 
+    resp->status_code = HTTP_SWITCHING_PROTOCOLS; 
+    resp->connection_close = 0; 
+    resp->websocket = handlers; 
+    resp->websocket_data = data; 
+    return 0; 
+}
+
+int http_ws_start(Http_connection_t* con, const Http_ws_handlers_t* handlers, void* data)
+{
+    assert(con != NULL && con->ws == NULL); 
+
+    Http_ws_t* ws = calloc(1, sizeof(Http_ws_t)); 
+    if (!ws)
+    {
+        perror("calloc"); 
+        return -1; 
+    }
+    ws->con = con; 
+    ws->handlers = handlers; 
+    ws->data = data; 
+    ws->close_code = HTTP_WS_CLOSE_ABNORMAL; 
+    con->ws = ws; 
+
+    /* from now on the timer is the ping clock */ 
+    if (http_timer_update(con->ctx->timer, con, HTTP_WS_PING_INTERVAL) == -1)
+        return -1; /* closed, the websocket goes with the connection */ 
+    if (handlers->open)
+        handlers->open(ws); 
+    return 0; 
+}
+
+void http_ws_free(Http_connection_t* con)
+{
+    Http_ws_t* ws = con->ws; 
+    if (!ws)
+        return; 
+    ws->close_sent = 1; /* sends from the close handler fail */ 
+    if (ws->handlers->close)
+        ws->handlers->close(ws, ws->close_code); 
+    free(ws->message); 
+    free(ws->out); 
+    free(ws); 
+    con->ws = NULL; 
+}
+
+void http_ws_read(Http_connection_t* con)
+{
+    Http_ws_t* ws = con->ws; 
+    assert(ws != NULL); 
+
+    ws_process(con, ws); /* frames that came with the handshake */ 
+    while (!ws->close_received)
+    {
+        /* a frame that doesn't fit is taken out as it comes, there is always room */ 
+        ssize_t n = http_connection_recv(con, con->buff + con->buff_len, HTTP_REQUEST_SIZE - con->buff_len); 
+        if (n == 0)
+            break; 
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("read"); 
+            break; 
+        }
+        con->buff_len += n; 
+        ws_process(con, ws); 
+    }
+}
+
+void http_ws_write(Http_connection_t* con)
+{
+    Http_ws_t* ws = con->ws; 
+    assert(ws != NULL); 
+
+    while (ws->out_sent < ws->out_len)
+    {
+        ssize_t n = http_connection_send(con, ws->out + ws->out_sent, ws->out_len - ws->out_sent); 
+        if (n == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return; 
+            perror("write"); 
+            HTTP_SET_SHOULD_CLOSE(con->flags); 
+            HTTP_CLEAR_WRITING(con->flags); 
+            return; 
+        }
+        ws->out_sent += n; 
+        con->bytes_sent += n; 
+    }
+    /* idle websockets don't keep an output buffer */ 
+    free(ws->out); 
+    ws->out = NULL; 
+    ws->out_len = 0; 
+    ws->out_sent = 0; 
+    ws->out_cap = 0; 
+
+    HTTP_CLEAR_WRITING(con->flags); 
+    /* both sides said goodbye */ 
+    if (ws->close_sent && ws->close_received)
+        HTTP_SET_SHOULD_CLOSE(con->flags); 
+}
+
+int http_ws_timeout(Http_connection_t* con)
+{
+    Http_ws_t* ws = con->ws; 
+    /* the client had a whole interval to read the close frame */ 
+    if (ws->close_sent)
+        return -1; 
+    if (ws->seen)
+        ws->seen = 0; 
+    else if (ws->ping_pending)
+        return -1; /* not even a pong */ 
+    else
+    {
+        if (ws_queue(ws, HTTP_WS_PING, NULL, 0) == -1)
+            return -1; 
+        ws->ping_pending = 1; 
+        HTTP_SET_WRITING(con->flags); 
+    }
+    return http_timer_add_timeout(con->ctx->timer, con, HTTP_WS_PING_INTERVAL); 
+}
+
+int http_ws_send(Http_ws_t* ws, Http_ws_opcode_t opcode, const void* data, size_t len)
+{
+    if (ws->close_sent || (opcode != HTTP_WS_TEXT && opcode != HTTP_WS_BINARY))
+        return -1; 
+    if (ws_queue(ws, opcode, data, len) == -1)
+        return -1; 
+    ws_kick(ws); 
+    return 0; 
+}
+
+int http_ws_close(Http_ws_t* ws, uint16_t code, const char* reason)
+{
+    if (ws->close_sent)
+        return -1; 
+    uint8_t payload[WS_MAX_CONTROL]; 
+    size_t reason_len = reason ? strlen(reason) : 0; 
+    if (reason_len > sizeof payload - 2)
+        reason_len = sizeof payload - 2; 
+    payload[0] = code >> 8; 
+    payload[1] = code & 0xff; 
+    if (reason_len)
+        memcpy(payload + 2, reason, reason_len); 
+
+    ws_closing(ws, code); 
+    ws_queue(ws, HTTP_WS_CLOSE, payload, 2 + reason_len); /* closed anyway if it doesn't fit */ 
+    ws_kick(ws); 
+    return 0; 
+}
+
+/* unmask and hand out what's in the connection buffer, what's left of a frame stays for the next read */ 
+static void ws_process(Http_connection_t* con, Http_ws_t* ws)
+{
+    uint8_t* buff = (uint8_t*)con->buff; 
+    size_t pos = 0; 
+    if (con->buff_len > 0)
+    {
+        ws->seen = 1; 
+        ws->ping_pending = 0; 
+    }
+
+    while (!ws->close_received && pos < con->buff_len)
+    {
+        uint8_t* p = buff + pos; 
+        size_t avail = con->buff_len - pos; 
+
+        /* the rest of a frame too big for the buffer, unmasked into the message */ 
+        if (ws->frame_left)
+        {
+            size_t n = avail < ws->frame_left ? avail : ws->frame_left; 
+            ws_unmask(p, n, ws->mask, ws->mask_pos); 
+            if (text_check(ws, ws->message_opcode, p, n, ws->frame_fin && n == ws->frame_left) == -1 ||
+                message_append(ws, p, n) == -1)
+                break; 
+            ws->mask_pos = (ws->mask_pos + n) & 3; 
+            ws->frame_left -= n; 
+            pos += n; 
+            if (!ws->frame_left && ws->frame_fin)
+                message_deliver(ws); 
+            continue; 
+        }
+
+        if (avail < 2)
+            break; 
+        int fin = p[0] & 0x80; 
+        uint8_t opcode = p[0] & 0x0f; 
+        uint64_t len = p[1] & 0x7f; 
+        size_t header_len = 2; 
+        if (len == 126)
+        {
+            if (avail < 4)
+                break; 
+            len = (uint64_t)p[2] << 8 | p[3]; 
+            header_len = 4; 
+        }
+        else if (len == 127)
+        {
+            if (avail < 10)
+                break; 
+            len = 0; 
+            for (int i = 0; i < 8; i++)
+                len = len << 8 | p[2 + i]; 
+            header_len = 10; 
+        }
+
+        /* no extension is negotiated so no rsv bit, and clients always mask */ 
+        int control = opcode & 0x8; 
+        int valid = !(p[0] & 0x70) && (p[1] & 0x80); 
+        if (control)
+            valid = valid && fin && len <= WS_MAX_CONTROL &&
+                (opcode == HTTP_WS_CLOSE || opcode == HTTP_WS_PING || opcode == HTTP_WS_PONG); 
+        else if (opcode == HTTP_WS_CONTINUATION)
+            valid = valid && ws->message_opcode; 
+        else
+            valid = valid && !ws->message_opcode && (opcode == HTTP_WS_TEXT || opcode == HTTP_WS_BINARY); 
+        if (!valid)
+        {
+            ws_fail(ws, HTTP_WS_CLOSE_PROTOCOL); 
+            break; 
+        }
+        if (!control && len > HTTP_WS_MAX_MESSAGE - ws->message_len)
+        {
+            ws_fail(ws, HTTP_WS_CLOSE_TOO_BIG); 
+            break; 
+        }
+        if (avail < header_len + 4)
+            break; 
+        const uint8_t* mask = p + header_len; 
+        header_len += 4; 
+
+        if (header_len + len > avail)
+        {
+            /* it fits once the buffer is compacted, wait for the rest */ 
+            if (control || header_len + len <= HTTP_REQUEST_SIZE)
+                break; 
+            memcpy(ws->mask, mask, 4); 
+            ws->mask_pos = 0; 
+            ws->frame_left = len; 
+            ws->frame_fin = fin != 0; 
+            if (opcode)
+                ws->message_opcode = opcode; 
+            pos += header_len; 
+            continue; 
+        }
+
+        uint8_t* payload = p + header_len; 
+        ws_unmask(payload, len, mask, 0); 
+        pos += header_len + len; 
+        if (control)
+            ws_control(ws, opcode, payload, len); 
+        else if (fin && opcode)
+        {
+            if (text_check(ws, opcode, payload, len, 1) == -1)
+                break; 
+            if (!ws->close_sent)
+                ws->handlers->message(ws, opcode, (const char*)payload, len); /* straight from the buffer */ 
+        }
+        else
+        {
+            if (opcode)
+                ws->message_opcode = opcode; 
+            if (text_check(ws, ws->message_opcode, payload, len, fin) == -1 ||
+                message_append(ws, payload, len) == -1)
+                break; 
+            if (fin)
+                message_deliver(ws); 
+        }
+    }
+
+    if (ws->close_received)
+        pos = con->buff_len; /* nothing else is read */ 
+    if (pos < con->buff_len)
+        memmove(buff, buff + pos, con->buff_len - pos); 
+    con->buff_len -= pos; 
+}
+
+static void ws_control(Http_ws_t* ws, uint8_t opcode, const uint8_t* payload, size_t len)
+{
+    switch (opcode)
+    {
+        case HTTP_WS_PING: 
+            if (ws_queue(ws, HTTP_WS_PONG, payload, len) == 0)
+                ws_kick(ws); 
+            break; 
+        case HTTP_WS_CLOSE: 
+            if (len == 1)
+            {
+                ws_fail(ws, HTTP_WS_CLOSE_PROTOCOL); 
+                break; 
+            }
+            /* the reason is text too, checked on its own since a message may be half way */ 
+            uint32_t state = 0; 
+            if (len > 2 && (utf8_check(&state, payload + 2, len - 2) == -1 || state))
+            {
+                ws_fail(ws, HTTP_WS_CLOSE_INVALID_DATA); 
+                break; 
+            }
+            ws->close_received = 1; 
+            /* ours was answered, or the status is echoed. the connection closes once it's out */ 
+            if (!ws->close_sent)
+            {
+                ws_closing(ws, len >= 2 ? (uint16_t)(payload[0] << 8 | payload[1]) : HTTP_WS_CLOSE_NO_STATUS); 
+                ws_queue(ws, HTTP_WS_CLOSE, payload, len >= 2 ? 2 : 0); 
+            }
+            ws_kick(ws); 
+            break; 
+        case HTTP_WS_PONG: 
+        default: 
+            break; /* ping_pending is cleared by any frame */ 
+    }
+}
+
+/* returns -1 if too much is queued */ 
+static int ws_queue(Http_ws_t* ws, uint8_t opcode, const void* data, size_t len)
+{
+    Http_connection_t* con = ws->con; 
+    uint8_t header[10]; 
+    size_t header_len = 2; 
+    header[0] = 0x80 | opcode; 
+    if (len < 126)
+        header[1] = len; 
+    else if (len <= 0xffff)
+    {
+        header[1] = 126; 
+        header[2] = len >> 8; 
+        header[3] = len & 0xff; 
+        header_len = 4; 
+    }
+    else
+    {
+        header[1] = 127; 
+        for (int i = 0; i < 8; i++)
+            header[2 + i] = (uint64_t)len >> (56 - 8 * i); 
+        header_len = 10; 
+    }
+
+    /* the response buffer is free most of the time, it's only skipped to keep the order */ 
+    if (ws->out_len == 0 && header_len + len <= HTTP_RESPONSE_SIZE - con->response_len)
+    {
+        memcpy(con->response + con->response_len, header, header_len); 
+        if (len)
+            memcpy(con->response + con->response_len + header_len, data, len); 
+        con->response_len += header_len + len; 
+        return 0; 
+    }
+
+    if (header_len + len > HTTP_WS_MAX_OUTPUT - ws->out_len)
+        return -1; 
+    if (ws->out_len + header_len + len > ws->out_cap)
+    {
+        size_t cap = ws->out_cap ? ws->out_cap : HTTP_RESPONSE_SIZE; 
+        while (cap < ws->out_len + header_len + len)
+            cap *= 2; 
+        char* out = realloc(ws->out, cap); 
+        if (!out)
+        {
+            perror("realloc"); 
+            return -1; 
+        }
+        ws->out = out; 
+        ws->out_cap = cap; 
+    }
+    memcpy(ws->out + ws->out_len, header, header_len); 
+    if (len)
+        memcpy(ws->out + ws->out_len + header_len, data, len); 
+    ws->out_len += header_len + len; 
+    return 0; 
+}
+
+/* frames were queued, possibly from outside the connection's event */ 
+static void ws_kick(Http_ws_t* ws)
+{
+    Http_connection_t* con = ws->con; 
+    /* an empty write still goes through the handler that closes it */ 
+    HTTP_SET_WRITING(con->flags); 
+    http_connection_update_events(con->ctx->epoll_fd, con->item); 
+}
+
+/* the client broke the protocol, closed as soon as the close frame is out */ 
+static void ws_fail(Http_ws_t* ws, uint16_t code)
+{
+    ws->close_received = 1; 
+    if (http_ws_close(ws, code, NULL) == -1)
+        ws_kick(ws); 
+}
+
+/* the client gets a full interval to answer the close frame */ 
+static void ws_closing(Http_ws_t* ws, uint16_t code)
+{
+    Http_connection_t* con = ws->con; 
+    ws->close_sent = 1; 
+    ws->close_code = code; 
+    if (con->timeout_index != -1)
+        http_timer_update(con->ctx->timer, con, HTTP_WS_PING_INTERVAL); 
+}
+
+/* returns -1 if the websocket was failed */ 
+static int message_append(Http_ws_t* ws, const uint8_t* data, size_t len)
+{
+    if (ws->close_sent)
+        return 0; /* dropped */ 
+    if (ws->message_len + len > ws->message_cap)
+    {
+        size_t cap = ws->message_cap ? ws->message_cap : HTTP_REQUEST_SIZE; 
+        while (cap < ws->message_len + len)
+            cap *= 2; 
+        char* message = realloc(ws->message, cap); 
+        if (!message)
+        {
+            perror("realloc"); 
+            ws_fail(ws, HTTP_WS_CLOSE_TOO_BIG); 
+            return -1; 
+        }
+        ws->message = message; 
+        ws->message_cap = cap; 
+    }
+    memcpy(ws->message + ws->message_len, data, len); 
+    ws->message_len += len; 
+    return 0; 
+}
+
+static void message_deliver(Http_ws_t* ws)
+{
+    char* message = ws->message; 
+    size_t len = ws->message_len; 
+    Http_ws_opcode_t opcode = ws->message_opcode; 
+    /* released before the handler, it may close the websocket */ 
+    ws->message = NULL; 
+    ws->message_len = 0; 
+    ws->message_cap = 0; 
+    ws->message_opcode = 0; 
+    if (!ws->close_sent)
+        ws->handlers->message(ws, opcode, message, len); 
+    free(message); 
+}
+
+/* text is checked as it comes in, a sequence can be split between frames and it has to
+ * be complete at the end of the message. returns -1 if the websocket was failed */ 
+static int text_check(Http_ws_t* ws, uint8_t opcode, const uint8_t* data, size_t len, int fin)
+{
+    if (opcode != HTTP_WS_TEXT)
+        return 0; 
+    if (utf8_check(&ws->utf8_state, data, len) == -1 || (fin && ws->utf8_state))
+    {
+        ws->utf8_state = 0; 
+        ws_fail(ws, HTTP_WS_CLOSE_INVALID_DATA); 
+        return -1; 
+    }
+    return 0; 
+}
+
+/* state is the number of bytes the unfinished sequence still needs, with the range the next
+ * one must be in above it (overlong forms, surrogates and past U+10FFFF are rejected there).
+ * returns -1 on a byte that can't be utf-8 */ 
+static int utf8_check(uint32_t* state, const uint8_t* data, size_t len)
+{
+    uint32_t need = *state & 0xff; 
+    uint32_t lo = *state >> 8 & 0xff; 
+    uint32_t hi = *state >> 16; 
+    size_t i = 0; 
+    while (i < len)
+    {
+        uint8_t c = data[i]; 
+        if (need)
+        {
+            if (c < lo || c > hi)
+                return -1; 
+            need--; 
+            lo = 0x80; 
+            hi = 0xbf; 
+            i++; 
+            continue; 
+        }
+        if (c < 0x80)
+        {
+#ifdef __SSE2__
+            /* mostly ascii, skipped 16 bytes at a time */ 
+            while (i + 16 <= len && !_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(data + i))))
+                i += 16; 
+            if (i < len && data[i] < 0x80)
+                i++; 
+#else
+            i++; 
+#endif
+            continue; 
+        }
+
+        lo = 0x80; 
+        hi = 0xbf; 
+        if (c >= 0xc2 && c <= 0xdf)
+            need = 1; 
+        else if (c >= 0xe0 && c <= 0xef)
+        {
+            need = 2; 
+            if (c == 0xe0)
+                lo = 0xa0; 
+            else if (c == 0xed)
+                hi = 0x9f; 
+        }
+        else if (c >= 0xf0 && c <= 0xf4)
+        {
+            need = 3; 
+            if (c == 0xf0)
+                lo = 0x90; 
+            else if (c == 0xf4)
+                hi = 0x8f; 
+        }
+        else
+            return -1; 
+        i++; 
+    }
+    *state = need ? need | lo << 8 | hi << 16 : 0; 
+    return 0; 
+}
+
+/* xor with the key, offset is the position in the key of data[0]. every block starts at
+ * a multiple of 4 so one widened key does for all of them */ 
+static void ws_unmask(uint8_t* data, size_t len, const uint8_t mask[4], size_t offset)
+{
+    uint8_t key[4]; 
+    for (int i = 0; i < 4; i++)
+        key[i] = mask[(offset + i) & 3]; 
+    uint32_t key32; 
+    memcpy(&key32, key, 4); 
+    size_t i = 0; 
+
+#ifdef __SSE2__
+    __m128i key128 = _mm_set1_epi32((int)key32); 
+    for (; i + 64 <= len; i += 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(data + i)); 
+        __m128i b = _mm_loadu_si128((const __m128i*)(data + i + 16)); 
+        __m128i c = _mm_loadu_si128((const __m128i*)(data + i + 32)); 
+        __m128i d = _mm_loadu_si128((const __m128i*)(data + i + 48)); 
+        _mm_storeu_si128((__m128i*)(data + i), _mm_xor_si128(a, key128)); 
+        _mm_storeu_si128((__m128i*)(data + i + 16), _mm_xor_si128(b, key128)); 
+        _mm_storeu_si128((__m128i*)(data + i + 32), _mm_xor_si128(c, key128)); 
+        _mm_storeu_si128((__m128i*)(data + i + 48), _mm_xor_si128(d, key128)); 
+    }
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i)); 
+        _mm_storeu_si128((__m128i*)(data + i), _mm_xor_si128(v, key128)); 
+    }
+#endif
+
+    uint64_t key64 = (uint64_t)key32 << 32 | key32; 
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t v; 
+        memcpy(&v, data + i, 8); 
+        v ^= key64; 
+        memcpy(data + i, &v, 8); 
+    }
+    for (; i < len; i++)
+        data[i] ^= key[i & 3]; 
+}
+
+/* the token is one of the comma separated values */ 
+static int header_has_token(Http_slice_t value, const char* token)
+{
+    size_t token_len = strlen(token); 
+    size_t i = 0; 
+    while (value.ptr && i < value.len)
+    {
+        while (i < value.len && (value.ptr[i] == ' ' || value.ptr[i] == '\t' || value.ptr[i] == ','))
+            i++; 
+        size_t start = i; 
+        while (i < value.len && value.ptr[i] != ',')
+            i++; 
+        size_t end = i; 
+        while (end > start && (value.ptr[end - 1] == ' ' || value.ptr[end - 1] == '\t'))
+            end--; 
+        if (end - start == token_len && !strncasecmp(value.ptr + start, token, token_len))
+            return 1; 
+    }
+    return 0; 
+}
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/* only for the handshake, the key is always 60 bytes */ 
+static void sha1(const uint8_t* data, size_t len, uint8_t digest[20])
+{
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 }; 
+    uint8_t block[64]; 
+    uint64_t bits = (uint64_t)len * 8; 
+    size_t blocks = (len + 8) / 64 + 1; 
+
+    for (size_t b = 0; b < blocks; b++)
+    {
+        /* the message, the 0x80 after it and the length in the last 8 bytes */ 
+        for (size_t i = 0; i < 64; i++)
+        {
+            size_t at = b * 64 + i; 
+            if (at < len)
+                block[i] = data[at]; 
+            else if (at == len)
+                block[i] = 0x80; 
+            else
+                block[i] = 0; 
+        }
+        if (b == blocks - 1)
+        {
+            for (int i = 0; i < 8; i++)
+                block[56 + i] = bits >> (56 - 8 * i); 
+        }
+
+        uint32_t w[80]; 
+        for (int i = 0; i < 16; i++)
+            w[i] = (uint32_t)block[4 * i] << 24 | block[4 * i + 1] << 16 | block[4 * i + 2] << 8 | block[4 * i + 3]; 
+        for (int i = 16; i < 80; i++)
+            w[i] = ROL(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1); 
+
+        uint32_t a = h[0], bb = h[1], c = h[2], d = h[3], e = h[4]; 
+        for (int i = 0; i < 80; i++)
+        {
+            uint32_t f, k; 
+            if (i < 20)
+            {
+                f = (bb & c) | (~bb & d); 
+                k = 0x5A827999; 
+            }
+            else if (i < 40)
+            {
+                f = bb ^ c ^ d; 
+                k = 0x6ED9EBA1; 
+            }
+            else if (i < 60)
+            {
+                f = (bb & c) | (bb & d) | (c & d); 
+                k = 0x8F1BBCDC; 
+            }
+            else
+            {
+                f = bb ^ c ^ d; 
+                k = 0xCA62C1D6; 
+            }
+            uint32_t t = ROL(a, 5) + f + e + k + w[i]; 
+            e = d; 
+            d = c; 
+            c = ROL(bb, 30); 
+            bb = a; 
+            a = t; 
+        }
+        h[0] += a; 
+        h[1] += bb; 
+        h[2] += c; 
+        h[3] += d; 
+        h[4] += e; 
+    }
+
+    for (int i = 0; i < 5; i++)
+    {
+        digest[4 * i] = h[i] >> 24; 
+        digest[4 * i + 1] = h[i] >> 16; 
+        digest[4 * i + 2] = h[i] >> 8; 
+        digest[4 * i + 3] = h[i]; 
+    }
+}
+
+/* out gets 4 * ((len + 2) / 3) characters and a nul */ 
+static void base64_encode(const uint8_t* data, size_t len, char* out)
+{
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"; 
+    size_t i; 
+    for (i = 0; i + 2 < len; i += 3)
+    {
+        uint32_t v = (uint32_t)data[i] << 16 | data[i + 1] << 8 | data[i + 2]; 
+        *out++ = table[v >> 18]; 
+        *out++ = table[(v >> 12) & 63]; 
+        *out++ = table[(v >> 6) & 63]; 
+        *out++ = table[v & 63]; 
+    }
+    if (i < len)
+    {
+        uint32_t v = (uint32_t)data[i] << 16 | (i + 1 < len ? data[i + 1] << 8 : 0); 
+        *out++ = table[v >> 18]; 
+        *out++ = table[(v >> 12) & 63]; 
+        *out++ = i + 1 < len ? table[(v >> 6) & 63] : '='; 
+        *out++ = '='; 
+    }
+    *out = '\0'; 
+}
@@ -0,0 +1,327 @@
+#define _GNU_SOURCE /* sched_setaffinity */ 
+#include <errno.h> 
+#include <sched.h> 
+#include <signal.h> 
+#include <stdint.h> 
+#include <stdio.h> 
+#include <stdlib.h> 
+#include <string.h> 
+#include <unistd.h> 
+#include <linux/mempolicy.h> 
+#include <sys/epoll.h> 
+#include <sys/eventfd.h> 
+#include <sys/syscall.h> 
+#include <sys/wait.h> 
+
+#include <loom/workers.h> 
+#include <loom/epoll_utils.h> 
+
+#define SUPERVISOR_SHUTDOWN HTTP_MAX_WORKERS /* epoll data of the supervisor's own shutdown event, workers are their index */ 
+
+static int  cpus_auto(int* cpus, int max); 
+static int  worker_setup(Http_server_context_t* ctx, int i, const int* listeners, const int* tls_listeners, int cpu); 
+static void worker_reap(Http_workers_t* workers, int i, int stopping); 
+static void workers_stop(Http_workers_t* workers); 
+static void workers_wait(Http_workers_t* workers); 
+
+int http_workers_cpus(const char* list, int* cpus, int max)
+{
+    if (!strcmp(list, "auto"))
+        return cpus_auto(cpus, max); 
+
+    int count = 0; 
+    const char* p = list; 
+    while (*p)
+    {
+        char* end; 
+        long first = strtol(p, &end, 10); 
+        long last = first; 
+        if (end == p || first < 0 || first >= CPU_SETSIZE)
+            return -1; 
+        if (*end == '-')
+        {
+            p = end + 1; 
+            last = strtol(p, &end, 10); 
+            if (end == p || last < first || last >= CPU_SETSIZE)
+                return -1; 
+        }
+        for (long cpu = first; cpu <= last && count < max; cpu++)
+            cpus[count++] = cpu; 
+
+        if (*end == ',')
+            end++; 
+        else if (*end)
+            return -1; 
+        p = end; 
+    }
+    return count ? count : -1; 
+}
+
+static int cpus_auto(int* cpus, int max)
+{
+    cpu_set_t set; 
+    if (sched_getaffinity(0, sizeof set, &set) == -1)
+    {
+        perror("sched_getaffinity"); 
+        return -1; 
+    }
+    int count = 0; 
+    for (int cpu = 0; cpu < CPU_SETSIZE && count < max; cpu++)
+    {
+        if (CPU_ISSET(cpu, &set))
+            cpus[count++] = cpu; 
+    }
+    return count ? count : -1; 
+}
+
+int http_workers_pin(int cpu, int numa)
+{
+    if (cpu != -1)
+    {
+        cpu_set_t set; 
+        CPU_ZERO(&set); 
+        CPU_SET(cpu, &set); 
+        if (sched_setaffinity(0, sizeof set, &set) == -1)
+        {
+            perror("sched_setaffinity"); 
+            return -1; 
+        }
+    }
+    /* pages go to a node when first touched, the loop's pools are all touched by the loop.
+     * this undoes an inherited policy (numactl --interleave), ENOSYS is a kernel with one node */ 
+    if (numa && syscall(SYS_set_mempolicy, MPOL_LOCAL, NULL, 0) == -1 && errno != ENOSYS)
+    {
+        perror("set_mempolicy"); 
+        return -1; 
+    }
+    return 0; 
+}
+
+int http_workers_start(Http_server_context_t* ctx, const int* listeners, const int* tls_listeners, const int* cpus)
+{
+    int count = ctx->cfg->workers; 
+    Http_workers_t* workers = calloc(1, sizeof(Http_workers_t)); 
+    if (!workers)
+    {
+        perror("calloc"); 
+        return -1; 
+    }
+    workers->count = count; 
+    for (int i = 0; i < count; i++)
+    {
+        workers->worker[i].pidfd = -1; 
+        workers->worker[i].shutdown_fd = -1; 
+    }
+    ctx->workers = workers; 
+
+    /* the supervisor waits for its shutdown event and for its workers to exit */ 
+    ctx->epoll_fd = http_epoll_create_instance(); 
+    ctx->shutdown_fd = eventfd(0, EFD_NONBLOCK); 
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = SUPERVISOR_SHUTDOWN }; 
+    int ret = -1; 
+    if (ctx->epoll_fd == -1 || ctx->shutdown_fd == -1 ||
+        epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, ctx->shutdown_fd, &ev) == -1)
+    {
+        fprintf(stderr, "Error: failed setting up the supervisor\n"); 
+        count = 0; 
+    }
+
+    /* or every worker prints what's buffered */ 
+    fflush(stdout); 
+    fflush(stderr); 
+    int i; 
+    for (i = 0; i < count; i++)
+    {
+        Http_worker_t* worker = &workers->worker[i]; 
+        worker->shutdown_fd = eventfd(0, EFD_NONBLOCK); 
+        if (worker->shutdown_fd == -1)
+        {
+            perror("eventfd"); 
+            break; 
+        }
+        worker->pid = fork(); 
+        if (worker->pid == -1)
+        {
+            perror("fork"); 
+            break; 
+        }
+        if (worker->pid == 0)
+            return worker_setup(ctx, i, listeners, tls_listeners, cpus[i]); 
+
+        workers->running++; 
+        worker->pidfd = syscall(SYS_pidfd_open, worker->pid, 0); 
+        ev.data.u32 = i; 
+        if (worker->pidfd == -1 || epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, worker->pidfd, &ev) == -1)
+        {
+            perror("pidfd_open"); 
+            kill(worker->pid, SIGKILL); 
+            waitpid(worker->pid, NULL, 0); 
+            if (worker->pidfd != -1)
+                close(worker->pidfd); 
+            worker->pidfd = -1; 
+            workers->running--; 
+            break; 
+        }
+    }
+    if (count && i == count)
+        ret = 0; 
+
+    /* the workers have their copies */ 
+    for (int j = 0; j < ctx->cfg->workers; j++)
+    {
+        close(listeners[j]); 
+        if (tls_listeners[j] != -1)
+            close(tls_listeners[j]); 
+    }
+    if (ret == -1)
+    {
+        workers_stop(workers); 
+        workers_wait(workers); 
+    }
+    return ret; 
+}
+
+static int worker_setup(Http_server_context_t* ctx, int i, const int* listeners, const int* tls_listeners, int cpu)
+{
+    Http_workers_t* workers = ctx->workers; 
+    int shutdown_fd = workers->worker[i].shutdown_fd; 
+
+    /* what belongs to the supervisor and the other workers */ 
+    close(ctx->epoll_fd); 
+    close(ctx->shutdown_fd); 
+    for (int j = 0; j < workers->count; j++)
+    {
+        if (j == i)
+            continue; 
+        close(listeners[j]); 
+        if (tls_listeners[j] != -1)
+            close(tls_listeners[j]); 
+        if (workers->worker[j].shutdown_fd != -1)
+            close(workers->worker[j].shutdown_fd); 
+        if (workers->worker[j].pidfd != -1)
+            close(workers->worker[j].pidfd); 
+    }
+    free(workers); 
+
+    ctx->workers = NULL; 
+    ctx->worker = i; 
+    ctx->epoll_fd = -1; 
+    ctx->shutdown_fd = shutdown_fd; 
+    ctx->listen_fd = listeners[i]; 
+    ctx->tls_listen_fd = tls_listeners[i]; 
+
+    /* rotating a shared file would move it under the other workers */ 
+    size_t len = strlen(ctx->cfg->access_log); 
+    if (len)
+        snprintf(ctx->cfg->access_log + len, HTTP_MAX_PATH_LEN - len, ".%d", i); 
+
+    /* before the loop allocates anything */ 
+    if (http_workers_pin(cpu, ctx->cfg->numa) == -1)
+        return -1; 
+    unsigned int on_cpu, node; 
+    if (cpu != -1 && syscall(SYS_getcpu, &on_cpu, &node, NULL) == 0)
+        printf("worker %d (pid %d) pinned to cpu %u, node %u\n", i, getpid(), on_cpu, node); 
+    return 0; 
+}
+
+void http_workers_run(Http_server_context_t* ctx)
+{
+    Http_workers_t* workers = ctx->workers; 
+    struct epoll_event events[HTTP_MAX_WORKERS + 1]; 
+    int stopping = 0; 
+
+    while (workers->running)
+    {
+        int n = epoll_wait(ctx->epoll_fd, events, HTTP_MAX_WORKERS + 1, -1); 
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue; 
+            perror("epoll_wait"); 
+            break; 
+        }
+        for (int i = 0; i < n; i++)
+        {
+            uint32_t id = events[i].data.u32; 
+            if (id == SUPERVISOR_SHUTDOWN)
+            {
+                uint64_t u; 
+                read(ctx->shutdown_fd, &u, sizeof u); 
+                /* a second trigger stops them right away, like a single loop */ 
+                stopping = 1; 
+                workers_stop(workers); 
+            }
+            else
+                worker_reap(workers, id, stopping); 
+        }
+    }
+
+    /* the supervisor failed, nobody is left behind */ 
+    if (workers->running)
+    {
+        workers_stop(workers); 
+        workers_wait(workers); 
+    }
+}
+
+static void worker_reap(Http_workers_t* workers, int i, int stopping)
+{
+    Http_worker_t* worker = &workers->worker[i]; 
+    int status; 
+    if (waitpid(worker->pid, &status, WNOHANG) <= 0)
+        return; 
+
+    /* its listener is gone with it, the kernel hands its connections to the other workers */ 
+    if (WIFSIGNALED(status))
+        fprintf(stderr, "Error: worker %d (pid %d) killed by signal %d\n", i, worker->pid, WTERMSIG(status)); 
+    else if (!stopping || WEXITSTATUS(status))
+        fprintf(stderr, "Error: worker %d (pid %d) exited with %d\n", i, worker->pid, WEXITSTATUS(status)); 
+    close(worker->pidfd); 
+    worker->pidfd = -1; 
+    workers->running--; 
+}
+
+static void workers_stop(Http_workers_t* workers)
+{
+    uint64_t u = 1; 
+    for (int i = 0; i < workers->count; i++)
+    {
+        if (workers->worker[i].pidfd != -1)
+            write(workers->worker[i].shutdown_fd, &u, sizeof u); 
+    }
+}
+
+static void workers_wait(Http_workers_t* workers)
+{
+    for (int i = 0; i < workers->count; i++)
+    {
+        Http_worker_t* worker = &workers->worker[i]; 
+        if (worker->pidfd == -1)
+            continue; 
+        waitpid(worker->pid, NULL, 0); 
+        close(worker->pidfd); 
+        worker->pidfd = -1; 
+        workers->running--; 
+    }
+}
+
+void http_workers_clean(Http_server_context_t* ctx)
+{
+    Http_workers_t* workers = ctx->workers; 
+    if (workers->running)
+    {
+        workers_stop(workers); 
+        workers_wait(workers); 
+    }
+    for (int i = 0; i < workers->count; i++)
+    {
+        if (workers->worker[i].shutdown_fd != -1)
+            close(workers->worker[i].shutdown_fd); 
+    }
+    if (ctx->epoll_fd != -1)
+        close(ctx->epoll_fd); 
+    if (ctx->shutdown_fd != -1)
+        close(ctx->shutdown_fd); 
+    free(workers); 
+    ctx->workers = NULL; 
+}
@@ -0,0 +1,7 @@
+#!/bin/bash
+# self signed certificate for testing the https listener
+set -e
+
+openssl req -x509 -newkey rsa:2048 -nodes -days 365 \
+    -subj "/CN=localhost" \
+    -keyout key.pem -out cert.pem
@@ -4,7 +4,7 @@ set -e
 HOST=${1:-127.0.0.1}
 PORT=${2:-6969}
 
-gcc test.c -O2 -lloom -o server
+gcc test.c -O2 -lloom -lz -o server # add -lssl -lcrypto for a TLS=1 build
 ./server -H $HOST -p $PORT &
 SERVER_PID=$!
 
@@ -18,4 +18,5 @@ trap cleanup EXIT
 
 sleep 2 # waiting the server to start
 
+python3 test_h2.py $HOST $PORT
 ./load_test.sh $HOST $PORT
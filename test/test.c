@@ -3,6 +3,7 @@
 #include <strings.h> 
 #include <stdlib.h> 
 #include <signal.h> 
+#include <pthread.h> 
 
 #include <loom/server.h>
 
@@ -10,13 +11,30 @@ void print_help(char* program_name);
 void parse_arguments(int argc, char* argv[], Http_config_t* config); 
 void sigint_handler(int sig); 
 Http_handler_result_t handler(Http_request_t* req, Http_response_t* resp); 
+Http_handler_result_t ws_handler(Http_request_t* req, Http_response_t* resp); 
+Http_handler_result_t events_handler(Http_request_t* req, Http_response_t* resp); 
+Http_handler_result_t publish_handler(Http_request_t* req, Http_response_t* resp); 
+int routes_register(Http_router_t* router); 
+void* reload_thread(void* arg); 
 
 /* this will allow me to use the server context in the sigint handler */ 
 Http_server_context_t* server_context_ptr = NULL; 
+/* backends given with --upstream, requests under /api/ are proxied to them */ 
+Http_upstream_t* upstream = NULL; 
 
 int main(int argc, char* argv[])
 {
     signal(SIGINT, sigint_handler); /* will call http_trigger_shutdown() */ 
+    signal(SIGTERM, sigint_handler); 
+    /* SIGHUP is waited for by the reload thread, every thread inherits the mask */ 
+    sigset_t hup; 
+    sigemptyset(&hup); 
+    sigaddset(&hup, SIGHUP); 
+    pthread_sigmask(SIG_BLOCK, &hup, NULL); 
+
+    /* preparing the config */ 
+    Http_config_t config = HTTP_DEFAULT_CONFIG; 
+    parse_arguments(argc, argv, &config); 
 
     /* preparing routing */ 
     Http_router_t router; 
@@ -25,16 +43,12 @@ int main(int argc, char* argv[])
         fprintf(stderr, "Error : failed to init the server\n"); 
         return EXIT_FAILURE; 
     }
-    if (http_route_register(&router, HTTP_METHOD_GET, "/", handler) == -1)
+    if (routes_register(&router) == -1)
     {
-        fprintf(stderr, "Error : failed to register a route\n"); 
+        fprintf(stderr, "Error : failed to register the routes\n"); 
         return EXIT_FAILURE; 
     }
-
-    /* preparing the config */ 
-    Http_config_t config = HTTP_DEFAULT_CONFIG; 
     config.router = &router; 
-    parse_arguments(argc, argv, &config); 
     /* server context */ 
     Http_server_context_t server_context; 
     server_context_ptr = &server_context; 
@@ -43,10 +57,14 @@ int main(int argc, char* argv[])
         fprintf(stderr, "Error : can't start ther server\n"); 
         return EXIT_FAILURE; 
     }
+    pthread_t reloader; 
+    if (pthread_create(&reloader, NULL, reload_thread, &hup) == 0)
+        pthread_detach(reloader); 
 
     http_server_run(&server_context); 
     http_server_clean(&server_context); 
     http_router_clean(&router); 
+    http_upstream_destroy(upstream); 
 
     return EXIT_SUCCESS; 
 }
@@ -59,6 +77,63 @@ void print_help(char* program_name)
     printf("  -H, --host    <host>    Set the server host (default: %s)\n", HTTP_DEFAULT_HOST);
     printf("  -p, --port    <port>    Set the server port (default: %d)\n", HTTP_DEFAULT_PORT);
     printf("  -b, --backlog <port>    Set the server backlog (default: %d)\n", HTTP_DEFAULT_BACKLOG);
+    printf("  -t, --tls-port <port>   Also listen for https on this port (needs make TLS=1)\n"); 
+    printf("  -c, --cert    <file>    Tls certificate chain (default: %s)\n", HTTP_DEFAULT_TLS_CERT); 
+    printf("  -k, --key     <file>    Tls private key (default: %s)\n", HTTP_DEFAULT_TLS_KEY); 
+    printf("  -u, --upstream <host:port> Proxy /api/ to this backend, can be repeated\n"); 
+    printf("  -m, --max-connections <n> Pause accepting above n clients (default: %d, 0 for no limit)\n", HTTP_DEFAULT_MAX_CONNECTIONS); 
+    printf("  -i, --max-inflight <n>  Answer 503 while n responses are pending (default: no limit)\n"); 
+    printf("  -l, --max-lag <ms>      Answer 503 while the event loop lags more than ms (default: disabled)\n"); 
+    printf("  -r, --rate-limit <n>    Answer 429 above n requests per second from an address (default: no limit)\n"); 
+    printf("  -a, --max-per-ip <n>    Close connections above n from an address (default: no limit)\n"); 
+    printf("  -d, --drain <s>         Seconds given to open connections on shutdown (default: %d)\n", HTTP_DEFAULT_DRAIN_TIMEOUT); 
+    printf("  -x, --handoff <path>    Take the listeners from the server on this unix socket and hand them to the next one\n"); 
+    printf("  -T, --tuning <preset>   Socket options: none, low-latency or bulk (default: none)\n"); 
+    printf("  -L, --access-log <file> Log every request to file, rotated above 64 MiB\n"); 
+    printf("  -S, --trace <n>         Print the phase timings of one request in n to stderr\n"); 
+    printf("  -K, --keepalive <s>     Seconds an idle connection is kept, less near --max-connections (default: %d)\n", HTTP_DEFAULT_KEEPALIVE_TIMEOUT); 
+    printf("  -R, --keepalive-requests <n> Close a connection after n requests (default: %d, 0 for no limit)\n", HTTP_DEFAULT_KEEPALIVE_REQUESTS); 
+    printf("  -w, --workers <n>       Run n event loops, each in its own process (default: %d)\n", HTTP_DEFAULT_WORKERS); 
+    printf("  -C, --cpus    <list>    Pin the loops to these cpus, auto or a list like 0-3,8\n"); 
+    printf("  -N, --numa              Allocate each loop's memory on the node of its cpu\n"); 
+    printf("  -s, --steer             Send a connection to the loop of the cpu that received it\n"); 
+    printf("  -B, --busy-poll <us>    Poll for events this long before sleeping (default: disabled)\n"); 
+    printf("  -P, --kernel-busy-poll <us> Poll the device queues instead of waiting for interrupts (needs CAP_NET_ADMIN)\n"); 
+}
+
+int routes_register(Http_router_t* router)
+{
+    if (http_route_register(router, HTTP_METHOD_GET, "/", handler) == -1)
+        return -1; 
+    if (http_route_register(router, HTTP_METHOD_GET, "/ws", ws_handler) == -1)
+        return -1; 
+    if (http_route_register(router, HTTP_METHOD_GET, "/events", events_handler) == -1)
+        return -1; 
+    if (http_route_register(router, HTTP_METHOD_POST, "/publish", publish_handler) == -1)
+        return -1; 
+    if (upstream && http_route_proxy(router, "/api/", upstream) == -1)
+        return -1; 
+    return 0; 
+}
+
+/* kill -HUP rebuilds the routes and swaps them in without stopping the server */ 
+void* reload_thread(void* arg)
+{
+    sigset_t* hup = arg; 
+    int sig; 
+    while (sigwait(hup, &sig) == 0)
+    {
+        Http_router_t* router = http_router_create(); 
+        if (!router || routes_register(router) == -1)
+        {
+            fprintf(stderr, "Error : failed to rebuild the routes\n"); 
+            http_router_destroy(router); 
+            continue; 
+        }
+        if (http_server_publish_router(server_context_ptr, router) == 0)
+            printf("routes reloaded\n"); 
+    }
+    return NULL; 
 }
 
 /* this is a simple http handler example */ 
@@ -72,20 +147,62 @@ Http_handler_result_t handler(Http_request_t* req, Http_response_t* resp)
     resp->body_len = strlen(BODY); 
     resp->body_mem = HTTP_MEM_STATIC; /* tell the server to not free body buffer */ 
 
-    resp->headers[0].key = "test"; 
-    resp->headers[0].key_mem = HTTP_MEM_STATIC; 
-    resp->headers[0].value = "test"; 
-    resp->headers[0].value_mem = HTTP_MEM_STATIC; 
-    resp->headers_count = 1; 
+    http_response_add_header(resp, "test", HTTP_MEM_STATIC, "test", HTTP_MEM_STATIC); 
+    /* common headers have typed setters, no string to build */ 
+    http_response_set_cache_control(resp, HTTP_CACHE_CONTROL_NO_CACHE, 0); 
+
+    /* built for this request, gone once the response is made (no free) */ 
+    char* served = http_arena_printf(req->arena, "%s %s", req->method_str, req->path); 
+    if (served)
+        http_response_add_header(resp, "X-Served", HTTP_MEM_STATIC, served, HTTP_MEM_ARENA); 
 
     resp->connection_close = 0;       
-    char* connection = http_request_search_header(req, "connection"); 
-    if (connection == NULL || strcasecmp(connection, "keep-alive"))
+    Http_slice_t connection = http_request_header(req, "connection"); /* points into the request, not nul terminated */ 
+    if (!http_slice_eq_nocase(connection, "keep-alive"))
         resp->connection_close = 1;       /* close connection after response */  
 
     return HTTP_HANDLER_OK; 
 }
 
+/* websocket echo, every message comes back as it was sent */ 
+static void ws_echo(Http_ws_t* ws, Http_ws_opcode_t opcode, const char* data, size_t len)
+{
+    if (http_ws_send(ws, opcode, data, len) == -1)
+        http_ws_close(ws, HTTP_WS_CLOSE_TOO_BIG, "slow down"); 
+}
+
+static const Http_ws_handlers_t ws_echo_handlers = { .message = ws_echo }; 
+
+Http_handler_result_t ws_handler(Http_request_t* req, Http_response_t* resp)
+{
+    if (http_ws_accept(req, resp, &ws_echo_handlers, NULL) == -1)
+    {
+        http_response_make_error(resp, HTTP_BAD_REQUEST); 
+    }
+    return HTTP_HANDLER_OK; 
+}
+
+/* event stream, every body posted to /publish is sent to all the subscribers */ 
+Http_handler_result_t events_handler(Http_request_t* req, Http_response_t* resp)
+{
+    if (http_sse_accept(req, resp, "news") == -1)
+    {
+        http_response_make_error(resp, HTTP_BAD_REQUEST); 
+    }
+    return HTTP_HANDLER_OK; 
+}
+
+Http_handler_result_t publish_handler(Http_request_t* req, Http_response_t* resp)
+{
+    /* handlers run on the loop, publishing is only queuing */ 
+    Http_sse_topic_t* topic = http_sse_topic(server_context_ptr, "news"); 
+    if (!topic || http_sse_publish(topic, NULL, req->body, req->body_len) == -1)
+        return HTTP_HANDLER_ERR; 
+    resp->status_code = HTTP_NO_CONTENT; 
+    resp->connection_close = 0; 
+    return HTTP_HANDLER_OK; 
+}
+
 void parse_arguments(int argc, char* argv[], Http_config_t* config)
 {
     int opt;  
@@ -96,10 +213,32 @@ void parse_arguments(int argc, char* argv[], Http_config_t* config)
         {"host",    required_argument,  0, 'H'}, 
         {"port",    required_argument,  0, 'p'}, 
         {"backlog", required_argument,  0, 'b'}, 
+        {"tls-port", required_argument, 0, 't'},
+        {"cert",    required_argument,  0, 'c'},
+        {"key",     required_argument,  0, 'k'},
+        {"upstream", required_argument, 0, 'u'},
+        {"max-connections", required_argument, 0, 'm'},
+        {"max-inflight", required_argument, 0, 'i'},
+        {"max-lag", required_argument, 0, 'l'},
+        {"rate-limit", required_argument, 0, 'r'},
+        {"max-per-ip", required_argument, 0, 'a'},
+        {"drain",   required_argument,  0, 'd'},
+        {"handoff", required_argument,  0, 'x'},
+        {"tuning",  required_argument,  0, 'T'},
+        {"access-log", required_argument, 0, 'L'},
+        {"trace",   required_argument,  0, 'S'},
+        {"keepalive", required_argument, 0, 'K'},
+        {"keepalive-requests", required_argument, 0, 'R'},
+        {"workers", required_argument,  0, 'w'},
+        {"cpus",    required_argument,  0, 'C'},
+        {"numa",    no_argument,        0, 'N'},
+        {"steer",   no_argument,        0, 's'},
+        {"busy-poll", required_argument, 0, 'B'},
+        {"kernel-busy-poll", required_argument, 0, 'P'},
         {0, 0, 0, 0}, 
     }; 
 
-    while ((opt = getopt_long(argc, argv, "hH:p:b:", long_options, NULL)) != -1)
+    while ((opt = getopt_long(argc, argv, "hH:p:b:t:c:k:u:m:i:l:r:a:d:x:T:L:S:K:R:w:C:NsB:P:", long_options, NULL)) != -1)
     {
         switch (opt) 
         {
@@ -126,6 +265,108 @@ void parse_arguments(int argc, char* argv[], Http_config_t* config)
                     exit(EXIT_FAILURE); 
                 }
                 break; 
+            case 't': 
+                config->tls_port = atoi(optarg); 
+                if (config->tls_port <= 0 || config->tls_port > 65535)
+                {
+                    fprintf(stderr, "Error: %s is an invalid port number\n", optarg); 
+                    exit(EXIT_FAILURE); 
+                }
+                break; 
+            case 'c': 
+                strncpy(config->tls_cert, optarg, HTTP_MAX_PATH_LEN-1); 
+                config->tls_cert[HTTP_MAX_PATH_LEN-1] = '\0'; 
+                break; 
+            case 'k': 
+                strncpy(config->tls_key, optarg, HTTP_MAX_PATH_LEN-1); 
+                config->tls_key[HTTP_MAX_PATH_LEN-1] = '\0'; 
+                break; 
+            case 'u': 
+            {
+                char* colon = strrchr(optarg, ':'); 
+                if (!colon)
+                {
+                    fprintf(stderr, "Error: %s is not host:port\n", optarg); 
+                    exit(EXIT_FAILURE); 
+                }
+                *colon = '\0'; 
+                if (!upstream && !(upstream = http_upstream_create()))
+                    exit(EXIT_FAILURE); 
+                if (http_upstream_add_server(upstream, optarg, atoi(colon + 1)) == -1)
+                {
+                    fprintf(stderr, "Error: can't use %s:%s as a backend\n", optarg, colon + 1); 
+                    exit(EXIT_FAILURE); 
+                }
+            }
+            break; 
+            case 'm': 
+                config->max_connections = strtoul(optarg, NULL, 10); 
+                break; 
+            case 'i': 
+                config->max_inflight = strtoul(optarg, NULL, 10); 
+                break; 
+            case 'l': 
+                config->max_loop_lag_ms = atoi(optarg); 
+                break; 
+            case 'r': 
+                config->rate_limit = atoi(optarg); 
+                break; 
+            case 'a': 
+                config->max_connections_per_ip = strtoul(optarg, NULL, 10); 
+                break; 
+            case 'd': 
+                config->drain_timeout = atoi(optarg); 
+                break; 
+            case 'x': 
+                strncpy(config->handoff_path, optarg, HTTP_MAX_PATH_LEN-1); 
+                config->handoff_path[HTTP_MAX_PATH_LEN-1] = '\0'; 
+                break; 
+            case 'T': 
+                if (http_sockopt_preset(optarg, &config->tuning) == -1)
+                {
+                    fprintf(stderr, "Error: %s is not a tuning preset\n", optarg); 
+                    exit(EXIT_FAILURE); 
+                }
+                break; 
+            case 'L': 
+                strncpy(config->access_log, optarg, HTTP_MAX_PATH_LEN-1); 
+                config->access_log[HTTP_MAX_PATH_LEN-1] = '\0'; 
+                config->access_log_max_size = 64 * 1024 * 1024; 
+                break; 
+            case 'S': 
+                config->trace_sample = atoi(optarg); 
+                break; 
+            case 'K': 
+                config->keepalive_timeout = atoi(optarg); 
+                break; 
+            case 'R': 
+                config->keepalive_requests = atoi(optarg); 
+                break; 
+            case 'w': 
+                config->workers = atoi(optarg); 
+                if (config->workers <= 0 || config->workers > HTTP_MAX_WORKERS)
+                {
+                    fprintf(stderr, "Error: %s is an invalid number of workers\n", optarg); 
+                    exit(EXIT_FAILURE); 
+                }
+                break; 
+            case 'C': 
+                strncpy(config->cpus, optarg, HTTP_MAX_CPU_LIST-1); 
+                config->cpus[HTTP_MAX_CPU_LIST-1] = '\0'; 
+                break; 
+            case 'N': 
+                config->numa = 1; 
+                break; 
+            case 's': 
+                config->steer = 1; 
+                break; 
+            case 'B': 
+                config->busy_poll_us = atoi(optarg); 
+                break; 
+            case 'P': 
+                config->tuning.busy_poll = atoi(optarg); 
+                config->tuning.prefer_busy_poll = 1; 
+                break; 
             default: 
                 print_help(argv[0]); 
                 exit(EXIT_FAILURE); 
@@ -0,0 +1,89 @@
+import socket
+import struct
+import sys
+
+HOST = sys.argv[1] if len(sys.argv) > 1 else "127.0.0.1"
+PORT = int(sys.argv[2]) if len(sys.argv) > 2 else 6969
+
+PREFACE = b"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+TABLE_SIZE = 4096 # the server's hpack table
+ENTRY_OVERHEAD = 32
+
+def frame(type, flags, stream_id, payload):
+    return struct.pack(">I", len(payload))[1:] + bytes([type, flags]) + struct.pack(">I", stream_id) + payload
+
+def hpack_int(value, prefix, first):
+    limit = (1 << prefix) - 1
+    if value < limit:
+        return bytes([first | value])
+    out = bytes([first | limit])
+    value -= limit
+    while value >= 128:
+        out += bytes([value % 128 + 128])
+        value //= 128
+    return out + bytes([value])
+
+def hpack_string(s):
+    return hpack_int(len(s), 7, 0) + s
+
+def literal_indexed(name, value):
+    # literal with incremental indexing, new name
+    return b"\x40" + hpack_string(name) + hpack_string(value)
+
+def literal_indexed_name(index, value):
+    # literal with incremental indexing, the name taken from the table
+    return hpack_int(index, 6, 0x40) + hpack_string(value)
+
+def request(path_field):
+    # :method GET, :scheme http, then the path and a literal :authority
+    return b"\x82\x86" + path_field + b"\x01" + hpack_string(HOST.encode())
+
+def read_statuses(sock, streams):
+    statuses = {}
+    buff = b""
+    while len(statuses) < len(streams):
+        chunk = sock.recv(65536)
+        if not chunk:
+            raise ConnectionError("Connection closed by server")
+        buff += chunk
+        while len(buff) >= 9:
+            length = int.from_bytes(buff[:3], "big")
+            if len(buff) < 9 + length:
+                break
+            type, stream_id, payload = buff[3], int.from_bytes(buff[5:9], "big") & 0x7fffffff, buff[9:9 + length]
+            buff = buff[9 + length:]
+            if type == 7: # goaway
+                raise ConnectionError("GOAWAY error %d" % int.from_bytes(payload[4:8], "big"))
+            if type == 1 and stream_id in streams:
+                statuses[stream_id] = payload[0] # :status 200 is static index 8
+    return statuses
+
+def main():
+    # the first entry fills the table. the next request names it and adds an entry that evicts it,
+    # the last one names the new entry with a value bigger than the table, which empties it
+    big = b"/?" + b"a" * (TABLE_SIZE - ENTRY_OVERHEAD - len(b":path") - 2 - 60)
+    blocks = [
+        request(literal_indexed(b":path", big)),
+        request(literal_indexed_name(62, b"/?b" * 20)),
+        request(literal_indexed_name(62, b"/?" + b"c" * TABLE_SIZE)),
+        request(b"\x84"), # /
+    ]
+
+    with socket.create_connection((HOST, PORT)) as sock:
+        out = PREFACE + frame(4, 0, 0, b"")
+        for i, block in enumerate(blocks):
+            out += frame(1, 0x5, 1 + 2 * i, block) # END_STREAM | END_HEADERS
+        sock.sendall(out)
+        sock.settimeout(5)
+
+        streams = [1 + 2 * i for i in range(len(blocks))]
+        statuses = read_statuses(sock, streams)
+        for stream_id in streams:
+            ok = statuses[stream_id] == 0x88
+            print(f"stream {stream_id}: {'200' if ok else 'not 200 (0x%02x)' % statuses[stream_id]}")
+            assert ok, "an evicted table entry was used as the header name"
+    print("hpack eviction: ok")
+
+
+if __name__ == "__main__":
+    main()